@@ -1,6 +1,6 @@
 TEMPLATE = subdirs
 
-SUBDIRS += sleepyhead
+SUBDIRS += sleepyhead tests
 
 CONFIG += ordered
 
@@ -8,8 +8,10 @@
 
 #include <cmath>
 #include <QApplication>
+#include <QThread>
 #include <QThreadPool>
 #include <QMutexLocker>
+#include <algorithm>
 
 #include "MinutesAtPressure.h"
 #include "Graphs/gGraph.h"
@@ -26,24 +28,36 @@ MinutesAtPressure::MinutesAtPressure() :Layer(NoChannel)
     m_minpressure = 3;
     m_maxpressure = 30;
     m_minimum_height = 0;
+    m_binipap = m_binepap = 0;
+    m_accminx = m_accmaxx = 0;
+    m_accvalid = false;
 }
 MinutesAtPressure::~MinutesAtPressure()
 {
-    while (recalculating()) {};
+    quitRecalc();
+    while (m_pending.load() > 0) {
+        QThread::yieldCurrentThread();
+    }
 }
 
 RecalcMAP::~RecalcMAP()
 {
 }
 void RecalcMAP::quit() {
-    map->mutex.lock();
+    // Not under map->mutex, the running pass holds that until it's done
     m_quit = true;
-    map->mutex.unlock();
 }
 
 
 void MinutesAtPressure::SetDay(Day *day)
 {
+    quitRecalc();
+    QMutexLocker locker(&mutex);
+
+    // Bins belong to the old day's sessions
+    m_bins.clear();
+    m_accvalid = false;
+
     Layer::SetDay(day);
 
     // look at session summaryValues.
@@ -93,7 +107,6 @@ void MinutesAtPressure::SetDay(Day *day)
 
 
     m_empty = false;
-    m_recalculating = false;
     m_lastminx = 0;
     m_lastmaxx = 0;
     m_empty = !m_day || !(m_day->channelExists(CPAP_Pressure) || m_day->channelExists(CPAP_EPAP));
@@ -255,7 +268,7 @@ void MinutesAtPressure::paint(QPainter &painter, gGraph &graph, const QRegion &r
         schema::Channel & ichan = schema::channel[ipap.code];
         schema::Channel & echan = schema::channel[epap.code];
 
-        QPoint mouse=graph.graphView()->currentMousePos();
+        QPoint mouse=graph.currentMousePos();
         if (region.contains(mouse)) {
             float p =  minpressure + (mouse.x() - left) / pstep;
             mouseOverKey = floor(p*pressureMult);
@@ -852,121 +865,148 @@ void MinutesAtPressure::paint(QPainter &painter, gGraph &graph, const QRegion &r
 }
 
 
-//! \brief Updates Time At Pressure from session *sess
-void RecalcMAP::updateTimes(PressureInfo & info, Session * sess)
-{
-    qint64 d1,d2;
-    EventDataType gain;
-    EventStoreType data, lastdata;
-    qint64 time, lasttime;
-    int ELsize, duration;
-    bool first;
-    int key;
-    EventDataType val = 0;
-
-    ChannelID code = info.code;
-    qint64 minx = info.minx;
-    qint64 maxx = info.maxx;
-
-    if (code == 0) return;
-
-    // Find pressure channel
-    auto ei = sess->eventlist.find(code);
+// Pressure steps held by PressureInfo, at up to 5 per cmH2O
+const int pressureSteps = 300;
 
-    // Done already if no channel
-    if (ei == sess->eventlist.end())
-        return;
+void PressureHistogram::reset(const QList<ChannelID> & chans)
+{
+    ms.fill(0, pressureSteps);
+    events.clear();
+    for (const auto & code : chans) {
+        events[code].fill(0, pressureSteps);
+    }
+}
 
-    pressureMult = (sess->machine()->loaderName() == "PRS1") ? 2 : 5;
-    // Loop through event lists
+void PressureHistogram::fill(PressureInfo & info) const
+{
+    for (int i=0, end=qMin(ms.size(), info.times.size()); i < end; ++i) {
+        info.times[i] = ms.at(i) / 1000L;
+    }
+    for (const auto & code : info.chans) {
+        auto it = events.find(code);
+        if (it == events.end()) continue;
+
+        QVector<int> & dest = info.events[code];
+        const QVector<double> & src = it.value();
+        for (int i=0, end=qMin(src.size(), dest.size()); i < end; ++i) {
+            dest[i] = qMax(0, qRound(src.at(i)));
+        }
+    }
+}
 
-    for (const auto & EL : ei.value()) {
-        gain = EL->gain();
+bool PressureBins::build(Session * sess, ChannelID code, const QList<ChannelID> & chans, volatile bool & quit)
+{
+    runs.clear();
+    flags.clear();
 
-        // Don't bother with short sessions
-        ELsize = EL->count();
-        if (ELsize < 1) continue;
+    if (code == 0) return true;
 
-        lasttime = 0;
-        lastdata = 0;
+    auto ei = sess->eventlist.find(code);
+    if (ei == sess->eventlist.end()) return true;
 
-        first = true;
+    pressureMult = (sess->machine()->loaderName() == "PRS1") ? 2 : 5;
 
-        // Skip if outside of range
-        if ((EL->first() > maxx) || (EL->last() < minx)) {
-            continue;
-        }
+    // Split the pressure channel into runs of the same pressure step
+    for (const auto & EL : ei.value()) {
+        int ELsize = EL->count();
+        if (ELsize < 1) continue;
 
-        // Scan through pressure samples
-        for (int e = 0; e < ELsize; ++e) {
-            if (m_quit) {
-                m_done = true;
-                return;
+        EventDataType gain = EL->gain();
+        qint64 lasttime = EL->time(0);
+        int lastkey = floor(float(EL->raw(0)) * gain * pressureMult);
+
+        for (int e = 1; e <= ELsize; ++e) {
+            qint64 time;
+            int key;
+            if (e < ELsize) {
+                time = EL->time(e);
+                key = floor(float(EL->raw(e)) * gain * pressureMult); // pressure times mult, so can look at .2 intervals in an integer
+                if (key == lastkey) continue;
+            } else {
+                time = EL->last();
+                key = -1;
             }
 
-            time = EL->time(e);
-            data = floor(float(EL->raw(e)) * gain * pressureMult);  // pressure times ten, so can look at .1 intervals in an integer
-
-            if (data>=300) {
-                qWarning() << "data >= 300 in RecalcMAP::updateTimes!";
-                return;
+            if ((time > lasttime) && (lastkey >= 0) && (lastkey < pressureSteps)) {
+                Run run;
+                run.start = lasttime;
+                run.end = time;
+                run.key = lastkey;
+                runs.append(run);
+            } else if (lastkey >= pressureSteps) {
+                qWarning() << "Pressure step" << lastkey << "out of range in PressureBins::build";
             }
+            lasttime = time;
+            lastkey = key;
+        }
+        if (quit) return false;
+    }
 
-            if ((time < minx) || first) {
-                lasttime = time;
-                lastdata = data;
-
-                first = false;
-                continue;
+    std::sort(runs.begin(), runs.end(), [](const Run & a, const Run & b) {
+        return a.start < b.start;
+    });
+
+    // File each flag under the run it landed in
+    for (const auto & cod : chans) {
+        auto fi = sess->eventlist.find(cod);
+        if (fi == sess->eventlist.end()) continue;
+
+        bool span = schema::channel[cod].type() == schema::SPAN;
+        QVector<Flag> & list = flags[cod];
+
+        for (const auto & EL : fi.value()) {
+            for (quint32 i=0, end=EL->count(); i < end; ++i) {
+                qint64 time = EL->time(i);
+
+                auto it = std::upper_bound(runs.constBegin(), runs.constEnd(), time, [](qint64 t, const Run & run) {
+                    return t < run.start;
+                });
+                if (it == runs.constBegin()) continue;
+                --it;
+                if (time > it->end) continue;
+
+                Flag flag;
+                flag.time = time;
+                flag.key = it->key;
+                flag.weight = span ? EL->data(i) : 1;
+                list.append(flag);
             }
+        }
+        std::sort(list.begin(), list.end(), [](const Flag & a, const Flag & b) {
+            return a.time < b.time;
+        });
+        if (quit) return false;
+    }
+    return true;
+}
 
-            if (lastdata != data) {
-                d1 = qMax(minx, lasttime);
-                d2 = qMin(maxx, time);
-
-                duration = (d2 - d1) / 1000L;
-                key = lastdata;
-                info.times[key] += duration;
-
-
-                for (const auto & cod : info.chans) {
-                    schema::Channel & chan = schema::channel[cod];
-                    if (chan.type() == schema::SPAN) {
-                        info.events[cod][key] += val = sess->rangeSum(cod, d1, d2);
-                    } else {
-                        info.events[cod][key] += val = sess->rangeCount(cod, d1, d2);
-                    }
-                }
-
-                lasttime = time;
-                lastdata = data;
-            }
-            if (time > maxx) {
-                break;
-            }
+void PressureBins::apply(PressureHistogram & hist, qint64 t1, qint64 t2, int sign) const
+{
+    if (t2 <= t1) return;
+
+    // First run still going at t1
+    auto it = std::upper_bound(runs.constBegin(), runs.constEnd(), t1, [](qint64 t, const Run & run) {
+        return t < run.end;
+    });
+    for (auto end = runs.constEnd(); (it != end) && (it->start < t2); ++it) {
+        hist.ms[it->key] += sign * (qMin(t2, it->end) - qMax(t1, it->start));
+    }
 
-        }
-        if ((lasttime < maxx) || (lastdata == data)) {
-            d1 = qMax(lasttime, minx);
-            d2 = qMin(maxx, EL->last());
-
-            duration = (d2 - d1) / 1000L;
-            key = lastdata;
-            info.times[key] += duration;
-
-            for (const auto & cod : info.chans) {
-                schema::Channel & chan = schema::channel[cod];
-                if (chan.type() == schema::SPAN) {
-                    info.events[cod][key] += sess->rangeSum(cod, d1, d2);
-                } else {
-                    info.events[cod][key] += sess->rangeCount(cod, d1, d2);
-                }
-            }
+    for (auto fi = flags.begin(), fend = flags.end(); fi != fend; ++fi) {
+        auto hi = hist.events.find(fi.key());
+        if (hi == hist.events.end()) continue;
+        QVector<double> & events = hi.value();
+
+        const QVector<Flag> & list = fi.value();
+        auto before = [](const Flag & flag, qint64 t) { return flag.time < t; };
+        auto f1 = std::lower_bound(list.constBegin(), list.constEnd(), t1, before);
+        auto f2 = std::lower_bound(f1, list.constEnd(), t2, before);
+        for (; f1 != f2; ++f1) {
+            events[f1->key] += sign * f1->weight;
         }
     }
 }
 
-
 void PressureInfo::finishCalcs()
 {
     peaktime = peakevents = 0;
@@ -1026,10 +1066,33 @@ void PressureInfo::finishCalcs()
 
 void RecalcMAP::run()
 {
-    QMutexLocker locker(&map->mutex);
-    map->m_recalculating = true;
+    MinutesAtPressure * map = this->map;
+
+    map->mutex.lock();
+    bool finished = !m_quit && update();
+
+    map->timelock.lock();
+    if (map->m_remap == this) {
+        map->m_remap = nullptr;
+        map->m_recalculating = false;
+    }
+    map->timelock.unlock();
+
+    if (finished) {
+        map->recalcFinished();
+    }
+    map->mutex.unlock();
+
+    m_done = true;
+
+    // Last touch, map is free to go after this
+    map->m_pending.deref();
+}
+
+bool RecalcMAP::update()
+{
     Day * day = map->m_day;
-    if (!day) return;
+    if (!day) return false;
 
     // Get the channels for specified Channel types
     QList<ChannelID> chans = day->getSortedMachineChannels(schema::FLAG);
@@ -1038,245 +1101,144 @@ void RecalcMAP::run()
     chans.removeAll(CPAP_VSnore2);
     chans.removeAll(CPAP_FlowLimit);
     chans.removeAll(CPAP_RERA);
-//    for (int i=0;i<chans.size();i++) {
-//        schema::Channel &chan = schema::channel[chans.at(i)];
-//        qDebug() << chan.fullname();
-//    }
 
     ChannelID ipapcode = (day->channelExists(CPAP_IPAP)) ? CPAP_IPAP : CPAP_Pressure;
     ChannelID epapcode = (day->channelExists(CPAP_EPAP)) ? CPAP_EPAP : 0;
 
     qint64 minx, maxx;
-    map->m_graph->graphView()->GetXBounds(minx, maxx);
-    PressureInfo IPAP(ipapcode, minx, maxx), EPAP(epapcode, minx, maxx);
-
-    IPAP.AddChannels(chans);
-    EPAP.AddChannels(chans);
-
-    //ChannelID code;
-
-//    QList<ChannelID> badchans;
-//    for (int i=0 ; i < chans.size(); ++i) {
-//        code = chans.at(i);
-//      //  if (!day->channelExists(code)) badchans.push_back(code);
-//    }
-
-//    for (int i=0; i < badchans.size(); ++i) {
-//        code = badchans.at(i);
-//        chans.removeAll(code);
-//    }
-
-
-//    int numchans = chans.size();
-//    // Zero the pressure counts
-//    for (int i=map->m_minpressure; i <= map->m_maxpressure; i++) {
-//        times[i] = 0;
-
-//        for (int c = 0; c < numchans; ++c) {
-//            code = chans.at(c);
-//            events[code].insert(i, 0);
-//        }
-//    }
+    if (map->m_graph->graphView()) {
+        map->m_graph->graphView()->GetXBounds(minx, maxx);
+    } else {
+        // A clone being printed, which has no view to share bounds with
+        minx = map->m_graph->min_x;
+        maxx = map->m_graph->max_x;
+    }
 
+    if ((chans != map->m_binchans) || (ipapcode != map->m_binipap) || (epapcode != map->m_binepap)) {
+        map->m_bins.clear();
+        map->m_binchans = chans;
+        map->m_binipap = ipapcode;
+        map->m_binepap = epapcode;
+        map->m_accvalid = false;
+    }
 
+    // Forget sessions no longer part of this day
+    for (auto it = map->m_bins.begin(); it != map->m_bins.end();) {
+        if (!day->sessions.contains(it.key())) {
+            if (map->m_accvalid) {
+                it.value().ipap.apply(map->m_ipaphist, map->m_accminx, map->m_accmaxx, -1);
+                it.value().epap.apply(map->m_epaphist, map->m_accminx, map->m_accmaxx, -1);
+            }
+            it = map->m_bins.erase(it);
+        } else {
+            ++it;
+        }
+    }
 
+    // Bin any sessions not seen before, this is the only part that has to scan event data
     for (const auto & sess : day->sessions) {
+        if (map->m_bins.contains(sess)) continue;
 
-        updateTimes(EPAP, sess);
-        updateTimes(IPAP, sess);
-
-        if (m_quit) {
-            m_done = true;
-            return;
+        MinutesAtPressure::SessionBins bins;
+        if (!bins.ipap.build(sess, ipapcode, chans, m_quit) || !bins.epap.build(sess, epapcode, chans, m_quit)) {
+            return false;
         }
-
-
-/*        auto ei = sess->eventlist.find(ipapcode);
-        if (ei == sess->eventlist.end())
-            continue;
-
-        const auto & evec = ei.value();
-        int esize = evec.size();
-        for (int ei = 0; ei < esize; ++ei) {
-            const EventList *EL = evec.at(ei);
-            EventDataType gain = EL->gain();
-            quint32 ELsize = EL->count();
-            if (ELsize < 1)  return;
-            qint64 lasttime = 0; //EL->time(0);
-            EventStoreType lastdata = 0; // EL->raw(0);
-
-            bool first = true;
-            if ((EL->first() > maxx) || (EL->last() < minx)) {
-                continue;
-            }
-
-            for (quint32 e = 0; e < ELsize; ++e) {
-                qint64 time = EL->time(e);
-                EventStoreType data = EL->raw(e);
-
-                if ((time < minx)) {
-                    lasttime = time;
-                    lastdata = data;
-                    first = false;
-                    goto skip;
-                }
-
-                if (first) {
-                    lasttime = time;
-                    lastdata = data;
-                    first = false;
-                }
-
-                if (lastdata != data) {
-                    qint64 d1 = qMax(minx, lasttime);
-                    qint64 d2 = qMin(maxx, time);
-
-
-                    int duration = (d2 - d1) / 1000L;
-                    EventStoreType key = floor(lastdata * gain);
-                    if (key <= 30) {
-                        times[key] += duration;
-                        for (int c = 0; c < chans.size(); ++c) {
-                            ChannelID code = chans.at(c);
-                            schema::Channel & chan = schema::channel[code];
-                            if (chan.type() == schema::SPAN) {
-                                events[code][key] += sess->rangeSum(code, d1, d2);
-                            } else {
-                                events[code][key] += sess->rangeCount(code, d1, d2);
-                            }
-                        }
-                    }
-                    lasttime = time;
-                    lastdata = data;
-                }
-                if (time > maxx) {
-
-                    break;
-                }
-skip:
-                if (m_quit) {
-                    m_done = true;
-                    return;
-                }
-            }
-            if (lasttime < maxx) {
-                qint64 d1 = qMax(lasttime, minx);
-                qint64 d2 = qMin(maxx, EL->last());
-
-                int duration = (d2 - d1) / 1000L;
-                EventStoreType key = floor(lastdata * gain);
-                if (key <= 30) {
-                    times[key] += duration;
-                    for (int c = 0; c < chans.size(); ++c) {
-                        ChannelID code = chans.at(c);
-                        schema::Channel & chan = schema::channel[code];
-                        if (chan.type() == schema::SPAN) {
-                            events[code][key] += sess->rangeSum(code, d1, d2);
-                        } else {
-                            events[code][key] += sess->rangeCount(code, d1, d2);
-                        }
-                    }
-                }
-
-            }
-
-
-        } */
+        if (map->m_accvalid) {
+            bins.ipap.apply(map->m_ipaphist, map->m_accminx, map->m_accmaxx, 1);
+            bins.epap.apply(map->m_epaphist, map->m_accminx, map->m_accmaxx, 1);
+        }
+        map->m_bins.insert(sess, bins);
     }
 
-
-    EPAP.finishCalcs();
-    IPAP.finishCalcs();
-
-/*
-    int maxtime = 0;
-
-    QList<EventStoreType> trash;
-    for (auto it=times.begin(), end=times.end(); it != end; ++it) {
-        //EventStoreType key = it.key();
-        int value = it.value();
-//        if (value == 0) {
-//            trash.append(key);
-//        } else {
-            maxtime = qMax(value, maxtime);
-//        }
+    // Slide the summed range over to the visible one, only counting the edges that changed,
+    // unless that would be more work than starting over
+    qint64 accmin = map->m_accminx, accmax = map->m_accmaxx;
+    if (!map->m_accvalid || (minx >= accmax) || (maxx <= accmin)
+            || ((qAbs(minx - accmin) + qAbs(maxx - accmax)) > (maxx - minx))) {
+        map->m_ipaphist.reset(chans);
+        map->m_epaphist.reset(chans);
+        map->applyBins(minx, maxx, 1);
+    } else {
+        if (minx < accmin) {
+            map->applyBins(minx, accmin, 1);
+        } else if (minx > accmin) {
+            map->applyBins(accmin, minx, -1);
+        }
+        if (maxx > accmax) {
+            map->applyBins(accmax, maxx, 1);
+        } else if (maxx < accmax) {
+            map->applyBins(maxx, accmax, -1);
+        }
     }
-    chans.push_front(CPAP_AHI);
-
-    int maxevents = 0, val;
+    map->m_accminx = minx;
+    map->m_accmaxx = maxx;
+    map->m_accvalid = true;
 
-    for (int i = map->m_minpressure; i <= map->m_maxpressure; i++) {
-        val = events[CPAP_Obstructive][i] +
-              events[CPAP_Hypopnea][i] +
-              events[CPAP_Apnea][i] +
-              events[CPAP_ClearAirway][i];
-
-        events[CPAP_AHI].insert(i, val);
-     //   maxevents = qMax(val, maxevents);
-    }
+    PressureInfo IPAP(ipapcode, minx, maxx), EPAP(epapcode, minx, maxx);
 
-    for (int i = map->m_minpressure; i <= map->m_maxpressure; i++) {
-        for (int j=0 ; j < chans.size(); ++j) {
-            code = chans.at(j);
-            if ((code == CPAP_AHI) || (schema::channel[code].type() == schema::SPAN)) continue;
-            val = events[code][i];
-            maxevents = qMax(val, maxevents);
-        }
-    }
+    IPAP.AddChannels(chans);
+    EPAP.AddChannels(chans);
 
-//    for (int i=0; i< trash.size(); ++i) {
-//        EventStoreType key = trash.at(i);
+    map->m_ipaphist.fill(IPAP);
+    map->m_epaphist.fill(EPAP);
 
-//        times.remove(key);
-//        for (auto eit=events.begin(), end=events.end(); eit != end; ++eit) {
-//            eit.value().remove(key);
-//        }
-//    }
-*/
+    EPAP.finishCalcs();
+    IPAP.finishCalcs();
 
     map->timelock.lock();
-
-//    map->times = times;
-//    map->events = events;
     map->epap = EPAP;
     map->ipap = IPAP;
-//    map->chans = chans;
- //   map->m_presChannel = ipapcode;
     map->timelock.unlock();
 
-    map->recalcFinished();
-    m_done = true;
+    return true;
 }
 
-void MinutesAtPressure::recalculate(gGraph * graph)
+void MinutesAtPressure::applyBins(qint64 t1, qint64 t2, int sign)
 {
+    for (auto it = m_bins.begin(), end = m_bins.end(); it != end; ++it) {
+        it.value().ipap.apply(m_ipaphist, t1, t2, sign);
+        it.value().epap.apply(m_epaphist, t1, t2, sign);
+    }
+}
 
-    while (recalculating())
+void MinutesAtPressure::quitRecalc()
+{
+    timelock.lock();
+    if (m_remap) {
         m_remap->quit();
+    }
+    timelock.unlock();
+}
 
-    m_remap = new RecalcMAP(this);
-    m_remap->setAutoDelete(true);
-
+void MinutesAtPressure::recalculate(gGraph * graph)
+{
     m_graph = graph;
 
-    QThreadPool * tp = QThreadPool::globalInstance();
-//    tp->reserveThread();
+    RecalcMAP * remap = new RecalcMAP(this);
+
+    // Any pass still queued or running is out of date now, and bails out before touching the histograms
+    timelock.lock();
+    if (m_remap) {
+        m_remap->quit();
+    }
+    m_remap = remap;
+    m_recalculating = true;
+    timelock.unlock();
+
+    m_pending.ref();
 
     if (graph->printing()) {
-        m_remap->run();
+        remap->setAutoDelete(false);
+        remap->run();
+        delete remap;
     } else {
-        while(!tp->tryStart(m_remap));
+        // Start recalculating in another thread, it organizes a callback to redraw when done..
+        remap->setAutoDelete(true);
+        QThreadPool::globalInstance()->start(remap);
 
         m_lastmaxx = m_maxx;
         m_lastminx = m_minx;
-
     }
-
-
-    // Start recalculating in another thread, organize a callback to redraw when done..
-
-
-
 }
 
 void MinutesAtPressure::recalcFinished()
@@ -1285,11 +1247,6 @@ void MinutesAtPressure::recalcFinished()
         // Can't call this using standard timedRedraw function, we are in another thread, so have to use a throwaway timer
         QTimer::singleShot(0, m_graph->graphView(), SLOT(refreshTimeout()));
     }
-    m_remap = nullptr;
-    m_recalculating = false;
-//    QThreadPool * tp = QThreadPool::globalInstance();
-//    tp->releaseThread();
-
 }
 
 
@@ -9,6 +9,8 @@
 #ifndef MINUTESATPRESSURE_H
 #define MINUTESATPRESSURE_H
 
+#include <QAtomicInt>
+
 #include "Graphs/layer.h"
 #include "SleepLib/day.h"
 
@@ -62,6 +64,53 @@ struct PressureInfo
     QList<ChannelID> chans;
 };
 
+/*! \struct PressureHistogram
+    \brief Running totals behind a PressureInfo, indexed by pressure step
+
+    Kept in milliseconds and unrounded event weights, so ranges can be added and taken away again
+    without the totals drifting.
+    */
+struct PressureHistogram
+{
+    //! \brief Zero everything, sized for the pressure steps and channels in chans
+    void reset(const QList<ChannelID> & chans);
+
+    //! \brief Copy the totals into info's times (in seconds) and events
+    void fill(PressureInfo & info) const;
+
+    QVector<qint64> ms;
+    QHash<ChannelID, QVector<double> > events;
+};
+
+/*! \struct PressureBins
+    \brief One session's pressure channel split into runs of constant pressure step,
+    with each flag event filed under the step it happened at
+
+    Built once per session, after which any time range can be added to or taken away from
+    a PressureHistogram with a couple of binary searches.
+    */
+struct PressureBins
+{
+    struct Run {
+        qint64 start, end;
+        short key;
+    };
+    struct Flag {
+        qint64 time;
+        short key;
+        EventDataType weight;   // 1, or the duration for SPAN channels
+    };
+
+    //! \brief Bin sess by pressure channel code, returns false if quit was set before it finished
+    bool build(Session * sess, ChannelID code, const QList<ChannelID> & chans, volatile bool & quit);
+
+    //! \brief Add (sign 1) or take away (sign -1) the time and events in [t1, t2) to hist
+    void apply(PressureHistogram & hist, qint64 t1, qint64 t2, int sign) const;
+
+    QVector<Run> runs;                      // in time order, never overlapping
+    QHash<ChannelID, QVector<Flag> > flags; // in time order
+};
+
 class RecalcMAP:public QRunnable
 {
     friend class MinutesAtPressure;
@@ -72,7 +121,9 @@ public:
 
     void quit();
 protected:
-    void updateTimes(PressureInfo & info, Session * sess);
+    //! \brief Brings map's histograms up to date with the visible range, returns false if interrupted
+    bool update();
+
     MinutesAtPressure * map;
     volatile bool m_quit;
     volatile bool m_done;
@@ -114,22 +165,21 @@ public:
         layer->m_minimum_height = m_minimum_height;
         layer->m_lastminx = m_lastminx;
         layer->m_lastmaxx = m_lastmaxx;
-        layer->times = times;
-        layer->chans = chans;
-        layer->events = events;
-        layer->maxtime = maxtime;
-        layer->maxevents = maxevents;
-        layer->m_presChannel = m_presChannel;
         layer->m_minpressure = m_minpressure;
         layer->m_maxpressure = m_maxpressure;
-        layer->max_mins = max_mins;
-
-        layer->ahis = ahis;
+        layer->ipap = ipap;
+        layer->epap = epap;
 
         timelock.unlock();
         mutex.unlock();
     }
 protected:
+    //! \brief Ask the current RecalcMAP pass, if any, to stop early
+    void quitRecalc();
+
+    //! \brief Add (sign 1) or take away (sign -1) [t1, t2) from the histograms for every binned session
+    void applyBins(qint64 t1, qint64 t2, int sign);
+
     QMutex timelock;
     QMutex mutex;
 
@@ -139,22 +189,24 @@ protected:
     qint64 m_lastminx;
     qint64 m_lastmaxx;
     gGraph * m_graph;
-    RecalcMAP * m_remap;
-    QMap<EventStoreType, int> times;
-    QMap<EventStoreType, int> epap_times;
-    QList<ChannelID> chans;
-    QHash<ChannelID, QMap<EventStoreType, EventDataType> > events;
-    int maxtime;
-    int maxevents;
-    ChannelID m_presChannel;
+    RecalcMAP * m_remap;        // latest pass started, guarded by timelock
+    QAtomicInt m_pending;       // passes started but not yet finished with this layer
     EventStoreType m_minpressure;
     EventStoreType m_maxpressure;
 
     PressureInfo epap, ipap;
 
-    EventDataType max_mins;
-
-    QMap<EventStoreType, EventDataType> ahis;
+    // Everything below belongs to whichever RecalcMAP holds mutex
+    struct SessionBins {
+        PressureBins ipap, epap;
+    };
+    QHash<Session *, SessionBins> m_bins;
+    QList<ChannelID> m_binchans;
+    ChannelID m_binipap, m_binepap;
+
+    PressureHistogram m_ipaphist, m_epaphist;
+    qint64 m_accminx, m_accmaxx;    // range currently summed into the histograms
+    bool m_accvalid;
 };
 
 #endif // MINUTESATPRESSURE_H
@@ -8,9 +8,11 @@
 
 #include <cmath>
 #include <QVector>
+#include <QDataStream>
 #include "SleepLib/profiles.h"
 #include "gFlagsLine.h"
 #include "gYAxis.h"
+#include "gProfiler.h"
 
 gLabelArea::gLabelArea(Layer * layer)
     : gSpacer(20)
@@ -241,6 +243,12 @@ gFlagsLine::gFlagsLine(ChannelID code)
 gFlagsLine::~gFlagsLine()
 {
 }
+void gFlagsLine::SetDay(Day *d)
+{
+    Layer::SetDay(d);
+    m_markskey.clear();
+    m_lines.clear();
+}
 void gFlagsLine::paint(QPainter &painter, gGraph &w, const QRegion &region)
 {
     int left = region.boundingRect().left();
@@ -284,136 +292,153 @@ void gFlagsLine::paint(QPainter &painter, gGraph &w, const QRegion &region)
 
     qint64 start;
     quint32 *tptr;
-    EventStoreType *dptr, * eptr;
-    int idx;
+    EventStoreType *dptr;
+    quint32 idx, np;
     QHash<ChannelID, QVector<EventList *> >::iterator cei;
 
     qint64 clockdrift = qint64(p_profile->cpap->clockDrift()) * 1000L;
     qint64 drift = 0;
 
-    QVector<QLine> vlines;
+    bool span = (chan.type() == schema::SPAN);
 
     QColor color=schema::channel[m_code].defaultColor();
     QBrush brush(color);
 
-    int tooltipTimeout = AppSetting->tooltipTimeout();
-
-    bool hover = false;
-    for (const auto & sess : m_day->sessions) {
-        if (!sess->enabled()) {
-            continue;
-        }
-
-        drift = (sess->type() == MT_CPAP) ? clockdrift : 0;
-
-        cei = sess->eventlist.find(m_code);
-
-        if (cei == sess->eventlist.end()) {
-            continue;
+    QByteArray key;
+    {
+        QDataStream out(&key, QIODevice::WriteOnly);
+        out << width << height << minx << maxx << clockdrift << quintptr(m_day) << color << m_code;
+        for (const auto & sess : m_day->sessions) {
+            out << sess->session() << sess->enabled() << sess->eventGeneration();
         }
+    }
+    bool rebuild = m_lines.begin(key, QPoint(left, top));
 
+    if (key != m_markskey) {
+        ///////////////////////////////////////////////////////////////////////////
+        // Work out which events are on screen, and where
+        ///////////////////////////////////////////////////////////////////////////
+        m_markskey = key;
+        m_marks.clear();
+        int visited = 0;
 
-        for (const auto & el : cei.value()) {
-
-            start = el->first() + drift;
-            tptr = el->rawTime();
-            dptr = el->rawData();
-            int np = el->count();
-            eptr = dptr + np;
-
-            for (idx = 0; dptr < eptr; dptr++, tptr++, idx++) {
-                X = start + *tptr;
-                L = *dptr * 1000;
-
-                if (X >= minx) {
-                    break;
-                }
+        for (const auto & sess : m_day->sessions) {
+            if (!sess->enabled()) {
+                continue;
+            }
 
-                X2 = X - L;
+            drift = (sess->type() == MT_CPAP) ? clockdrift : 0;
 
-                if (X2 >= minx) {
-                    break;
-                }
+            cei = sess->eventlist.find(m_code);
 
+            if (cei == sess->eventlist.end()) {
+                continue;
             }
 
-            np -= idx;
-
-            if (chan.type() == schema::SPAN) {
-                ///////////////////////////////////////////////////////////////////////////
-                // Draw Event Flag Spans
-                ///////////////////////////////////////////////////////////////////////////
-
-                for (; dptr < eptr; dptr++) {
-                    X = start + * tptr++;
+            for (const auto & el : cei.value()) {
+                start = el->first() + drift;
+                tptr = el->rawTime();
+                dptr = el->rawData();
+                np = el->count();
 
+                // Skip straight to the first event ending inside the window
+                idx = el->lowerBound(qint64(minx) - drift);
 
-                    L = *dptr * 1000L;
+                int first = m_marks.size();
+                for (; idx < np; ++idx) {
+                    X = start + tptr[idx];
+                    L = span ? dptr[idx] * 1000L : 0;
                     X2 = X - L;
+
                     if (X2 > maxx) {
                         break;
                     }
+                    visited++;
 
-                    x1 = double(X - minx) * xmult + left;
-                    x2 = double(X2 - minx) * xmult + left;
-
-                    brush = QBrush(color);
-                    painter.fillRect(x2, bartop, x1-x2, bottom-bartop, brush);
-                    if (!w.selectingArea() && !hover && QRect(x2, bartop, x1-x2, bottom-bartop).contains(w.graphView()->currentMousePos())) {
-                        hover = true;
-                        painter.setPen(QPen(Qt::red,1));
-
-                        painter.drawRect(x2, bartop, x1-x2, bottom-bartop);
-                        int x,y;
-                        int s = *dptr;
-                        int m = s / 60;
-                        s %= 60;
-                        QString lab = QString("%1").arg(schema::channel[m_code].fullname());
-                        if (m>0) {
-                            lab += QObject::tr(" (%2 min, %3 sec)").arg(m).arg(s);
-                        } else {
-                            lab += QObject::tr(" (%3 sec)").arg(m).arg(s);
-                        }
-                        GetTextExtent(lab, x, y);
-                        w.ToolTip(lab, x2 - 10, bartop + (3 * w.printScaleY()), TT_AlignRight, tooltipTimeout);
-
-                    }
-                }
-
-            } else { //if (chan.type() == schema::FLAG) {
-                ///////////////////////////////////////////////////////////////////////////
-                // Draw Event Flag Bars
-                ///////////////////////////////////////////////////////////////////////////
-
-                for (int i = 0; i < np; i++, dptr++) {
-                    X = start + *tptr++;
+                    x1 = double(X - minx) * xmult;
+                    x2 = double(X2 - minx) * xmult;
 
-                    if (X > maxx) {
-                        break;
+                    // Events sharing a pixel column with the last one only need drawing once
+                    if (m_marks.size() > first) {
+                        FlagMark & last = m_marks.last();
+                        if ((int(x1) == int(last.x1)) && (int(x2) == int(last.x2))) {
+                            last.count++;
+                            continue;
+                        }
                     }
 
-                    x1 = (X - minx) * xmult + left;
-
-                    if (!w.selectingArea() && !hover && QRect(x1-3, bartop-2, 6, bottom-bartop+4).contains(w.graphView()->currentMousePos())) {
-                        hover = true;
-                        painter.setPen(QPen(Qt::red,1));
+                    FlagMark mark;
+                    mark.x1 = x1;
+                    mark.x2 = x2;
+                    mark.data = dptr[idx];
+                    mark.count = 1;
+                    m_marks.append(mark);
+                }
+            }
+        }
+        gProfiler::count("events", visited);
+    }
 
-                        painter.drawRect(x1-2, bartop-2, 4, bottom-bartop+4);
-                        int x,y;
-                        QString lab = QString("%1 (%2)").arg(schema::channel[m_code].fullname()).arg(*dptr);
-                        GetTextExtent(lab, x, y);
+    if (rebuild && !span) {
+        QVector<QLine> vlines;
+        vlines.reserve(m_marks.size());
+        for (const auto & mark : m_marks) {
+            vlines.append(QLine(left + mark.x1, bartop, left + mark.x1, bottom));
+        }
+        m_lines.add(vlines, color);
+    }
 
-                        w.ToolTip(lab, x1 - 10, bartop + (3 * w.printScaleY()), TT_AlignRight, tooltipTimeout);
-                    }
+    int tooltipTimeout = AppSetting->tooltipTimeout();
+    QPoint mouse = w.currentMousePos();
+    bool canhover = !w.selectingArea();
 
-                    vlines.append(QLine(x1, bartop, x1, bottom));
+    bool hover = false;
+    for (const auto & mark : m_marks) {
+        x1 = left + mark.x1;
+        x2 = left + mark.x2;
+
+        if (span) {
+            ///////////////////////////////////////////////////////////////////////////
+            // Draw Event Flag Spans
+            ///////////////////////////////////////////////////////////////////////////
+            painter.fillRect(x2, bartop, x1-x2, bottom-bartop, brush);
+            if (canhover && !hover && QRect(x2, bartop, x1-x2, bottom-bartop).contains(mouse)) {
+                hover = true;
+                painter.setPen(QPen(Qt::red,1));
+
+                painter.drawRect(x2, bartop, x1-x2, bottom-bartop);
+                int x,y;
+                int s = mark.data;
+                int m = s / 60;
+                s %= 60;
+                QString lab = QString("%1").arg(schema::channel[m_code].fullname());
+                if (m>0) {
+                    lab += QObject::tr(" (%2 min, %3 sec)").arg(m).arg(s);
+                } else {
+                    lab += QObject::tr(" (%3 sec)").arg(m).arg(s);
                 }
+                GetTextExtent(lab, x, y);
+                w.ToolTip(lab, x2 - 10, bartop + (3 * w.printScaleY()), TT_AlignRight, tooltipTimeout);
+            }
+        } else { //if (chan.type() == schema::FLAG) {
+            ///////////////////////////////////////////////////////////////////////////
+            // Hover over Event Flag Bars, which are drawn from the line buffer
+            ///////////////////////////////////////////////////////////////////////////
+            if (canhover && !hover && QRect(x1-3, bartop-2, 6, bottom-bartop+4).contains(mouse)) {
+                hover = true;
+                painter.setPen(QPen(Qt::red,1));
+
+                painter.drawRect(x1-2, bartop-2, 4, bottom-bartop+4);
+                int x,y;
+                QString lab = QString("%1 (%2)").arg(schema::channel[m_code].fullname()).arg(mark.data);
+                GetTextExtent(lab, x, y);
+
+                w.ToolTip(lab, x1 - 10, bartop + (3 * w.printScaleY()), TT_AlignRight, tooltipTimeout);
             }
         }
     }
 
-    painter.setPen(color);
-    painter.drawLines(vlines);
+    w.countLines(m_lines.draw(painter, QPoint(left, top)));
 }
 
 bool gFlagsLine::mouseMoveEvent(QMouseEvent *event, gGraph *graph)
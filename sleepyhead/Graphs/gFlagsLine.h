@@ -26,12 +26,17 @@ class gLabelArea: public gSpacer
         Q_UNUSED(region);
     }
     virtual int minimumWidth();
+
+    //! \brief Returns the layer this passes its mouse events on to
+    Layer * mainLayer() { return m_mainlayer; }
+    void setMainLayer(Layer * layer) { m_mainlayer = layer; }
   protected:
     Layer *m_mainlayer;
     virtual bool mouseMoveEvent(QMouseEvent *event, gGraph *graph);
 
+    // gGraph::cloneLayers points the clone at the main layer's own clone
     virtual Layer * Clone() {
-        gLabelArea * layer = new gLabelArea(nullptr);  //ouchie..
+        gLabelArea * layer = new gLabelArea(m_mainlayer);
         Layer::CloneInto(layer);
         CloneInto(layer);
         return layer;
@@ -63,6 +68,9 @@ class gFlagsLine: public Layer
     //! \brief Drawing code to add the flags and span markers to the Vertex buffers.
     virtual void paint(QPainter &painter, gGraph &w, const QRegion &region);
 
+    //! \brief Drops the flags cached for the previous day
+    virtual void SetDay(Day *d);
+
     void setTotalLines(int i) { total_lines = i; }
     void setLineNum(int i) { line_num = i; }
 
@@ -89,6 +97,13 @@ class gFlagsLine: public Layer
     int total_lines, line_num;
     int m_lx, m_ly;
 
+    //! \brief Flag bars from the last paint, reused while the range stays put
+    gLineBuffer m_lines;
+
+    //! \brief Events inside the visible range, in pixels, kept until the range changes
+    QVector<FlagMark> m_marks;
+    QByteArray m_markskey;
+
 };
 
 /*! \class gFlagsGroup
@@ -22,6 +22,12 @@ class gShadowArea: public Layer
 
     virtual void paint(QPainter &painter, gGraph &w, const QRegion &region);
 
+    virtual Layer * Clone() {
+        gShadowArea * layer = new gShadowArea(m_shadow_color, m_line_color);
+        Layer::CloneInto(layer);
+        return layer;
+    }
+
   protected:
     QColor m_shadow_color;
     QColor m_line_color;
@@ -0,0 +1,282 @@
+/* gGlyphAtlas Implementation
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#include <cmath>
+#include <QFontMetricsF>
+#include <QPaintDevice>
+#include <QTransform>
+
+#include "Graphs/gGlyphAtlas.h"
+
+// Page size in pixels, roomy enough for a couple of hundred glyphs at typical label sizes
+const int atlas_size = 512;
+
+// Once there's more pages than this, any not used in a frame get thrown away
+const int atlas_max_pages = 48;
+
+// Padding around each glyph, so antialiased edges don't bleed into the next one
+const qreal atlas_padding = 2.0;
+
+// Returns true if ch can be drawn on its own, without shaping against its neighbours
+static bool standaloneChar(QChar ch)
+{
+    if (ch.isSurrogate() || (ch == QLatin1Char('\n')) || (ch == QLatin1Char('\t'))) {
+        return false;
+    }
+    switch (ch.script()) {
+    case QChar::Script_Common:
+    case QChar::Script_Latin:
+    case QChar::Script_Greek:
+    case QChar::Script_Cyrillic:
+    case QChar::Script_Han:
+    case QChar::Script_Hiragana:
+    case QChar::Script_Katakana:
+    case QChar::Script_Hangul:
+    case QChar::Script_Bopomofo:
+        return true;
+    default:
+        return false;
+    }
+}
+
+gGlyphAtlas::gGlyphAtlas()
+    :m_rendered(0)
+{
+}
+
+gGlyphAtlas::~gGlyphAtlas()
+{
+    clear();
+}
+
+void gGlyphAtlas::clear()
+{
+    qDeleteAll(m_pages);
+    m_pages.clear();
+    m_order.clear();
+}
+
+gGlyphAtlas::Page * gGlyphAtlas::page(QPainter &painter, const QFont &font, const QColor &color, bool antialias)
+{
+    QPaintDevice * device = painter.device();
+    qreal dpr = device ? device->devicePixelRatioF() : 1.0;
+
+    QString key = QString("%1:%2:%3:%4").arg(font.key()).arg(color.rgba()).arg(antialias).arg(dpr);
+
+    auto it = m_pages.find(key);
+    if (it != m_pages.end()) {
+        return it.value();
+    }
+
+    Page * pg = new Page;
+    pg->font = font;
+    pg->color = color;
+    pg->antialias = antialias;
+    pg->dpr = dpr;
+
+    QFontMetricsF fm(font);
+    pg->ascent = fm.ascent();
+    pg->descent = fm.descent();
+    pg->height = fm.height();
+    pg->xheight = fm.xHeight();
+
+    pg->image = QImage(atlas_size, atlas_size, QImage::Format_ARGB32_Premultiplied);
+    pg->image.fill(Qt::transparent);
+    pg->dirty = true;
+    pg->full = false;
+    pg->x = pg->y = pg->row = 0;
+
+    m_pages[key] = pg;
+    return pg;
+}
+
+const gGlyphAtlas::Glyph * gGlyphAtlas::glyph(Page * pg, QChar ch)
+{
+    auto it = pg->glyphs.constFind(ch.unicode());
+    if (it != pg->glyphs.constEnd()) {
+        return &it.value();
+    }
+    if (pg->full) {
+        return nullptr;
+    }
+
+    QFontMetricsF fm(pg->font);
+
+    Glyph g;
+    g.advance = fm.width(ch);
+
+    QRectF ink = fm.boundingRect(ch);
+    if (ink.isEmpty()) {
+        // Nothing to draw, just move along
+        g.source = QRect();
+        g.offset = QPointF();
+        return &pg->glyphs.insert(ch.unicode(), g).value();
+    }
+
+    QRectF cell = ink.adjusted(-atlas_padding, -atlas_padding, atlas_padding, atlas_padding);
+    int cw = ceil(cell.width() * pg->dpr);
+    int chh = ceil(cell.height() * pg->dpr);
+
+    if (pg->x + cw > atlas_size) {
+        pg->x = 0;
+        pg->y += pg->row;
+        pg->row = 0;
+    }
+    if ((pg->y + chh > atlas_size) || (cw > atlas_size)) {
+        // Out of room, it gets wiped after the next flush
+        pg->full = true;
+        return nullptr;
+    }
+
+    g.source = QRect(pg->x, pg->y, cw, chh);
+    g.offset = cell.topLeft();
+
+    QPainter p(&pg->image);
+    p.setClipRect(g.source);
+    p.setRenderHint(QPainter::TextAntialiasing, pg->antialias);
+    p.setRenderHint(QPainter::Antialiasing, pg->antialias);
+    p.setFont(pg->font);
+    p.setPen(pg->color);
+    p.translate(pg->x, pg->y);
+    p.scale(pg->dpr, pg->dpr);
+    p.drawText(-cell.topLeft(), QString(ch));
+    p.end();
+
+    pg->x += cw;
+    pg->row = qMax(pg->row, chh);
+    pg->dirty = true;
+    m_rendered++;
+
+    return &pg->glyphs.insert(ch.unicode(), g).value();
+}
+
+qreal gGlyphAtlas::prepare(Page * pg, const QString &text)
+{
+    qreal width = 0;
+    for (const QChar & ch : text) {
+        if (!standaloneChar(ch)) {
+            return -1;
+        }
+        const Glyph * g = glyph(pg, ch);
+        if (!g) {
+            return -1;
+        }
+        width += g->advance;
+    }
+    return width;
+}
+
+void gGlyphAtlas::emitText(Page * pg, const QString &text, const QPointF &pos, float angle, const QPointF &origin)
+{
+    QTransform transform;
+    transform.translate(origin.x(), origin.y());
+    transform.rotate(-angle);
+
+    qreal scale = 1.0 / pg->dpr;
+    qreal x = pos.x();
+
+    for (const QChar & ch : text) {
+        const Glyph & g = pg->glyphs[ch.unicode()];
+        if (!g.source.isEmpty()) {
+            QPointF center = QPointF(x, pos.y()) + g.offset
+                    + QPointF(g.source.width() * scale / 2.0, g.source.height() * scale / 2.0);
+            pg->fragments.append(QPainter::PixmapFragment::create(transform.map(center), QRectF(g.source),
+                                                                   scale, scale, -angle));
+        }
+        x += g.advance;
+    }
+
+    if (!m_order.contains(pg)) {
+        m_order.append(pg);
+    }
+}
+
+bool gGlyphAtlas::addText(QPainter &painter, const QString &text, const QFont &font, const QColor &color, bool antialias,
+                          const QPointF &pos, float angle, const QPointF &origin)
+{
+    Page * pg = page(painter, font, color, antialias);
+    if (prepare(pg, text) < 0) {
+        return false;
+    }
+    emitText(pg, text, pos, angle, origin);
+    return true;
+}
+
+bool gGlyphAtlas::addText(QPainter &painter, const QString &text, const QFont &font, const QColor &color, bool antialias,
+                          const QRectF &rect, quint32 flags)
+{
+    if (flags & (Qt::TextWordWrap | Qt::TextWrapAnywhere | Qt::TextShowMnemonic)) {
+        return false;
+    }
+
+    Page * pg = page(painter, font, color, antialias);
+    qreal width = prepare(pg, text);
+    if (width < 0) {
+        return false;
+    }
+
+    QPointF pos;
+    if (flags & Qt::AlignRight) {
+        pos.setX(rect.right() - width);
+    } else if (flags & Qt::AlignHCenter) {
+        pos.setX(rect.left() + (rect.width() - width) / 2.0);
+    } else {
+        pos.setX(rect.left());
+    }
+
+    if (flags & Qt::AlignBottom) {
+        pos.setY(rect.bottom() - pg->descent);
+    } else if (flags & Qt::AlignVCenter) {
+        pos.setY(rect.top() + (rect.height() - pg->height) / 2.0 + pg->ascent);
+    } else {
+        pos.setY(rect.top() + pg->ascent);
+    }
+
+    emitText(pg, text, pos, 0, QPointF());
+    return true;
+}
+
+qreal gGlyphAtlas::textWidth(QPainter &painter, const QString &text, const QFont &font, const QColor &color, bool antialias)
+{
+    return prepare(page(painter, font, color, antialias), text);
+}
+
+void gGlyphAtlas::flush(QPainter &painter)
+{
+    for (Page * pg : m_order) {
+        if (!pg->fragments.isEmpty()) {
+            if (pg->dirty) {
+                pg->pixmap = QPixmap::fromImage(pg->image);
+                pg->dirty = false;
+            }
+            painter.drawPixmapFragments(pg->fragments.constData(), pg->fragments.size(), pg->pixmap);
+            pg->fragments.clear();
+        }
+
+        if (pg->full) {
+            // Start the page over, whatever is still needed gets rasterized again next time
+            pg->glyphs.clear();
+            pg->image.fill(Qt::transparent);
+            pg->x = pg->y = pg->row = 0;
+            pg->full = false;
+            pg->dirty = true;
+        }
+    }
+
+    if (m_pages.size() > atlas_max_pages) {
+        for (auto it = m_pages.begin(); it != m_pages.end();) {
+            if (!m_order.contains(it.value())) {
+                delete it.value();
+                it = m_pages.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    m_order.clear();
+}
@@ -0,0 +1,99 @@
+/* gGlyphAtlas Header
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#ifndef GGLYPHATLAS_H
+#define GGLYPHATLAS_H
+
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include <QFont>
+#include <QColor>
+#include <QImage>
+#include <QPixmap>
+#include <QPainter>
+
+/*! \class gGlyphAtlas
+    \brief Draws queued text from pages of pre-rendered glyphs, one page per font, colour and pixel ratio
+
+    Each glyph is only rasterized the first time it's seen, after which whole strings are assembled
+    from it and drawn with a single QPainter::drawPixmapFragments call per page.
+    Kerning is lost, which is fine for axis labels. Scripts that need shaping are refused, as are
+    strings that won't fit, so the caller can draw those with QPainter::drawText instead.
+    */
+class gGlyphAtlas
+{
+  public:
+    gGlyphAtlas();
+    ~gGlyphAtlas();
+
+    /*! \brief Queue text with its baseline starting at pos, after translating to origin and rotating angle degrees anticlockwise
+        Returns false if the text can't be drawn from the atlas */
+    bool addText(QPainter &painter, const QString &text, const QFont &font, const QColor &color, bool antialias,
+                 const QPointF &pos, float angle = 0.0, const QPointF &origin = QPointF());
+
+    /*! \brief Queue text aligned inside rect using Qt alignment flags, the same way QPainter::drawText would place it
+        Returns false if the text can't be drawn from the atlas */
+    bool addText(QPainter &painter, const QString &text, const QFont &font, const QColor &color, bool antialias,
+                 const QRectF &rect, quint32 flags);
+
+    //! \brief Returns the advance width of text in font, or -1 if the atlas can't draw it
+    qreal textWidth(QPainter &painter, const QString &text, const QFont &font, const QColor &color, bool antialias);
+
+    //! \brief Draw everything queued since the last flush
+    void flush(QPainter &painter);
+
+    //! \brief Drop every page
+    void clear();
+
+    //! \brief Returns how many glyphs had to be rasterized since the last call
+    int takeGlyphsRendered() { int c = m_rendered; m_rendered = 0; return c; }
+
+  protected:
+    struct Glyph {
+        QRect source;       // in page pixels, empty for blank glyphs like spaces
+        QPointF offset;     // top left of source, relative to the baseline origin
+        qreal advance;
+    };
+
+    struct Page {
+        QFont font;
+        QColor color;
+        bool antialias;
+        qreal dpr;
+
+        qreal ascent, descent, height, xheight;
+
+        QImage image;
+        QPixmap pixmap;
+        bool dirty;
+        bool full;
+
+        // next free slot, packed in rows
+        int x, y, row;
+
+        QHash<ushort, Glyph> glyphs;
+        QVector<QPainter::PixmapFragment> fragments;
+    };
+
+    Page * page(QPainter &painter, const QFont &font, const QColor &color, bool antialias);
+
+    //! \brief Look up or rasterize ch on page, returns nullptr if there's no room left
+    const Glyph * glyph(Page * page, QChar ch);
+
+    //! \brief Returns the width of text on page, or -1 if any of it can't be drawn from the atlas
+    qreal prepare(Page * page, const QString &text);
+
+    void emitText(Page * page, const QString &text, const QPointF &pos, float angle, const QPointF &origin);
+
+    QHash<QString, Page *> m_pages;
+    QList<Page *> m_order;      // pages in the order they got text this frame
+    int m_rendered;
+};
+
+#endif // GGLYPHATLAS_H
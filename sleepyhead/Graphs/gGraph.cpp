@@ -15,17 +15,24 @@
 
 #include "mainwindow.h"
 #include "Graphs/gGraphView.h"
+#include "Graphs/gFlagsLine.h"
 #include "Graphs/layer.h"
+#include "Graphs/gProfiler.h"
 #include "SleepLib/profiles.h"
 
 extern MainWindow *mainwin;
 
 // Graph globals.
-QFont *defaultfont = nullptr;
-QFont *mediumfont = nullptr;
-QFont *bigfont = nullptr;
+thread_local QFont *defaultfont = nullptr;
+thread_local QFont *mediumfont = nullptr;
+thread_local QFont *bigfont = nullptr;
 QHash<QString, QImage *> images;
 
+// The preference fonts, which the GUI thread's pointers above start out at
+static QFont *graphfont = nullptr;
+static QFont *titlefont = nullptr;
+static QFont *largefont = nullptr;
+
 static bool globalsInitialized = false;
 
 // Graph constants.
@@ -92,6 +99,10 @@ bool InitGraphGlobals()
     mediumfont->setStyleHint(QFont::AnyStyle, QFont::OpenGLCompatible);
     bigfont->setStyleHint(QFont::AnyStyle, QFont::OpenGLCompatible);
 
+    graphfont = defaultfont;
+    titlefont = mediumfont;
+    largefont = bigfont;
+
     //images["mask"] = new QImage(":/icons/mask.png");
     images["oximeter"] = new QImage(":/icons/cubeoximeter.png");
     images["smiley"] = new QImage(":/icons/smileyface.png");
@@ -112,9 +123,10 @@ void DestroyGraphGlobals()
         return;
     }
 
-    delete defaultfont;
-    delete bigfont;
-    delete mediumfont;
+    delete graphfont;
+    delete largefont;
+    delete titlefont;
+    defaultfont = mediumfont = bigfont = nullptr;
 
     for (auto & image : images) {
         delete image;
@@ -123,9 +135,31 @@ void DestroyGraphGlobals()
     globalsInitialized = false;
 }
 
+gThreadFonts::gThreadFonts(bool printing)
+    :m_defaultfont(defaultfont), m_mediumfont(mediumfont), m_bigfont(bigfont),
+      fa(*graphfont), fb(*titlefont), fc(*largefont)
+{
+    if (printing) {
+        fa.setPixelSize(28);
+        fb.setPixelSize(32);
+        fc.setPixelSize(70);
+    }
+    defaultfont = &fa;
+    mediumfont = &fb;
+    bigfont = &fc;
+}
+
+gThreadFonts::~gThreadFonts()
+{
+    defaultfont = m_defaultfont;
+    mediumfont = m_mediumfont;
+    bigfont = m_bigfont;
+}
+
 gGraph::gGraph(QString name, gGraphView *graphview, QString title, QString units, int height, short group)
     : m_name(name),
       m_graphview(graphview),
+      m_print(nullptr),
       m_title(title),
       m_units(units),
       m_visible(true)
@@ -172,6 +206,7 @@ gGraph::gGraph(QString name, gGraphView *graphview, QString title, QString units
     m_marginright = 15;
     m_selecting_area = m_blockzoom = false;
     m_pinned = false;
+    m_revision = 0;
     m_lastx23 = 0;
 
     invalidate_yAxisImage = true;
@@ -211,7 +246,7 @@ void gGraph::Trigger(int ms)
 void gGraph::Timeout()
 {
     deselect();
-    m_graphview->timedRedraw(0);
+    timedRedraw(0);
 }
 
 void gGraph::deselect()
@@ -248,8 +283,8 @@ bool gGraph::isEmpty()
 }
 
 
-float gGraph::printScaleX() { return m_graphview->printScaleX(); }
-float gGraph::printScaleY() { return m_graphview->printScaleY(); }
+float gGraph::printScaleX() { return m_print ? m_print->scaleX : m_graphview->printScaleX(); }
+float gGraph::printScaleY() { return m_print ? m_print->scaleY : m_graphview->printScaleY(); }
 
 
 //void gGraph::drawGLBuf()
@@ -270,6 +305,7 @@ void gGraph::setDay(Day *day)
     if (m_snapshot) return;
 
     m_day = day;
+    invalidate();
 
     for (auto & layer : m_layers) {
         layer->SetDay(day);
@@ -287,17 +323,30 @@ void gGraph::setZoomY(short zoom)
 
 void gGraph::renderText(QString text, int x, int y, float angle, QColor color, QFont *font, bool antialias)
 {
+    if (m_print) {
+        m_print->textque.append(TextQue(x, y, angle, text, color, font, antialias));
+        return;
+    }
     m_graphview->AddTextQue(text, x, y, angle, color, font, antialias);
 }
 
 void gGraph::renderText(QString text, QRectF rect, quint32 flags, float angle, QColor color, QFont *font, bool antialias)
 {
+    if (m_print) {
+        m_print->textqueRect.append(TextQueRect(rect, flags, text, angle, color, font, antialias));
+        return;
+    }
     m_graphview->AddTextQue(text, rect, flags, angle, color, font, antialias);
 }
 
 
 void gGraph::paint(QPainter &painter, const QRegion &region)
 {
+    gProfiler::Scope scope("graph", this);
+
+    // Layers read this days sessions and event lists directly, while summary charts may be filling them elsewhere
+    QMutexLocker daylock(m_day ? m_day->cacheMutex() : nullptr);
+
     m_rect = region.boundingRect();
     int originX = m_rect.left();
     int originY = m_rect.top();
@@ -331,9 +380,9 @@ void gGraph::paint(QPainter &painter, const QRegion &region)
         title_x = float(yh) ;
 
         QString & txt = title();
-        graphView()->AddTextQue(txt, marginLeft() + title_x + 8*printScaleX(), originY + height / 2 - y / 2, 90, Qt::black, mediumfont);
+        renderText(txt, marginLeft() + title_x + 8*printScaleX(), originY + height / 2 - y / 2, 90, Qt::black, mediumfont);
 
-        left += graphView()->titleWidth*printScaleX();
+        left += titleWidth()*printScaleX();
     } else { left = 0; }
 
 
@@ -382,8 +431,10 @@ void gGraph::paint(QPainter &painter, const QRegion &region)
         if (!layer->visible()) { continue; }
 
         tmp = layer->minimumWidth();
-        tmp *= m_graphview->printScaleX();
-        tmp *= m_graphview->devicePixelRatio();
+        tmp *= printScaleX();
+        if (!m_print) {
+            tmp *= m_graphview->devicePixelRatio();
+        }
 
         if (layer->position() == LayerLeft) {
             QRect rect(originX + left, originY + top, tmp, height - top - bottom);
@@ -421,6 +472,7 @@ void gGraph::paint(QPainter &painter, const QRegion &region)
         if (layer->position() == LayerTop) {
             QRect rect(originX + left, originY + top, width - left - right, tmp);
             layer->m_rect = rect;
+            gProfiler::Scope scope("layer", this, layer);
             layer->paint(painter, *this, QRegion(rect));
             top += tmp;
         }
@@ -429,6 +481,7 @@ void gGraph::paint(QPainter &painter, const QRegion &region)
             bottom += tmp * printScaleY();
             QRect rect(originX + left, originY + height - bottom, width - left - right, tmp);
             layer->m_rect = rect;
+            gProfiler::Scope scope("layer", this, layer);
             layer->paint(painter, *this, QRegion(rect));
         }
     }
@@ -444,6 +497,7 @@ void gGraph::paint(QPainter &painter, const QRegion &region)
         if (layer->position() == LayerCenter) {
             QRect rect(originX + left, originY + top, width - left - right, height - top - bottom);
             layer->m_rect = rect;
+            gProfiler::Scope scope("layer", this, layer);
             layer->paint(painter, *this, QRegion(rect));
         }
     }
@@ -452,6 +506,7 @@ void gGraph::paint(QPainter &painter, const QRegion &region)
     for (const auto & layer : m_layers) {
         if (!layer->visible()) { continue; }
         if ((layer->position() == LayerLeft) || (layer->position() == LayerRight)) {
+            gProfiler::Scope scope("layer", this, layer);
             layer->paint(painter, *this, QRegion(layer->m_rect));
         }
     }
@@ -465,12 +520,19 @@ void gGraph::paint(QPainter &painter, const QRegion &region)
 //                     originX + m_selection.x(), originY + height - bottom, col.rgba());
     }
 
-    if (isPinned() && !printing()) {
+    if (isPinned() && !printing() && m_graphview) {
         painter.drawPixmap(-5, originY-10, m_graphview->pin_icon);
     }
 
 }
 
+void gGraph::moveLayerRects(int dx, int dy)
+{
+    for (const auto & layer : m_layers) {
+        layer->m_rect.translate(dx, dy);
+    }
+}
+
 QPixmap gGraph::renderPixmap(int w, int h, bool printing)
 {
 
@@ -527,6 +589,58 @@ QPixmap gGraph::renderPixmap(int w, int h, bool printing)
     return pm;
 }
 
+void gGraph::paintPrinted(QPainter &painter, const QRect &rect)
+{
+    m_printing = true;
+    painter.fillRect(rect, QBrush(QColor(Qt::white)));
+    paint(painter, QRegion(rect));
+    DrawTextQue(painter);
+    m_printing = false;
+}
+
+gGraph * gGraph::Clone()
+{
+    gGraph * graph = new gGraph(m_name, nullptr, m_title, m_units, m_height, m_group);
+    graph->setHeight(m_height);
+    graph->setMargins(m_marginleft, m_marginright, m_margintop, m_marginbottom);
+    graph->m_blockzoom = m_blockzoom;
+    graph->m_block_select = m_block_select;
+    graph->m_zoomY = m_zoomY;
+    graph->m_showTitle = m_showTitle;
+    graph->m_visible = m_visible;
+    graph->m_min_height = m_min_height;
+    graph->f_miny = f_miny;
+    graph->f_maxy = f_maxy;
+    graph->m_enforceMinY = m_enforceMinY;
+    graph->m_enforceMaxY = m_enforceMaxY;
+    graph->m_day = m_day;
+    graph->min_x = min_x;
+    graph->max_x = max_x;
+
+    graph->cloneLayers(this);
+    return graph;
+}
+
+void gGraph::cloneLayers(gGraph * graph)
+{
+    QHash<Layer *, Layer *> clones;
+    for (const auto & l : graph->m_layers) {
+        Layer * layer = l->Clone();
+        if (layer) {
+            clones[l] = layer;
+            m_layers.append(layer);
+        }
+    }
+
+    // Label areas pass their mouse events to another layer, which has to be the clone of it
+    for (const auto & layer : m_layers) {
+        gLabelArea * label = dynamic_cast<gLabelArea *>(layer);
+        if (label) {
+            label->setMainLayer(clones.value(label->mainLayer()));
+        }
+    }
+}
+
 // Sets a new Min & Max X clipping, refreshing the graph and all it's layers.
 void gGraph::SetXBounds(qint64 minx, qint64 maxx)
 {
@@ -559,6 +673,9 @@ void gGraph::ToolTip(QString text, int x, int y, ToolTipAlignment align, int tim
         timeout = AppSetting->tooltipTimeout();
     }
 
+    // Offscreen graphs have nowhere to show one
+    if (!m_graphview) return;
+
     m_graphview->m_tooltip->display(text, x, y, align, timeout);
 }
 
@@ -686,6 +803,7 @@ void gGraph::AddLayer(Layer *l, LayerPosition position, short width, short heigh
 
 void gGraph::dataChanged()
 {
+    invalidate();
     for (auto & layer : m_layers) {
         layer->dataChanged();
     }
@@ -693,16 +811,44 @@ void gGraph::dataChanged()
 
 void gGraph::redraw()
 {
-    m_graphview->redraw();
+    invalidate();
+    if (m_graphview) {
+        m_graphview->redraw();
+    }
 }
 void gGraph::timedRedraw(int ms)
 {
-    m_graphview->timedRedraw(ms);
+    invalidate();
+    if (m_graphview) {
+        m_graphview->timedRedraw(ms);
+    }
 }
 
 double gGraph::currentTime() const
 {
-    return m_graphview->currentTime();
+    return m_graphview ? m_graphview->currentTime() : 0;
+}
+
+QPoint gGraph::currentMousePos() const
+{
+    return m_graphview ? m_graphview->currentMousePos() : QPoint(-1, -1);
+}
+
+int gGraph::titleWidth() const
+{
+    return m_print ? m_print->titleWidth : m_graphview->titleWidth;
+}
+
+bool gGraph::showLineCursor() const
+{
+    return AppSetting->lineCursorMode() && !m_printing;
+}
+
+void gGraph::countLines(int count)
+{
+    if (m_graphview) {
+        m_graphview->lines_drawn_this_frame += count;
+    }
 }
 double gGraph::screenToTime(int xpos)
 {
@@ -719,6 +865,9 @@ void gGraph::mouseMoveEvent(QMouseEvent *event)
 {
     // qDebug() << m_title << "Move" << event->pos() << m_graphview->pointClicked();
     if (m_rect.width() == 0) return;
+
+    // Hover and selection state live in the graph and its layers, so the tile can't be reused
+    invalidate();
     int y = event->y();
     int x = event->x();
 
@@ -871,6 +1020,7 @@ bool gGraph::selectingArea() { return m_selecting_area || m_graphview->metaSelec
 
 void gGraph::mousePressEvent(QMouseEvent *event)
 {
+    invalidate();
     int y = event->pos().y();
     int x = event->pos().x();
 
@@ -896,6 +1046,7 @@ void gGraph::mousePressEvent(QMouseEvent *event)
 
 void gGraph::mouseReleaseEvent(QMouseEvent *event)
 {
+    invalidate();
 
     int y = event->pos().y();
     int x = event->pos().x();
@@ -1057,6 +1208,7 @@ void gGraph::mouseReleaseEvent(QMouseEvent *event)
 
 void gGraph::wheelEvent(QWheelEvent *event)
 {
+    invalidate();
     //qDebug() << m_title << "Wheel" << event->x() << event->y() << event->delta();
     //int y=event->pos().y();
     if (event->orientation() == Qt::Horizontal) {
@@ -1084,6 +1236,7 @@ void gGraph::wheelEvent(QWheelEvent *event)
 }
 void gGraph::mouseDoubleClickEvent(QMouseEvent *event)
 {
+    invalidate();
     //mousePressEvent(event);
     //mouseReleaseEvent(event);
     int y = event->pos().y();
@@ -1115,6 +1268,7 @@ void gGraph::mouseDoubleClickEvent(QMouseEvent *event)
 }
 void gGraph::keyPressEvent(QKeyEvent *event)
 {
+    invalidate();
     for (const auto & layer : m_layers) {
         layer->keyPressEvent(event, this);
     }
@@ -1125,6 +1279,7 @@ void gGraph::keyPressEvent(QKeyEvent *event)
 void gGraph::keyReleaseEvent(QKeyEvent *event)
 {
     if (!m_graphview) return;
+    invalidate();
 
     if (m_graphview->selectionInProgress() && m_graphview->metaSelect()) {
         if (!(event->modifiers() & Qt::AltModifier)) {
@@ -1190,6 +1345,10 @@ void gGraph::ZoomX(double mult, int origin_px)
 
 void gGraph::DrawTextQue(QPainter &painter)
 {
+    if (m_print) {
+        m_print->DrawTextQue(painter);
+        return;
+    }
     AppSetting->usePixmapCaching() ? m_graphview->DrawTextQueCached(painter) : m_graphview->DrawTextQue(painter);
 }
 
@@ -22,16 +22,33 @@
 #include "Graphs/layer.h"
 
 class gGraphView;
+class gPrintContext;
 
-// Graph globals.
-extern QFont *defaultfont;
-extern QFont *mediumfont;
-extern QFont *bigfont;
+// Graph globals. The fonts are per thread, see gThreadFonts
+extern thread_local QFont *defaultfont;
+extern thread_local QFont *mediumfont;
+extern thread_local QFont *bigfont;
 extern QHash<QString, QImage *> images;
 
 bool InitGraphGlobals();
 void DestroyGraphGlobals();
 
+/*! \class gThreadFonts
+    \brief Points the calling thread's graph fonts at its own copies of the preference fonts for as long as it's in scope
+
+    Graphs painted off the GUI thread need this, as they can't share QFonts with it.
+    */
+class gThreadFonts
+{
+  public:
+    //! \brief Copies the fonts, at the sizes used for printed reports if printing is true
+    gThreadFonts(bool printing = false);
+    ~gThreadFonts();
+  protected:
+    QFont * m_defaultfont, * m_mediumfont, * m_bigfont;
+    QFont fa, fb, fc;
+};
+
 const int mouse_movement_threshold = 6;
 
 float CatmullRomSpline(float p0, float p1, float p2, float p3, float t = 0.5);
@@ -83,6 +100,17 @@ class gGraph : public QObject
         */
     QPixmap renderPixmap(int width, int height, bool printing = false);
 
+    /*! \brief Paints the graph into rect as it would appear on a printed page, along with its queued text
+        Unlike renderPixmap, this leaves the fonts alone, and takes its print scale from the graph's gPrintContext.
+        Safe to call from a worker thread on a cloned graph that isn't in any gGraphView. */
+    void paintPrinted(QPainter &painter, const QRect &rect);
+
+    //! \brief Returns a new graph outside of any gGraphView, with the same settings and day as this one, and clones of its layers
+    gGraph * Clone();
+
+    //! \brief Paint through context instead of a gGraphView, for graphs that don't belong to one
+    void setPrintContext(gPrintContext * context) { m_print = context; }
+
     //! \brief Set Graph visibility status
     void setVisible(bool b) { m_visible = b; }
 
@@ -129,6 +157,18 @@ class gGraph : public QObject
     double currentTime() const;
     void setCurrentTime(double value) { m_currentTime = value; }
 
+    //! \brief Returns where the mouse is in the gGraphView, or off the graph if there isn't one
+    QPoint currentMousePos() const;
+
+    //! \brief Returns the width of the vertical title column
+    int titleWidth() const;
+
+    //! \brief Returns true if the line cursor should be drawn, which it never is when printing
+    bool showLineCursor() const;
+
+    //! \brief Adds count to the gGraphView's lines drawn statistic
+    void countLines(int count);
+
 
 
     //! \brief Add Layer l to graph object, allowing you to specify position,
@@ -273,6 +313,12 @@ class gGraph : public QObject
     //! \brief Asks the main gGraphView to redraw after ms milliseconds
     void timedRedraw(int ms);
 
+    //! \brief Marks this graphs cached tile out of date, for when something it draws from has changed
+    void invalidate() { m_revision++; }
+
+    //! \brief Returns a number that changes whenever this graph has to be rendered again
+    inline quint32 revision() const { return m_revision; }
+
     double screenToTime(int xpos);
 
     void dataChanged();
@@ -296,6 +342,9 @@ class gGraph : public QObject
 
     const inline QRect &rect() const { return m_rect; }
 
+    //! \brief Shift the layer rectangles, for when a cached image of this graph is drawn somewhere else
+    void moveLayerRects(int dx, int dy);
+
     bool isPinned() { return m_pinned; }
     void setPinned(bool b) { m_pinned = b; }
 
@@ -331,6 +380,9 @@ class gGraph : public QObject
     inline bool printing() const { return m_printing; }
 
   protected:
+    //! \brief Replaces this graph's layers with clones of graph's
+    void cloneLayers(gGraph * graph);
+
     //! \brief Mouse Wheel events
     virtual void wheelEvent(QWheelEvent *event);
 
@@ -355,6 +407,7 @@ class gGraph : public QObject
     void cancelSelection() {
         m_selecting_area = false;
         m_selection = QRect(0,0,0,0);
+        invalidate();
     }
 
     void dumpInfo();
@@ -367,6 +420,7 @@ class gGraph : public QObject
     QString m_name;
 
     gGraphView *m_graphview;
+    gPrintContext *m_print;
     QString m_title;
     QString m_units;
 
@@ -400,6 +454,7 @@ class gGraph : public QObject
     QString m_selDurString;
 
     bool m_snapshot;
+    quint32 m_revision;
 
   protected slots:
     //! \brief Deselects any highlights, and schedules a main gGraphView redraw
@@ -11,7 +11,6 @@
 #include <QDir>
 #include <QFontMetrics>
 #include <QLabel>
-#include <QPixmapCache>
 #include <QTimer>
 #include <QFontMetrics>
 #include <QWidgetAction>
@@ -19,6 +18,7 @@
 #include <QVBoxLayout>
 #include <QDockWidget>
 #include <QMainWindow>
+#include <QFileDialog>
 # include <QWindow>
 
 
@@ -35,6 +35,7 @@
 #include "Graphs/gSessionTimesChart.h"
 #include "Graphs/gYAxis.h"
 #include "Graphs/gFlagsLine.h"
+#include "Graphs/gProfiler.h"
 #include "SleepLib/profiles.h"
 
 
@@ -206,65 +207,16 @@ void gToolTip::timerDone()
     m_graphview->resetMouse();
 }
 
-#ifdef ENABLE_THREADED_DRAWING
-
-gThread::gThread(gGraphView *g)
-{
-    graphview = g;
-    mutex.lock();
-}
-gThread::~gThread()
-{
-    if (isRunning()) {
-        m_running = false;
-        mutex.unlock();
-        wait();
-        terminate();
-    }
-}
-
-void gThread::run()
-{
-    m_running = true;
-    gGraph *g;
-
-    while (m_running) {
-        mutex.lock();
-
-        //mutex.unlock();
-        if (!m_running) { break; }
-
-        do {
-            g = graphview->popGraph();
-
-            if (g) {
-                g->paint(QRegion(g->m_lastbounds));
-                //int i=0;
-            } else {
-                //mutex.lock();
-                graphview->masterlock->release(1); // This thread gives up for now..
-
-            }
-        } while (g);
-    }
-}
-
-#endif // ENABLE_THREADED_DRAWING
-
 void gGraphView::queGraph(gGraph *g, int left, int top, int width, int height)
 {
     g->m_rect = QRect(left, top, width, height);
-#ifdef ENABLED_THREADED_DRAWING
-    dl_mutex.lock();
-#endif
     m_drawlist.push_back(g);
-#ifdef ENABLED_THREADED_DRAWING
-    dl_mutex.unlock();
-#endif
 }
 
 void gGraphView::trashGraphs(bool destroy)
 {
+    invalidateTiles();
+
     if (destroy) {
         for (auto & graph : m_graphs) {
             delete graph;
@@ -275,25 +227,6 @@ void gGraphView::trashGraphs(bool destroy)
     m_graphsbyname.clear();
 }
 
-// Take the next graph to render from the drawing list
-gGraph *gGraphView::popGraph()
-{
-    gGraph *g;
-#ifdef ENABLED_THREADED_DRAWING
-    dl_mutex.lock();
-#endif
-
-    if (!m_drawlist.isEmpty()) {
-        g = m_drawlist.at(0);
-        m_drawlist.pop_front();
-    } else { g = nullptr; }
-
-#ifdef ENABLED_THREADED_DRAWING
-    dl_mutex.unlock();
-#endif
-    return g;
-}
-
 gGraphView::gGraphView(QWidget *parent, gGraphView *shared)
 #ifdef BROKEN_OPENGL_BUILD
     : QWidget(parent),
@@ -332,19 +265,7 @@ gGraphView::gGraphView(QWidget *parent, gGraphView *shared)
     this->setMouseTracking(true);
     m_emptytext = STR_Empty_NoData;
     InitGraphGlobals(); // FIXME: sstangl: handle error return.
-#ifdef ENABLE_THREADED_DRAWING
-    m_idealthreads = QThread::idealThreadCount();
-
-    if (m_idealthreads <= 0) { m_idealthreads = 1; }
-
-    masterlock = new QSemaphore(m_idealthreads);
-#endif
     m_tooltip = new gToolTip(this);
-    /*for (int i=0;i<m_idealthreads;i++) {
-        gThread * gt=new gThread(this);
-        m_threads.push_back(gt);
-        //gt->start();
-    }*/
 
     setFocusPolicy(Qt::StrongFocus);
     m_showsplitter = true;
@@ -375,6 +296,13 @@ gGraphView::gGraphView(QWidget *parent, gGraphView *shared)
 #if QT_VERSION < QT_VERSION_CHECK(5,4,0)
     // happens no matter what in 5.4+
     setAutoBufferSwap(false);
+#else
+    if (AppSetting->antiAliasing()) {
+        // Lines drawn from vertex buffers bypass QPainter's antialiasing, so multisample instead
+        QSurfaceFormat fmt = format();
+        fmt.setSamples(4);
+        setFormat(fmt);
+    }
 #endif
 #endif
 
@@ -394,6 +322,9 @@ gGraphView::gGraphView(QWidget *parent, gGraphView *shared)
     QAction * action = context_menu->addAction(tr("Reset Graph Layout"), this, SLOT(resetLayout()));
     action->setToolTip(tr("Resets all graphs to a uniform height and default order."));
 
+    trace_action = context_menu->addAction(tr("Save Performance Trace..."), this, SLOT(exportPerformanceTrace()));
+    trace_action->setToolTip(tr("Saves recorded drawing times in Chrome trace format, for chrome://tracing or Perfetto."));
+
     context_menu->addSeparator();
     limits_menu = context_menu->addMenu(tr("Y-Axis"));
     plots_menu = context_menu->addMenu(tr("Plots"));
@@ -504,13 +435,7 @@ void gGraphView::popoutGraph()
         gv->m_graphs.insert(m_graphs.indexOf(graph)+1, newgraph);
         gv->m_graphsbyname[newname] = newgraph;
         newgraph->m_graphview = gv;
-
-        for (auto & l : graph->m_layers) {
-            Layer * layer = l->Clone();
-            if (layer) {
-                newgraph->m_layers.append(layer);
-            }
-        }
+        newgraph->cloneLayers(graph);
 
         for (auto & g : m_graphs) {
             group = qMax(g->group(), group);
@@ -556,7 +481,7 @@ void gGraphView::closeEvent(QCloseEvent * event)
     disconnect(timer, 0, 0, 0);
     timer->deleteLater();
     redrawtimer->deleteLater();
-    pixmapcache.clear();
+    m_glyphatlas.clear();
     if (m_scrollbar) {
         this->disconnect(m_scrollbar, SIGNAL(sliderMoved(int)), 0, 0);
     }
@@ -575,15 +500,6 @@ gGraphView::~gGraphView()
     doneCurrent();
 #endif
 
-#ifdef ENABLE_THREADED_DRAWING
-
-    for (int i=0; i < m_threads.size(); i++) {
-        delete m_threads[i];
-    }
-
-    delete masterlock;
-#endif
-
     // Note: This will cause a crash if two graphs accidentally have the same name
     for (auto & graph : m_graphs) {
         delete graph;
@@ -741,15 +657,25 @@ void gGraphView::dumpInfo()
 //    }
 }
 
-// Render graphs with QPainter or pixmap caching, depending on preferences
+// Render graphs with QPainter or the glyph atlas, depending on preferences
 void gGraphView::DrawTextQue(QPainter &painter)
+{
+    strings_drawn_this_frame += drawTextQues(painter, m_textque, m_textqueRect);
+}
+
+void gPrintContext::DrawTextQue(QPainter &painter)
+{
+    gGraphView::drawTextQues(painter, textque, textqueRect);
+}
+
+int gGraphView::drawTextQues(QPainter &painter, QVector<TextQue> & textque, QVector<TextQueRect> & textqueRect)
 {
     // process the text drawing queue
     int h,w;
 
-    strings_drawn_this_frame += m_textque.size() + m_textqueRect.size();;
+    int count = textque.size() + textqueRect.size();
 
-    for (const TextQue & q : m_textque) {
+    for (const TextQue & q : textque) {
         // can do antialiased text via texture cache fine on mac
         // Just draw the fonts..
         painter.setPen(QColor(q.color));
@@ -768,13 +694,13 @@ void gGraphView::DrawTextQue(QPainter &painter)
             painter.translate(-q.x, -q.y);
         }
     }
-    m_textque.clear();
+    textque.clear();
 
     ////////////////////////////////////////////////////////////////////////
     // Text Rectangle Queues..
     ////////////////////////////////////////////////////////////////////////
 
-    for (const TextQueRect & q : m_textqueRect) {
+    for (const TextQueRect & q : textqueRect) {
         // Just draw the fonts..
 
         painter.setPen(QColor(q.color));
@@ -794,149 +720,84 @@ void gGraphView::DrawTextQue(QPainter &painter)
         }
 
     }
-    m_textqueRect.clear();
-}
+    textqueRect.clear();
 
+    return count;
+}
 
-const QString z__cacheStr = "%1:%2:%3";
 
 void gGraphView::DrawTextQueCached(QPainter &painter)
 {
-    // process the text drawing queue
-    int h,w;
-    QString hstr;
-    QPixmap pm;
-    float xxx, yyy;
-    const int buf = 8;
-    int fonta = defaultfont->pointSize();
-    int fontb = mediumfont->pointSize();
-    int fontc = bigfont->pointSize();
-    int size;
-
+    // Strings the atlas can't handle are put back in the queue for DrawTextQue
+    QVector<TextQue> textque;
+    QVector<TextQueRect> textqueRect;
+    qreal w;
+    int h, cached = 0;
 
     for (const TextQue & q : m_textque) {
-        // can do antialiased text via texture cache fine on mac
-        // Generate the pixmap cache "key"
-        size = (q.font == defaultfont) ? fonta : (q.font==mediumfont) ? fontb : (q.font == bigfont) ? fontc : q.font->pointSize();
-
-        hstr = z__cacheStr.arg(q.text).arg(q.color.name()).arg(size);
-
-        if (!QPixmapCache::find(hstr, &pm)) {
-
-            QFontMetrics fm(*q.font);
-            w = fm.width(q.text);
-            h = fm.height()+buf;
-
-            pm = QPixmap(w, h);
-            pm.fill(Qt::transparent);
-
-            QPainter imgpainter(&pm);
-
-            imgpainter.setPen(q.color);
-            imgpainter.setFont(*q.font);
-
-            imgpainter.setRenderHint(QPainter::TextAntialiasing, q.antialias);
-            imgpainter.drawText(0, h-buf, q.text);
-            imgpainter.end();
-
-            QPixmapCache::insert(hstr, pm);
-        }
-
-        h = pm.height();
-        w = pm.width();
-        if (q.angle != 0) {
-            xxx = q.x - h - (h / 2);
-            yyy = q.y + w / 2;
-
-            xxx += 4;
-            yyy += 4;
-
-            painter.translate(xxx, yyy);
-            painter.rotate(-q.angle);
-            painter.drawPixmap(QRect(0, h / 2, w, h), pm);
-            painter.rotate(+q.angle);
-            painter.translate(-xxx, -yyy);
+        bool ok;
+        if (q.angle == 0) {
+            ok = m_glyphatlas.addText(painter, q.text, *q.font, q.color, q.antialias, QPointF(q.x, q.y));
+        } else {
+            // Placed exactly as DrawTextQue would
+            w = m_glyphatlas.textWidth(painter, q.text, *q.font, q.color, q.antialias);
+            h = QFontMetrics(*q.font).xHeight() + 2;
+            ok = (w >= 0) && m_glyphatlas.addText(painter, q.text, *q.font, q.color, q.antialias,
+                                                  QPointF(floor(-w / 2.0)-6, floor(-h / 2.0)), q.angle, QPointF(q.x, q.y));
+        }
+        if (ok) {
+            cached++;
         } else {
-            QRect r1(q.x - buf / 2 + 4, q.y - h + buf, w, h);
-            painter.drawPixmap(r1, pm);
+            textque.append(q);
         }
     }
+
     ////////////////////////////////////////////////////////////////////////
     // Text Rectangle Queues..
     ////////////////////////////////////////////////////////////////////////
 
     for (const TextQueRect & q : m_textqueRect) {
-        // can do antialiased text via texture cache fine on mac
-        // Generate the pixmap cache "key"
-
-        size = (q.font == defaultfont) ? fonta : (q.font==mediumfont) ? fontb : (q.font == bigfont) ? fontc : q.font->pointSize();
-
-        hstr = z__cacheStr.arg(q.text).arg(q.color.name()).arg(size);
-
-        if (!QPixmapCache::find(hstr, &pm)) {
-
-            w = q.rect.width();
-            h = q.rect.height();
-
-            pm = QPixmap(w, h);
-
-            pm.fill(Qt::transparent);
-
-            QPainter imgpainter(&pm);
-
-            imgpainter.setPen(q.color);
-            imgpainter.setFont(*q.font);
-            imgpainter.setRenderHint(QPainter::TextAntialiasing, true);
-            imgpainter.drawText(QRect(0,0, w, h), q.flags, q.text);
-            imgpainter.end();
-
-            QPixmapCache::insert(hstr, pm);
+        bool ok;
+        if (q.angle == 0) {
+            ok = m_glyphatlas.addText(painter, q.text, *q.font, q.color, q.antialias, q.rect, q.flags);
         } else {
-            h = pm.height();
-            w = pm.width();
+            w = m_glyphatlas.textWidth(painter, q.text, *q.font, q.color, q.antialias);
+            h = QFontMetrics(*q.font).xHeight() + 2;
+            ok = (w >= 0) && m_glyphatlas.addText(painter, q.text, *q.font, q.color, q.antialias,
+                                                  QPointF(floor(-w / 2.0), floor(-h / 2.0)), q.angle, q.rect.topLeft());
         }
-        if (q.angle != 0) {
-            xxx = q.rect.x() - h - (h / 2);
-            yyy = q.rect.y() + w / 2;
-
-            xxx += 4;
-            yyy += 4;
-
-            painter.translate(xxx, yyy);
-            painter.rotate(-q.angle);
-            painter.drawPixmap(QRect(0, h / 2, w, h), pm);
-            painter.rotate(+q.angle);
-            painter.translate(-xxx, -yyy);
+        if (ok) {
+            cached++;
         } else {
-            painter.drawPixmap(q.rect,pm, QRect(0,0,w,h));
+            textqueRect.append(q);
         }
     }
 
-    strings_drawn_this_frame += m_textque.size() + m_textqueRect.size();;
-    m_textque.clear();
-    m_textqueRect.clear();
+    m_glyphatlas.flush(painter);
+
+    int rendered = m_glyphatlas.takeGlyphsRendered();
+    strings_drawn_this_frame += cached;
+    strings_cached_this_frame += cached;
+    glyphs_rendered_this_frame += rendered;
+    gProfiler::count("text_atlas", cached);
+    gProfiler::count("text_direct", textque.size() + textqueRect.size());
+    gProfiler::count("glyphs_rendered", rendered);
+
+    m_textque = textque;
+    m_textqueRect = textqueRect;
+    if (!m_textque.isEmpty() || !m_textqueRect.isEmpty()) {
+        DrawTextQue(painter);
+    }
 }
 
 void gGraphView::AddTextQue(const QString &text, QRectF rect, quint32 flags, float angle, QColor color, QFont *font, bool antialias)
 {
-#ifdef ENABLED_THREADED_DRAWING
-    text_mutex.lock();
-#endif
     m_textqueRect.append(TextQueRect(rect,flags,text,angle,color,font,antialias));
-#ifdef ENABLED_THREADED_DRAWING
-    text_mutex.unlock();
-#endif
 }
 
 void gGraphView::AddTextQue(const QString &text, short x, short y, float angle, QColor color, QFont *font, bool antialias)
 {
-#ifdef ENABLED_THREADED_DRAWING
-    text_mutex.lock();
-#endif
     m_textque.append(TextQue(x,y,angle,text,color,font,antialias));
-#ifdef ENABLED_THREADED_DRAWING
-    text_mutex.unlock();
-#endif
 }
 
 void gGraphView::addGraph(gGraph *g, short group)
@@ -1047,11 +908,7 @@ void gGraphView::scrollbarValueChanged(int val)
     //qDebug() << "Scrollbar Changed" << val;
     if (m_offsetY != val) {
         m_offsetY = val;
-#if QT_VERSION >= QT_VERSION_CHECK(5,4,0)
-        update();
-#else
-        timedRedraw(); // do this on a timer?
-#endif
+        redrawScrolled();
     }
 }
 
@@ -1162,6 +1019,130 @@ void gGraphView::setScrollBar(MyScrollBar *sb)
     this->connect(m_scrollbar, SIGNAL(valueChanged(int)), SLOT(scrollbarValueChanged(int)));
 }
 
+bool GraphTile::matches(gGraph * g, const QSize & size, float dpr, double cursor) const
+{
+    return !image.isNull() && (rect.size() == size) && (m_dpr == dpr) && (revision == g->revision())
+            && (min_x == g->min_x) && (max_x == g->max_x) && (rmin_x == g->rmin_x) && (rmax_x == g->rmax_x)
+            && (min_y == g->min_y) && (max_y == g->max_y) && (this->cursor == cursor);
+}
+
+//! \brief Where the line cursor is drawn, which every graph showing it depends on
+static inline double tileCursor(gGraphView * view)
+{
+    return AppSetting->lineCursorMode() ? view->currentTime() : -1;
+}
+
+void gGraphView::renderTile(gGraph * g, GraphTile & tile, QPainter::RenderHints hints)
+{
+    const QRect rect = g->m_rect;
+    QImage image(rect.size() * m_dpr, QImage::Format_ARGB32_Premultiplied);
+    image.setDevicePixelRatio(m_dpr);
+    image.fill(Qt::white);
+
+    // Revision first, anything changing it while painting means painting again
+    tile.revision = g->revision();
+    tile.cursor = tileCursor(this);
+
+    // Painted in place, so the graph and layer rects stay valid for mouse handling
+    QPainter tp(&image);
+    tp.setRenderHints(hints);
+    tp.translate(-rect.left(), -rect.top());
+    g->paint(tp, QRegion(rect));
+
+    // This graphs text belongs in the tile too
+    AppSetting->usePixmapCaching() ? DrawTextQueCached(tp) : DrawTextQue(tp);
+    tp.end();
+
+    tile.image = image;
+    tile.rect = rect;
+    tile.m_dpr = m_dpr;
+    tile.min_x = g->min_x;
+    tile.max_x = g->max_x;
+    tile.rmin_x = g->rmin_x;
+    tile.rmax_x = g->rmax_x;
+    tile.min_y = g->min_y;
+    tile.max_y = g->max_y;
+    tiles_drawn_this_frame++;
+    gProfiler::count("tile_misses");
+}
+
+void gGraphView::paintGraphTile(QPainter &painter, gGraph * g)
+{
+    const QRect rect = g->m_rect;
+    GraphTile & tile = m_tiles[g];
+
+    if (!tile.matches(g, rect.size(), m_dpr, tileCursor(this))) {
+        renderTile(g, tile, painter.renderHints());
+    } else {
+        gProfiler::count("tile_hits");
+        if (tile.rect.topLeft() != rect.topLeft()) {
+            // Scrolled since, so keep the layer rects in line with where it's now drawn
+            g->moveLayerRects(rect.left() - tile.rect.left(), rect.top() - tile.rect.top());
+        }
+    }
+    tile.rect = rect;
+
+    painter.drawImage(rect.topLeft(), tile.image);
+}
+
+void gGraphView::invalidateTiles()
+{
+    m_tiles.clear();
+}
+
+void gGraphView::drawProfilerOverlay(QPainter &painter)
+{
+    const gFrameStats & stats = m_framestats;
+    if (stats.frame == 0) return;
+
+    auto rate = [&stats](const QString & hits, const QString & misses) -> QString {
+        double r = stats.hitRate(hits, misses);
+        return (r < 0) ? QString("-") : QString::number(r, 'f', 0) + "%";
+    };
+
+    QStringList lines;
+    lines << QString("Frame %1: %2 ms").arg(stats.frame).arg(stats.ms, 0, 'f', 2);
+    lines << QString("Samples %1, event loading %2 ms").arg(stats.counters.value("samples")).arg(stats.stall_ms, 0, 'f', 1);
+    lines << QString("Hits: tiles %1, line buffers %2, text atlas %3")
+             .arg(rate("tile_hits", "tile_misses"))
+             .arg(rate("linebuffer_hits", "linebuffer_misses"))
+             .arg(rate("text_atlas", "text_direct"));
+
+    for (const auto & layer : stats.slowestLayers(5)) {
+        lines << QString("%1 ms  %2").arg(layer.second, 6, 'f', 2).arg(layer.first);
+    }
+
+    painter.setFont(*defaultfont);
+    QFontMetrics fm(*defaultfont);
+    int lh = fm.height();
+    int w = 0;
+    for (const auto & line : lines) {
+        w = qMax(w, fm.width(line));
+    }
+    QRect rect(8, height() - lines.size() * lh - 16, w + 12, lines.size() * lh + 8);
+
+    painter.fillRect(rect, QColor(255, 255, 224, 224));
+    painter.setPen(Qt::gray);
+    painter.drawRect(rect);
+    painter.setPen(Qt::black);
+
+    int y = rect.top() + 4 + fm.ascent();
+    for (const auto & line : lines) {
+        painter.drawText(rect.left() + 6, y, line);
+        y += lh;
+    }
+}
+
+void gGraphView::exportPerformanceTrace()
+{
+    QString filename = QFileDialog::getSaveFileName(this, tr("Save Performance Trace"),
+                                                    QDir::homePath() + "/sleepyhead-trace.json",
+                                                    tr("Chrome Trace (*.json)"));
+    if (filename.isEmpty()) return;
+
+    gProfiler::exportTrace(filename);
+}
+
 bool gGraphView::renderGraphs(QPainter &painter)
 {
     float px = m_offsetX;
@@ -1170,19 +1151,6 @@ bool gGraphView::renderGraphs(QPainter &painter)
     float h, w;
     //ax=px;//-m_offsetX;
 
-    //bool threaded;
-
-    // Tempory hack using this pref..
-    //#ifdef ENABLED_THREADED_DRAWING
-    /*if (profile->session->multithreading()) { // && (m_idealthreads>1)) {
-        threaded=true;
-        for (int i=0;i<m_idealthreads;i++) {
-            if (!m_threads[i]->isRunning())
-                m_threads[i]->start();
-        }
-    } else threaded=false; */
-    //#endif
-    //threaded=false;
     if (height() < 40) return false;
 
     if (m_scaleY < 0.0000001) {
@@ -1255,9 +1223,15 @@ bool gGraphView::renderGraphs(QPainter &painter)
         py = ceil(py + h + graphSpacer);
     }
 
-    // Physically draw the unpinned graphs
+    // Physically draw the unpinned graphs, from their cached tiles where possible.
+    // Under OpenGL the layers keep their lines in vertex buffers, which beats a raster tile.
+    bool direct = gLineBuffer::available(painter);
     for (const auto & g : m_drawlist) {
-        g->paint(painter, QRegion(g->m_rect));
+        if (direct) {
+            g->paint(painter, QRegion(g->m_rect));
+        } else {
+            paintGraphTile(painter, g);
+        }
     }
     m_drawlist.clear();
 
@@ -1310,28 +1284,11 @@ bool gGraphView::renderGraphs(QPainter &painter)
         py = ceil(py + h + graphSpacer);
     }
 
-    //int thr=m_idealthreads;
-#ifdef ENABLED_THREADED_DRAWING
-    if (threaded) {
-        for (int i = 0; i < m_idealthreads; i++) {
-            masterlock->acquire(1);
-            m_threads[i]->mutex.unlock();
-        }
-
-        // wait till all the threads are done
-        // ask for all the CPU's back..
-        masterlock->acquire(m_idealthreads);
-        masterlock->release(m_idealthreads);
-    } else {
-#endif
-        for (const auto & g : m_drawlist) {
-            g->paint(painter, QRegion(g->m_rect));
-        }
-        m_drawlist.clear();
-
-#ifdef ENABLED_THREADED_DRAWING
+    // Pinned graphs sit over the gradient and the pin icon hangs outside their rect, so they always paint directly
+    for (const auto & g : m_drawlist) {
+        g->paint(painter, QRegion(g->m_rect));
     }
-#endif
+    m_drawlist.clear();
     //int elapsed=time.elapsed();
     //QColor col=Qt::black;
 
@@ -1370,6 +1327,14 @@ void gGraphView::paintGL()
     if (width() <= 0) { return; }
     if (height() <= 0) { return; }
 
+    QString framename = objectName().isEmpty() ? QString("gGraphView") : objectName();
+    gProfiler::setEnabled(AppSetting->showPerformance());
+    gFrameStats laststats = gProfiler::lastFrame();
+    if (laststats.name == framename) {
+        m_framestats = laststats;
+    }
+    gProfiler::Scope framescope("frame", framename);
+
 
     // Create QPainter object, note this is only valid from paintGL events!
     QPainter painter(this);
@@ -1386,6 +1351,8 @@ void gGraphView::paintGL()
     quads_drawn_this_frame = 0;
     strings_drawn_this_frame = 0;
     strings_cached_this_frame = 0;
+    glyphs_rendered_this_frame = 0;
+    tiles_drawn_this_frame = 0;
 
     graphs_drawn = renderGraphs(painter);
 
@@ -1456,7 +1423,9 @@ void gGraphView::paintGL()
                 + QString::number(lines_drawn_this_frame, 'f', 0) + " lines "
 //                + QString::number(quads_drawn_this_frame, 'f', 0) + " quads "
                 + QString::number(strings_drawn_this_frame, 'f', 0) + " strings "
-                + QString::number(strings_cached_this_frame, 'f', 0) + " cached ";
+                + QString::number(strings_cached_this_frame, 'f', 0) + " cached "
+                + QString::number(glyphs_rendered_this_frame, 'f', 0) + " glyphs "
+                + QString::number(tiles_drawn_this_frame, 'f', 0) + " tiles ";
 
         int w, h;
         // this uses tightBoundingRect, which is different on Mac than it is on Windows & Linux.
@@ -1471,6 +1440,8 @@ void gGraphView::paintGL()
 #endif
         AddTextQue(ss, width(), w / 2, 90, QColor(Qt::black), defaultfont);
         AppSetting->usePixmapCaching() ? DrawTextQueCached(painter) :DrawTextQue(painter);
+
+        drawProfilerOverlay(painter);
     }
 //    painter.setPen(Qt::lightGray);
 //    painter.drawLine(0, 0, 0, height());
@@ -1551,7 +1522,7 @@ void gGraphView::setOffsetY(int offsetY)
 {
     if (m_offsetY != offsetY) {
         m_offsetY = offsetY;
-        redraw(); //issue full redraw..
+        redrawScrolled();
     }
 }
 
@@ -1992,6 +1963,7 @@ void gGraphView::populateMenu(gGraph * graph)
         snap_action->setData(graph->name()+"|snapshot");
       //  zoom100_action->setVisible(true);
     }
+    trace_action->setVisible(AppSetting->showPerformance());
 
     // Menu title fonts
     QFont font = QApplication::font();
@@ -2259,13 +2231,7 @@ void gGraphView::onSnapshotGraphToggle()
         m_graphs.insert(m_graphs.indexOf(graph)+1, newgraph);
         m_graphsbyname[newname] = newgraph;
         newgraph->m_graphview = this;
-
-        for (const auto & l : graph->m_layers) {
-            Layer * layer = l->Clone();
-            if (layer) {
-                newgraph->m_layers.append(layer);
-            }
-        }
+        newgraph->cloneLayers(graph);
 
         for (const auto & g : m_graphs) {
             group = qMax(g->group(), group);
@@ -2370,7 +2336,7 @@ void gGraphView::onOverlaysClicked(QAction *action)
         if (widget) {
             widget->setChecked(b);
         }
-        timedRedraw(0);
+        graph->timedRedraw(0);
         return;
     }
 
@@ -2406,6 +2372,7 @@ void gGraphView::onOverlaysClicked(QAction *action)
                 }
             }
         }
+        graph->timedRedraw(0);
     }
 
 }
@@ -2435,6 +2402,8 @@ void gGraphView::onLinesClicked(QAction *action)
         lc->m_dot_enabled[dot.code][dot.type] = !lc->m_dot_enabled[dot.code][dot.type];
 
     }
+    // The channel setting is shared, so other graphs may show it too
+    invalidateTiles();
     timedRedraw(0);
 }
 
@@ -3089,7 +3058,7 @@ void gGraphView::keyPressEvent(QKeyEvent *event)
             m_offsetY -= AppSetting->graphHeight() * 3 * m_scaleY;
             m_scrollbar->setValue(m_offsetY);
             m_offsetY = m_scrollbar->value();
-            redraw();
+            redrawScrolled();
         }
         return;
     } else if (event->key() == Qt::Key_PageDown) {
@@ -3100,7 +3069,7 @@ void gGraphView::keyPressEvent(QKeyEvent *event)
 
             m_scrollbar->setValue(m_offsetY);
             m_offsetY = m_scrollbar->value();
-            redraw();
+            redrawScrolled();
         }
         return;
         //        redraw();
@@ -3185,6 +3154,7 @@ void gGraphView::keyPressEvent(QKeyEvent *event)
 
 void gGraphView::setDay(Day *day)
 {
+    invalidateTiles();
 
     m_day = day;
 
@@ -3216,7 +3186,6 @@ void gGraphView::refreshTimeout()
 }
 void gGraphView::timedRedraw(int ms)
 {
-
     if (timer->isActive()) {
         if (ms == 0) {
             timer->stop();
@@ -3457,6 +3426,16 @@ void gGraphView::dataChanged()
 
 
 void gGraphView::redraw()
+{
+    // Graph tiles are only redrawn where their own inputs changed, see gGraph::invalidate()
+#ifdef BROKEN_OPENGL_BUILD
+    repaint();
+#else
+    update();
+#endif
+}
+
+void gGraphView::redrawScrolled()
 {
 #ifdef BROKEN_OPENGL_BUILD
     repaint();
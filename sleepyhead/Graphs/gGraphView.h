@@ -18,7 +18,8 @@
 #include <QWaitCondition>
 #include <QPixmap>
 #include <QRect>
-#include <QPixmapCache>
+#include <QImage>
+#include <QHash>
 #include <QMenu>
 #include <QCheckBox>
 #include <QComboBox>
@@ -38,6 +39,8 @@
 
 #include <Graphs/gGraph.h>
 #include <Graphs/glcommon.h>
+#include <Graphs/gGlyphAtlas.h>
+#include <Graphs/gProfiler.h>
 #include <SleepLib/day.h>
 
 
@@ -196,27 +199,44 @@ class MyScrollBar : public QScrollBar
     }
 };
 
-/*! \class gThread
-    \brief Part of the Threaded drawing code
+/*! \struct GraphTile
+    \brief A graph rendered into an image, redrawn from cache until its size, bounds or revision change
+    */
+struct GraphTile
+{
+    GraphTile() : m_dpr(0), min_x(0), max_x(0), rmin_x(0), rmax_x(0), min_y(0), max_y(0), revision(0), cursor(0) {}
+
+    //! \brief Returns true if this tile still shows graph g at the given size, with the line cursor at cursor
+    bool matches(gGraph * g, const QSize & size, float dpr, double cursor) const;
+
+    QImage image;
+    QRect rect;     // where it was last drawn, in widget coordinates
+    float m_dpr;
+    qint64 min_x, max_x, rmin_x, rmax_x;
+    EventDataType min_y, max_y;
+    quint32 revision;
+    double cursor;
+};
 
-    This is currently broken, as Qt didn't behave anyway, and it offered no performance improvement drawing-wise
+/*! \class gPrintContext
+    \brief Stands in for the gGraphView of a cloned graph being painted offscreen
+
+    Holds the print scale and text queue of one rendering job, so graphs painted on
+    different threads don't share anything, and no widget is needed to paint them.
     */
-class gThread : public QThread
+class gPrintContext
 {
   public:
-    gThread(gGraphView *g);
-    ~gThread();
-
-    //! \brief Start thread process
-    void run();
+    gPrintContext(int titlewidth, float scalex = 2.5f, float scaley = 2.2f)
+        :scaleX(scalex), scaleY(scaley), titleWidth(titlewidth) {}
 
-    //! \brief Kill thread process
-    void die() { m_running = false; }
-    QMutex mutex;
+    //! \brief Draws and empties the text queue
+    void DrawTextQue(QPainter &painter);
 
-  protected:
-    gGraphView *graphview;
-    volatile bool m_running;
+    float scaleX, scaleY;
+    int titleWidth;
+    QVector<TextQue> textque;
+    QVector<TextQueRect> textqueRect;
 };
 
 /*! \class gToolTip
@@ -428,9 +448,12 @@ class gGraphView
     //! \brief Draw all text components using QPainter object painter
     void DrawTextQue(QPainter &painter);
 
-    //! \brief Draw all text components using QPainter object painter using Pixmapcache
+    //! \brief Draw all text components using QPainter object painter, from the glyph atlas where possible
     void DrawTextQueCached(QPainter &painter);
 
+    //! \brief Draws and empties the supplied text queues, returning how many strings were drawn
+    static int drawTextQues(QPainter &painter, QVector<TextQue> & textque, QVector<TextQueRect> & textqueRect);
+
     //! \brief Returns number of graphs contained (whether they are visible or not)
     int size() const { return m_graphs.size(); }
 
@@ -467,22 +490,9 @@ class gGraphView
     inline const float &devicePixelRatio() { return m_dpr; }
     void setDevicePixelRatio(float dpr) { m_dpr = dpr; }
 
-#ifdef ENABLE_THREADED_DRAWING
-    QMutex text_mutex;
-    QMutex gl_mutex;
-    QSemaphore *masterlock;
-    bool useThreads() { return m_idealthreads > 1; }
-    QVector<gThread *> m_threads;
-    int m_idealthreads;
-    QMutex dl_mutex;
-#endif
-
     //! \brief Sends day object to be distributed to all Graphs Layers objects
     void setDay(Day *day);
 
-    //! \brief pops a graph off the list for multithreaded drawing code
-    gGraph *popGraph(); // exposed for multithreaded drawing
-
     //! \brief Hides the splitter, used in report printing code
     void hideSplitter() { m_showsplitter = false; }
 
@@ -498,6 +508,18 @@ class gGraphView
     //! \brief Graph drawing routines, returns true if there weren't any graphs to draw
     bool renderGraphs(QPainter &painter);
 
+    //! \brief Draws a graph from its cached tile, rendering the tile first if it's out of date
+    void paintGraphTile(QPainter &painter, gGraph * g);
+
+    //! \brief Render graph g into tile. Graphs of a view share their Day's caches, so this stays on the GUI thread
+    void renderTile(gGraph * g, GraphTile & tile, QPainter::RenderHints hints);
+
+    //! \brief Throw away every cached graph tile, for changes no graph can see, like channel or preference settings
+    void invalidateTiles();
+
+    //! \brief Draws the last frames timings, slowest layers and cache hit rates in the bottom left corner
+    void drawProfilerOverlay(QPainter &painter);
+
     //! \brief Used internally by graph mousehandler to set modifier state
     void setMetaSelect(bool b) { m_metaselect = b; }
 
@@ -537,6 +559,8 @@ class gGraphView
     int quads_drawn_this_frame;
     int strings_drawn_this_frame;
     int strings_cached_this_frame;
+    int glyphs_rendered_this_frame;
+    int tiles_drawn_this_frame;
 
     QVector<SelectionHistoryItem> history;
 
@@ -638,6 +662,7 @@ class gGraphView
     //! \brief ANother text que with rect alignment capabilities...
     QVector<TextQueRect> m_textqueRect;
 
+
     int m_lastxpos, m_lastypos;
 
     QString m_emptytext;
@@ -666,7 +691,14 @@ class gGraphView
 
     bool use_pixmap_cache;
 
-    QPixmapCache pixmapcache;
+    //! \brief Pre-rendered glyphs used by DrawTextQueCached
+    gGlyphAtlas m_glyphatlas;
+
+    //! \brief Rendered unpinned graphs, reused while only the scroll position changes
+    QHash<gGraph *, GraphTile> m_tiles;
+
+    //! \brief Profiler stats from this views last frame
+    gFrameStats m_framestats;
 
     QTime horizScrollTime, vertScrollTime;
     QMenu * context_menu;
@@ -679,6 +711,7 @@ class gGraphView
     QAction * snap_action;
 
     QAction * zoom100_action;
+    QAction * trace_action;
 
     bool m_showAuthorMessage;
 
@@ -697,6 +730,9 @@ class gGraphView
     //! \brief Call UpdateGL unless animation is in progress
     void redraw();
 
+    //! \brief Repaint after a scroll only, reusing any cached graph tiles
+    void redrawScrolled();
+
     //! \brief Resets all contained graphs to have a uniform height.
     void resetLayout();
 
@@ -711,6 +747,9 @@ class gGraphView
 
     void popoutGraph();
     void togglePin();
+
+    //! \brief Ask for a filename and save the profiler trace there, in Chrome trace format
+    void exportPerformanceTrace();
 protected slots:
     void onLinesClicked(QAction *);
     void onPlotsClicked(QAction *);
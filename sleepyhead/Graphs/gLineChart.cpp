@@ -18,6 +18,7 @@
 #include "Graphs/gGraphView.h"
 #include "SleepLib/profiles.h"
 #include "Graphs/gLineOverlay.h"
+#include "Graphs/gProfiler.h"
 
 #define EXTRA_ASSERTS 1
 
@@ -95,6 +96,7 @@ void gLineChart::SetDay(Day *d)
 {
     //    Layer::SetDay(d);
     m_day = d;
+    m_lines.clear();
 
     m_minx = 0, m_maxx = 0;
     m_miny = 0, m_maxy = 0;
@@ -447,14 +449,14 @@ void gLineChart::paint(QPainter &painter, gGraph &w, const QRegion &region)
     painter.setRenderHint(QPainter::Antialiasing, AppSetting->antiAliasing());
 
     //bool mouseover = false;
-    if (rect.contains(w.graphView()->currentMousePos())) {
+    if (rect.contains(w.currentMousePos())) {
         //mouseover = true;
 
         painter.fillRect(rect, QBrush(QColor(255,255,245,128)));
     }
 
 
-    bool linecursormode = AppSetting->lineCursorMode();
+    bool linecursormode = w.showLineCursor();
     ////////////////////////////////////////////////////////////////////////
     // Display Line Cursor
     ////////////////////////////////////////////////////////////////////////
@@ -526,6 +528,21 @@ void gLineChart::paint(QPainter &painter, gGraph &w, const QRegion &region)
 
     float lineThickness = AppSetting->lineThickness()+0.001F;
 
+    // The plotted lines only need working out again when something that moves them has changed
+    QByteArray key;
+    {
+        QDataStream out(&key, QIODevice::WriteOnly);
+        out << width << height << minx << maxx << miny << maxy << lineThickness << clockdrift;
+        out << quintptr(m_day) << m_square_plot << m_disable_accel;
+        for (const auto & code : m_codes) {
+            out << m_enabled.value(code);
+        }
+        for (const auto & sess : m_day->sessions) {
+            out << (sess && sess->enabled()) << (sess ? sess->eventGeneration() : 0);
+        }
+    }
+    bool rebuild = m_lines.begin(key, QPoint(left, top));
+
     for (const auto & code : m_codes) {
         const schema::Channel &chan = schema::channel[code];
 
@@ -594,6 +611,9 @@ void gLineChart::paint(QPainter &painter, gGraph &w, const QRegion &region)
             total_points += num_points;
             codepoints += num_points;
 
+            // Lines from last time still stand
+            if (!rebuild) { continue; }
+
             // Max number of samples taken from samples per pixel for better min/max values
             const int num_averages = 20;
 
@@ -732,55 +752,44 @@ void gLineChart::paint(QPainter &painter, gGraph &w, const QRegion &region)
                         // Accelerated Waveform Plot
                         //////////////////////////////////////////////////////////////////
 
-                        for (int i = idx; i <= siz; i += sam, ptr += sam) {
-                            time += rate;
-                            // This is much faster than QVector access.
-                            data = *ptr * gain;
+                        // Each pixel column gets the min/max of every sample beneath it. The lists
+                        // min/max pyramid answers that in a handful of steps, so this costs O(width)
+                        // however many samples are on screen.
+                        EventStoreType rmin, rmax;
 
-                            // Scale the time scale X to pixel scale X
-                            px = ((time - minx) * xmult);
+                        for (int z = 0; (z <= width) && (z < max_drawlist_size); ++z) {
+                            // Samples that round to pixel z
+                            double t1 = minx + (double(z) - 0.5) / xmult;
+                            double t2 = minx + (double(z) + 0.5) / xmult;
 
-                            // Same for Y scale, with gain factored in nmult
-                            py = ((data - miny) * ymult);
+                            if (t2 <= x0) { continue; }
+                            if (t1 > xL) { break; }
 
-                            // In accel mode, each pixel has a min/max Y value.
-                            // m_drawlist's index is the pixel index for the X pixel axis.
-                            //int z = round(px); // Hmmm... round may screw this up.
-                            int z = (px>=0.5)?(int(px)+1):int(px);
-
-                            if (z < minz) {
-                                minz = z;    // minz=First pixel
-                            }
-
-                            if (z > maxz) {
-                                maxz = z;    // maxz=Last pixel
-                            }
+                            int i1 = (t1 <= x0) ? 0 : int(ceil((t1 - x0) / sr));
+                            int i2 = int(ceil((t2 - x0) / sr));
+                            if (i2 > siz) { i2 = siz; }
+                            if (i1 >= i2) { continue; }
 
-                            if (minz < 0) {
-                                qDebug() << "gLineChart::Plot() minz<0  should never happen!! minz =" << minz;
-                                minz = 0;
-                            }
+                            el.rawMinMax(i1, i2, rmin, rmax);
 
-                            if (maxz > max_drawlist_size) {
-                                qDebug() << "gLineChart::Plot() maxz>max_drawlist_size!!!! maxz = " << maxz <<
-                                         " max_drawlist_size =" << max_drawlist_size;
-                                maxz = max_drawlist_size;
-                            }
+                            // Same for Y scale, with gain factored in (which may flip min and max)
+                            double y1 = ((EventDataType(rmin) * gain) - miny) * ymult;
+                            double y2 = ((EventDataType(rmax) * gain) - miny) * ymult;
 
-                            // Update the Y pixel bounds.
-                            if (py < m_drawlist[z].x()) {
-                                m_drawlist[z].setX(py);
-                            }
+                            m_drawlist[z].setX(qMin(y1, y2));
+                            m_drawlist[z].setY(qMax(y1, y2));
 
-                            if (py > m_drawlist[z].y()) {
-                                m_drawlist[z].setY(py);
+                            if (z < minz) {
+                                minz = z;    // minz=First pixel
                             }
 
-                            if (time > maxx) {
-                                done = true;
-                                break;
+                            if (z >= maxz) {
+                                maxz = z + 1;    // maxz=One past the last pixel
                             }
+                        }
 
+                        if (xL > maxx) {
+                            done = true;
                         }
 
                         // Plot compressed accelerated vertex list
@@ -833,9 +842,7 @@ void gLineChart::paint(QPainter &painter, gGraph &w, const QRegion &region)
                         }
                     }
 
-                    painter.setPen(QPen(chan.defaultColor(), lineThickness));
-                    painter.drawLines(lines);
-                    w.graphView()->lines_drawn_this_frame += lines.count();
+                    m_lines.add(lines, chan.defaultColor(), lineThickness);
                     lines.clear();
 
                 } else  {
@@ -956,9 +963,7 @@ void gLineChart::paint(QPainter &painter, gGraph &w, const QRegion &region)
                             }
                         }
                     }
-                    painter.setPen(QPen(chan.defaultColor(), lineThickness));
-                    painter.drawLines(lines);
-                    w.graphView()->lines_drawn_this_frame+=lines.count();
+                    m_lines.add(lines, chan.defaultColor(), lineThickness);
                     lines.clear();
 
                 }
@@ -1000,6 +1005,14 @@ void gLineChart::paint(QPainter &painter, gGraph &w, const QRegion &region)
             legendx -= linewidth + (2*ratioX);
         }
     }
+
+    if (rebuild) {
+        gProfiler::count("samples", total_points);
+    }
+
+    // All channels in one go, from the vertex buffer when on OpenGL
+    w.countLines(m_lines.draw(painter, QPoint(left, top)));
+
     painter.setClipping(false);
 
     ////////////////////////////////////////////////////////////////////
@@ -1084,7 +1097,7 @@ void gLineChart::paint(QPainter &painter, gGraph &w, const QRegion &region)
     int cnt = 0;
 
     // Draw the linechart overlays
-    if (m_day && (AppSetting->lineCursorMode() || (m_codes[0]==CPAP_FlowRate))) {
+    if (m_day && (w.showLineCursor() || (m_codes[0]==CPAP_FlowRate))) {
         bool blockhover = false;
         for (auto fit=flags.begin(), end=flags.end(); fit != end; ++fit) {
             code = fit.key();
@@ -13,6 +13,7 @@
 #include <QVector>
 
 #include "Graphs/layer.h"
+#include "Graphs/glcommon.h"
 #include "SleepLib/event.h"
 #include "SleepLib/day.h"
 #include "Graphs/gLineOverlay.h"
@@ -178,6 +179,9 @@ class gLineChart: public Layer
 
     QVector<QLine> lines;
 
+    //! \brief Plotted lines from the last paint, reused while nothing moves them
+    gLineBuffer m_lines;
+
     QString lasttext;
     qint64 lasttime;
 };
@@ -7,6 +7,8 @@
  * for more details. */
 
 #include <math.h>
+#include <QDataStream>
+#include "Graphs/gProfiler.h"
 #include "SleepLib/profiles.h"
 #include "gLineOverlay.h"
 
@@ -20,6 +22,13 @@ gLineOverlayBar::~gLineOverlayBar()
 {
 }
 
+void gLineOverlayBar::SetDay(Day *d)
+{
+    Layer::SetDay(d);
+    m_markskey.clear();
+    m_lines.clear();
+}
+
 QColor brighten(QColor, float);
 
 void gLineOverlayBar::paint(QPainter &painter, gGraph &w, const QRegion &region)
@@ -56,10 +65,11 @@ void gLineOverlayBar::paint(QPainter &painter, gGraph &w, const QRegion &region)
     qint64 X;
     qint64 Y;
 
-    QPoint mouse=w.graphView()->currentMousePos();
+    QPoint mouse=w.currentMousePos();
+
+    qint64 clockdrift = qint64(p_profile->cpap->clockDrift()) * 1000L;
+    qint64 drift = 0;
 
-    m_count = 0;
-    m_sum = 0;
     m_flag_color = schema::channel[m_code].defaultColor();
 
 
@@ -69,210 +79,210 @@ void gLineOverlayBar::paint(QPainter &painter, gGraph &w, const QRegion &region)
 
     painter.setPen(m_flag_color);
 
+    // Hover highlights are drawn as we go, but the plain flag lines only change with the range
+    QByteArray key;
+    {
+        QDataStream out(&key, QIODevice::WriteOnly);
+        out << width << height << w.min_x << w.max_x << w.printScaleY() << clockdrift;
+        out << quintptr(m_day) << m_flag_color << int(m_flt) << int(m_odt) << m_code;
+        for (const auto & sess : m_day->sessions) {
+            out << sess->session() << sess->enabled() << sess->eventGeneration();
+        }
+    }
+    bool rebuild = m_lines.begin(key, QPoint(left, topp));
+
+
     EventStoreType raw;
 
     quint32 *tptr;
-    EventStoreType *dptr, *eptr;
+    EventStoreType *dptr;
     qint64 stime;
+    quint32 idx, count;
 
     OverlayDisplayType odt = m_odt;
     QHash<ChannelID, QVector<EventList *> >::iterator cei;
-    int count;
 
-    qint64 clockdrift = qint64(p_profile->cpap->clockDrift()) * 1000L;
-    qint64 drift = 0;
-    //bool hover = false;
+    bool span = (m_flt == FT_Span);
 
-    int tooltipTimeout = AppSetting->tooltipTimeout();
+    if ((key != m_markskey) && ((m_flt == FT_Span) || (m_flt == FT_Bar) || (m_flt == FT_Dot))) {
+        ////////////////////////////////////////////////////////////////////////////
+        // Work out which events are on screen, and where
+        ////////////////////////////////////////////////////////////////////////////
+        m_markskey = key;
+        m_marks.clear();
+        m_count = 0;
+        m_sum = 0;
 
-    // For each session, process it's eventlist
-    for (const auto sess : m_day->sessions) {
-        if (!sess->enabled()) { continue; }
+        // For each session, process it's eventlist
+        for (const auto sess : m_day->sessions) {
+            if (!sess->enabled()) { continue; }
 
-        cei = sess->eventlist.find(m_code);
+            cei = sess->eventlist.find(m_code);
 
-        if (cei == sess->eventlist.end()) { continue; }
+            if (cei == sess->eventlist.end()) { continue; }
 
-        if (cei.value().size() == 0) { continue; }
+            if (cei.value().size() == 0) { continue; }
 
-        drift = (sess->type() == MT_CPAP) ? clockdrift : 0;
+            drift = (sess->type() == MT_CPAP) ? clockdrift : 0;
 
-        // Could loop through here, but nowhere uses more than one yet..
-        for (const auto & el : cei.value()) {
-            count = el->count();
-            stime = el->first() + drift;
-            dptr = el->rawData();
-            eptr = dptr + count;
-            tptr = el->rawTime();
+            // Could loop through here, but nowhere uses more than one yet..
+            for (const auto & el : cei.value()) {
+                count = el->count();
+                stime = el->first() + drift;
+                dptr = el->rawData();
+                tptr = el->rawTime();
 
-            ////////////////////////////////////////////////////////////////////////////
-            // Skip data previous to minx bounds
-            ////////////////////////////////////////////////////////////////////////////
+                // Skip data previous to minx bounds
+                idx = el->lowerBound(w.min_x - drift);
 
-            for (; dptr < eptr; ++dptr) {
+                int first = m_marks.size();
+                for (; idx < count; ++idx) {
+                    X = stime + tptr[idx];
+                    raw = dptr[idx];
 
-                if ((stime + *tptr) >= w.min_x) {
-                    break;
-                }
+                    if (span) {
+                        Y = X - (qint64(raw) * 1000.0L); // duration
 
-                ++tptr;
-            }
+                        if (Y > w.max_x) {
+                            break;
+                        }
 
-            if (m_flt == FT_Span) {
-                ////////////////////////////////////////////////////////////////////////////
-                // FT_Span
-                ////////////////////////////////////////////////////////////////////////////
-                QBrush brush(m_flag_color);
-                for (; dptr < eptr; dptr++) {
+                        x1 = jj * double(X - w.min_x);
+                        x2 = jj * double(Y - w.min_x);
 
-                    X = stime + *tptr++;
-                    raw = *dptr;
-                    Y = X - (qint64(raw) * 1000.0L); // duration
+                        x2 += (int(x1)==int(x2)) ? 1 : 0;
 
-                    if (Y > w.max_x) {
-                        break;
+                        x2 = qMax(0.0, x2);
+                        x1 = qMin(width, x1);
+                    } else {
+                        if (X > w.max_x) {
+                            break;
+                        }
+                        x1 = x2 = jj * double(X - w.min_x);
                     }
                     m_sum += raw;
                     ++m_count;
 
-                    x1 = jj * double(X - w.min_x);
-                    x2 = jj * double(Y - w.min_x);
-
-                    x2 += (int(x1)==int(x2)) ? 1 : 0;
-
-                    x2 = qMax(0.0, x2)+left;
-                    x1 = qMin(width, x1)+left;
-
-                    painter.fillRect(QRect(x2, start_py, x1-x2, height), brush);
-                }
-            }/* else if (m_flt == FT_Dot) {
-                ////////////////////////////////////////////////////////////////////////////
-                // FT_Dot
-                ////////////////////////////////////////////////////////////////////////////
-                for (; dptr < eptr; dptr++) {
-                    hover = false;
-
-                    X = stime + *tptr++; //el.time(i);
-                    raw = *dptr; //el.data(i);
-
-                    if (X > w.max_x) {
-                        break;
+                    // Events landing on the same pixels as the last one only need drawing once
+                    if (m_marks.size() > first) {
+                        FlagMark & last = m_marks.last();
+                        if ((int(x1) == int(last.x1)) && (int(x2) == int(last.x2))) {
+                            last.count++;
+                            continue;
+                        }
                     }
 
-                    x1 = jj * double(X - w.min_x) + left;
-                    m_count++;
-                    m_sum += raw;
-
-//                    if ((odt == ODT_Bars) || (xx < 3600000)) {
-                        // show the fat dots in the middle
-                        painter.setPen(QPen(m_flag_color,4));
-
-                        painter.drawPoint(x1, double(height) / double(yy)*double(-20 - w.min_y) + topp);
-                        painter.setPen(QPen(m_flag_color,1));
-
-//                    } else {
-//                        // thin lines down the bottom
-//                        painter.drawLine(x1, start_py + 1, x1, start_py + 1 + 12);
-//                    }
+                    FlagMark mark;
+                    mark.x1 = x1;
+                    mark.x2 = x2;
+                    mark.data = raw;
+                    mark.count = 1;
+                    m_marks.append(mark);
                 }
-            } */else if ((m_flt == FT_Bar) || (m_flt == FT_Dot)) {
-                ////////////////////////////////////////////////////////////////////////////
-                // FT_Bar
-                ////////////////////////////////////////////////////////////////////////////
-                QColor col = m_flag_color;
+            }
+        }
+        gProfiler::count("events", m_count);
+    }
 
-                QString lab = QString("%1").arg(m_label);
-                GetTextExtent(lab, x, y);
+    int tooltipTimeout = AppSetting->tooltipTimeout();
 
-                //int lx,ly;
+    if (m_flt == FT_Span) {
+        ////////////////////////////////////////////////////////////////////////////
+        // FT_Span
+        ////////////////////////////////////////////////////////////////////////////
+        QBrush brush(m_flag_color);
+        for (const auto & mark : m_marks) {
+            x1 = mark.x1 + left;
+            x2 = mark.x2 + left;
+            painter.fillRect(QRect(x2, start_py, x1-x2, height), brush);
+        }
+    } else if ((m_flt == FT_Bar) || (m_flt == FT_Dot)) {
+        ////////////////////////////////////////////////////////////////////////////
+        // FT_Bar
+        ////////////////////////////////////////////////////////////////////////////
+        QColor col = m_flag_color;
 
-                for (; dptr < eptr; dptr++) {
-                   // hover = false;
-                    X = stime + *tptr++;
-                    raw = *dptr;
+        QString lab = QString("%1").arg(m_label);
+        GetTextExtent(lab, x, y);
 
-                    if (X > w.max_x) {
-                        break;
-                    }
+        QVector<QLine> barlines, faintlines, markerlines;
+        int z = start_py + height;
 
-                    x1 = jj * double(X - w.min_x) + left;
-                    m_count++;
-                    m_sum += raw;
-                    int z = start_py + height;
+        for (const auto & mark : m_marks) {
+            x1 = mark.x1 + left;
+            raw = mark.data;
 
-                    double d1 = jj * double(raw) * 1000.0;
+            if ((m_flt == FT_Bar) && (odt == ODT_Bars)) {
+                double d1 = jj * double(raw) * 1000.0;
+                QRect rect(x1-d1, top, d1+4, height);
 
+                painter.setPen(QPen(col,4));
+                painter.drawPoint(x1, top);
 
-                    if ((m_flt == FT_Bar) && (odt == ODT_Bars)) {
-                        QRect rect(x1-d1, top, d1+4, height);
+                if (!w.selectingArea() && !m_blockhover && rect.contains(mouse) && !m_hover) {
+                    m_hover = true;
 
-                        painter.setPen(QPen(col,4));
-                        painter.drawPoint(x1, top);
+                    QColor col2(230,230,230,128);
+                    QRect rect((x1-d1), start_py+2, d1, height-2);
+                    if (rect.x() < left) {
+                        rect.setX(left);
+                    }
 
-                        if (!w.selectingArea() && !m_blockhover && rect.contains(mouse) && !m_hover) {
-                            m_hover = true;
+                    painter.fillRect(rect, QBrush(col2));
+                    painter.setPen(col);
+                    painter.drawRect(rect);
 
-                            QColor col2(230,230,230,128);
-                            QRect rect((x1-d1), start_py+2, d1, height-2);
-                            if (rect.x() < left) {
-                                rect.setX(left);
-                            }
+                    // Queue tooltip
+                    QString lab2 = QString("%1 (%2)").arg(schema::channel[m_code].fullname()).arg(raw);
+                    w.ToolTip(lab2, x1 - 10, start_py + 24 + (3 * w.printScaleY()), TT_AlignRight, AppSetting->tooltipTimeout());
 
-                            painter.fillRect(rect, QBrush(col2));
-                            painter.setPen(col);
-                            painter.drawRect(rect);
+                    painter.setPen(QPen(col,3));
+                    painter.drawLine(x1, top, x1, bottom);
+                }
+                if (rebuild) {
+                    barlines.append(QLine(x1, top, x1, bottom));
+                }
+                if (xx < (3600000)) {
+                    w.renderText(lab, x1 - (x / 2), top - y + (5 * w.printScaleY()),0);
+                }
+            } else {
+                //////////////////////////////////////////////////////////////////////////////////////
+                // Top and bottom markers
+                //////////////////////////////////////////////////////////////////////////////////////
+                if (!w.selectingArea() && !m_blockhover && QRect(x1-2, topp, 6, height).contains(mouse) && !m_hover) {
+                    // only want to draw the highlight/label once per frame
+                    m_hover = true;
 
-                            // Queue tooltip
-                            QString lab2 = QString("%1 (%2)").arg(schema::channel[m_code].fullname()).arg(raw);
-                            w.ToolTip(lab2, x1 - 10, start_py + 24 + (3 * w.printScaleY()), TT_AlignRight, AppSetting->tooltipTimeout());
+                    // Draw text label
+                    QString lab = QString("%1 (%2)").arg(schema::channel[m_code].fullname()).arg(raw);
+                    GetTextExtent(lab, x, y, defaultfont);
 
-                            painter.setPen(QPen(col,3));
-                        } else {
-                            painter.setPen(QPen(col,1));
-                        }
-                        painter.drawLine(x1, top, x1, bottom);
-                        if (xx < (3600000)) {
-                            w.renderText(lab, x1 - (x / 2), top - y + (5 * w.printScaleY()),0);
-                        }
+                    w.ToolTip(lab, x1 - 10, start_py + 24 + (3 * w.printScaleY()), TT_AlignRight, tooltipTimeout);
 
+                    QColor col = m_flag_color;
+                    col.setAlpha(60);
+                    painter.setPen(QPen(col, 4));
 
-                    } else {
-                        //////////////////////////////////////////////////////////////////////////////////////
-                        // Top and bottom markers
-                        //////////////////////////////////////////////////////////////////////////////////////
-                        //bool b = false;
-                        if (!w.selectingArea() && !m_blockhover && QRect(x1-2, topp, 6, height).contains(mouse) && !m_hover) {
-                            // only want to draw the highlight/label once per frame
-                            m_hover = true;
-
-                            // Draw text label
-                            QString lab = QString("%1 (%2)").arg(schema::channel[m_code].fullname()).arg(raw);
-                            GetTextExtent(lab, x, y, defaultfont);
-
-                            w.ToolTip(lab, x1 - 10, start_py + 24 + (3 * w.printScaleY()), TT_AlignRight, tooltipTimeout);
-
-                            QColor col = m_flag_color;
-                            col.setAlpha(60);
-                            painter.setPen(QPen(col, 4));
-
-                            painter.drawLine(x1, start_py+14, x1, z - 12);
-                            painter.setPen(QPen(m_flag_color,4));
-
-                            painter.drawLine(x1, z, x1, z - 14);
-                            painter.drawLine(x1, start_py+2, x1, start_py + 16);
-                        } else {
-                            QColor col = m_flag_color;
-                            col.setAlpha(10);
-                            painter.setPen(QPen(col,1));
-                            painter.drawLine(x1, start_py+14, x1, z);
-                            painter.setPen(QPen(m_flag_color,1));
-                            painter.drawLine(x1, start_py+2, x1, start_py + 14);
-                        }
-                    }
+                    painter.drawLine(x1, start_py+14, x1, z - 12);
+                    painter.setPen(QPen(m_flag_color,4));
+
+                    painter.drawLine(x1, z, x1, z - 14);
+                    painter.drawLine(x1, start_py+2, x1, start_py + 16);
+                }
+                if (rebuild) {
+                    faintlines.append(QLine(x1, start_py+14, x1, z));
+                    markerlines.append(QLine(x1, start_py+2, x1, start_py + 14));
                 }
             }
         }
+
+        QColor faint = m_flag_color;
+        faint.setAlpha(10);
+        m_lines.add(barlines, m_flag_color);
+        m_lines.add(faintlines, faint);
+        m_lines.add(markerlines, m_flag_color);
     }
+    w.countLines(m_lines.draw(painter, QPoint(left, topp)));
 }
 bool gLineOverlayBar::mouseMoveEvent(QMouseEvent *event, gGraph *graph)
 {
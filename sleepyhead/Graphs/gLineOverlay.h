@@ -27,6 +27,9 @@ class gLineOverlayBar: public Layer
     //! \brief The drawing code that fills the OpenGL vertex GLBuffers
     virtual void paint(QPainter &painter, gGraph &w, const QRegion &region);
 
+    //! \brief Drops the flags cached for the previous day
+    virtual void SetDay(Day *d);
+
     virtual EventDataType Miny() { return 0; }
     virtual EventDataType Maxy() { return 0; }
 
@@ -43,6 +46,18 @@ class gLineOverlayBar: public Layer
 
     inline void setOverlayDisplayType(OverlayDisplayType odt) { m_odt = odt; }
     inline OverlayDisplayType overlayDisplayType() { return m_odt; }
+
+    virtual Layer * Clone() {
+        gLineOverlayBar * layer = new gLineOverlayBar(m_code, m_flag_color, m_label, m_flt);
+        Layer::CloneInto(layer);
+        CloneInto(layer);
+        return layer;
+    }
+
+    void CloneInto(gLineOverlayBar * layer) {
+        layer->m_odt = m_odt;
+        layer->m_blockhover = m_blockhover;
+    }
   protected:
     //! \brief Mouse moved over this layers area (shows the hover-over tooltips here)
     virtual bool mouseMoveEvent(QMouseEvent *event, gGraph *graph);
@@ -55,6 +70,13 @@ class gLineOverlayBar: public Layer
     double m_sum;
     bool m_hover;
     bool m_blockhover;
+
+    //! \brief Flag lines from the last paint, reused while the range stays put
+    gLineBuffer m_lines;
+
+    //! \brief Events inside the visible range, in pixels, kept until the range changes
+    QVector<FlagMark> m_marks;
+    QByteArray m_markskey;
 };
 
 /*! \class gLineOverlaySummary
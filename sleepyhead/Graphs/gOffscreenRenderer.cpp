@@ -0,0 +1,356 @@
+/* gOffscreenRenderer Implementation
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#include <QApplication>
+#include <QDir>
+#include <QFontDatabase>
+#include <QMap>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QRunnable>
+#include <QThread>
+#include <QDebug>
+
+#include "Graphs/gOffscreenRenderer.h"
+#include "Graphs/gGraphView.h"
+#include "SleepLib/profiles.h"
+#include "version.h"
+
+// Same sizes the printed reports use, in report pixels
+const int offscreen_width = 2048;
+const int offscreen_height = 420;
+const int offscreen_spacing = 20;
+
+//! \brief Paints graph the way it's printed into a new width x height image, through a print context of its own
+static QImage paintGraph(gGraph * graph, int titlewidth, int width, int height)
+{
+    gPrintContext context(titlewidth);
+    graph->setPrintContext(&context);
+    graph->deselect();
+
+    QImage image(width, height, QImage::Format_ARGB32_Premultiplied);
+    QPainter painter(&image);
+    graph->paintPrinted(painter, image.rect());
+    painter.end();
+
+    graph->setPrintContext(nullptr);
+    return image;
+}
+
+/*! \class gRenderJob
+    \brief Lays out and paints one day on a worker's cloned graphs
+    */
+class gRenderJob:public QRunnable
+{
+  public:
+    gRenderJob(gOffscreenRenderer * renderer, gOffscreenRenderer::Worker * worker, Day * day, gRenderedDay * result)
+        :m_renderer(renderer), m_worker(worker), m_day(day), m_result(result) {}
+    virtual ~gRenderJob() {}
+
+    virtual void run();
+  protected:
+    gOffscreenRenderer * m_renderer;
+    gOffscreenRenderer::Worker * m_worker;
+    Day * m_day;
+    gRenderedDay * m_result;
+};
+
+void gRenderJob::run()
+{
+    Day * day = m_day;
+
+    // Print sized fonts for this thread only, the GUI keeps its own
+    gThreadFonts fonts(true);
+
+    bool loaded = day->eventsLoaded();
+    day->incUseCounter();
+    day->OpenEvents();
+
+    for (auto & graph : m_worker->graphs) {
+        graph->setDay(day);
+    }
+
+    qint64 st = 0, et = 0;
+    MachineType types[] = { MT_CPAP, MT_OXIMETER };
+    for (const auto type : types) {
+        if (!day->machine(type)) continue;
+        st = st ? qMin(st, day->first(type)) : day->first(type);
+        et = qMax(et, day->last(type));
+    }
+
+    for (auto & graph : m_worker->graphs) {
+        if (graph->isEmpty()) continue;
+
+        graph->SetXBounds(st, et);
+        m_result->titles.append(graph->title());
+        m_result->images.append(paintGraph(graph, m_renderer->m_titlewidth, m_renderer->m_width, m_renderer->m_height));
+    }
+
+    for (auto & graph : m_worker->graphs) {
+        graph->setDay(nullptr);
+    }
+    day->decUseCounter();
+    if (!loaded && (day->useCounter() == 0)) {
+        day->CloseEvents();
+    }
+
+    if (!m_renderer->m_pngpath.isEmpty()) {
+        QString filename = QDir(m_renderer->m_pngpath).filePath(m_result->date.toString(Qt::ISODate) + ".png");
+        if (!m_result->images.isEmpty() && !m_result->stacked().save(filename, "PNG")) {
+            qWarning() << "Couldn't write" << filename;
+            m_renderer->m_failed.ref();
+        }
+        m_result->images.clear();
+    }
+}
+
+/*! \class gGraphJob
+    \brief Paints cloned graphs sharing a day one after another, each over the range it's given
+
+    Session and EventList fill their caches lazily without locking, so graphs of the same day never run side by side.
+    */
+class gGraphJob:public QRunnable
+{
+  public:
+    gGraphJob(const QVector<gGraph *> & graphs, const QVector<qint64> & start, const QVector<qint64> & end,
+              const QVector<int> & items, int titlewidth, int width, int height, QVector<QImage> * results)
+        :m_graphs(graphs), m_start(start), m_end(end), m_items(items), m_titlewidth(titlewidth), m_width(width),
+          m_height(height), m_results(results) {}
+    virtual ~gGraphJob() {}
+
+    virtual void run() {
+        gThreadFonts fonts(true);
+
+        for (const auto i : m_items) {
+            m_graphs.at(i)->SetXBounds(m_start.at(i), m_end.at(i));
+            (*m_results)[i] = paintGraph(m_graphs.at(i), m_titlewidth, m_width, m_height);
+        }
+    }
+  protected:
+    const QVector<gGraph *> & m_graphs;
+    const QVector<qint64> & m_start, & m_end;
+    QVector<int> m_items;
+    int m_titlewidth, m_width, m_height;
+    QVector<QImage> * m_results;
+};
+
+QImage gRenderedDay::stacked() const
+{
+    int width = 0, height = 0;
+    for (const auto & image : images) {
+        width = qMax(width, image.width());
+        height += image.height() + offscreen_spacing;
+    }
+    if (height == 0) {
+        return QImage();
+    }
+
+    QImage result(width, height - offscreen_spacing, QImage::Format_ARGB32_Premultiplied);
+    result.fill(Qt::white);
+
+    QPainter painter(&result);
+    int top = 0;
+    for (const auto & image : images) {
+        painter.drawImage(0, top, image);
+        top += image.height() + offscreen_spacing;
+    }
+    return result;
+}
+
+gOffscreenRenderer::gOffscreenRenderer(gGraphView * source, int threads, QObject * parent)
+    :QObject(parent), m_source(source), m_width(offscreen_width), m_height(offscreen_height),
+      m_titlewidth(source->titleWidth), m_failed(0), m_abort(false)
+{
+    if (threads <= 0) {
+        threads = AppSetting->multithreading() ? QThread::idealThreadCount() : 1;
+    }
+    if (!QFontDatabase::supportsThreadedFontRendering()) {
+        // Graphs are full of text, so there's no point going wide if it all has to happen on one thread
+        threads = 1;
+    }
+    m_pool.setMaxThreadCount(qMax(threads, 1));
+}
+
+gOffscreenRenderer::~gOffscreenRenderer()
+{
+    m_pool.waitForDone();
+    for (auto & worker : m_workers) {
+        qDeleteAll(worker.graphs);
+    }
+}
+
+gGraph * gOffscreenRenderer::cloneGraph(gGraph * graph)
+{
+    gGraph * copy = graph->Clone();
+    copy->m_marginbottom = 0;
+    return copy;
+}
+
+gOffscreenRenderer::Worker gOffscreenRenderer::createWorker()
+{
+    Worker worker;
+    for (int i = 0; i < m_source->size(); ++i) {
+        gGraph * graph = (*m_source)[i];
+        if (graph->isSnapshot() || !graph->visible()) continue;
+        if (!m_names.isEmpty() && !m_names.contains(graph->name())) continue;
+
+        worker.graphs.append(cloneGraph(graph));
+    }
+    return worker;
+}
+
+int gOffscreenRenderer::render(QDate first, QDate last, std::function<void(const gRenderedDay &)> sink)
+{
+    m_abort = false;
+    m_failed.store(0);
+
+    // Summaries get opened here on the GUI thread, only the events are left to the workers
+    QList<QPair<QDate, Day *> > days;
+    for (QDate date = first; date <= last; date = date.addDays(1)) {
+        if (!p_profile->GetGoodDay(date, MT_CPAP) && !p_profile->GetGoodDay(date, MT_OXIMETER)) continue;
+
+        Day * day = p_profile->GetDay(date);
+        if (day) {
+            days.append(qMakePair(date, day));
+        }
+    }
+
+    emit setProgressMax(days.size());
+    emit setProgressValue(0);
+
+    int batch = qMin(m_pool.maxThreadCount(), days.size());
+    while (m_workers.size() < batch) {
+        m_workers.append(createWorker());
+    }
+
+    int done = 0;
+    while ((done < days.size()) && !m_abort) {
+        int count = qMin(batch, days.size() - done);
+        QVector<gRenderedDay> results(count);
+
+        for (int i = 0; i < count; ++i) {
+            results[i].date = days.at(done + i).first;
+            gRenderJob * job = new gRenderJob(this, &m_workers[i], days.at(done + i).second, &results[i]);
+            job->setAutoDelete(true);
+            m_pool.start(job);
+        }
+        m_pool.waitForDone();
+
+        for (const auto & result : results) {
+            if (sink) {
+                sink(result);
+            }
+        }
+        done += count;
+
+        emit setProgressValue(done);
+        QApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+    }
+    return done;
+}
+
+bool gOffscreenRenderer::exportImages(const QString & path, QDate first, QDate last)
+{
+    if (!QDir().mkpath(path)) {
+        qWarning() << "Couldn't create" << path;
+        return false;
+    }
+    m_pngpath = path;
+    render(first, last, nullptr);
+    m_pngpath.clear();
+
+    return m_failed.load() == 0;
+}
+
+bool gOffscreenRenderer::exportPDF(const QString & filename, QDate first, QDate last)
+{
+    QPdfWriter writer(filename);
+    writer.setPageSize(QPagedPaintDevice::A4);
+    writer.setPageMargins(QMarginsF(10, 10, 10, 10), QPageLayout::Millimeter);
+    writer.setCreator(QString("SleepyHead v%1").arg(VersionString));
+    writer.setTitle(QObject::tr("Daily Graphs"));
+
+    QPainter painter;
+    if (!painter.begin(&writer)) {
+        qWarning() << "Couldn't open" << filename << "for writing";
+        return false;
+    }
+
+    // Same virtual page as the printed reports, so graphs come out the same size
+    QRect prect(QPoint(0, 0), writer.pageLayout().paintRectPixels(writer.resolution()).size());
+    float virt_width = m_width;
+    float virt_height = virt_width * float(prect.height()) / float(prect.width());
+    painter.setWindow(0, 0, virt_width, virt_height);
+    painter.setViewport(prect);
+
+    QFont title_font = *bigfont;
+    title_font.setPixelSize(60);
+    int normal_height = 30;
+
+    bool firstpage = true;
+    int pages = render(first, last, [&](const gRenderedDay & day) {
+        if (day.images.isEmpty()) return;
+
+        if (!firstpage) {
+            writer.newPage();
+        }
+        firstpage = false;
+
+        painter.setFont(title_font);
+        QString title = day.date.toString(Qt::SystemLocaleLongDate);
+        QRectF bounds = painter.boundingRect(QRectF(0, 0, virt_width, 0), title, QTextOption(Qt::AlignHCenter));
+        painter.drawText(bounds, title, QTextOption(Qt::AlignHCenter));
+        int top = bounds.height() + normal_height;
+
+        for (const auto & image : day.images) {
+            if ((top + image.height()) > virt_height) {
+                writer.newPage();
+                top = 0;
+            }
+            painter.drawImage(QRect(0, top, image.width(), image.height()), image);
+            top += image.height() + normal_height;
+        }
+    });
+
+    painter.end();
+    return pages > 0;
+}
+
+QVector<QImage> gOffscreenRenderer::renderGraphs(const QVector<gGraph *> & graphs, const QVector<qint64> & start,
+                                                 const QVector<qint64> & end, int width, int height)
+{
+    QVector<QImage> images(graphs.size());
+    QVector<gGraph *> copies;
+
+    // Several of these can share a day, so their layers are set up here rather than all at once on the workers
+    for (const auto & graph : graphs) {
+        gGraph * copy = cloneGraph(graph);
+        copy->setDay(copy->day());
+        copies.append(copy);
+    }
+
+    // Parallel across days only. Graphs without a day summarise every day, so then it all goes in one job
+    QMap<Day *, QVector<int> > bydays;
+    bool dayless = false;
+    for (const auto & copy : copies) {
+        dayless |= (copy->day() == nullptr);
+    }
+    for (int i = 0; i < copies.size(); ++i) {
+        bydays[dayless ? nullptr : copies.at(i)->day()].append(i);
+    }
+
+    for (const auto & items : bydays) {
+        gGraphJob * job = new gGraphJob(copies, start, end, items, m_titlewidth, width, height, &images);
+        job->setAutoDelete(true);
+        m_pool.start(job);
+    }
+    m_pool.waitForDone();
+
+    qDeleteAll(copies);
+    return images;
+}
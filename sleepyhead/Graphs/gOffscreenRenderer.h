@@ -0,0 +1,107 @@
+/* gOffscreenRenderer Header
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#ifndef GOFFSCREENRENDERER_H
+#define GOFFSCREENRENDERER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QDate>
+#include <QImage>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+#include <functional>
+
+class gGraph;
+class gGraphView;
+class Day;
+
+/*! \struct gRenderedDay
+    \brief One day's graphs, rendered as they would appear on a printed page
+    */
+struct gRenderedDay
+{
+    QDate date;
+    QStringList titles;
+    QVector<QImage> images;
+
+    //! \brief Returns the graphs stacked top to bottom in one image
+    QImage stacked() const;
+};
+
+/*! \class gOffscreenRenderer
+    \brief Renders copies of a gGraphView's graphs into QImages, several days at a time
+
+    Workers paint clones of the source view's graphs that don't belong to any gGraphView, through QPainter's
+    raster engine, so no widget or OpenGL context is involved and the live view keeps its own day and zoom.
+    Each job brings its own print fonts and gPrintContext, so nothing process wide is changed while they run.
+    The GUI thread only clones the graphs, collects the days and writes out the results between batches.
+    */
+class gOffscreenRenderer:public QObject
+{
+    Q_OBJECT
+    friend class gRenderJob;
+  public:
+    //! \brief Render copies of source's visible graphs, using up to threads workers (0 for one per core)
+    explicit gOffscreenRenderer(gGraphView * source, int threads = 0, QObject * parent = nullptr);
+    virtual ~gOffscreenRenderer();
+
+    //! \brief Set the size of each rendered graph, defaults to the same size as a printed report
+    void setGraphSize(int width, int height) { m_width = width; m_height = height; }
+
+    //! \brief Only render the named graphs, empty renders every visible graph
+    void setGraphs(const QStringList & names) { m_names = names; }
+
+    /*! \brief Render each day in [first, last] with CPAP or oximetry data, handing them to sink in date order
+        Returns the number of days rendered */
+    int render(QDate first, QDate last, std::function<void(const gRenderedDay &)> sink);
+
+    //! \brief Write one PNG per day named by date into path, returns false if any couldn't be written
+    bool exportImages(const QString & path, QDate first, QDate last);
+
+    //! \brief Write every day's graphs into a single PDF, a new page for each day
+    bool exportPDF(const QString & filename, QDate first, QDate last);
+
+    /*! \brief Render copies of graphs, each over its own range from start to end, into width x height images
+        The copies keep their graph's day, so these can come from any view, and graphs of one day are painted in turn.
+        Returns the images in the same order */
+    QVector<QImage> renderGraphs(const QVector<gGraph *> & graphs, const QVector<qint64> & start, const QVector<qint64> & end,
+                                 int width, int height);
+
+  public slots:
+    //! \brief Stop after the batch currently rendering
+    void abort() { m_abort = true; }
+
+  signals:
+    void setProgressMax(int max);
+    void setProgressValue(int value);
+
+  protected:
+    struct Worker {
+        QVector<gGraph *> graphs;
+    };
+
+    //! \brief Clone the source's graphs, outside of any gGraphView
+    Worker createWorker();
+
+    //! \brief Clone graph for painting on a worker, laid out the way it's printed
+    gGraph * cloneGraph(gGraph * graph);
+
+    gGraphView * m_source;
+    QList<Worker> m_workers;
+    QThreadPool m_pool;
+    QStringList m_names;
+    QString m_pngpath;      // when set, workers write each day out themselves instead of keeping it
+    int m_width, m_height;
+    int m_titlewidth;
+    QAtomicInt m_failed;
+    volatile bool m_abort;
+};
+
+#endif // GOFFSCREENRENDERER_H
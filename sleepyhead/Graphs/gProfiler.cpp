@@ -0,0 +1,335 @@
+/* gProfiler Implementation
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThread>
+#include <QThreadStorage>
+#include <QAtomicInt>
+#include <QDebug>
+#include <algorithm>
+
+#include "Graphs/gProfiler.h"
+#include "Graphs/gGraph.h"
+#include "Graphs/layer.h"
+#include "SleepLib/schema.h"
+
+// Roughly a minute of busy redrawing, older events get dropped once it fills
+const int profiler_max_events = 200000;
+
+struct gTraceEvent
+{
+    QString name;
+    const char * category;
+    qint64 ts;      // usecs since the profiler started
+    qint64 dur;     // usecs, -1 while still open
+    int tid;
+    QHash<QString, qint64> args;
+    char phase;     // 'X' for a complete event, 'C' for a counter
+};
+
+struct gProfilerThread
+{
+    gProfilerThread() { tid = -1; }
+    int tid;
+    QVector<qint64> stack;
+};
+
+bool gProfiler::s_enabled = false;
+
+static QMutex profilerMutex;
+static QElapsedTimer profilerClock;
+static QVector<gTraceEvent> profilerEvents;
+static qint64 profilerBase = 0;     // index of the first event still held
+static gFrameStats profilerFrame;
+static gFrameStats profilerLastFrame;
+static int profilerFrameCount = 0;
+static QAtomicInt profilerThreads(1);
+static QThreadStorage<gProfilerThread> profilerThread;
+
+static gProfilerThread & currentThread()
+{
+    gProfilerThread & thread = profilerThread.localData();
+    if (thread.tid < 0) {
+        QCoreApplication * app = QCoreApplication::instance();
+        thread.tid = (app && (QThread::currentThread() == app->thread())) ? 0 : profilerThreads.fetchAndAddRelaxed(1);
+    }
+    return thread;
+}
+
+static inline qint64 profilerNow()
+{
+    return profilerClock.nsecsElapsed() / 1000L;
+}
+
+QVector<QPair<QString, double> > gFrameStats::slowestLayers(int n) const
+{
+    QVector<QPair<QString, double> > list;
+    for (auto it = layers.begin(), end = layers.end(); it != end; ++it) {
+        list.append(qMakePair(it.key(), it.value()));
+    }
+    std::sort(list.begin(), list.end(), [](const QPair<QString, double> & a, const QPair<QString, double> & b) {
+        return a.second > b.second;
+    });
+    if (list.size() > n) {
+        list.resize(n);
+    }
+    return list;
+}
+
+double gFrameStats::hitRate(const QString & hits, const QString & misses) const
+{
+    qint64 h = counters.value(hits);
+    qint64 m = counters.value(misses);
+    if ((h + m) == 0) {
+        return -1;
+    }
+    return double(h) * 100.0 / double(h + m);
+}
+
+gProfiler::Scope::Scope(const char * category, const char * name)
+    :m_index(-1)
+{
+    if (s_enabled) {
+        m_index = open(category, QString(name));
+    }
+}
+
+gProfiler::Scope::Scope(const char * category, const QString & name)
+    :m_index(-1)
+{
+    if (s_enabled) {
+        m_index = open(category, name);
+    }
+}
+
+gProfiler::Scope::Scope(const char * category, gGraph * graph, Layer * layer)
+    :m_index(-1)
+{
+    if (s_enabled) {
+        m_index = open(category, layerName(graph, layer));
+    }
+}
+
+gProfiler::Scope::~Scope()
+{
+    if (m_index >= 0) {
+        close(m_index);
+    }
+}
+
+void gProfiler::setEnabled(bool b)
+{
+    if (b && !profilerClock.isValid()) {
+        profilerClock.start();
+    }
+    s_enabled = b;
+}
+
+qint64 gProfiler::open(const char * category, const QString & name)
+{
+    gProfilerThread & thread = currentThread();
+
+    gTraceEvent event;
+    event.name = name;
+    event.category = category;
+    event.dur = -1;
+    event.tid = thread.tid;
+    event.phase = 'X';
+
+    QMutexLocker lock(&profilerMutex);
+    event.ts = profilerNow();
+    profilerEvents.append(event);
+
+    qint64 index = profilerBase + profilerEvents.size() - 1;
+    thread.stack.append(index);
+    return index;
+}
+
+void gProfiler::close(qint64 index)
+{
+    gProfilerThread & thread = currentThread();
+    if (!thread.stack.isEmpty()) {
+        thread.stack.removeLast();
+    }
+
+    QMutexLocker lock(&profilerMutex);
+    qint64 now = profilerNow();
+
+    // Dropped from the window while it was open
+    if (index < profilerBase) {
+        return;
+    }
+
+    gTraceEvent & event = profilerEvents[index - profilerBase];
+    event.dur = now - event.ts;
+    double ms = double(event.dur) / 1000.0;
+
+    if (qstrcmp(event.category, "layer") == 0) {
+        profilerFrame.layers[event.name] += ms;
+    } else if (qstrcmp(event.category, "stall") == 0) {
+        profilerFrame.stall_ms += ms;
+    } else if (qstrcmp(event.category, "frame") == 0) {
+        profilerFrame.name = event.name;
+        profilerFrame.ms = ms;
+        profilerFrame.frame = ++profilerFrameCount;
+
+        // Per frame counters, so they show up as graphs in the trace viewer
+        if (!profilerFrame.counters.isEmpty()) {
+            gTraceEvent counters;
+            counters.name = "counters";
+            counters.category = "frame";
+            counters.ts = event.ts;
+            counters.dur = 0;
+            counters.tid = event.tid;
+            counters.args = profilerFrame.counters;
+            counters.phase = 'C';
+            profilerEvents.append(counters);
+        }
+
+        profilerLastFrame = profilerFrame;
+        profilerFrame = gFrameStats();
+
+        if (profilerEvents.size() > profiler_max_events) {
+            int drop = profilerEvents.size() / 2;
+            profilerEvents.remove(0, drop);
+            profilerBase += drop;
+        }
+    }
+}
+
+void gProfiler::count(const char * name, qint64 n)
+{
+    if (!s_enabled) {
+        return;
+    }
+    gProfilerThread & thread = currentThread();
+    QString key(name);
+
+    QMutexLocker lock(&profilerMutex);
+    profilerFrame.counters[key] += n;
+
+    if (!thread.stack.isEmpty()) {
+        qint64 index = thread.stack.last();
+        if (index >= profilerBase) {
+            profilerEvents[index - profilerBase].args[key] += n;
+        }
+    }
+}
+
+gFrameStats gProfiler::lastFrame()
+{
+    QMutexLocker lock(&profilerMutex);
+    return profilerLastFrame;
+}
+
+void gProfiler::clear()
+{
+    QMutexLocker lock(&profilerMutex);
+    profilerBase += profilerEvents.size();
+    profilerEvents.clear();
+    profilerFrame = gFrameStats();
+    profilerLastFrame = gFrameStats();
+}
+
+QString gProfiler::layerName(gGraph * graph, Layer * layer)
+{
+    QString name = graph ? graph->title() : QString();
+    if (!layer) {
+        return name;
+    }
+
+    QString type;
+    switch (layer->layerType()) {
+    case LT_LineChart:
+        type = "LineChart";
+        break;
+    case LT_SummaryChart:
+        type = "SummaryChart";
+        break;
+    case LT_EventFlags:
+        type = "EventFlags";
+        break;
+    case LT_Spacer:
+        type = "Spacer";
+        break;
+    case LT_Overview:
+        type = "Overview";
+        break;
+    default:
+        type = "Layer";
+    }
+    if (layer->code() != 0) {
+        type += QString("(%1)").arg(schema::channel[layer->code()].code());
+    }
+    return name.isEmpty() ? type : name + " / " + type;
+}
+
+bool gProfiler::exportTrace(const QString & filename)
+{
+    QVector<gTraceEvent> events;
+    {
+        QMutexLocker lock(&profilerMutex);
+        events = profilerEvents;
+    }
+
+    QJsonArray array;
+
+    QJsonObject meta;
+    meta["name"] = "thread_name";
+    meta["ph"] = "M";
+    meta["pid"] = 1;
+    meta["tid"] = 0;
+    QJsonObject metaargs;
+    metaargs["name"] = "GUI";
+    meta["args"] = metaargs;
+    array.append(meta);
+
+    for (const auto & event : events) {
+        // Still open when the trace was taken
+        if (event.dur < 0) {
+            continue;
+        }
+        QJsonObject obj;
+        obj["name"] = event.name;
+        obj["cat"] = QString(event.category);
+        obj["ph"] = QString(QChar(event.phase));
+        obj["ts"] = double(event.ts);
+        if (event.phase == 'X') {
+            obj["dur"] = double(event.dur);
+        }
+        obj["pid"] = 1;
+        obj["tid"] = event.tid;
+
+        if (!event.args.isEmpty()) {
+            QJsonObject args;
+            for (auto it = event.args.begin(), end = event.args.end(); it != end; ++it) {
+                args[it.key()] = double(it.value());
+            }
+            obj["args"] = args;
+        }
+        array.append(obj);
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = array;
+    root["displayTimeUnit"] = "ms";
+
+    QFile file(filename);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "Couldn't open" << filename << "for writing";
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return true;
+}
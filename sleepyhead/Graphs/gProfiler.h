@@ -0,0 +1,91 @@
+/* gProfiler Header
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#ifndef GPROFILER_H
+#define GPROFILER_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include <QPair>
+
+class gGraph;
+class Layer;
+
+/*! \struct gFrameStats
+    \brief What went into one gGraphView frame, for the performance overlay
+    */
+struct gFrameStats
+{
+    gFrameStats() { frame = 0; ms = 0; stall_ms = 0; }
+
+    QString name;                           // name of the frame scope, so each view can pick out its own
+    int frame;
+    double ms;
+    double stall_ms;                        // event data loaded from disk since the previous frame
+    QHash<QString, double> layers;          // Layer::paint time in ms, by graph and layer name
+    QHash<QString, qint64> counters;        // samples visited, cache hits and misses, etc..
+
+    //! \brief Returns the n most expensive layers, slowest first
+    QVector<QPair<QString, double> > slowestLayers(int n) const;
+
+    //! \brief Returns hits / (hits + misses) as a percentage, or -1 if neither was counted
+    double hitRate(const QString & hits, const QString & misses) const;
+};
+
+/*! \class gProfiler
+    \brief Records frame, graph and layer paint timings while the performance overlay is enabled
+
+    Timings are kept as a rolling window of trace events, which can be saved in Chrome's
+    trace event format and opened in chrome://tracing or Perfetto.
+    When disabled, a Scope costs a single flag check.
+    */
+class gProfiler
+{
+  public:
+    //! \brief Times everything between construction and destruction
+    class Scope
+    {
+      public:
+        Scope(const char * category, const char * name);
+        Scope(const char * category, const QString & name);
+
+        //! \brief Named after the graph, and the layer if given, only building the string when enabled
+        Scope(const char * category, gGraph * graph, Layer * layer = nullptr);
+        ~Scope();
+
+      private:
+        qint64 m_index;
+    };
+
+    static bool enabled() { return s_enabled; }
+    static void setEnabled(bool b);
+
+    //! \brief Adds n to counter name for this frame, and to the innermost open scope on this thread
+    static void count(const char * name, qint64 n = 1);
+
+    //! \brief Returns the stats for the last completed frame
+    static gFrameStats lastFrame();
+
+    //! \brief Save the recorded trace events as Chrome trace JSON
+    static bool exportTrace(const QString & filename);
+
+    //! \brief Drop everything recorded so far
+    static void clear();
+
+    //! \brief Returns a readable name for layer, for labelling timings
+    static QString layerName(gGraph * graph, Layer * layer);
+
+  protected:
+    static qint64 open(const char * category, const QString & name);
+    static void close(qint64 index);
+
+    static bool s_enabled;
+};
+
+#endif // GPROFILER_H
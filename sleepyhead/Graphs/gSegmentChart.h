@@ -43,6 +43,22 @@ class gSegmentChart : public Layer
     const GraphSegmentType &graphType() { return m_graph_type; }
     void setGraphType(GraphSegmentType type) { m_graph_type = type; }
 
+    virtual Layer * Clone() {
+        gSegmentChart * layer = new gSegmentChart(m_graph_type, m_gradient_color, m_outline_color);
+        Layer::CloneInto(layer);
+        CloneInto(layer);
+        return layer;
+    }
+
+    void CloneInto(gSegmentChart * layer) {
+        layer->m_codes = m_codes;
+        layer->m_names = m_names;
+        layer->m_values = m_values;
+        layer->m_colors = m_colors;
+        layer->m_total = m_total;
+        layer->m_empty = m_empty;
+    }
+
   protected:
     QVector<ChannelID> m_codes;
     QVector<QString> m_names;
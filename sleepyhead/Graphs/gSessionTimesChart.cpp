@@ -9,10 +9,17 @@
 #include <math.h>
 #include <QLabel>
 #include <QDateTime>
+#include <QThread>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QDir>
+#include <QFileInfo>
 
 #include "mainwindow.h"
 #include "SleepLib/profiles.h"
 #include "gSessionTimesChart.h"
+#include "translation.h"
 
 #include "gYAxis.h"
 
@@ -20,6 +27,60 @@ extern MainWindow * mainwin;
 
 short SummaryCalcItem::midcalc;
 
+QMutex gSummaryChart::cachelock;
+QWaitCondition gSummaryChart::populatorDone;
+
+const quint16 summarychart_version = 2;
+
+void PopulateSummaryTask::run()
+{
+    QElapsedTimer time;
+    time.start();
+
+    int size = order.size();
+    for (int i=0; i < size; ++i) {
+        if (m_quit) break;
+
+        int idx = order.at(i);
+        Day * day = chart->daylist.at(idx);
+        quint32 fingerprint = day->fingerprint();
+
+        chart->cachelock.lock();
+        bool done = m_quit || chart->populated.contains(idx) || chart->restoreDay(idx, fingerprint);
+        chart->cachelock.unlock();
+
+        if (!done) {
+            // Loading summaries from disk is the slow bit, so it's done outside the lock
+            day->OpenSummary();
+
+            chart->cachelock.lock();
+            if (!m_quit && !chart->populated.contains(idx)) {
+                // Some charts read the sessions directly, which the GUI may be doing with this day too
+                QMutexLocker daylock(day->cacheMutex());
+                chart->populate(day, idx);
+                chart->populated.insert(idx);
+                chart->storeDay(idx, fingerprint);
+            }
+            chart->cachelock.unlock();
+        }
+
+        // Redraw as visible days come in, but not for every single one of them
+        if ((i < visible) && ((i == visible-1) || (time.elapsed() > 100))) {
+            // We are in another thread, so have to use a throwaway timer
+            QTimer::singleShot(0, view, SLOT(refreshTimeout()));
+            time.restart();
+        }
+    }
+
+    chart->cachelock.lock();
+    if (!m_quit) {
+        chart->saveStore();
+    }
+    chart->m_populator = nullptr;
+    chart->populatorDone.wakeAll();
+    chart->cachelock.unlock();
+}
+
 gSummaryChart::gSummaryChart(QString label, MachineType machtype)
     :Layer(NoChannel), m_label(label), m_machtype(machtype)
 {
@@ -33,6 +94,12 @@ gSummaryChart::gSummaryChart(QString label, MachineType machtype)
 
     idx_end = 0;
     idx_start = 0;
+
+    m_populator = nullptr;
+    pop_start = pop_end = -1;
+
+    m_storeLoaded = false;
+    m_storeChanged = false;
 }
 
 gSummaryChart::gSummaryChart(ChannelID code, MachineType machtype)
@@ -53,15 +120,27 @@ gSummaryChart::gSummaryChart(ChannelID code, MachineType machtype)
 
     idx_end = 0;
     idx_start = 0;
+
+    m_populator = nullptr;
+    pop_start = pop_end = -1;
+
+    m_storeLoaded = false;
+    m_storeChanged = false;
 }
 
 gSummaryChart::~gSummaryChart()
 {
+    cancelPopulate();
+    saveStore();
 }
 
 void gSummaryChart::SetDay(Day *unused_day)
 {
+    cancelPopulate();
     cache.clear();
+    eventcache.clear();
+    populated.clear();
+    loadStore();
 
     Q_UNUSED(unused_day)
     Layer::SetDay(nullptr);
@@ -388,6 +467,278 @@ void gSummaryChart::populate(Day * day, int idx)
     }
 }
 
+void gSummaryChart::cancelPopulate()
+{
+    QMutexLocker lock(&cachelock);
+    while (m_populator) {
+        m_populator->quit();
+        populatorDone.wait(&cachelock);
+    }
+}
+
+bool gSummaryChart::populateRange(gGraph & graph, int start, int end)
+{
+    int size = daylist.size();
+    end = qMin(end, size-1);
+
+    QList<int> order;
+    {
+        QMutexLocker lock(&cachelock);
+        for (int i=start; i <= end; ++i) {
+            if (daylist.at(i) && !populated.contains(i)) {
+                order.append(i);
+            }
+        }
+        if (order.isEmpty()) return true;
+
+        // Already on it
+        if (m_populator && (pop_start == start) && (pop_end == end)) return false;
+    }
+
+    // Days the on-disk cache still has right are cheap enough to fill in straight away
+    QList<quint32> fingerprints;
+    for (int idx : order) {
+        fingerprints.append(daylist.at(idx)->fingerprint());
+    }
+    {
+        QMutexLocker lock(&cachelock);
+        for (int i=order.size()-1; i >= 0; --i) {
+            int idx = order.at(i);
+            if (populated.contains(idx) || restoreDay(idx, fingerprints.at(i))) {
+                order.removeAt(i);
+                fingerprints.removeAt(i);
+            }
+        }
+    }
+    if (order.isEmpty()) return true;
+
+    if (graph.printing()) {
+        // Nothing gets a second chance to draw when printing, so fill them in right here
+        for (int i=0; i < order.size(); ++i) {
+            int idx = order.at(i);
+            Day * day = daylist.at(idx);
+            day->OpenSummary();
+
+            QMutexLocker lock(&cachelock);
+            if (!populated.contains(idx)) {
+                QMutexLocker daylock(day->cacheMutex());
+                populate(day, idx);
+                populated.insert(idx);
+                storeDay(idx, fingerprints.at(i));
+            }
+        }
+        return true;
+    }
+
+    // Range changed, so start over from the days now on screen
+    cancelPopulate();
+    int visible = order.size();
+
+    // Then work outwards, so scrolling either way finds its days ready
+    for (int lo=start-1, hi=end+1; (lo >= 0) || (hi < size); --lo, ++hi) {
+        if ((hi < size) && daylist.at(hi) && !populated.contains(hi)) {
+            order.append(hi);
+        }
+        if ((lo >= 0) && daylist.at(lo) && !populated.contains(lo)) {
+            order.append(lo);
+        }
+    }
+
+    pop_start = start;
+    pop_end = end;
+    m_populator = new PopulateSummaryTask(this, graph.graphView(), order, visible);
+    m_populator->setAutoDelete(true);
+    QThreadPool::globalInstance()->start(m_populator);
+
+    return false;
+}
+
+void gSummaryChart::loadStore()
+{
+    // Everything besides the sessions themselves that changes what populate() comes up with
+    QString signature = QString("%1 %2 %3 %4 %5 %6 %7").
+            arg(p_profile->general->prefCalcMiddle()).
+            arg(p_profile->general->prefCalcPercentile()).
+            arg(p_profile->general->prefCalcMax()).
+            arg(p_profile->general->calculateRDI()).
+            arg(p_profile->cpap->complianceHours()).
+            arg(p_profile->session->daySplitTime().toString()).
+            arg(currentLanguage());
+
+    // Slices keep the colour and label they were built with
+    for (const auto & item : calcitems) {
+        signature += QString(" %1:%2:%3").arg(item.color.rgba(), 0, 16).
+                arg(schema::channel[item.code].label()).
+                arg(schema::channel[item.code].fullname());
+    }
+
+    QString name = m_label.isEmpty() ? schema::channel[m_code].code() : m_label;
+    QString filename = p_profile->Get("{" + STR_GEN_DataFolder + "}/SummaryCharts/") + QString("%1_%2.cache").arg(name).arg(m_machtype);
+
+    if (m_storeLoaded && (filename == m_storeFile)) {
+        if (signature != m_storeSignature) {
+            m_store.clear();
+            m_storeSignature = signature;
+            m_storeChanged = true;
+        }
+        return;
+    }
+
+    // Profile changed underneath us
+    saveStore();
+
+    m_store.clear();
+    m_storeFile = filename;
+    m_storeSignature = signature;
+    m_storeLoaded = true;
+    m_storeChanged = false;
+
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly)) {
+        return;
+    }
+
+    QDataStream in(&file);
+    in.setByteOrder(QDataStream::LittleEndian);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 mag32;
+    quint16 ft16, version;
+    QString sig;
+
+    in >> mag32;
+    in >> ft16;
+    in >> version;
+    in >> sig;
+
+    if ((mag32 != magic) || (ft16 != filetype_summarychart) || (version != summarychart_version) || (sig != signature)) {
+        qDebug() << "Summary chart cache" << filename << "is outdated, ignoring it";
+        m_storeChanged = true;
+        return;
+    }
+
+    qint32 size;
+    in >> size;
+
+    int calcs = calcitems.size();
+    SummaryCalcItem * items = calcitems.data();
+    bool bad = false;
+
+    for (int i=0; (i < size) && !bad; ++i) {
+        QDate date;
+        quint32 fingerprint;
+        qint32 cnt;
+
+        in >> date;
+        in >> fingerprint;
+        in >> cnt;
+
+        StoredSummaryDay & stored = m_store[date];
+        stored.fingerprint = fingerprint;
+        in >> stored.events;
+
+        for (int j=0; j < cnt; ++j) {
+            qint16 calc;
+            EventDataType value, height;
+            QString name;
+            quint32 color;
+
+            in >> calc >> value >> height >> name >> color;
+            if ((calc < 0) || (calc >= calcs) || (in.status() != QDataStream::Ok)) {
+                bad = true;
+                break;
+            }
+            stored.slices.append(SummaryChartSlice(&items[calc], value, height, name, QColor::fromRgba(color)));
+        }
+    }
+
+    if (bad || (in.status() != QDataStream::Ok)) {
+        qWarning() << "Summary chart cache" << filename << "is corrupt, ignoring it";
+        m_store.clear();
+        m_storeChanged = true;
+    }
+}
+
+void gSummaryChart::saveStore()
+{
+    if (!m_storeChanged || m_storeFile.isEmpty()) return;
+
+    QDir().mkpath(QFileInfo(m_storeFile).path());
+
+    QFile file(m_storeFile);
+    if (!file.open(QFile::WriteOnly)) {
+        qDebug() << "Couldn't open" << m_storeFile << "for writing";
+        return;
+    }
+
+    QDataStream out(&file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.setVersion(QDataStream::Qt_5_0);
+
+    out << magic;
+    out << filetype_summarychart;
+    out << summarychart_version;
+    out << m_storeSignature;
+
+    const SummaryCalcItem * items = calcitems.constData();
+    int calcs = calcitems.size();
+
+    out << (qint32)m_store.size();
+    for (auto it=m_store.begin(), end=m_store.end(); it != end; ++it) {
+        const StoredSummaryDay & stored = it.value();
+
+        // A stray slice just means this day gets populated again next time
+        bool good = true;
+        for (const auto & slice : stored.slices) {
+            int calc = slice.calc - items;
+            if ((calc < 0) || (calc >= calcs)) good = false;
+        }
+
+        out << it.key();
+        out << (good ? stored.fingerprint : quint32(0));
+        out << (qint32)(good ? stored.slices.size() : 0);
+        out << stored.events;
+        if (!good) continue;
+
+        for (const auto & slice : stored.slices) {
+            out << (qint16)(slice.calc - items);
+            out << slice.value;
+            out << slice.height;
+            out << slice.name;
+            out << (quint32)slice.color.rgba();
+        }
+    }
+
+    m_storeChanged = false;
+}
+
+bool gSummaryChart::restoreDay(int idx, quint32 fingerprint)
+{
+    auto it = m_store.find(firstday.addDays(idx));
+    if ((it == m_store.end()) || (it.value().fingerprint != fingerprint)) {
+        return false;
+    }
+
+    const QVector<SummaryChartSlice> & slices = it.value().slices;
+    if (!slices.isEmpty()) {
+        cache[idx] = slices;
+    }
+    eventcache[idx] = it.value().events;
+    populated.insert(idx);
+    return true;
+}
+
+void gSummaryChart::storeDay(int idx, quint32 fingerprint)
+{
+    StoredSummaryDay & stored = m_store[firstday.addDays(idx)];
+    stored.fingerprint = fingerprint;
+    stored.slices = cache.value(idx);
+
+    // Only ever called straight after populate(), so the summaries are open
+    stored.events = eventcache[idx] = daylist.at(idx)->eventCount();
+    m_storeChanged = true;
+}
+
 void gSummaryChart::paint(QPainter &painter, gGraph &graph, const QRegion &region)
 {
     QRectF rect = region.boundingRect();
@@ -428,7 +779,7 @@ void gSummaryChart::paint(QPainter &painter, gGraph &graph, const QRegion &regio
         idx_end = ite.value();
     }
 
-    QPoint mouse = graph.graphView()->currentMousePos();
+    QPoint mouse = graph.currentMousePos();
 
     nousedays = 0;
     totaldays = 0;
@@ -442,6 +793,10 @@ void gSummaryChart::paint(QPainter &painter, gGraph &graph, const QRegion &regio
     if ((daylist.size() == 0) || (it == dayindex.end()))
         return;
 
+    // Anything not populated yet is done in the background, and drawn as a placeholder until then
+    bool complete = populateRange(graph, idx_start, idx_end);
+    QMutexLocker lock(&cachelock);
+
     //Day * lastday = nullptr;
 
     //    int dc = 0;
@@ -483,15 +838,8 @@ void gSummaryChart::paint(QPainter &painter, gGraph &graph, const QRegion &regio
             continue;
         }
 
-        day->OpenSummary();
-
         auto cit = cache.find(i);
 
-        if (cit == cache.end()) {
-            populate(day, i);
-            cit = cache.find(i);
-        }
-
         if (cit != cache.end()) {
             float base = 0, val;
             for (const auto & slice : cit.value()) {
@@ -540,7 +888,6 @@ void gSummaryChart::paint(QPainter &painter, gGraph &graph, const QRegion &regio
 
         float x1 = lastx1 + barw;
 
-        day->OpenSummary();
         QRectF hl2_rect;
 
         bool hlday = false;
@@ -557,9 +904,8 @@ void gSummaryChart::paint(QPainter &painter, gGraph &graph, const QRegion &regio
 
         auto cit = cache.find(idx);
 
-        if (cit == cache.end()) {
-            populate(day, idx);
-            cit = cache.find(idx);
+        if ((cit == cache.end()) && !populated.contains(idx)) {
+            painter.fillRect(rec2, QBrush(QColor(224,224,224)));
         }
 
         float lastval = 0, val, y1,y2;
@@ -628,18 +974,26 @@ void gSummaryChart::paint(QPainter &painter, gGraph &graph, const QRegion &regio
 
         graph.ToolTip(txt, mouse.x()-15, mouse.y()+5, TT_AlignRight);
     }
+
+    // Totals would only be partial until every visible day is in
+    if (!complete) return;
+
     try {
         afterDraw(painter, graph, rect);
     } catch(...) {
         qDebug() << "Bad median call in" << m_label;
     }
 
+    bool empty = (cache.size() == 0);
+    lock.unlock();
 
     // This could be turning off graphs prematurely..
-    if (cache.size() == 0) {
+    if (empty) {
 
         m_empty = true;
-        graph.graphView()->updateScale();
+        if (graph.graphView()) {
+            graph.graphView()->updateScale();
+        }
     }
 
 }
@@ -800,6 +1154,53 @@ void gSessionTimesChart::afterDraw(QPainter & /*painter */, gGraph &graph, QRect
     graph.renderText(txt, rect.left(), rect.top()-5*graph.printScaleY(), 0);
 }
 
+void gSessionTimesChart::populate(Day * day, int idx)
+{
+    QDate date = firstday.addDays(idx);
+    QDateTime splittime = QDateTime(date, split);
+
+    QVector<SummaryChartSlice> & slices = cache[idx];
+
+    bool haveoxi = day->hasMachine(MT_OXIMETER);
+
+    QColor goodcolor = haveoxi ? QColor(128,255,196) : QColor(64,128,255);
+
+    QString datestr = date.toString(Qt::SystemLocaleShortDate);
+
+    for (const auto & sess : day->sessions) {
+        if (!sess->enabled() || (sess->type() != m_machtype)) continue;
+
+        // Look at mask on/off slices...
+        if (sess->m_slices.size() > 0) {
+            // segments
+            for (const auto & slice : sess->m_slices) {
+                QDateTime st = QDateTime::fromMSecsSinceEpoch(slice.start, Qt::LocalTime);
+
+                float s1 = float(splittime.secsTo(st)) / 3600.0;
+
+                float s2 = double(slice.end - slice.start) / 3600000.0;
+
+                QColor col = (slice.status == EquipmentOn) ? goodcolor : Qt::black;
+                QString txt = QObject::tr("%1\nLength: %3\nStart: %2\n").arg(datestr).arg(st.time().toString("hh:mm:ss")).arg(s2,0,'f',2);
+
+                txt += (slice.status == EquipmentOn) ? QObject::tr("Mask On") : QObject::tr("Mask Off");
+                slices.append(SummaryChartSlice(&calcitems[0], s1, s2, txt, col));
+            }
+        } else {
+            // otherwise just show session duration
+            qint64 sf = sess->first();
+            QDateTime st = QDateTime::fromMSecsSinceEpoch(sf, Qt::LocalTime);
+            float s1 = float(splittime.secsTo(st)) / 3600.0;
+
+            float s2 = sess->hours();
+
+            QString txt = QObject::tr("%1\nLength: %3\nStart: %2").arg(datestr).arg(st.time().toString("hh:mm:ss")).arg(s2,0,'f',2);
+
+            slices.append(SummaryChartSlice(&calcitems[0], s1, s2, txt, goodcolor));
+        }
+    }
+}
+
 void gSessionTimesChart::paint(QPainter &painter, gGraph &graph, const QRegion &region)
 {
     QRectF rect = region.boundingRect();
@@ -820,8 +1221,6 @@ void gSessionTimesChart::paint(QPainter &painter, gGraph &graph, const QRegion &
 
     float barw = float(rect.width()) / float(days);
 
-    QDateTime splittime;
-
 //    float lasty1 = rect.bottom();
     float lastx1 = rect.left();
 
@@ -840,10 +1239,13 @@ void gSessionTimesChart::paint(QPainter &painter, gGraph &graph, const QRegion &
         idx_end = ite.value();
     }
 
-    QPoint mouse = graph.graphView()->currentMousePos();
+    QPoint mouse = graph.currentMousePos();
 
     if (daylist.size() == 0) return;
 
+    bool complete = populateRange(graph, idx, idx_end);
+    QMutexLocker lock(&cachelock);
+
     QVector<QRectF> outlines;
     int size = idx_end - idx;
     outlines.reserve(size * 5);
@@ -870,55 +1272,6 @@ void gSessionTimesChart::paint(QPainter &painter, gGraph &graph, const QRegion &
 
         auto cit = cache.find(i);
 
-        if (cit == cache.end()) {
-            day->OpenSummary();
-            date = it2.key();
-            splittime = QDateTime(date, split);
-
-            QVector<SummaryChartSlice> & slices = cache[i];
-
-            bool haveoxi = day->hasMachine(MT_OXIMETER);
-
-            QColor goodcolor = haveoxi ? QColor(128,255,196) : QColor(64,128,255);
-
-            QString datestr = date.toString(Qt::SystemLocaleShortDate);
-
-            for (const auto & sess : day->sessions) {
-                if (!sess->enabled() || (sess->type() != m_machtype)) continue;
-
-                // Look at mask on/off slices...
-                if (sess->m_slices.size() > 0) {
-                    // segments
-                    for (const auto & slice : sess->m_slices) {
-                        QDateTime st = QDateTime::fromMSecsSinceEpoch(slice.start, Qt::LocalTime);
-
-                        float s1 = float(splittime.secsTo(st)) / 3600.0;
-
-                        float s2 = double(slice.end - slice.start) / 3600000.0;
-
-                        QColor col = (slice.status == EquipmentOn) ? goodcolor : Qt::black;
-                        QString txt = QObject::tr("%1\nLength: %3\nStart: %2\n").arg(datestr).arg(st.time().toString("hh:mm:ss")).arg(s2,0,'f',2);
-
-                        txt += (slice.status == EquipmentOn) ? QObject::tr("Mask On") : QObject::tr("Mask Off");
-                        slices.append(SummaryChartSlice(&calcitems[0], s1, s2, txt, col));
-                    }
-                } else {
-                    // otherwise just show session duration
-                    qint64 sf = sess->first();
-                    QDateTime st = QDateTime::fromMSecsSinceEpoch(sf, Qt::LocalTime);
-                    float s1 = float(splittime.secsTo(st)) / 3600.0;
-
-                    float s2 = sess->hours();
-
-                    QString txt = QObject::tr("%1\nLength: %3\nStart: %2").arg(datestr).arg(st.time().toString("hh:mm:ss")).arg(s2,0,'f',2);
-
-                    slices.append(SummaryChartSlice(&calcitems[0], s1, s2, txt, goodcolor));
-                }
-            }
-
-            cit = cache.find(i);
-        }
-
         if (cit != cache.end()) {
             float peak = 0, base = 999;
 
@@ -985,6 +1338,8 @@ void gSessionTimesChart::paint(QPainter &painter, gGraph &graph, const QRegion &
             QColor col2(255,0,0,64);
             painter.fillRect(rec2, QBrush(col2));
             //hl = true;
+        } else if ((cit == cache.end()) && !populated.contains(idx)) {
+            painter.fillRect(rec2, QBrush(QColor(224,224,224)));
         }
 
         if (cit != cache.end()) {
@@ -1034,7 +1389,10 @@ void gSessionTimesChart::paint(QPainter &painter, gGraph &graph, const QRegion &
 
     painter.setPen(QPen(Qt::black,1));
     painter.drawRects(outlines);
-    afterDraw(painter, graph, rect);
+
+    if (complete) {
+        afterDraw(painter, graph, rect);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////
@@ -1127,7 +1485,7 @@ void gAHIChart::customCalc(Day *day, QVector<SummaryChartSlice> &list)
     int size = list.size();
     if (size == 0) return;
     EventDataType hours = day->hours(m_machtype);
-    EventDataType ahi_cnt = 0;
+    EventDataType ahi_cnt = eventcache.value(dayindex.value(day->date(), -1));
 
     for (auto & slice : list) {
         SummaryCalcItem * calc = slice.calc;
@@ -1150,8 +1508,6 @@ void gAHIChart::customCalc(Day *day, QVector<SummaryChartSlice> &list)
 
         calc->min = qMin(valh, calc->min);
         calc->max = qMax(valh, calc->max);
-
-        ahi_cnt += value;
     }
     min_ahi = qMin(ahi_cnt / hours, min_ahi);
     max_ahi = qMax(ahi_cnt / hours, max_ahi);
@@ -1246,11 +1602,10 @@ void gAHIChart::populate(Day *day, int idx)
 QString gAHIChart::tooltipData(Day *day, int idx)
 {
     QVector<SummaryChartSlice> & slices = cache[idx];
-    float total = 0;
+    float total = eventcache.value(idx);
     float hour = day->hours(m_machtype);
     QString txt;
     for (const auto & slice : slices) {
-        total += slice.value;
         txt += QString("\n%1: %2").arg(slice.name).arg(float(slice.value) / hour, 0, 'f', 2);
     }
     return QString("\n%1: %2").arg(STR_TR_AHI).arg(float(total) / hour,0,'f',2)+txt;
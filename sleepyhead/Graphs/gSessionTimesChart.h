@@ -9,6 +9,11 @@
 #ifndef GSESSIONTIMESCHART_H
 #define GSESSIONTIMESCHART_H
 
+#include <QRunnable>
+#include <QMutex>
+#include <QSet>
+#include <QWaitCondition>
+
 #include "SleepLib/day.h"
 #include "SleepLib/profiles.h"
 #include "gGraphView.h"
@@ -154,8 +159,42 @@ struct SummaryChartSlice {
 //    QBrush brush;
 };
 
+/*! \struct StoredSummaryDay
+    \brief A days slices as kept in a summary chart's on-disk cache, with the Day fingerprint they were made from
+    */
+struct StoredSummaryDay {
+    StoredSummaryDay() : fingerprint(0), events(0) {}
+    quint32 fingerprint;
+    QVector<SummaryChartSlice> slices;
+    EventDataType events;   // Day::eventCount(), so the AHI doesn't need the summaries opened
+};
+
+class gSummaryChart;
+
+/*! \class PopulateSummaryTask
+    \brief Fills a gSummaryChart's day cache in the background, visible days first
+    */
+class PopulateSummaryTask:public QRunnable
+{
+public:
+    PopulateSummaryTask(gSummaryChart * chart, gGraphView * view, const QList<int> & order, int visible)
+        :chart(chart), view(view), order(order), visible(visible), m_quit(false) {}
+    virtual ~PopulateSummaryTask() {}
+
+    virtual void run();
+
+    void quit() { m_quit = true; }
+protected:
+    gSummaryChart * chart;
+    gGraphView * view;
+    QList<int> order;
+    int visible;    // how many at the front of order are on screen
+    volatile bool m_quit;
+};
+
 class gSummaryChart : public Layer
 {
+    friend class PopulateSummaryTask;
 public:
     gSummaryChart(QString label, MachineType machtype);
     gSummaryChart(ChannelID code, MachineType machtype);
@@ -185,9 +224,15 @@ public:
     virtual QString tooltipData(Day *, int);
 
     virtual void dataChanged() {
+        cancelPopulate();
         cache.clear();
+        eventcache.clear();
+        populated.clear();
     }
 
+    //! \brief Stops the background populate task, and waits for it to let go
+    void cancelPopulate();
+
 
     void addCalc(ChannelID code, SummaryType type, QColor color) {
         calcitems.append(SummaryCalcItem(code, type, color));
@@ -204,6 +249,9 @@ public:
         // copy this here, because only base summary charts need it
         sc->calcitems = calcitems;
 
+        // Slices point into calcitems, so don't let either side detach later on
+        sc->calcitems.detach();
+
         return sc;
     }
 
@@ -218,6 +266,7 @@ public:
         layer->idx_start = idx_start;
         layer->idx_end = idx_end;
         layer->cache.clear();
+        layer->eventcache.clear();
         layer->dayindex = dayindex;
         layer->daylist = daylist;
     }
@@ -235,6 +284,21 @@ protected:
     //! \brief Mouse Button was released over this area. (jumps to daily view here)
     virtual bool mouseReleaseEvent(QMouseEvent *event, gGraph *graph);
 
+    //! \brief Makes sure days start to end get populated, in the background unless printing. Returns true if they are all there
+    bool populateRange(gGraph & graph, int start, int end);
+
+    //! \brief Loads this chart's on-disk cache, or drops it if a preference populate() depends on has changed
+    void loadStore();
+
+    //! \brief Writes the on-disk cache back out, if anything changed
+    void saveStore();
+
+    //! \brief Fills cache[idx] from the on-disk cache if the days fingerprint still matches. cachelock must be held
+    bool restoreDay(int idx, quint32 fingerprint);
+
+    //! \brief Keeps cache[idx] in the on-disk cache. cachelock must be held
+    void storeDay(int idx, quint32 fingerprint);
+
     QString m_label;
     MachineType m_machtype;
     bool m_empty;
@@ -250,6 +314,29 @@ protected:
     QHash<int, QVector<SummaryChartSlice> > cache;
     QVector<SummaryCalcItem> calcitems;
 
+    //! \brief Days that have been through populate(), whether they came up with anything or not
+    QSet<int> populated;
+
+    //! \brief Each populated day's Day::eventCount(), kept with the slices in the on-disk cache
+    QHash<int, EventDataType> eventcache;
+
+    /*! \brief Held around this charts cache while populating and painting. Shared by all summary charts
+        The days themselves are guarded by Day::cacheMutex(), which populate() is called with and which is taken after this */
+    static QMutex cachelock;
+
+    //! \brief Woken whenever a populate task lets go of its chart, waited on with cachelock held
+    static QWaitCondition populatorDone;
+
+    PopulateSummaryTask * m_populator;
+    int pop_start, pop_end;
+
+    //! \brief Populated days by date, saved across restarts
+    QHash<QDate, StoredSummaryDay> m_store;
+    QString m_storeFile;
+    QString m_storeSignature;
+    bool m_storeLoaded;
+    bool m_storeChanged;
+
     int expected_slices;
 
     int nousedays;
@@ -277,7 +364,7 @@ public:
         addCalc(NoChannel, ST_SESSIONS, QColor(64,128,255));
         addCalc(NoChannel, ST_SESSIONS, QColor(64,128,255));
     }
-    virtual ~gSessionTimesChart() {}
+    virtual ~gSessionTimesChart() { cancelPopulate(); }
 
     virtual void SetDay(Day * day = nullptr) {
         gSummaryChart::SetDay(day);
@@ -290,6 +377,7 @@ public:
     virtual void preCalc();
     virtual void customCalc(Day *, QVector<SummaryChartSlice> & slices);
     virtual void afterDraw(QPainter &, gGraph &, QRectF);
+    virtual void populate(Day *, int idx);
 
     //! \brief Renders the graph to the QPainter object
     virtual void paint(QPainter &painter, gGraph &graph, const QRegion &region);
@@ -321,7 +409,14 @@ public:
         :gSummaryChart("Usage", MT_CPAP) {
         addCalc(NoChannel, ST_HOURS, QColor(64,128,255));
     }
-    virtual ~gUsageChart() {}
+    virtual ~gUsageChart() { cancelPopulate(); }
+
+    virtual void SetDay(Day * day = nullptr) {
+        gSummaryChart::SetDay(day);
+
+        // populate() uses this, and can run before the first preCalc()
+        compliance_threshold = p_profile->cpap->complianceHours();
+    }
 
     virtual void preCalc();
     virtual void customCalc(Day *, QVector<SummaryChartSlice> &);
@@ -355,7 +450,7 @@ public:
         :gSummaryChart("TTIA", MT_CPAP) {
         addCalc(NoChannel, ST_CNT, QColor(255,147,150));
     }
-    virtual ~gTTIAChart() {}
+    virtual ~gTTIAChart() { cancelPopulate(); }
 
     virtual void preCalc();
     virtual void customCalc(Day *, QVector<SummaryChartSlice> &);
@@ -388,7 +483,7 @@ public:
         if (p_profile->general->calculateRDI())
             addCalc(CPAP_RERA, ST_CPH);
     }
-    virtual ~gAHIChart() {}
+    virtual ~gAHIChart() { cancelPopulate(); }
 
     virtual void preCalc();
     virtual void customCalc(Day *, QVector<SummaryChartSlice> &);
@@ -433,7 +528,7 @@ class gPressureChart : public gSummaryChart
 {
 public:
     gPressureChart();
-    virtual ~gPressureChart() {}
+    virtual ~gPressureChart() { cancelPopulate(); }
 
     virtual Layer * Clone() {
         gPressureChart * sc = new gPressureChart();
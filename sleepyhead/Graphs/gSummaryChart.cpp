@@ -412,7 +412,7 @@ void SummaryChart::paint(QPainter &painter, gGraph &w, const QRegion &region)
 
     bool buttuglydaysteps = false ; //!p_profile->appearance->animations();
 
-    double lcursor = w.graphView()->currentTime();
+    double lcursor = w.currentTime();
     if (days >= 1) {
 
         double b = w.max_x - w.min_x;
@@ -493,7 +493,7 @@ void SummaryChart::paint(QPainter &painter, gGraph &w, const QRegion &region)
     lastdaygood = true;
 
     // Display Line Cursor
-    if (AppSetting->lineCursorMode()) {
+    if (w.showLineCursor()) {
         qint64 time = lcursor;
         double xmult = double(width) / xx;
 
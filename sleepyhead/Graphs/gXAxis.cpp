@@ -85,7 +85,7 @@ void gXAxis::paint(QPainter &painter, gGraph &w, const QRegion &region)
 
     QFontMetrics fm(*defaultfont);
 
-    bool usepixmap = AppSetting->usePixmapCaching(); // Whether or not to use pixmap caching
+    bool usepixmap = AppSetting->usePixmapCaching() && !w.printing(); // Whether or not to use pixmap caching
 
     if (!usepixmap || (usepixmap && w.invalidate_xAxisImage)) {
         // Redraw graph xaxis labels and ticks either to pixmap or directly to screen
@@ -346,7 +346,7 @@ void gXAxis::paint(QPainter &painter, gGraph &w, const QRegion &region)
         } else {
             painter.drawLines(ticks);
         }
-        w.graphView()->lines_drawn_this_frame += ticks.size();
+        w.countLines(ticks.size());
 
         w.invalidate_xAxisImage = false;
     }
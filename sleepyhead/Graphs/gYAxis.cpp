@@ -133,7 +133,7 @@ void gXGrid::paint(QPainter &painter, gGraph &w, const QRegion &region)
     painter.drawLines(majorlines);
     painter.setPen(QPen(m_minor_color,1));
     painter.drawLines(minorlines);
-    w.graphView()->lines_drawn_this_frame += majorlines.size() + minorlines.size();
+    w.countLines(majorlines.size() + minorlines.size());
 }
 
 
@@ -167,7 +167,7 @@ void gYAxis::paint(QPainter &painter, gGraph &w, const QRegion &region)
     //Todo: clean this up as there is a lot of duplicate code between the sections
 
     QFontMetrics fm(*defaultfont);
-    static QString fd;
+    QString fd;
 
     if (0) {
     } else {
@@ -284,7 +284,7 @@ void gYAxis::paint(QPainter &painter, gGraph &w, const QRegion &region)
         }
         painter.setPen(Qt::black);
         painter.drawLines(ticks);
-        w.graphView()->lines_drawn_this_frame += ticks.size();
+        w.countLines(ticks.size());
 
     }
 }
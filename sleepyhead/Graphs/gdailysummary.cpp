@@ -358,8 +358,8 @@ void gDailySummary::paint(QPainter &painter, gGraph &w, const QRegion &region)
 
         QRectF box(column, floor(row) , (flag_value_width + flag_label_width + 20 + 4), ceil(flag_height));
         painter.fillRect(box, QBrush(flag_background.at(i)));
-        if (box.contains(w.graphView()->currentMousePos())) {
-            w.ToolTip(chan.description(), w.graphView()->currentMousePos().x()+5, w.graphView()->currentMousePos().y(), TT_AlignLeft);
+        if (box.contains(w.currentMousePos())) {
+            w.ToolTip(chan.description(), w.currentMousePos().x()+5, w.currentMousePos().y(), TT_AlignLeft);
             font.setBold(true);
             font.setItalic(true);
             painter.setFont(font);
@@ -7,7 +7,22 @@
  * for more details. */
 
 #include <cmath>
+#include <cstddef>
+#include <QHash>
+#include <QPainter>
+#include <QPaintEngine>
+#include <QDebug>
+
+#ifndef NO_OPENGL_BUILD
+#include <QOpenGLContext>
+#include <QOpenGLBuffer>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QMatrix4x4>
+#endif
+
 #include "glcommon.h"
+#include "gProfiler.h"
 
 float brightness(QColor color) {
     return color.redF()*0.299 + color.greenF()*0.587 + color.blueF()*0.114;
@@ -42,6 +57,263 @@ QColor brighten(QColor color, float mult)
 
 }
 
+gLineBuffer::gLineBuffer()
+    :m_count(0), m_vbo(nullptr), m_context(nullptr), m_uploaded(false)
+{
+}
+
+gLineBuffer::~gLineBuffer()
+{
+#ifndef NO_OPENGL_BUILD
+    delete m_vbo;
+#endif
+}
+
+bool gLineBuffer::begin(const QByteArray & key, const QPoint & origin)
+{
+    if (!key.isEmpty() && (key == m_key)) {
+        gProfiler::count("linebuffer_hits");
+        return false;
+    }
+    gProfiler::count("linebuffer_misses");
+    clear();
+    m_key = key;
+    m_origin = origin;
+    return true;
+}
+
+void gLineBuffer::add(const QVector<QLine> & lines, const QColor & color, float width)
+{
+    if (lines.isEmpty()) return;
+
+    // Keep adding to the last batch while the pen stays the same
+    if (!m_batches.isEmpty() && (m_batches.last().color == color) && (m_batches.last().width == width)) {
+        m_batches.last().lines += lines;
+    } else {
+        Batch batch;
+        batch.color = color;
+        batch.width = width;
+        batch.lines = lines;
+        m_batches.append(batch);
+    }
+    m_count += lines.size();
+    m_uploaded = false;
+}
+
+void gLineBuffer::clear()
+{
+    m_key.clear();
+    m_batches.clear();
+    m_count = 0;
+    m_uploaded = false;
+}
+
+int gLineBuffer::draw(QPainter & painter, const QPoint & origin)
+{
+    if (m_count == 0) return 0;
+
+    QPoint offset = origin - m_origin;
+
+#ifndef NO_OPENGL_BUILD
+    if (available(painter)) {
+        drawGL(painter, offset);
+        return m_count;
+    }
+#endif
+
+    if (!offset.isNull()) painter.translate(offset);
+    for (const auto & batch : m_batches) {
+        painter.setPen(QPen(batch.color, batch.width));
+        painter.drawLines(batch.lines);
+    }
+    if (!offset.isNull()) painter.translate(-offset);
+
+    return m_count;
+}
+
+#ifndef NO_OPENGL_BUILD
+
+struct gLineVertex
+{
+    GLfloat x, y;
+    GLubyte r, g, b, a;
+};
+
+static const char * lineVertexShader =
+    "attribute highp vec2 vertex;\n"
+    "attribute lowp vec4 color;\n"
+    "uniform highp mat4 matrix;\n"
+    "varying lowp vec4 v_color;\n"
+    "void main() {\n"
+    "    gl_Position = matrix * vec4(vertex, 0.0, 1.0);\n"
+    "    v_color = color;\n"
+    "}\n";
+
+static const char * lineFragmentShader =
+    "varying lowp vec4 v_color;\n"
+    "void main() {\n"
+    "    gl_FragColor = v_color;\n"
+    "}\n";
+
+// One program per context, null if it wouldn't build there
+static QHash<QOpenGLContext *, QOpenGLShaderProgram *> lineShaders;
+
+static QOpenGLShaderProgram * lineShader(QOpenGLContext * ctx)
+{
+    auto it = lineShaders.find(ctx);
+    if (it != lineShaders.end()) {
+        return it.value();
+    }
+
+    QOpenGLShaderProgram * program = new QOpenGLShaderProgram();
+    bool ok = program->addShaderFromSourceCode(QOpenGLShader::Vertex, lineVertexShader) &&
+              program->addShaderFromSourceCode(QOpenGLShader::Fragment, lineFragmentShader);
+    if (ok) {
+        program->bindAttributeLocation("vertex", 0);
+        program->bindAttributeLocation("color", 1);
+        ok = program->link();
+    }
+    if (!ok) {
+        qWarning() << "Line shader unavailable, drawing lines with QPainter instead:" << program->log();
+        delete program;
+        program = nullptr;
+    }
+    lineShaders[ctx] = program;
+
+    QObject::connect(ctx, &QOpenGLContext::aboutToBeDestroyed, [ctx]() {
+        delete lineShaders.take(ctx);
+    });
+    return program;
+}
+
+bool gLineBuffer::available(QPainter & painter)
+{
+    QPaintEngine * engine = painter.paintEngine();
+    if (!engine || (engine->type() != QPaintEngine::OpenGL2)) {
+        return false;
+    }
+    QOpenGLContext * ctx = QOpenGLContext::currentContext();
+    return ctx && lineShader(ctx);
+}
+
+void gLineBuffer::drawGL(QPainter & painter, const QPoint & offset)
+{
+    QOpenGLContext * ctx = QOpenGLContext::currentContext();
+    QOpenGLShaderProgram * program = lineShader(ctx);
+    QOpenGLFunctions * f = ctx->functions();
+
+    // Grab what's needed from the painter before it hands over
+    QTransform transform = painter.combinedTransform();
+    bool clipping = painter.hasClipping();
+    QRect clip = clipping ? transform.mapRect(painter.clipBoundingRect()).toAlignedRect() : QRect();
+    transform.translate(offset.x(), offset.y());
+
+    QPaintDevice * device = painter.device();
+    qreal dpr = device->devicePixelRatioF();
+    int devw = device->width();
+    int devh = device->height();
+
+    painter.beginNativePainting();
+
+    // Buffers only carry over between contexts that share them
+    if (m_vbo && (m_context != ctx) && !QOpenGLContext::areSharing(m_context, ctx)) {
+        delete m_vbo;
+        m_vbo = nullptr;
+    }
+    if (!m_vbo) {
+        m_vbo = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+        m_vbo->setUsagePattern(QOpenGLBuffer::StaticDraw);
+        m_vbo->create();
+        m_context = ctx;
+        m_uploaded = false;
+    }
+    m_vbo->bind();
+
+    if (!m_uploaded) {
+        QVector<gLineVertex> vertices;
+        vertices.reserve(m_count * 2);
+
+        for (const auto & batch : m_batches) {
+            gLineVertex v;
+            v.r = batch.color.red();
+            v.g = batch.color.green();
+            v.b = batch.color.blue();
+            v.a = batch.color.alpha();
+
+            // Half pixel in, so one pixel lines land on the same pixels QPainter would use
+            for (const auto & line : batch.lines) {
+                v.x = line.x1() + 0.5f;
+                v.y = line.y1() + 0.5f;
+                vertices.append(v);
+                v.x = line.x2() + 0.5f;
+                v.y = line.y2() + 0.5f;
+                vertices.append(v);
+            }
+        }
+        m_vbo->allocate(vertices.constData(), vertices.size() * sizeof(gLineVertex));
+        m_uploaded = true;
+    }
+
+    QMatrix4x4 matrix;
+    matrix.ortho(0, devw, devh, 0, -1, 1);
+    matrix *= QMatrix4x4(transform);
+
+    program->bind();
+    program->setUniformValue("matrix", matrix);
+    program->enableAttributeArray(0);
+    program->enableAttributeArray(1);
+    program->setAttributeBuffer(0, GL_FLOAT, offsetof(gLineVertex, x), 2, sizeof(gLineVertex));
+    // setAttributeBuffer doesn't normalize, and colours need to arrive as 0..1
+    f->glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(gLineVertex),
+                             reinterpret_cast<const void *>(offsetof(gLineVertex, r)));
+
+    f->glEnable(GL_BLEND);
+    f->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    if (clipping) {
+        // Scissor works in framebuffer pixels, from the bottom left
+        f->glEnable(GL_SCISSOR_TEST);
+        f->glScissor(clip.x() * dpr, (devh - clip.y() - clip.height()) * dpr, clip.width() * dpr, clip.height() * dpr);
+    }
+
+    // One draw call per run of batches sharing a line width
+    int start = 0;
+    int size = m_batches.size();
+    for (int i=0; i < size;) {
+        float width = m_batches.at(i).width;
+        int count = 0;
+        for (; (i < size) && (m_batches.at(i).width == width); ++i) {
+            count += m_batches.at(i).lines.size() * 2;
+        }
+        f->glLineWidth(width * dpr);
+        f->glDrawArrays(GL_LINES, start, count);
+        start += count;
+    }
+
+    if (clipping) {
+        f->glDisable(GL_SCISSOR_TEST);
+    }
+    program->disableAttributeArray(0);
+    program->disableAttributeArray(1);
+    program->release();
+    m_vbo->release();
+
+    painter.endNativePainting();
+}
+
+#else
+
+bool gLineBuffer::available(QPainter &)
+{
+    return false;
+}
+
+void gLineBuffer::drawGL(QPainter &, const QPoint &)
+{
+}
+
+#endif // NO_OPENGL_BUILD
+
 #ifdef BUILD_WITH_MSVC
 
 #if (_MSC_VER < 1800)
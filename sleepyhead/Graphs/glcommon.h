@@ -10,6 +10,14 @@
 #define GLCOMMON_H
 
 #include <QColor>
+#include <QVector>
+#include <QLine>
+#include <QPoint>
+#include <QByteArray>
+
+class QPainter;
+class QOpenGLBuffer;
+class QOpenGLContext;
 
 #ifndef nullptr
 #define nullptr NULL
@@ -56,6 +64,55 @@ const QColor COLOR_ALT_BG2 = COLOR_White;                    // Alternating Back
 
 QColor brighten(QColor color, float mult = 2.0);
 
+/*! \class gLineBuffer
+    \brief A layers lines, kept between frames and only rebuilt when its data or range changes
+
+    When painting onto an OpenGL paint engine they are drawn from a vertex buffer with a GL 2.1 / ES 2.0
+    shader, which software rasterizers like llvmpipe handle fine. Anything else gets QPainter::drawLines.
+    */
+class gLineBuffer
+{
+  public:
+    gLineBuffer();
+    ~gLineBuffer();
+
+    //! \brief Starts over unless key matches what the lines were built from. Returns true if they need adding again
+    bool begin(const QByteArray & key, const QPoint & origin = QPoint());
+
+    //! \brief Queue lines to be drawn in color, width pixels wide
+    void add(const QVector<QLine> & lines, const QColor & color, float width = 1.0);
+
+    //! \brief Forget all lines, so the next begin() rebuilds whatever the key
+    void clear();
+
+    //! \brief Draw the lines, shifted by however far origin moved since they were built. Returns how many were drawn
+    int draw(QPainter & painter, const QPoint & origin = QPoint());
+
+    //! \brief Returns true if painter is on an OpenGL paint engine the vertex buffer path can use
+    static bool available(QPainter & painter);
+
+  protected:
+    void drawGL(QPainter & painter, const QPoint & offset);
+
+    struct Batch {
+        QColor color;
+        float width;
+        QVector<QLine> lines;
+    };
+
+    QByteArray m_key;
+    QPoint m_origin;
+    QVector<Batch> m_batches;
+    int m_count;
+
+    QOpenGLBuffer * m_vbo;
+    QOpenGLContext * m_context;
+    bool m_uploaded;
+
+  private:
+    Q_DISABLE_COPY(gLineBuffer)
+};
+
 const int max_history = 50;
 
 #ifndef M_PI
@@ -28,6 +28,16 @@ enum ToolTipAlignment { TT_AlignCenter, TT_AlignLeft, TT_AlignRight };
 
 enum LayerType { LT_Other = 0, LT_LineChart, LT_SummaryChart, LT_EventFlags, LT_Spacer, LT_Overview };
 
+/*! \struct FlagMark
+    \brief An event flag or span in screen space, merged with any neighbours landing on the same pixel
+    */
+struct FlagMark {
+    float x1;               // pixel offset from the layers left edge of the event time
+    float x2;               // pixel offset of the span start, same as x1 for flags
+    EventStoreType data;    // raw data of the first event merged in
+    int count;              // how many events were merged into this mark
+};
+
 /*! \class Layer
     \brief The base component for all individual Graph layers
     */
@@ -0,0 +1,526 @@
+/* SleepLib Aggregate Cube Implementation
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#include <limits>
+
+#include <QThread>
+
+#include "SleepLib/aggregatecube.h"
+#include "SleepLib/profiles.h"
+#include "SleepLib/day.h"
+
+// Days per merged percentile histogram, a year's range is about a dozen merges
+const int cube_block = 32;
+
+static inline quint64 columnKey(AggregateCube::Kind kind, ChannelID code, MachineType mt)
+{
+    return (quint64(kind) << 40) | (quint64(mt) << 32) | quint64(code);
+}
+
+//! \brief Kinds that are per day rather than per channel, these all share one column per machine type
+static inline bool isDayKind(AggregateCube::Kind kind)
+{
+    return (kind == AggregateCube::Hours) || (kind == AggregateCube::Days) || (kind == AggregateCube::Compliant);
+}
+
+static inline bool isMinimum(AggregateCube::Kind kind)
+{
+    return (kind == AggregateCube::Min) || (kind == AggregateCube::SettingsMin);
+}
+
+static inline bool isExtreme(AggregateCube::Kind kind)
+{
+    return isMinimum(kind) || (kind == AggregateCube::Max) || (kind == AggregateCube::SettingsMax);
+}
+
+//! \brief The value an extreme column holds for days without one, so it never wins
+static inline double noValue(AggregateCube::Kind kind)
+{
+    return isMinimum(kind) ? std::numeric_limits<double>::max() : -std::numeric_limits<double>::max();
+}
+
+// Fenwick tree helpers, index i is zero based
+static void fenwickAdd(QVector<double> & tree, int i, double delta)
+{
+    for (int n = tree.size(); i < n; i |= i + 1) {
+        tree[i] += delta;
+    }
+}
+
+// Sum of [0, i]
+static double fenwickSum(const QVector<double> & tree, int i)
+{
+    double sum = 0;
+    for (; i >= 0; i = (i & (i + 1)) - 1) {
+        sum += tree[i];
+    }
+    return sum;
+}
+
+static inline double fenwickRange(const QVector<double> & tree, int first, int last)
+{
+    return fenwickSum(tree, last) - fenwickSum(tree, first - 1);
+}
+
+static inline double segCombine(bool minimum, double a, double b)
+{
+    return minimum ? qMin(a, b) : qMax(a, b);
+}
+
+static void mergeInto(QMap<EventDataType, qint64> & dest, const QMap<EventDataType, qint64> & src)
+{
+    for (auto it = src.begin(), end = src.end(); it != end; ++it) {
+        dest[it.key()] += it.value();
+    }
+}
+
+AggregateCube::AggregateCube(Profile * profile)
+    :m_profile(profile), m_owner(QThread::currentThread()), m_size(0), m_reset(true)
+{
+}
+
+AggregateCube::~AggregateCube()
+{
+    qDeleteAll(m_columns);
+}
+
+void AggregateCube::invalidate(QDate date)
+{
+    if (!date.isValid()) {
+        return;
+    }
+    QMutexLocker lock(&m_dirtyMutex);
+    m_dirty.insert(date.toJulianDay());
+}
+
+void AggregateCube::clear()
+{
+    QMutexLocker lock(&m_dirtyMutex);
+    m_reset = true;
+}
+
+void AggregateCube::sync(bool pull)
+{
+    QSet<qint64> dirty;
+    bool reset;
+    {
+        QMutexLocker lock(&m_dirtyMutex);
+        if (pull) {
+            dirty.swap(m_dirty);
+        }
+        reset = m_reset;
+        m_reset = false;
+    }
+
+    QDate first = m_profile->FirstDay();
+    QDate last = m_profile->LastDay();
+    int size = (first.isValid() && last.isValid()) ? (first.daysTo(last) + 1) : 0;
+
+    if (reset || (first != m_base) || (size != m_size)) {
+        // The range moved, every index is off, so start over
+        qDeleteAll(m_columns);
+        m_columns.clear();
+        m_base = first;
+        m_size = qMax(size, 0);
+        return;
+    }
+
+    if (dirty.isEmpty() || m_columns.isEmpty()) {
+        return;
+    }
+
+    qint64 base = m_base.toJulianDay();
+    for (const qint64 jd : dirty) {
+        int i = jd - base;
+        if ((i < 0) || (i >= m_size)) {
+            continue;
+        }
+        for (auto & col : m_columns) {
+            // Blocks not built yet pick the change up when they are
+            if (col->built.testBit(i / cube_block)) {
+                update(*col, i);
+            }
+        }
+    }
+}
+
+void AggregateCube::compute(Column & col, int i)
+{
+    double a = 0, b = 0;
+    if (col.kind == Percentile) {
+        col.days[i].clear();
+    }
+
+    // Day counts only need the session list, so leave the summaries closed
+    Day * day = ((col.kind == Days) || (col.kind == Compliant)) ? m_profile->FindGoodDay(m_base.addDays(i), col.mt)
+                                                                : m_profile->GetGoodDay(m_base.addDays(i), col.mt);
+    if (day) {
+        // Percentiles read the sessions directly, and summary charts may be populating this day
+        QMutexLocker daylock(day->cacheMutex());
+        ChannelID code = col.code;
+        switch (col.kind) {
+        case Count:
+            a = day->count(code);
+            break;
+        case Sum:
+            a = day->sum(code);
+            break;
+        case Hours:
+            a = day->hours();
+            break;
+        case Days:
+            a = 1;
+            break;
+        case Compliant:
+            a = (day->hours(col.mt) > col.threshold) ? 1 : 0;
+            break;
+        case Index:
+            a = day->indexCount(SessionIndex(code));
+            break;
+        case Avg:
+            if (!day->summaryOnly() || day->hasData(code, ST_AVG)) {
+                a = day->sum(code);
+                b = day->count(code);
+            }
+            break;
+        case Wavg:
+            if (!day->summaryOnly() || day->hasData(code, ST_WAVG)) {
+                b = day->hours();
+                a = day->wavg(code) * b;
+            }
+            break;
+        case Min:
+            if (!day->summaryOnly() || day->hasData(code, ST_MIN)) {
+                a = day->Min(code);
+                b = 1;
+            }
+            break;
+        case Max:
+            if (!day->summaryOnly() || day->hasData(code, ST_MAX)) {
+                a = day->Max(code);
+                b = 1;
+            }
+            break;
+        case SettingsMin:
+            a = day->settings_min(code);
+            b = 1;
+            break;
+        case SettingsMax:
+            a = day->settings_max(code);
+            b = 1;
+            break;
+        case Percentile:
+            if (day->summaryOnly()) {
+                b = 1;
+                break;
+            }
+            for (auto & sess : day->sessions) {
+                if (!sess->enabled()) {
+                    continue;
+                }
+                auto vsi = sess->m_valuesummary.find(code);
+                if (vsi == sess->m_valuesummary.end()) {
+                    continue;
+                }
+
+                EventDataType gain = sess->m_gain[code];
+                if (!gain) { gain = 1; }
+
+                // Time weighted where the session has it
+                auto tsi = sess->m_timesummary.find(code);
+                QMap<EventDataType, qint64> & wmap = col.days[i];
+                if (tsi != sess->m_timesummary.end()) {
+                    for (auto k = tsi.value().begin(), kend = tsi.value().end(); k != kend; ++k) {
+                        wmap[EventDataType(k.key()) * gain] += k.value();
+                        a += k.value();
+                    }
+                } else {
+                    for (auto k = vsi.value().begin(), kend = vsi.value().end(); k != kend; ++k) {
+                        wmap[EventDataType(k.key()) * gain] += k.value();
+                        a += k.value();
+                    }
+                }
+            }
+            break;
+        }
+    }
+
+    if (isExtreme(col.kind) && (b == 0)) {
+        // Nothing recorded, make sure it never wins
+        a = noValue(col.kind);
+    }
+
+    col.a[i] = a;
+    col.b[i] = b;
+}
+
+void AggregateCube::apply(Column & col, int i, double olda, double oldb)
+{
+    if (isExtreme(col.kind)) {
+        bool minimum = isMinimum(col.kind);
+        int p = i + m_size;
+        col.seg[p] = col.a[i];
+        for (p >>= 1; p >= 1; p >>= 1) {
+            col.seg[p] = segCombine(minimum, col.seg[p << 1], col.seg[(p << 1) | 1]);
+        }
+        return;
+    }
+
+    if (col.a[i] != olda) {
+        fenwickAdd(col.fa, i, col.a[i] - olda);
+    }
+    if (col.b[i] != oldb) {
+        fenwickAdd(col.fb, i, col.b[i] - oldb);
+    }
+}
+
+void AggregateCube::merge(Column & col, int block)
+{
+    QMap<EventDataType, qint64> & merged = col.blocks[block];
+    merged.clear();
+    for (int j = block * cube_block, end = qMin(j + cube_block, m_size); j < end; ++j) {
+        mergeInto(merged, col.days[j]);
+    }
+}
+
+void AggregateCube::update(Column & col, int i)
+{
+    double olda = col.a[i], oldb = col.b[i];
+    compute(col, i);
+    apply(col, i, olda, oldb);
+
+    if (col.kind == Percentile) {
+        merge(col, i / cube_block);
+    }
+}
+
+void AggregateCube::build(Column & col, int block)
+{
+    for (int i = block * cube_block, end = qMin(i + cube_block, m_size); i < end; ++i) {
+        double olda = col.a[i], oldb = col.b[i];
+        compute(col, i);
+        apply(col, i, olda, oldb);
+    }
+    if (col.kind == Percentile) {
+        merge(col, block);
+    }
+    col.built.setBit(block);
+}
+
+bool AggregateCube::built(const Column & col, int first, int last)
+{
+    for (int block = first / cube_block, end = last / cube_block; block <= end; ++block) {
+        if (!col.built.testBit(block)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AggregateCube::current(const Column & col)
+{
+    return (col.kind != Compliant) || (col.threshold == m_profile->cpap->complianceHours());
+}
+
+AggregateCube::Column & AggregateCube::column(Kind kind, ChannelID code, MachineType mt)
+{
+    if (isDayKind(kind)) {
+        code = 0;
+    }
+    quint64 key = columnKey(kind, code, mt);
+    auto it = m_columns.find(key);
+    if (it != m_columns.end()) {
+        if (current(*it.value())) {
+            return *it.value();
+        }
+        delete it.value();
+        m_columns.erase(it);
+    }
+
+    Column * col = new Column;
+    col->kind = kind;
+    col->code = code;
+    col->mt = mt;
+    col->threshold = m_profile->cpap->complianceHours();
+
+    // Starts out with every day empty, blocks are filled in by build() as queries reach them
+    int blocks = (m_size + cube_block - 1) / cube_block;
+    col->built.resize(blocks);
+    col->b.fill(0, m_size);
+    if (isExtreme(kind)) {
+        col->a.fill(noValue(kind), m_size);
+        col->seg.fill(noValue(kind), m_size * 2);
+    } else {
+        col->a.fill(0, m_size);
+        col->fa.fill(0, m_size);
+        col->fb.fill(0, m_size);
+    }
+    if (kind == Percentile) {
+        col->days.resize(m_size);
+        col->blocks.resize(blocks);
+    }
+
+    m_columns[key] = col;
+    return *col;
+}
+
+bool AggregateCube::stale(bool dirty)
+{
+    QDate first = m_profile->FirstDay();
+    QDate last = m_profile->LastDay();
+    int size = (first.isValid() && last.isValid()) ? (first.daysTo(last) + 1) : 0;
+    if ((first != m_base) || (qMax(size, 0) != m_size)) {
+        return true;
+    }
+
+    QMutexLocker lock(&m_dirtyMutex);
+    return m_reset || (dirty && !m_dirty.isEmpty());
+}
+
+AggregateCube::Column * AggregateCube::acquire(Kind kind, ChannelID code, MachineType mt, QDate start, QDate end,
+                                               int & first, int & last)
+{
+    quint64 key = columnKey(kind, isDayKind(kind) ? 0 : code, mt);
+
+    // Elsewhere days changed since are left for the owner to pick up, rather than reading them behind its back
+    bool owner = (QThread::currentThread() == m_owner);
+
+    m_lock.lockForRead();
+    Column * col = stale(owner) ? nullptr : m_columns.value(key);
+    if (!range(start, end, first, last)) {
+        first = 0;
+        last = -1;
+    }
+    if (col && (!current(*col) || !built(*col, first, last))) {
+        col = nullptr;
+    }
+
+    while (!col) {
+        m_lock.unlock();
+        m_lock.lockForWrite();
+        sync(owner);
+        Column & c = column(kind, code, mt);
+        if (range(start, end, first, last)) {
+            for (int block = first / cube_block, bend = last / cube_block; block <= bend; ++block) {
+                if (!c.built.testBit(block)) {
+                    build(c, block);
+                }
+            }
+        }
+        m_lock.unlock();
+
+        // Another thread may have reset the cube in between, in which case go around again
+        m_lock.lockForRead();
+        col = m_columns.value(key);
+        if (!range(start, end, first, last)) {
+            first = 0;
+            last = -1;
+        }
+        if (col && (!current(*col) || !built(*col, first, last))) {
+            col = nullptr;
+        }
+    }
+    return col;
+}
+
+void AggregateCube::prepare(Kind kind, ChannelID code, MachineType mt, QDate start, QDate end)
+{
+    int first, last;
+    acquire(kind, code, mt, start, end, first, last);
+    m_lock.unlock();
+}
+
+bool AggregateCube::range(QDate start, QDate end, int & first, int & last)
+{
+    if (!start.isValid() || !end.isValid() || (m_size == 0)) {
+        return false;
+    }
+    first = qMax(qint64(0), m_base.daysTo(start));
+    last = qMin(qint64(m_size - 1), m_base.daysTo(end));
+    return first <= last;
+}
+
+double AggregateCube::total(Kind kind, ChannelID code, MachineType mt, QDate start, QDate end)
+{
+    int first, last;
+    Column * col = acquire(kind, code, mt, start, end, first, last);
+
+    double result = 0;
+    if (first <= last) {
+        result = fenwickRange(col->fa, first, last);
+    }
+
+    m_lock.unlock();
+    return result;
+}
+
+void AggregateCube::totals(Kind kind, ChannelID code, MachineType mt, QDate start, QDate end, double & a, double & b)
+{
+    int first, last;
+    Column * col = acquire(kind, code, mt, start, end, first, last);
+
+    a = b = 0;
+    if (first <= last) {
+        a = fenwickRange(col->fa, first, last);
+        b = fenwickRange(col->fb, first, last);
+    }
+
+    m_lock.unlock();
+}
+
+bool AggregateCube::extreme(Kind kind, ChannelID code, MachineType mt, QDate start, QDate end, double & result)
+{
+    int first, last;
+    Column * col = acquire(kind, code, mt, start, end, first, last);
+
+    bool minimum = isMinimum(kind);
+    double none = noValue(kind);
+    double val = none;
+
+    if (first <= last) {
+        for (int l = first + m_size, r = last + m_size + 1; l < r; l >>= 1, r >>= 1) {
+            if (l & 1) { val = segCombine(minimum, val, col->seg[l++]); }
+            if (r & 1) { val = segCombine(minimum, val, col->seg[--r]); }
+        }
+    }
+
+    m_lock.unlock();
+
+    if (val == none) {
+        return false;
+    }
+    result = val;
+    return true;
+}
+
+qint64 AggregateCube::histogram(ChannelID code, MachineType mt, QDate start, QDate end, QMap<EventDataType, qint64> & wmap)
+{
+    int first, last;
+    Column * col = acquire(Percentile, code, mt, start, end, first, last);
+
+    qint64 total = 0;
+    if (first <= last) {
+        if (fenwickRange(col->fb, first, last) > 0) {
+            total = -1;
+        } else {
+            for (int i = first; i <= last;) {
+                if (((i % cube_block) == 0) && ((i + cube_block - 1) <= last)) {
+                    mergeInto(wmap, col->blocks[i / cube_block]);
+                    i += cube_block;
+                } else {
+                    mergeInto(wmap, col->days[i]);
+                    ++i;
+                }
+            }
+            total = qint64(fenwickRange(col->fa, first, last));
+        }
+    }
+
+    m_lock.unlock();
+    return total;
+}
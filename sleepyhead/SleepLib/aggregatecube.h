@@ -0,0 +1,157 @@
+/* SleepLib Aggregate Cube Header
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#ifndef AGGREGATECUBE_H
+#define AGGREGATECUBE_H
+
+#include <QBitArray>
+#include <QDate>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QVector>
+
+#include "SleepLib/machine_common.h"
+
+class QThread;
+class Profile;
+class Day;
+
+/*! \class AggregateCube
+    \brief Per channel, per day summary values for a Profile, indexed by date so range statistics don't walk the daylist
+
+    Each (channel, machine type, statistic) gets a column the first time it's asked for, holding one value per day
+    between the profiles first and last day. Days are only read in blocks as queries first reach them, so a one day
+    range doesn't open every summary in the profile. Sums and counts are kept in Fenwick trees, minimums and maximums in
+    segment trees, and percentiles as per day histograms merged into blocks of days, so any date range is answered
+    in O(log n) (or a few dozen histogram merges for percentiles).
+
+    Usage (days, compliant days, hours) is kept the same way, so enabling or disabling a session only updates
+    that one days entries.
+
+    Days changed after a column was built are only recomputed on the next query, see invalidate()
+    Queries can be made from several threads at once, they only serialize while columns are built or updated.
+    Building reads Day and Session caches, which fill themselves in without locking, so only the thread that
+    created the cube picks up invalidated days. Other threads should have their columns prepare()d there first,
+    so all they do is read the trees.
+    */
+class AggregateCube
+{
+  public:
+    enum Kind {
+        Count,          // day->count()
+        Sum,            // day->sum()
+        Hours,          // day->hours(), code is ignored
+        Avg,            // sum and count, skipping summary only days without averages
+        Wavg,           // wavg weighted by hours, skipping summary only days without weighted averages
+        Min,
+        Max,
+        SettingsMin,
+        SettingsMax,
+        Percentile,     // value histogram, only meaningful if no day in the range is summary only
+        Days,           // 1 for each day with enabled sessions, code is ignored
+        Compliant,      // 1 for each day used longer than the compliance hours, code is ignored
+        Index           // day->indexCount(), code is a SessionIndex
+    };
+
+    AggregateCube(Profile * profile);
+    ~AggregateCube();
+
+    //! \brief Mark date as changed, its values are recomputed in any built column on the next query
+    void invalidate(QDate date);
+
+    //! \brief Throw away every column, they get rebuilt as they're needed
+    void clear();
+
+    //! \brief Build everything a query of kind over [start, end] needs, so worker threads asking later don't touch any days
+    void prepare(Kind kind, ChannelID code, MachineType mt, QDate start, QDate end);
+
+    //! \brief Returns the sum over [start, end] of the columns first value (Count, Sum, Hours, Days, Compliant, Index)
+    double total(Kind kind, ChannelID code, MachineType mt, QDate start, QDate end);
+
+    /*! \brief Returns both running totals over [start, end], for statistics kept as a ratio
+        Avg: sum of values, sum of counts. Wavg: sum of wavg * hours, sum of hours */
+    void totals(Kind kind, ChannelID code, MachineType mt, QDate start, QDate end, double & a, double & b);
+
+    //! \brief Returns false if no day in [start, end] had a value, otherwise puts the min or max in result
+    bool extreme(Kind kind, ChannelID code, MachineType mt, QDate start, QDate end, double & result);
+
+    /*! \brief Merges the value histograms for [start, end] into wmap, returning the total weight
+        Returns -1 if any day in the range only has summary data */
+    qint64 histogram(ChannelID code, MachineType mt, QDate start, QDate end, QMap<EventDataType, qint64> & wmap);
+
+  protected:
+    struct Column {
+        Kind kind;
+        ChannelID code;
+        MachineType mt;
+        double threshold;               // compliance hours a Compliant column was built with
+
+        QVector<double> a, b;           // per day values, kept to work out the deltas on update
+        QVector<double> fa, fb;         // Fenwick trees over a and b
+        QVector<double> seg;            // segment tree over a, for min/max
+
+        QVector<QMap<EventDataType, qint64> > days;     // per day histograms
+        QVector<QMap<EventDataType, qint64> > blocks;   // merged histograms of cube_block days
+
+        QBitArray built;                // blocks of cube_block days that have been computed
+    };
+
+    //! \brief Returns true if the profile range moved, or dirty is set and days were invalidated since the last sync()
+    bool stale(bool dirty);
+
+    //! \brief Pull in profile range changes, and dirty days if dirty is set, must be called with m_lock held for writing
+    void sync(bool dirty);
+
+    //! \brief Returns false if col was built against settings that have since changed
+    bool current(const Column & col);
+
+    //! \brief Returns the column for key, creating an empty one if needed, must be called with m_lock held for writing
+    Column & column(Kind kind, ChannelID code, MachineType mt);
+
+    /*! \brief Returns an up to date column with m_lock held for reading, the caller unlocks it
+        Every block covering [start, end] is computed, which is clamped into first and last (first > last if empty) */
+    Column * acquire(Kind kind, ChannelID code, MachineType mt, QDate start, QDate end, int & first, int & last);
+
+    //! \brief Returns true if every block covering [first, last] in col has been computed
+    bool built(const Column & col, int first, int last);
+
+    //! \brief Compute every day in block, must be called with m_lock held for writing
+    void build(Column & col, int block);
+
+    //! \brief Work out index i's values for column col from its day record
+    void compute(Column & col, int i);
+
+    //! \brief Recompute index i in col, updating the trees above it
+    void update(Column & col, int i);
+
+    //! \brief Push index i's new values into col's trees, olda and oldb being what they replaced
+    void apply(Column & col, int i, double olda, double oldb);
+
+    //! \brief Remerge the percentile histogram for block
+    void merge(Column & col, int block);
+
+    //! \brief Clamp [start, end] to the cube, returns false if nothing is left
+    bool range(QDate start, QDate end, int & first, int & last);
+
+    Profile * m_profile;
+    QThread * m_owner;              // the only thread that recomputes invalidated days
+    QDate m_base;
+    int m_size;
+
+    QHash<quint64, Column *> m_columns;
+    QReadWriteLock m_lock;
+
+    QSet<qint64> m_dirty;           // julian days invalidated since the last query
+    bool m_reset;
+    QMutex m_dirtyMutex;            // leaf lock, so invalidate() can be called from anywhere
+};
+
+#endif // AGGREGATECUBE_H
@@ -0,0 +1,315 @@
+/* SleepLib Columnar Export Implementation
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QFile>
+#include <QRunnable>
+#include <QtEndian>
+#include <QDebug>
+
+#include "SleepLib/columnexport.h"
+#include "SleepLib/profiles.h"
+#include "SleepLib/day.h"
+
+const char columnexport_magic[] = "SHCOLS\r\n";
+
+// Longest run of one EventList put in a single block, so readers never need more than this in memory at once
+const quint32 column_block_rows = 65536;
+
+// Written out whenever this much has built up
+const int column_buffer_size = 4 * 1024 * 1024;
+
+/*! \class ColumnDayJob
+    \brief Encodes one day for ColumnExport on the worker pool
+    */
+class ColumnDayJob:public QRunnable
+{
+  public:
+    ColumnDayJob(ColumnExport * exporter, QDate date, Day * day, ColumnExport::Chunk * out)
+        :m_exporter(exporter), m_date(date), m_day(day), m_out(out) {}
+    virtual ~ColumnDayJob() {}
+
+    virtual void run() { m_exporter->encodeDay(*m_out, m_date, m_day); }
+  protected:
+    ColumnExport * m_exporter;
+    QDate m_date;
+    Day * m_day;
+    ColumnExport::Chunk * m_out;
+};
+
+//! \brief Sets up a QDataStream the way every record payload is written
+static void setupStream(QDataStream & out)
+{
+    out.setVersion(QDataStream::Qt_4_6);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+}
+
+//! \brief Delta codes count values into little endian bytes, wrapping on overflow so it's exactly reversible
+template <class T, class U>
+static QByteArray deltaEncode(const T * data, quint32 count)
+{
+    QByteArray bytes(int(count * sizeof(T)), Qt::Uninitialized);
+    uchar * p = reinterpret_cast<uchar *>(bytes.data());
+    U last = 0;
+    for (quint32 i = 0; i < count; ++i) {
+        U value = U(data[i]);
+        qToLittleEndian<U>(U(value - last), p);
+        last = value;
+        p += sizeof(T);
+    }
+    return bytes;
+}
+
+template <class T, class U>
+static QByteArray plainEncode(const T * data, quint32 count)
+{
+    QByteArray bytes(int(count * sizeof(T)), Qt::Uninitialized);
+    uchar * p = reinterpret_cast<uchar *>(bytes.data());
+    for (quint32 i = 0; i < count; ++i) {
+        qToLittleEndian<U>(U(data[i]), p);
+        p += sizeof(T);
+    }
+    return bytes;
+}
+
+//! \brief Appends whichever of the compressed or plain encodings comes out smaller
+static void appendEncoded(QByteArray & out, const QByteArray & delta, const QByteArray & plain)
+{
+    QByteArray packed = qCompress(delta);
+
+    quint8 encoding = ColumnExport::DeltaZlib;
+    const QByteArray * stored = &packed;
+    if (packed.size() >= plain.size()) {
+        encoding = ColumnExport::Plain;
+        stored = &plain;
+    }
+
+    uchar head[9];
+    head[0] = encoding;
+    qToLittleEndian<quint32>(quint32(plain.size()), head + 1);
+    qToLittleEndian<quint32>(quint32(stored->size()), head + 5);
+    out.append(reinterpret_cast<const char *>(head), sizeof(head));
+    out.append(*stored);
+}
+
+void ColumnExport::appendColumn(QByteArray & out, const EventStoreType * data, quint32 count)
+{
+    appendEncoded(out, deltaEncode<EventStoreType, quint16>(data, count), plainEncode<EventStoreType, quint16>(data, count));
+}
+
+void ColumnExport::appendColumn(QByteArray & out, const quint32 * data, quint32 count)
+{
+    appendEncoded(out, deltaEncode<quint32, quint32>(data, count), plainEncode<quint32, quint32>(data, count));
+}
+
+void ColumnExport::appendRecord(QByteArray & out, Tag tag, const QByteArray & payload)
+{
+    uchar head[5];
+    head[0] = quint8(tag);
+    qToLittleEndian<quint32>(quint32(payload.size()), head + 1);
+    out.append(reinterpret_cast<const char *>(head), sizeof(head));
+    out.append(payload);
+}
+
+ColumnExport::ColumnExport(QObject * parent)
+    :QObject(parent), m_abort(false)
+{
+    m_pool.setMaxThreadCount(AppSetting->multithreading() ? idealThreads() : 1);
+}
+
+QByteArray ColumnExport::channelRecord(ChannelID code)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+
+    schema::Channel & chan = schema::channel[code];
+    out << quint32(code);
+    out << chan.code();
+    out << chan.label();
+    out << chan.units();
+    out << quint16(chan.type());
+
+    QByteArray record;
+    appendRecord(record, TagChannel, payload);
+    return record;
+}
+
+void ColumnExport::encodeList(Chunk & chunk, Session * sess, ChannelID code, EventList * ev)
+{
+    quint32 count = ev->count();
+    bool waveform = (ev->type() == EVL_Waveform);
+    bool second = ev->hasSecondField();
+
+    for (quint32 start = 0; start < count; start += column_block_rows) {
+        quint32 rows = qMin(column_block_rows, count - start);
+
+        QByteArray payload;
+        {
+            QDataStream out(&payload, QIODevice::WriteOnly);
+            setupStream(out);
+            out << quint32(sess->session());
+            out << quint32(code);
+            out << quint8(ev->type());
+            out << quint8(second ? 1 : 0);
+            out << ev->gain();
+            out << ev->offset();
+            out << ev->rate();
+            out << ev->first();
+            out << ev->last();
+            out << start;
+            out << rows;
+        }
+
+        if (!waveform) {
+            appendColumn(payload, ev->rawTime() + start, rows);
+        }
+        appendColumn(payload, ev->rawData() + start, rows);
+        if (second) {
+            appendColumn(payload, ev->rawData2() + start, rows);
+        }
+
+        appendRecord(chunk.data, TagBlock, payload);
+        chunk.blocks++;
+        chunk.rows += rows;
+    }
+}
+
+void ColumnExport::encodeDay(Chunk & chunk, QDate date, Day * day)
+{
+    for (auto & sess : day->sessions) {
+        bool loaded = sess->eventsLoaded();
+        sess->OpenEvents();
+
+        QByteArray payload;
+        {
+            QDataStream out(&payload, QIODevice::WriteOnly);
+            setupStream(out);
+            Machine * mach = sess->machine();
+            out << quint32(sess->session());
+            out << qint32(date.toJulianDay());
+            out << quint16(sess->type());
+            out << quint32(mach ? mach->id() : 0);
+            out << (mach ? mach->serial() : QString());
+            out << sess->first();
+            out << sess->last();
+        }
+        appendRecord(chunk.data, TagSession, payload);
+        chunk.sessions++;
+
+        for (auto it = sess->eventlist.begin(), end = sess->eventlist.end(); it != end; ++it) {
+            for (auto & ev : it.value()) {
+                if (ev->count() == 0) continue;
+                encodeList(chunk, sess, it.key(), ev);
+                chunk.channels.insert(it.key());
+            }
+        }
+
+        // Leave anything else that had them open alone, like the Daily view
+        if (!loaded) {
+            sess->TrashEvents();
+        }
+    }
+}
+
+bool ColumnExport::exportRange(const QString & filename, QDate start, QDate end)
+{
+    QFile file(filename);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "Couldn't open" << filename << "for writing";
+        return false;
+    }
+    m_abort = false;
+    m_written.clear();
+
+    // Summaries are opened here, so the workers only ever load events
+    QList<QPair<QDate, Day *> > days;
+    for (QDate date = start; date <= end; date = date.addDays(1)) {
+        Day * day = p_profile->GetDay(date);
+        if (day) {
+            days.append(qMakePair(date, day));
+        }
+    }
+
+    emit setProgressMax(days.size());
+    emit setProgressValue(0);
+
+    QByteArray buffer;
+    buffer.reserve(column_buffer_size + column_buffer_size / 4);
+    buffer.append(columnexport_magic, sizeof(columnexport_magic) - 1);
+    uchar version[2];
+    qToLittleEndian<quint16>(columnexport_version, version);
+    buffer.append(reinterpret_cast<const char *>(version), sizeof(version));
+
+    quint32 sessions = 0, blocks = 0;
+    quint64 rows = 0;
+
+    bool ok = true;
+    // Waveform days can run to tens of megabytes encoded, so only one per worker is held at a time
+    int batch = m_pool.maxThreadCount();
+    int done = 0;
+
+    while ((done < days.size()) && !m_abort && ok) {
+        int count = qMin(batch, days.size() - done);
+        QVector<Chunk> chunks(count);
+
+        for (int i = 0; i < count; ++i) {
+            const auto & entry = days.at(done + i);
+            chunks[i].sessions = chunks[i].blocks = 0;
+            chunks[i].rows = 0;
+            ColumnDayJob * job = new ColumnDayJob(this, entry.first, entry.second, &chunks[i]);
+            job->setAutoDelete(true);
+            m_pool.start(job);
+        }
+        m_pool.waitForDone();
+
+        // Written out in date order, whichever finished first
+        for (auto & chunk : chunks) {
+            for (const auto code : chunk.channels) {
+                if (!m_written.contains(code)) {
+                    m_written.insert(code);
+                    buffer.append(channelRecord(code));
+                }
+            }
+            buffer.append(chunk.data);
+            chunk.data.clear();
+
+            sessions += chunk.sessions;
+            blocks += chunk.blocks;
+            rows += chunk.rows;
+
+            if (buffer.size() >= column_buffer_size) {
+                ok = (file.write(buffer) == buffer.size());
+                buffer.resize(0);   // keeps the reserved space
+                if (!ok) break;
+            }
+        }
+
+        done += count;
+        emit setProgressValue(done);
+        QCoreApplication::processEvents();
+    }
+
+    if (ok) {
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        setupStream(out);
+        out << sessions << blocks << rows;
+        appendRecord(buffer, TagEnd, payload);
+
+        ok = (file.write(buffer) == buffer.size());
+    }
+    if (!ok) {
+        qWarning() << "Couldn't write to" << filename;
+    }
+
+    file.close();
+    return ok;
+}
@@ -0,0 +1,118 @@
+/* SleepLib Columnar Export Header
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#ifndef COLUMNEXPORT_H
+#define COLUMNEXPORT_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QDate>
+#include <QList>
+#include <QSet>
+#include <QThreadPool>
+
+#include "SleepLib/machine_common.h"
+
+class Day;
+class Session;
+class EventList;
+
+const quint16 columnexport_version = 1;
+
+/*! \class ColumnExport
+    \brief Writes every session's raw events and waveforms in a date range out as typed, compressed column blocks
+
+    The file is self describing, so it can be read back without SleepyHead or its channel schema.
+    Everything is little endian, strings are QDataStream (Qt_4_6) QStrings.
+
+    File:    "SHCOLS\r\n", quint16 version, then records up to and including an End record
+    Record:  quint8 tag, quint32 payload length, payload. Unknown tags can be skipped by length.
+
+    Channel: quint32 channel id, QString code, QString label, QString units, quint16 ChanType
+             Written once, before the first block that uses the channel
+    Session: quint32 session id, qint32 julian day, quint16 MachineType, quint32 machine id, QString serial,
+             qint64 first, qint64 last
+             Written before that session's blocks
+    Block:   quint32 session id, quint32 channel id, quint8 EventListType, quint8 flags (1 = has data2),
+             float gain, float offset, float rate, qint64 first, qint64 last, quint32 start, quint32 rows,
+             then the time column (events only), the data column and the data2 column (if flagged)
+             Holds rows [start, start + rows) of one EventList, long lists are split over several blocks.
+             Values are raw EventStoreType, the real value is raw * gain + offset.
+             Event times are quint32 milliseconds after first, waveform sample i is at first + i * rate.
+    Column:  quint8 encoding, quint32 decoded bytes, quint32 stored bytes, stored bytes
+             Encoding 0 is the plain little endian values, encoding 1 is the values delta coded (wrapping,
+             each value minus the one before) and then qCompress()ed (4 byte big endian size then zlib)
+    End:     quint32 sessions, quint32 blocks, quint64 rows
+
+    Days are encoded on the worker pool a batch at a time and written in date order, and each session's events
+    are only held open while it's being encoded, so memory use doesn't grow with the size of the profile.
+    */
+class ColumnExport : public QObject
+{
+    Q_OBJECT
+    friend class ColumnDayJob;
+  public:
+    enum Tag {
+        TagChannel = 1,
+        TagSession = 2,
+        TagBlock = 3,
+        TagEnd = 0xff
+    };
+
+    enum Encoding {
+        Plain = 0,
+        DeltaZlib = 1
+    };
+
+    ColumnExport(QObject * parent = nullptr);
+    virtual ~ColumnExport() {}
+
+    //! \brief Export every session in [start, end] to filename, returns false if the file couldn't be written
+    bool exportRange(const QString & filename, QDate start, QDate end);
+
+  public slots:
+    //! \brief Stop after the batch of days currently being encoded, the file is still closed off properly
+    void abort() { m_abort = true; }
+
+  signals:
+    void setProgressMax(int max);
+    void setProgressValue(int value);
+
+  protected:
+    //! \brief What a worker produced for one day
+    struct Chunk {
+        QByteArray data;
+        QSet<ChannelID> channels;   // channels its blocks use
+        quint32 sessions;
+        quint32 blocks;
+        quint64 rows;
+    };
+
+    //! \brief Encode every session in day into chunk, called from the worker threads
+    void encodeDay(Chunk & chunk, QDate date, Day * day);
+
+    //! \brief Encode one EventList's rows as blocks
+    void encodeList(Chunk & chunk, Session * sess, ChannelID code, EventList * ev);
+
+    //! \brief Appends a tag and length prefixed record to out
+    static void appendRecord(QByteArray & out, Tag tag, const QByteArray & payload);
+
+    //! \brief Appends the column header and encoded values of count EventStoreType or quint32 values
+    static void appendColumn(QByteArray & out, const EventStoreType * data, quint32 count);
+    static void appendColumn(QByteArray & out, const quint32 * data, quint32 count);
+
+    //! \brief Returns a Channel record for code, GUI thread only
+    QByteArray channelRecord(ChannelID code);
+
+    QSet<ChannelID> m_written;      // channels with a record already in the file
+
+    QThreadPool m_pool;
+    volatile bool m_abort;
+};
+
+#endif // COLUMNEXPORT_H
@@ -151,6 +151,10 @@ Qt::DayOfWeek firstDayOfWeekFromLocale()
 
 int idealThreads() { return QThread::idealThreadCount(); }
 
+static bool headless_mode = false;
+bool headless() { return headless_mode; }
+void setHeadless(bool b) { headless_mode = b; }
+
 qint64 timezoneOffset()
 {
     static bool ok = false;
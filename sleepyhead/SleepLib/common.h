@@ -42,6 +42,8 @@ QByteArray gUncompress(const QByteArray &data);
 const quint16 filetype_summary = 0;
 const quint16 filetype_data = 1;
 const quint16 filetype_sessenabled = 5;
+const quint16 filetype_importmanifest = 6;
+const quint16 filetype_summarychart = 7;
 
 enum UnitSystem { US_Undefined, US_Metric, US_Archiac };
 
@@ -64,6 +66,10 @@ struct ValueCount {
 
 extern int idealThreads();
 
+//! \brief True when running as a command line batch job, with no windows to show questions or messages in
+bool headless();
+void setHeadless(bool b);
+
 void copyPath(QString src, QString dst);
 
 
@@ -0,0 +1,429 @@
+/* SleepLib CSV Export Implementation
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QRunnable>
+#include <QDebug>
+#include <cmath>
+
+#include "SleepLib/csvexport.h"
+#include "SleepLib/profiles.h"
+#include "SleepLib/day.h"
+
+// Written out whenever this much has built up
+const int csv_buffer_size = 4 * 1024 * 1024;
+
+// Days formatted at once per worker thread, they're held in memory until written in order
+const int csv_days_per_thread = 2;
+
+const char csv_sep = ',';
+const char csv_newline = '\n';
+
+static void appendInt(QByteArray & out, qint64 value)
+{
+    char buf[24];
+    char * p = buf + sizeof(buf);
+    bool negative = value < 0;
+    quint64 v = negative ? quint64(-(value + 1)) + 1 : quint64(value);
+    do {
+        *--p = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    if (negative) {
+        *--p = '-';
+    }
+    out.append(p, int(buf + sizeof(buf) - p));
+}
+
+static inline void appendTwoDigits(QByteArray & out, int value)
+{
+    out.append(char('0' + (value / 10) % 10));
+    out.append(char('0' + value % 10));
+}
+
+//! \brief Same as QString::number(value, 'f', decimals), without the allocations for ordinary sized values
+static void appendFixed(QByteArray & out, double value, int decimals)
+{
+    static const double scale[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+    if ((decimals < 0) || (decimals > 6) || !std::isfinite(value) || (fabs(value) >= 1e12)) {
+        out.append(QByteArray::number(value, 'f', decimals));
+        return;
+    }
+
+    qint64 scaled = qint64(floor(fabs(value) * scale[decimals] + 0.5));
+    if ((value < 0) && (scaled != 0)) {
+        out.append('-');
+    }
+    appendInt(out, scaled / qint64(scale[decimals]));
+    if (decimals > 0) {
+        out.append('.');
+        qint64 frac = scaled % qint64(scale[decimals]);
+        char buf[8];
+        for (int i = decimals - 1; i >= 0; --i) {
+            buf[i] = '0' + (frac % 10);
+            frac /= 10;
+        }
+        out.append(buf, decimals);
+    }
+}
+
+//! \brief Same as QString().sprintf("%02i:%02i:%02i") of a duration in seconds
+static void appendClock(QByteArray & out, int time)
+{
+    int h = time / 3600;
+    if (h < 10) {
+        out.append('0');
+    }
+    appendInt(out, h);
+    out.append(':');
+    appendTwoDigits(out, (time / 60) % 60);
+    out.append(':');
+    appendTwoDigits(out, time % 60);
+}
+
+/*! \class CSVTimestamp
+    \brief Formats millisecond timestamps the same as QDateTime::fromTime_t(t / 1000).toString(Qt::ISODate)
+
+    Timezone offsets are always whole minutes, so only the "yyyy-MM-ddTHH:mm:" part needs QDateTime,
+    and that's only worked out again when the minute changes.
+    */
+class CSVTimestamp
+{
+  public:
+    CSVTimestamp() :m_minute(-1) {}
+
+    void append(QByteArray & out, qint64 ms) {
+        qint64 secs = ms / 1000L;
+        qint64 minute = secs / 60;
+        if (minute != m_minute) {
+            m_minute = minute;
+            m_prefix = QDateTime::fromTime_t(minute * 60).toString(Qt::ISODate).left(17).toLatin1();
+        }
+        out.append(m_prefix);
+        appendTwoDigits(out, int(secs % 60));
+    }
+
+  protected:
+    qint64 m_minute;
+    QByteArray m_prefix;
+};
+
+/*! \class CSVDayJob
+    \brief Formats one day for CSVExport on the worker pool
+    */
+class CSVDayJob:public QRunnable
+{
+  public:
+    CSVDayJob(CSVExport * exporter, QDate date, Day * day, QByteArray * out)
+        :m_exporter(exporter), m_date(date), m_day(day), m_out(out) {}
+    virtual ~CSVDayJob() {}
+
+    virtual void run() { m_exporter->formatDay(*m_out, m_date, m_day); }
+  protected:
+    CSVExport * m_exporter;
+    QDate m_date;
+    Day * m_day;
+    QByteArray * m_out;
+};
+
+CSVExport::CSVExport(Mode mode, QObject * parent)
+    :QObject(parent), m_mode(mode), m_abort(false)
+{
+    m_countlist.append(CPAP_Hypopnea);
+    m_countlist.append(CPAP_Obstructive);
+    m_countlist.append(CPAP_Apnea);
+    m_countlist.append(CPAP_ClearAirway);
+    m_countlist.append(CPAP_VSnore);
+    m_countlist.append(CPAP_VSnore2);
+    m_countlist.append(CPAP_RERA);
+    m_countlist.append(CPAP_FlowLimit);
+    m_countlist.append(CPAP_SensAwake);
+    m_countlist.append(CPAP_NRI);
+    m_countlist.append(CPAP_ExP);
+    m_countlist.append(CPAP_LeakFlag);
+    m_countlist.append(CPAP_UserFlag1);
+    m_countlist.append(CPAP_UserFlag2);
+    m_countlist.append(CPAP_PressurePulse);
+
+    m_avglist.append(CPAP_Pressure);
+    m_avglist.append(CPAP_IPAP);
+    m_avglist.append(CPAP_EPAP);
+    m_avglist.append(CPAP_FLG);        // Pholynyk, 25Aug2015, add ResMed Flow Limitation
+
+    m_p90list.append(CPAP_Pressure);
+    m_p90list.append(CPAP_IPAP);
+    m_p90list.append(CPAP_EPAP);
+    m_p90list.append(CPAP_FLG);
+
+    m_maxlist.append(CPAP_Pressure);    // Pholynyk, 18Aug2015, add maximums
+    m_maxlist.append(CPAP_IPAP);
+    m_maxlist.append(CPAP_EPAP);
+    m_maxlist.append(CPAP_FLG);
+
+    m_percent = p_profile->general->prefCalcPercentile() / 100.0;
+
+    m_pool.setMaxThreadCount(AppSetting->multithreading() ? idealThreads() : 1);
+}
+
+QString CSVExport::header() const
+{
+    const QString sep = ",";
+    QString header;
+
+    // Not sure this section should be translateable.. :-/
+    if (m_mode == Details) {
+        header = QCoreApplication::translate("ExportCSV", "DateTime") + sep + QCoreApplication::translate("ExportCSV", "Session") + sep
+                + QCoreApplication::translate("ExportCSV", "Event") + sep + QCoreApplication::translate("ExportCSV", "Data/Duration");
+        return header;
+    }
+
+    if (m_mode == Summary) {
+        header = QCoreApplication::translate("ExportCSV", "Date") + sep + QCoreApplication::translate("ExportCSV", "Session Count");
+    } else {
+        header = QCoreApplication::translate("ExportCSV", "Date") + sep + QCoreApplication::translate("ExportCSV", "Session");
+    }
+    header += sep + QCoreApplication::translate("ExportCSV", "Start") + sep + QCoreApplication::translate("ExportCSV", "End") + sep
+            + QCoreApplication::translate("ExportCSV", "Total Time") + sep + QCoreApplication::translate("ExportCSV", "AHI");
+
+    for (const auto code : m_countlist) {
+        header += sep + schema::channel[code].label() + QCoreApplication::translate("ExportCSV", " Count");
+    }
+
+    for (const auto code : m_avglist) {
+        header += sep + Day::calcMiddleLabel(code);        // Pholynyk, 18Aug2015
+    }
+
+    for (const auto code : m_p90list) {
+        header += sep + QCoreApplication::translate("ExportCSV", "%1% ").arg(m_percent * 100.0, 0, 'f', 0) + schema::channel[code].label();
+    }
+
+    for (const auto code : m_maxlist) {
+        header += sep + Day::calcMaxLabel(code);           // added -- Pholynyk, 18Aug2015
+    }
+    return header;
+}
+
+void CSVExport::formatSummary(QByteArray & out, QDate date, Day * day)
+{
+    CSVTimestamp timestamp;
+
+    out.append(date.toString(Qt::ISODate).toLatin1());
+    out.append(csv_sep);
+    appendInt(out, day->size());
+    out.append(csv_sep);
+    timestamp.append(out, day->first());
+    out.append(csv_sep);
+    timestamp.append(out, day->last());
+    out.append(csv_sep);
+    appendClock(out, day->total_time() / 1000L);
+
+    float ahi = day->count(CPAP_Obstructive) + day->count(CPAP_Hypopnea) + day->count(CPAP_Apnea) + day->count(CPAP_ClearAirway);
+    ahi /= day->hours();
+    out.append(csv_sep);
+    appendFixed(out, ahi, 3);
+
+    for (const auto code : m_countlist) {
+        out.append(csv_sep);
+        out.append(QByteArray::number(day->count(code)));
+    }
+
+    for (const auto code : m_avglist) {
+        out.append(csv_sep);
+        out.append(QByteArray::number(day->calcMiddle(code)));     // Pholynyk, 11Aug2015
+    }
+
+    for (const auto code : m_p90list) {
+        out.append(csv_sep);
+        out.append(QByteArray::number(day->percentile(code, m_percent)));
+    }
+
+    for (const auto code : m_maxlist) {
+        out.append(csv_sep);
+        out.append(QByteArray::number(day->calcMax(code)));        // added -- Pholynyk, 18Aug2015
+    }
+    out.append(csv_newline);
+}
+
+void CSVExport::formatSessions(QByteArray & out, QDate date, Day * day)
+{
+    CSVTimestamp timestamp;
+    QByteArray datestr = date.toString(Qt::ISODate).toLatin1();
+
+    for (auto & sess : day->sessions) {
+        out.append(datestr);
+        out.append(csv_sep);
+        appendInt(out, sess->session());
+        out.append(csv_sep);
+        timestamp.append(out, sess->first());
+        out.append(csv_sep);
+        timestamp.append(out, sess->last());
+        out.append(csv_sep);
+        appendClock(out, sess->length() / 1000L);
+
+        float ahi = sess->count(CPAP_Obstructive) + sess->count(CPAP_Hypopnea) + sess->count(CPAP_Apnea) + sess->count(CPAP_ClearAirway);
+        ahi /= sess->hours();
+        out.append(csv_sep);
+        appendFixed(out, ahi, 3);
+
+        for (const auto code : m_countlist) {
+            out.append(csv_sep);
+            out.append(QByteArray::number(sess->count(code)));
+        }
+
+        for (const auto code : m_avglist) {
+            out.append(csv_sep);
+            out.append(QByteArray::number(sess->calcMiddle(code)));   // Pholynyk, 11Aug2015
+        }
+
+        for (const auto code : m_p90list) {
+            out.append(csv_sep);
+            out.append(QByteArray::number(sess->percentile(code, m_percent)));
+        }
+
+        for (const auto code : m_maxlist) {
+            out.append(csv_sep);
+            out.append(QByteArray::number(sess->calcMax(code)));
+        }
+        out.append(csv_newline);
+    }
+}
+
+void CSVExport::formatDetails(QByteArray & out, Day * day)
+{
+    CSVTimestamp timestamp;
+    QList<ChannelID> all = m_countlist;
+    all.append(m_avglist);
+
+    for (auto & sess : day->sessions) {
+        bool loaded = sess->eventsLoaded();
+        sess->OpenEvents();
+
+        QByteArray sessid = QByteArray::number(sess->session());
+
+        for (const auto code : all) {
+            auto fnd = sess->eventlist.find(code);
+            if (fnd == sess->eventlist.end()) {
+                continue;
+            }
+            const QByteArray & chan = m_codes[code];
+
+            for (auto & ev : fnd.value()) {
+                quint32 count = ev->count();
+                // About how long each line comes out, so the buffer grows once per list
+                out.reserve(out.size() + int(count) * (30 + sessid.size() + chan.size()));
+
+                for (quint32 q = 0; q < count; ++q) {
+                    timestamp.append(out, ev->time(q));
+                    out.append(csv_sep);
+                    out.append(sessid);
+                    out.append(csv_sep);
+                    out.append(chan);
+                    out.append(csv_sep);
+                    appendFixed(out, ev->data(q), 2);
+                    out.append(csv_newline);
+                }
+            }
+        }
+
+        // Leave anything else that had them open alone, like the Daily view
+        if (!loaded) {
+            sess->TrashEvents();
+        }
+    }
+}
+
+void CSVExport::formatDay(QByteArray & out, QDate date, Day * day)
+{
+    switch (m_mode) {
+    case Summary:
+        formatSummary(out, date, day);
+        break;
+    case Sessions:
+        formatSessions(out, date, day);
+        break;
+    case Details:
+        formatDetails(out, day);
+        break;
+    }
+}
+
+bool CSVExport::exportRange(const QString & filename, QDate start, QDate end)
+{
+    QFile file(filename);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "Couldn't open" << filename << "for writing";
+        return false;
+    }
+    m_abort = false;
+
+    // Looked up here, as schema::channel isn't safe to touch from the workers
+    m_codes.clear();
+    for (const auto code : m_countlist + m_avglist) {
+        m_codes[code] = schema::channel[code].code().toLatin1();
+    }
+
+    // Summaries are opened here, so the workers only ever load events
+    QList<QPair<QDate, Day *> > days;
+    for (QDate date = start; date <= end; date = date.addDays(1)) {
+        Day * day = p_profile->GetDay(date, MT_CPAP);
+        if (day) {
+            days.append(qMakePair(date, day));
+        }
+    }
+
+    emit setProgressMax(days.size());
+    emit setProgressValue(0);
+
+    QByteArray buffer;
+    buffer.reserve(csv_buffer_size + csv_buffer_size / 4);
+    buffer.append(header().toLatin1());
+    buffer.append(csv_newline);
+
+    bool ok = true;
+    int batch = m_pool.maxThreadCount() * csv_days_per_thread;
+    int done = 0;
+
+    while ((done < days.size()) && !m_abort && ok) {
+        int count = qMin(batch, days.size() - done);
+        QVector<QByteArray> chunks(count);
+
+        for (int i = 0; i < count; ++i) {
+            const auto & entry = days.at(done + i);
+            CSVDayJob * job = new CSVDayJob(this, entry.first, entry.second, &chunks[i]);
+            job->setAutoDelete(true);
+            m_pool.start(job);
+        }
+        m_pool.waitForDone();
+
+        // Written out in date order, whichever finished first
+        for (const auto & chunk : chunks) {
+            buffer.append(chunk);
+            if (buffer.size() >= csv_buffer_size) {
+                ok = (file.write(buffer) == buffer.size());
+                buffer.resize(0);   // keeps the reserved space
+                if (!ok) break;
+            }
+        }
+
+        done += count;
+        emit setProgressValue(done);
+        QCoreApplication::processEvents();
+    }
+
+    if (ok && !buffer.isEmpty()) {
+        ok = (file.write(buffer) == buffer.size());
+    }
+    if (!ok) {
+        qWarning() << "Couldn't write to" << filename;
+    }
+
+    file.close();
+    return ok;
+}
@@ -0,0 +1,75 @@
+/* SleepLib CSV Export Header
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#ifndef CSVEXPORT_H
+#define CSVEXPORT_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QDate>
+#include <QHash>
+#include <QList>
+#include <QThreadPool>
+
+#include "SleepLib/machine_common.h"
+
+class Day;
+
+/*! \class CSVExport
+    \brief Writes a range of days' summary, session or event data out as CSV
+
+    Each day is formatted into its own buffer on a worker thread, opening its events for only as long as
+    it needs them, and the buffers are written out in date order through one large write buffer.
+    */
+class CSVExport : public QObject
+{
+    Q_OBJECT
+    friend class CSVDayJob;
+  public:
+    enum Mode {
+        Summary,        // one line per day
+        Sessions,       // one line per session
+        Details         // one line per event
+    };
+
+    CSVExport(Mode mode, QObject * parent = nullptr);
+    virtual ~CSVExport() {}
+
+    //! \brief Export CPAP days in [start, end] to filename, returns false if the file couldn't be written
+    bool exportRange(const QString & filename, QDate start, QDate end);
+
+    //! \brief Returns the header line for this mode, without a line ending
+    QString header() const;
+
+  public slots:
+    //! \brief Stop after the batch of days currently being formatted
+    void abort() { m_abort = true; }
+
+  signals:
+    void setProgressMax(int max);
+    void setProgressValue(int value);
+
+  protected:
+    //! \brief Format one day's lines into out, called from the worker threads
+    void formatDay(QByteArray & out, QDate date, Day * day);
+
+    void formatSummary(QByteArray & out, QDate date, Day * day);
+    void formatSessions(QByteArray & out, QDate date, Day * day);
+    void formatDetails(QByteArray & out, Day * day);
+
+    Mode m_mode;
+    QList<ChannelID> m_countlist, m_avglist, m_p90list, m_maxlist;
+    EventDataType m_percent;
+
+    QHash<ChannelID, QByteArray> m_codes;   // channel codes, looked up before the workers start
+
+    QThreadPool m_pool;
+    volatile bool m_abort;
+};
+
+#endif // CSVEXPORT_H
@@ -7,6 +7,9 @@
  * for more details. */
 
 #include <QMultiMap>
+#include <QFileInfo>
+#include <QDataStream>
+#include <QDateTime>
 
 #include <algorithm>
 #include <cmath>
@@ -17,11 +20,11 @@
 #include "profiles.h"
 
 Day::Day()
+  : d_cacheMutex(QMutex::Recursive)
 {
     d_firstsession = true;
-    d_summaries_open = false;
+    d_summaries_open.storeRelease(0);
     d_events_open = false;
-    d_invalidate = true;
 
 }
 Day::~Day()
@@ -31,8 +34,17 @@ Day::~Day()
     }
 }
 
+void Day::invalidate()
+{
+    clearUsage();
+    if (p_profile) {
+        p_profile->dayChanged(d_date);
+    }
+}
+
 void Day::updateCPAPCache()
 {
+    QMutexLocker lock(&d_cacheMutex);
     d_count.clear();
     d_sum.clear();
     OpenSummary();
@@ -41,7 +53,6 @@ void Day::updateCPAPCache()
     for (const auto code : channels) {
         d_count[code] = count(code);
         d_sum[code] = count(code);
-        d_machhours[MT_CPAP] = hours(MT_CPAP);
     }
 }
 
@@ -160,6 +171,7 @@ QString Day::calcPercentileLabel(ChannelID code)
 
 EventDataType Day::countInsideSpan(ChannelID span, ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     int count = 0;
     for (auto & sess : sessions) {
         if (sess->enabled()) {
@@ -171,6 +183,7 @@ EventDataType Day::countInsideSpan(ChannelID span, ChannelID code)
 
 EventDataType Day::lookupValue(ChannelID code, qint64 time, bool square)
 {
+    QMutexLocker lock(&d_cacheMutex);
     for (auto & sess : sessions) {
         if (sess->enabled()) {
             if ((time > sess->first()) && (time < sess->last())) {
@@ -186,6 +199,7 @@ EventDataType Day::lookupValue(ChannelID code, qint64 time, bool square)
 
 EventDataType Day::timeAboveThreshold(ChannelID code, EventDataType threshold)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType val = 0;
 
     for (auto & sess : sessions) {
@@ -198,6 +212,7 @@ EventDataType Day::timeAboveThreshold(ChannelID code, EventDataType threshold)
 
 EventDataType Day::timeBelowThreshold(ChannelID code, EventDataType threshold)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType val = 0;
 
     for (auto & sess : sessions) {
@@ -211,6 +226,7 @@ EventDataType Day::timeBelowThreshold(ChannelID code, EventDataType threshold)
 
 EventDataType Day::settings_sum(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType val = 0;
 
     for (auto & sess : sessions) {
@@ -226,6 +242,7 @@ EventDataType Day::settings_sum(ChannelID code)
 
 EventDataType Day::settings_max(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType min = -std::numeric_limits<EventDataType>::max();
     EventDataType max = min;
     EventDataType value;
@@ -243,6 +260,7 @@ EventDataType Day::settings_max(ChannelID code)
 
 EventDataType Day::settings_min(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType max = std::numeric_limits<EventDataType>::max();
     EventDataType min = max;
     EventDataType value;
@@ -260,6 +278,7 @@ EventDataType Day::settings_min(ChannelID code)
 
 EventDataType Day::settings_avg(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType val = 0;
     int cnt = 0;
 
@@ -280,6 +299,7 @@ EventDataType Day::settings_avg(ChannelID code)
 
 EventDataType Day::settings_wavg(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     double s0 = 0, s1 = 0, s2 = 0, tmp;
 
     for (auto & sess : sessions) {
@@ -303,6 +323,7 @@ EventDataType Day::settings_wavg(ChannelID code)
 
 EventDataType Day::percentile(ChannelID code, EventDataType percentile)
 {
+    QMutexLocker lock(&d_cacheMutex);
     // Cache this calculation?
     //    QHash<ChannelID, QHash<EventDataType, EventDataType> >::iterator pi;
     //    pi=perc_cache.find(code);
@@ -442,6 +463,7 @@ EventDataType Day::p90(ChannelID code)
 
 EventDataType Day::rangeCount(ChannelID code, qint64 st, qint64 et)
 {
+    QMutexLocker lock(&d_cacheMutex);
     int cnt = 0;
 
     for (auto & sess : sessions) {
@@ -454,6 +476,7 @@ EventDataType Day::rangeCount(ChannelID code, qint64 st, qint64 et)
 }
 EventDataType Day::rangeSum(ChannelID code, qint64 st, qint64 et)
 {
+    QMutexLocker lock(&d_cacheMutex);
     double val = 0;
 
     for (auto & sess : sessions) {
@@ -466,6 +489,7 @@ EventDataType Day::rangeSum(ChannelID code, qint64 st, qint64 et)
 }
 EventDataType Day::rangeAvg(ChannelID code, qint64 st, qint64 et)
 {
+    QMutexLocker lock(&d_cacheMutex);
     double val = 0;
     int cnt = 0;
 
@@ -482,6 +506,7 @@ EventDataType Day::rangeAvg(ChannelID code, qint64 st, qint64 et)
 }
 EventDataType Day::rangeWavg(ChannelID code, qint64 st, qint64 et)
 {
+    QMutexLocker lock(&d_cacheMutex);
     double sum = 0;
     double cnt = 0;
     qint64 lasttime, time;
@@ -530,6 +555,7 @@ EventDataType Day::rangeWavg(ChannelID code, qint64 st, qint64 et)
 // Boring non weighted percentile
 EventDataType Day::rangePercentile(ChannelID code, float p, qint64 st, qint64 et)
 {
+    QMutexLocker lock(&d_cacheMutex);
     int count = rangeCount(code, st,et);
     QVector<EventDataType> list;
     list.resize(count);
@@ -574,6 +600,7 @@ EventDataType Day::rangePercentile(ChannelID code, float p, qint64 st, qint64 et
 
 EventDataType Day::avg(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     double val = 0;
     // Cache this?
     int cnt = 0;
@@ -592,6 +619,7 @@ EventDataType Day::avg(ChannelID code)
 
 EventDataType Day::sum(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     // Cache this?
     EventDataType val = 0;
 
@@ -606,6 +634,7 @@ EventDataType Day::sum(ChannelID code)
 
 EventDataType Day::wavg(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     double s0 = 0, s1 = 0, s2 = 0;
     qint64 d;
 
@@ -628,147 +657,70 @@ EventDataType Day::wavg(ChannelID code)
     return (s1 / s2);
 }
 
-// Total session time in milliseconds
-qint64 Day::total_time()
+Day::Usage Day::usage(MachineType type)
 {
-    qint64 d_totaltime = 0;
-    QMultiMap<qint64, bool> range;
-    //range.reserve(size()*2);
+    QMutexLocker lock(&d_usageMutex);
+    auto it = d_usage.find(type);
+    if (it != d_usage.end()) {
+        return it.value();
+    }
 
     // Remember sessions may overlap..
-
-    qint64 first, last;
-
+    Usage result;
     for (auto & sess : sessions) {
-        int slicesize = sess->m_slices.size();
-
-        if (sess->enabled() && (sess->type() != MT_JOURNAL)) {
-            first = sess->first();
-            last = sess->last();
-
-            if (slicesize == 0) {
-                // This algorithm relies on non zero length, and correctly ordered sessions
-                if (last > first) {
-                    range.insert(first, 0);
-                    range.insert(last, 1);
-                    d_totaltime += sess->length();
-                }
-            } else {
-                for (auto & slice : sess->m_slices) {
-                    if (slice.status == EquipmentOn) {
-                        range.insert(slice.start, 0);
-                        range.insert(slice.end, 1);
-                        d_totaltime += slice.end - slice.start;
-                    }
-                }
-            }
-        }
-    }
-
-    bool b;
-    int nest = 0;
-    qint64 ti = 0;
-    qint64 total = 0;
-
-    // This is my implementation of a typical "brace counting" algorithm mentioned here:
-    // http://stackoverflow.com/questions/7468948/problem-calculating-overlapping-date-ranges
-
-    auto rend = range.end();
-    for (auto rit = range.begin(); rit != rend; ++rit) {
-        b = rit.value();
-
-        if (!b) {
-            if (!ti) {
-                ti = rit.key();
-            }
+        if (!sess->enabled()) continue;
+        if ((type == MT_UNKNOWN) ? (sess->type() == MT_JOURNAL) : (sess->type() != type)) continue;
 
-            nest++;
+        if (sess->m_slices.isEmpty()) {
+            result.spans.append(Interval(sess->first(), sess->last()));
         } else {
-            if (--nest <= 0) {
-                total += rit.key() - ti;
-                ti = 0;
+            for (const auto & slice : sess->m_slices) {
+                if (slice.status == EquipmentOn) {
+                    result.spans.append(Interval(slice.start, slice.end));
+                }
             }
         }
     }
+    result.total = unionIntervals(result.spans);
 
-    if (total != d_totaltime) {
-        // They can overlap.. tough.
-//        qDebug() << "Sessions Times overlaps!" << total << d_totaltime;
-    }
-
-    return total; //d_totaltime;
+    d_usage[type] = result;
+    return result;
 }
 
-// Total session time in milliseconds, only considering machinetype
-qint64 Day::total_time(MachineType type)
+EventDataType Day::indexCount(SessionIndex idx)
 {
-    qint64 d_totaltime = 0;
-    QMultiMap<qint64, bool> range;
-    //range.reserve(size()*2);
-
-    // Remember sessions may overlap..
-
-    qint64 first, last;
-    for (auto & sess : sessions) {
-        int slicesize = sess->m_slices.size();
-
-        if (sess->enabled() && (sess->type() == type)) {
-            first = sess->first();
-            last = sess->last();
-
-            // This algorithm relies on non zero length, and correctly ordered sessions
-            if (slicesize == 0) {
-                if (last > first) {
-                    range.insert(first, 0);
-                    range.insert(last, 1);
-                    d_totaltime += sess->length();
-                }
-            } else {
-                for (const auto & slice : sess->m_slices) {
-                    if (slice.status == EquipmentOn) {
-                        range.insert(slice.start, 0);
-                        range.insert(slice.end, 1);
-                        d_totaltime += slice.end - slice.start;
-                    }
-                }
-            }
-        }
+    QMutexLocker cachelock(&d_cacheMutex);
+    QMutexLocker lock(&d_usageMutex);
+    if (!d_indices.isEmpty()) {
+        return d_indices.at(idx);
     }
 
-    bool b;
-    int nest = 0;
-    qint64 ti = 0;
-    qint64 total = 0;
-
-    // This is my implementation of a typical "brace counting" algorithm mentioned here:
-    // http://stackoverflow.com/questions/7468948/problem-calculating-overlapping-date-ranges
-
-    auto rend = range.end();
-    for (auto rit = range.begin(); rit != rend; ++rit) {
-        b = rit.value();
-
-        if (!b) {
-            if (!ti) {
-                ti = rit.key();
-            }
-
-            nest++;
-        } else {
-            if (--nest <= 0) {
-                total += rit.key() - ti;
-                ti = 0;
-            }
+    QVector<EventDataType> indices(IDX_Count, 0);
+    for (auto & sess : sessions) {
+        if (!sess->enabled()) continue;
+        for (int i = 0; i < IDX_Count; ++i) {
+            indices[i] += sess->indexCount(SessionIndex(i));
         }
     }
 
-    if (total != d_totaltime) {
-        // They can overlap.. tough.
-//        qDebug() << "Sessions Times overlaps!" << total << d_totaltime;
+    // Sessions without their summaries loaded count as nothing, so don't keep that
+    if (d_summaries_open.loadAcquire()) {
+        d_indices = indices;
     }
+    return indices.at(idx);
+}
 
-    return total; //d_totaltime;
+EventDataType Day::eventCount()
+{
+    return indexCount(p_profile->eventIndex());
 }
 
+void Day::clearUsage()
+{
+    QMutexLocker lock(&d_usageMutex);
+    d_usage.clear();
+    d_indices.clear();
+}
 
 bool Day::hasEnabledSessions()
 {
@@ -808,6 +760,7 @@ bool Day::hasEnabledSessions(MachineType type)
 
 qint64 Day::first(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     qint64 date = 0;
     qint64 tmp;
 
@@ -830,6 +783,7 @@ qint64 Day::first(ChannelID code)
 
 qint64 Day::last(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     qint64 date = 0;
     qint64 tmp;
 
@@ -852,6 +806,7 @@ qint64 Day::last(ChannelID code)
 
 EventDataType Day::Min(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType min = 0;
     EventDataType tmp;
     bool first = true;
@@ -875,6 +830,7 @@ EventDataType Day::Min(ChannelID code)
 
 EventDataType Day::physMin(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType min = 0;
     EventDataType tmp;
     bool first = true;
@@ -898,6 +854,7 @@ EventDataType Day::physMin(ChannelID code)
 
 bool Day::hasData(ChannelID code, SummaryType type)
 {
+    QMutexLocker lock(&d_cacheMutex);
     bool has = false;
 
     for (auto & sess : sessions) {
@@ -965,6 +922,7 @@ bool Day::hasData(ChannelID code, SummaryType type)
 
 EventDataType Day::Max(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType max = 0;
     EventDataType tmp;
     bool first = true;
@@ -987,6 +945,7 @@ EventDataType Day::Max(ChannelID code)
 
 EventDataType Day::physMax(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType max = 0;
     EventDataType tmp;
     bool first = true;
@@ -1007,6 +966,7 @@ EventDataType Day::physMax(ChannelID code)
 }
 EventDataType Day::cph(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     double sum = 0;
 
     for (auto & sess : sessions) {
@@ -1020,6 +980,7 @@ EventDataType Day::cph(ChannelID code)
 
 EventDataType Day::sph(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType sum = 0;
     EventDataType h = 0;
 
@@ -1036,6 +997,7 @@ EventDataType Day::sph(ChannelID code)
 
 EventDataType Day::count(ChannelID code)
 {
+    QMutexLocker lock(&d_cacheMutex);
     EventDataType total = 0;
 
     for (auto & sess : sessions) {
@@ -1076,6 +1038,7 @@ bool Day::summaryOnly(Machine * mach)
 
 bool Day::settingExists(ChannelID id)
 {
+    QMutexLocker lock(&d_cacheMutex);
     for (auto & sess : sessions) {
         if (sess->enabled()) {
             auto set = sess->settings.find(id);
@@ -1100,6 +1063,7 @@ bool Day::eventsLoaded()
 
 bool Day::channelExists(ChannelID id)
 {
+    QMutexLocker lock(&d_cacheMutex);
     for (auto & sess : sessions) {
         if (sess->enabled() && sess->eventlist.contains(id)) {
             return true;
@@ -1117,6 +1081,7 @@ bool Day::hasEvents() {
 
 bool Day::channelHasData(ChannelID id)
 {
+    QMutexLocker lock(&d_cacheMutex);
     for (auto & sess : sessions) {
         if (sess->enabled()) {
             if (sess->m_cnt.contains(id)) {
@@ -1138,6 +1103,7 @@ bool Day::channelHasData(ChannelID id)
 
 void Day::OpenEvents()
 {
+    QMutexLocker lock(&d_cacheMutex);
     for (auto & sess : sessions) {
         if (sess->type() != MT_JOURNAL)
             sess->OpenEvents();
@@ -1147,16 +1113,41 @@ void Day::OpenEvents()
 
 void Day::OpenSummary()
 {
-    if (d_summaries_open) return;
+    if (d_summaries_open.loadAcquire()) return;
+
+    // Summary charts open these from background threads too
+    QMutexLocker lock(&d_cacheMutex);
+    if (d_summaries_open.loadAcquire()) return;
+
     for (auto & sess : sessions) {
         sess->LoadSummary();
     }
-    d_summaries_open = true;
+    // Slices come in with the summaries, so usage worked out before now may have been off
+    clearUsage();
+    d_summaries_open.storeRelease(1);
+}
+
+quint32 Day::fingerprint()
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+
+    for (auto & sess : sessions) {
+        out << (quint32)sess->session();
+        out << sess->first() << sess->last();
+        out << sess->enabled() << sess->summaryOnly();
+
+        // Rewritten whenever the session is reimported or recalculated
+        QFileInfo fi(sess->machine()->getSummariesPath() + QString().sprintf("%08lx.000", sess->session()));
+        out << fi.lastModified().toMSecsSinceEpoch();
+    }
+    return qHash(data);
 }
 
 
 void Day::CloseEvents()
 {
+    QMutexLocker lock(&d_cacheMutex);
     for (auto & sess : sessions) {
         sess->TrashEvents();
     }
@@ -1299,6 +1290,7 @@ bool Day::removeSession(Session *sess)
     if (!searchMachine(mt)) {
         machines.remove(mt);
     }
+    invalidate();
     return b;
 }
 bool Day::searchMachine(MachineType mt) {
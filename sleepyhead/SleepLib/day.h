@@ -9,11 +9,15 @@
 #ifndef DAY_H
 #define DAY_H
 
+#include <QAtomicInt>
+#include <QMutex>
+
 #include "SleepLib/common.h"
 #include "SleepLib/machine_common.h"
 #include "SleepLib/machine.h"
 #include "SleepLib/event.h"
 #include "SleepLib/session.h"
+#include "SleepLib/intervals.h"
 
 /*! \class OneTypePerDay
     \brief An Exception class to catch multiple machine records per day
@@ -154,10 +158,14 @@ class Day
     qint64 last(ChannelID code);
 
     //! \brief Returns the total time in milliseconds for this day
-    qint64 total_time();
+    qint64 total_time() { return usage(MT_UNKNOWN).total; }
 
     //! \brief Returns the total time in milliseconds for this day for given machine type
-    qint64 total_time(MachineType type);
+    qint64 total_time(MachineType type) { return usage(type).total; }
+
+    /*! \brief Returns the sorted, non overlapping spans the equipment was on for this days enabled sessions of type
+        MT_UNKNOWN gives every session but the journal */
+    QVector<Interval> onIntervals(MachineType type = MT_UNKNOWN) { return usage(type).spans; }
 
     //! \brief Returns true if this day has enabled sessions for supplied machine type
     bool hasEnabledSessions(MachineType);
@@ -166,18 +174,8 @@ class Day
     bool hasEnabledSessions();
 
     //! \brief Return the total time in decimal hours for this day
-    EventDataType hours() {
-        if (!d_invalidate) return d_hours;
-        d_invalidate = false;
-        return d_hours = double(total_time()) / 3600000.0;
-    }
-    EventDataType hours(MachineType type) {
-        auto it = d_machhours.find(type);
-        if (it == d_machhours.end()) {
-            return d_machhours[type] = double(total_time(type)) / 3600000.0;
-        }
-        return it.value();
-    }
+    EventDataType hours() { return double(total_time()) / 3600000.0; }
+    EventDataType hours(MachineType type) { return double(total_time(type)) / 3600000.0; }
 
     //! \brief Return the session indexed by i
     Session *operator [](int i) { return sessions[i]; }
@@ -205,6 +203,9 @@ class Day
     void OpenEvents();
     void OpenSummary();
 
+    //! \brief Returns a hash of this days sessions, their times and summary files. Changes whenever any of them do
+    quint32 fingerprint();
+
 
     //! \brief Closes all Events files for this Days Sessions
     void CloseEvents();
@@ -237,16 +238,22 @@ class Day
 
     // Some more very much CPAP only related stuff
 
+    //! \brief Returns the enabled sessions total of the events making up index idx, cached until invalidate()
+    EventDataType indexCount(SessionIndex idx);
+
+    //! \brief Returns the events in the AHI or RDI, whichever the profile is set to show (see Profile::eventIndex())
+    EventDataType eventCount();
+
     //! \brief Calculate AHI (Apnea Hypopnea Index)
     EventDataType calcAHI() {
-        EventDataType c = count(CPAP_Hypopnea) + count(CPAP_Obstructive) + count(CPAP_Apnea) + count(CPAP_ClearAirway);
+        EventDataType c = indexCount(IDX_AHI);
         EventDataType minutes = hours(MT_CPAP) * 60.0;
         return (c * 60.0) / minutes;
     }
 
     //! \brief Calculate RDI (Respiratory Disturbance Index)
     EventDataType calcRDI() {
-        EventDataType c = count(CPAP_Hypopnea) + count(CPAP_Obstructive) + count(CPAP_Apnea) + count(CPAP_ClearAirway) + count(CPAP_RERA);
+        EventDataType c = indexCount(IDX_RDI);
         EventDataType minutes = hours(MT_CPAP) * 60.0;
         return (c * 60.0) / minutes;
     }
@@ -269,7 +276,7 @@ class Day
 
     //! \brief SleepyyHead Events Index, AHI combined with SleepyHead detected events.. :)
     EventDataType calcSHEI() {
-        EventDataType c = count(CPAP_Hypopnea) + count(CPAP_Obstructive) + count(CPAP_Apnea) + count(CPAP_ClearAirway) + count(CPAP_UserFlag1) + count(CPAP_UserFlag2);
+        EventDataType c = indexCount(IDX_SHEI);
         EventDataType minutes = hours(MT_CPAP) * 60.0;
         return (c * 60.0) / minutes;
     }
@@ -302,15 +309,19 @@ class Day
     int useCounter() { return d_useCounter; }
 
 
-    void invalidate() {
-        d_invalidate = true;
-        d_machhours.clear();
-    }
+    //! \brief Drops the cached usage and index totals, and marks this date as changed in the profiles statistics
+    void invalidate();
 
     void updateCPAPCache();
 
     inline QDate date() const { return d_date; }
     void setDate(QDate date) { d_date = date; }
+
+    /*! \brief Held while this days Sessions and EventLists are read or loaded, as they fill their caches unlocked
+        Day's own accessors take it, anything reaching into the sessions directly from another thread, or while
+        another thread might, holds it around that. Recursive, and taken after the summary chart and aggregate cube
+        locks, never before them */
+    QMutex * cacheMutex() { return &d_cacheMutex; }
   protected:
 
 
@@ -320,14 +331,27 @@ class Day
   private:
     bool d_firstsession;
     int d_useCounter;
-    bool d_summaries_open;
+    QAtomicInt d_summaries_open;
+    QMutex d_cacheMutex;
     bool d_events_open;
-    float d_hours;
-    QHash<MachineType, EventDataType> d_machhours;
     QHash<ChannelID, long> d_count;
     QHash<ChannelID, double> d_sum;
-    bool d_invalidate;
     QDate d_date;
+
+    struct Usage {
+        QVector<Interval> spans;    // merged equipment on time
+        qint64 total;
+    };
+
+    //! \brief Returns the cached usage for type, merging the session spans the first time it's asked for
+    Usage usage(MachineType type);
+
+    //! \brief Throw away cached usage and index totals, after sessions, slices or enabled states change
+    void clearUsage();
+
+    QHash<MachineType, Usage> d_usage;
+    QVector<EventDataType> d_indices;   // SessionIndex totals, empty until first asked for
+    QMutex d_usageMutex;
 };
 
 
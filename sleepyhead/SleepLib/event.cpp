@@ -7,8 +7,16 @@
  * for more details. */
 
 #include <QDebug>
+#include <algorithm>
+#include <cmath>
 #include "event.h"
 
+// EVENT_NO_SSE2 forces the scalar paths, so the tests can check one against the other
+#if !defined(EVENT_NO_SSE2) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)))
+#include <emmintrin.h>
+#define EVENT_USE_SSE2
+#endif
+
 EventList::EventList(EventListType et, EventDataType gain, EventDataType offset, EventDataType min,
                      EventDataType max, double rate, bool second_field)
     : m_type(et), m_gain(gain), m_offset(offset), m_min(min), m_max(max), m_rate(rate),
@@ -16,6 +24,7 @@ EventList::EventList(EventListType et, EventDataType gain, EventDataType offset,
 {
     m_first = m_last = 0;
     m_count = 0;
+    m_pyramid_count = 0;
 
     if (min == max) { // Update Min & Max unless forceably set here..
         m_update_minmax = true;
@@ -42,6 +51,8 @@ void EventList::clear()
     m_data2.clear();
     m_time.clear();
 
+    m_pyramid.clear();
+    m_pyramid_count = 0;
 }
 
 qint64 EventList::time(quint32 i) const
@@ -53,6 +64,28 @@ qint64 EventList::time(quint32 i) const
     return m_first + qint64((EventDataType(i) * m_rate));
 }
 
+quint32 EventList::lowerBound(qint64 time) const
+{
+    if (time <= m_first) {
+        return 0;
+    }
+    qint64 offset = time - m_first;
+
+    if (m_type == EVL_Waveform) {
+        if (m_rate <= 0) {
+            return 0;
+        }
+        return qMin(qint64(ceil(double(offset) / m_rate)), qint64(m_count));
+    }
+
+    // Event times are stored in order
+    if (offset > qint64(0xffffffff)) {
+        return m_count;
+    }
+    const quint32 * begin = m_time.constData();
+    return std::lower_bound(begin, begin + m_count, quint32(offset)) - begin;
+}
+
 EventDataType EventList::data(quint32 i)
 {
     return EventDataType(m_data[i]) * m_gain;
@@ -327,3 +360,242 @@ void EventList::AddWaveform(qint64 start, char *data, int recs, qint64 duration)
         }
     }
 }
+
+int EventList::interleavedCount(int size, int offset, int interleave, int cycle)
+{
+    if ((cycle <= 0) || (interleave <= 0)) return 0;
+
+    int recs = (size / cycle) * interleave;
+
+    // Trailing partial cycle
+    int rem = (size % cycle) - offset;
+    if (rem > 0) {
+        recs += qMin(rem, interleave);
+    }
+    return recs;
+}
+
+// Pulls one signal out of an interleaved byte block into dp, tracking the raw min/max as it goes
+template <bool is_signed>
+static void deinterleaveBytes(const unsigned char *data, int size, int offset, int interleave, int cycle,
+                              EventStoreType *dp, EventStoreType &rmin, EventStoreType &rmax)
+{
+    EventStoreType min = rmin, max = rmax, raw;
+    int pos = 0;
+
+#ifdef EVENT_USE_SSE2
+    if ((interleave == 1) && (cycle == 2)) {
+        // Common two signal layout alternating every byte: split 8 samples at a time.
+        // Little endian loads put the even byte in the low half of each 16bit lane.
+        const __m128i lomask = _mm_set1_epi16(0x00ff);
+        __m128i vmin = _mm_set1_epi16(min);
+        __m128i vmax = _mm_set1_epi16(max);
+        int pairs = size / 2;
+        int i = 0;
+
+        for (; i + 8 <= pairs; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + i * 2));
+            __m128i r;
+            if (offset == 0) {
+                r = is_signed ? _mm_srai_epi16(_mm_slli_epi16(v, 8), 8) : _mm_and_si128(v, lomask);
+            } else {
+                r = is_signed ? _mm_srai_epi16(v, 8) : _mm_srli_epi16(v, 8);
+            }
+            _mm_storeu_si128((__m128i *)(dp + i), r);
+            vmin = _mm_min_epi16(vmin, r);
+            vmax = _mm_max_epi16(vmax, r);
+        }
+
+        EventStoreType lanes[8];
+        _mm_storeu_si128((__m128i *)lanes, vmin);
+        for (int n=0; n < 8; ++n) if (min > lanes[n]) min = lanes[n];
+        _mm_storeu_si128((__m128i *)lanes, vmax);
+        for (int n=0; n < 8; ++n) if (max < lanes[n]) max = lanes[n];
+
+        dp += i;
+        pos = i * 2;
+    }
+#endif
+
+    // Scalar path, and whatever the SIMD path left over
+    for (; pos < size; pos += cycle) {
+        int start = pos + offset;
+        int end = qMin(start + interleave, size);
+        for (int p = start; p < end; ++p) {
+            raw = is_signed ? EventStoreType((signed char)data[p]) : EventStoreType(data[p]);
+            if (min > raw) min = raw;
+            if (max < raw) max = raw;
+            *dp++ = raw;
+        }
+    }
+    rmin = min;
+    rmax = max;
+}
+
+void EventList::AddInterleavedWaveform(qint64 start, const unsigned char *data, int size, int offset, int interleave,
+                                       int cycle, qint64 duration, bool is_signed)
+{
+    if (m_type != EVL_Waveform) {
+        qWarning() << "Attempted to add waveform data to non-waveform object";
+        return;
+    }
+
+    if (!m_rate) {
+        qWarning() << "Attempted to add waveform without setting sample rate";
+        return;
+    }
+
+    int recs = interleavedCount(size, offset, interleave, cycle);
+    if (recs <= 0) return;
+
+    qint64 last = start + duration;
+
+    if (!m_first) {
+        m_first = start;
+        m_last = last;
+    } else if (m_last < last) {
+        m_last = last;
+    }
+
+    // Grow once, then write straight into the storage
+    int r = m_count;
+    m_count += recs;
+    m_data.resize(m_count);
+
+    EventStoreType *dp = m_data.data() + r;
+    EventStoreType rmin = 32767, rmax = -32768;
+
+    if (is_signed) {
+        deinterleaveBytes<true>(data, size, offset, interleave, cycle, dp, rmin, rmax);
+    } else {
+        deinterleaveBytes<false>(data, size, offset, interleave, cycle, dp, rmin, rmax);
+    }
+
+    if (m_update_minmax) {
+        EventDataType a = EventDataType(rmin) * m_gain + m_offset;
+        EventDataType b = EventDataType(rmax) * m_gain + m_offset;
+        if (a > b) qSwap(a, b);  // negative gains
+
+        if (m_min > a) { m_min = a; }
+        if (m_max < b) { m_max = b; }
+    }
+}
+
+void EventList::buildPyramid()
+{
+    m_pyramid.clear();
+    m_pyramid_count = m_count;
+
+    if ((m_type != EVL_Waveform) || (m_count < pyramid_min_count)) {
+        return;
+    }
+
+    // Lowest level straight from the samples
+    quint32 n = m_count / pyramid_block;
+    QVector<EventStoreType> level(n * 2);
+    const EventStoreType * src = m_data.constData();
+    EventStoreType * dst = level.data();
+
+    for (quint32 i = 0; i < n; ++i) {
+        EventStoreType mn = *src, mx = *src;
+        for (int j = 1; j < pyramid_block; ++j) {
+            EventStoreType v = src[j];
+            if (v < mn) mn = v;
+            if (v > mx) mx = v;
+        }
+        *dst++ = mn;
+        *dst++ = mx;
+        src += pyramid_block;
+    }
+    m_pyramid.append(level);
+
+    // Then each level from the one below, until there's nothing left to summarise
+    const quint32 fanout = 1 << pyramid_shift;
+    while ((n >> pyramid_shift) >= 2) {
+        quint32 n2 = n >> pyramid_shift;
+        QVector<EventStoreType> next(n2 * 2);
+
+        const EventStoreType * lsrc = m_pyramid.last().constData();
+        dst = next.data();
+        for (quint32 i = 0; i < n2; ++i) {
+            EventStoreType mn = lsrc[0], mx = lsrc[1];
+            for (quint32 j = 1; j < fanout; ++j) {
+                if (lsrc[j * 2] < mn) mn = lsrc[j * 2];
+                if (lsrc[j * 2 + 1] > mx) mx = lsrc[j * 2 + 1];
+            }
+            *dst++ = mn;
+            *dst++ = mx;
+            lsrc += fanout * 2;
+        }
+        m_pyramid.append(next);
+        n = n2;
+    }
+}
+
+void EventList::rawMinMax(quint32 start, quint32 end, EventStoreType & min, EventStoreType & max)
+{
+    if (end > m_count) end = m_count;
+
+    min = 32767;
+    max = -32768;
+    if (start >= end) return;
+
+    if ((m_type == EVL_Waveform) && (m_pyramid_count != m_count)) {
+        buildPyramid();
+    }
+
+    const EventStoreType * data = m_data.constData();
+    quint32 i = start;
+
+    auto scanRaw = [&](quint32 from, quint32 to) {
+        for (const EventStoreType * p = data + from, * pend = data + to; p < pend; ++p) {
+            if (*p < min) min = *p;
+            if (*p > max) max = *p;
+        }
+    };
+    auto scanLevel = [&](int lvl, quint32 from, quint32 to) {
+        const EventStoreType * p = m_pyramid.at(lvl).constData() + from * 2;
+        for (quint32 k = from; k < to; ++k, p += 2) {
+            if (p[0] < min) min = p[0];
+            if (p[1] > max) max = p[1];
+        }
+    };
+
+    quint32 block = pyramid_block;
+    if (m_pyramid.isEmpty() || ((end - start) < block * 2)) {
+        scanRaw(start, end);
+        return;
+    }
+
+    // Raw samples up to the first block boundary
+    quint32 aligned = qMin(end, ((i + block - 1) / block) * block);
+    scanRaw(i, aligned);
+    i = aligned;
+
+    // Climb while a whole block of the next level still fits before end
+    int lvl = 0;
+    int levels = m_pyramid.size();
+    while (lvl + 1 < levels) {
+        quint32 nextblock = block << pyramid_shift;
+        aligned = ((i + nextblock - 1) / nextblock) * nextblock;
+        if (aligned + nextblock > end) break;
+
+        scanLevel(lvl, i / block, aligned / block);
+        i = aligned;
+        block = nextblock;
+        lvl++;
+    }
+
+    // Then back down, taking as many whole blocks as fit at each level
+    while (true) {
+        quint32 blocks = (end - i) / block;
+        scanLevel(lvl, i / block, i / block + blocks);
+        i += blocks * block;
+        if (lvl == 0) break;
+        lvl--;
+        block >>= pyramid_shift;
+    }
+
+    // Leftovers past the last block boundary
+    scanRaw(i, end);
+}
@@ -10,12 +10,22 @@
 #define EVENT_H
 
 #include <QDateTime>
+#include <QVector>
 
 #include "machine_common.h"
 
 //! \brief EventLists can either be Waveform or Event types
 enum EventListType { EVL_Waveform, EVL_Event };
 
+//! \brief Samples summarised by each entry of the lowest min/max pyramid level
+const int pyramid_block = 16;
+
+//! \brief Each pyramid level covers 1 << pyramid_shift entries of the level below
+const int pyramid_shift = 2;
+
+//! \brief Waveforms shorter than this aren't worth a pyramid
+const quint32 pyramid_min_count = 4096;
+
 /*! \class EventList
     \author Mark Watkins <jedimark_at_users.sourceforge.net>
     \brief EventLists contains waveforms at a specified rate, or a list of event and time data.
@@ -40,6 +50,21 @@ class EventList
     void AddWaveform(qint64 start, unsigned char *data, int recs, qint64 duration);
     void AddWaveform(qint64 start, char *data, int recs, qint64 duration);
 
+    /*! \brief Add one signal out of a block of interleaved 8bit samples, widening straight into this lists storage
+        The block repeats cycle bytes, of which this signal owns interleave samples starting at offset */
+    void AddInterleavedWaveform(qint64 start, const unsigned char *data, int size, int offset, int interleave,
+                                int cycle, qint64 duration, bool is_signed);
+
+    //! \brief Returns how many samples AddInterleavedWaveform() would pull out of a block of size bytes
+    static int interleavedCount(int size, int offset, int interleave, int cycle);
+
+    /*! \brief Finds the raw ("ungained") minimum and maximum of samples start to end-1
+        Waveforms use the min/max pyramid, so the cost stays logarithmic in the number of samples */
+    void rawMinMax(quint32 start, quint32 end, EventStoreType & min, EventStoreType & max);
+
+    //! \brief (Re)builds the min/max pyramid of a waveform. Done automatically when the sample count changes
+    void buildPyramid();
+
     //! \brief Returns a count of records contained in this EventList
     inline quint32 count() const { return m_count; }
 
@@ -61,6 +86,9 @@ class EventList
     //! \brief Returns either the timestamp for the i'th event, or calculates the waveform time position i
     qint64 time(quint32 i) const;
 
+    //! \brief Returns the index of the first entry at or after time, or count() if there isn't one. Binary searches EVL_Event lists
+    quint32 lowerBound(qint64 time) const;
+
     //! \brief Returns true if this EventList uses the second data field
     bool hasSecondField() { return m_second_field; }
 
@@ -183,6 +211,13 @@ class EventList
     qint64 m_first, m_last;
     bool m_update_minmax;
     bool m_second_field;
+
+    /*! \brief Multi-resolution min/max summary of m_data, for waveforms only
+        Level n holds min,max pairs for each full run of (pyramid_block << (pyramid_shift * n)) samples */
+    QVector<QVector<EventStoreType> > m_pyramid;
+
+    //! \brief m_count when m_pyramid was built
+    quint32 m_pyramid_count;
 };
 
 #endif // EVENT_H
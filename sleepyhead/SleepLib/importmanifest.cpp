@@ -0,0 +1,298 @@
+/* SleepLib Import Manifest Implementation
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#include <QFile>
+#include <QDebug>
+#include <QDateTime>
+
+#include "importmanifest.h"
+#include "machine.h"
+#include "machine_loader.h"
+
+#ifdef _MSC_VER
+#include "QtZlib/zlib.h"
+#else
+#include "zlib.h"
+#endif
+
+const quint16 importmanifest_version = 1;
+
+QDataStream & operator<<(QDataStream & out, const ImportedFile & rec)
+{
+    out << rec.size;
+    out << rec.modified;
+    out << rec.checksum;
+    out << rec.backup;
+
+    out << (qint32)rec.sessions.size();
+    for (auto & sid : rec.sessions) {
+        out << (quint32)sid;
+    }
+    return out;
+}
+
+QDataStream & operator>>(QDataStream & in, ImportedFile & rec)
+{
+    in >> rec.size;
+    in >> rec.modified;
+    in >> rec.checksum;
+    in >> rec.backup;
+
+    qint32 cnt;
+    quint32 sid;
+    in >> cnt;
+    rec.sessions.clear();
+    for (int i=0; i < cnt; ++i) {
+        in >> sid;
+        rec.sessions.append(sid);
+    }
+    return in;
+}
+
+ImportManifest::ImportManifest(Machine * mach)
+    :m_machine(mach), m_changed(false)
+{
+}
+
+QString ImportManifest::filename()
+{
+    return m_machine->getDataPath() + "Imported.manifest";
+}
+
+void ImportManifest::clear()
+{
+    m_files.clear();
+    m_staged.clear();
+    m_changed = true;
+}
+
+bool ImportManifest::Load()
+{
+    m_files.clear();
+    m_staged.clear();
+    m_changed = false;
+
+    QFile file(filename());
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setByteOrder(QDataStream::LittleEndian);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 mag32;
+    quint16 ft16, version;
+    qint32 loaderversion;
+
+    in >> mag32;
+    in >> ft16;
+    in >> version;
+    in >> loaderversion;
+
+    if ((mag32 != magic) || (ft16 != filetype_importmanifest) || (version != importmanifest_version)) {
+        qDebug() << "Import manifest" << file.fileName() << "is outdated, ignoring it";
+        m_changed = true;
+        return false;
+    }
+
+    MachineLoader * loader = m_machine->loader();
+    if (loader && (loader->Version() != loaderversion)) {
+        // Loader changed how it decodes files, so everything needs decoding again
+        qDebug() << "Import manifest for" << m_machine->loaderName() << "belongs to a different loader version";
+        m_changed = true;
+        return false;
+    }
+
+    qint32 size;
+    in >> size;
+
+    QString key;
+    for (int i=0; i < size; ++i) {
+        ImportedFile rec;
+        in >> key;
+        in >> rec;
+        if (in.status() != QDataStream::Ok) {
+            qWarning() << "Import manifest" << file.fileName() << "is corrupt, ignoring it";
+            m_files.clear();
+            m_changed = true;
+            return false;
+        }
+        m_files[key] = rec;
+    }
+
+    return true;
+}
+
+bool ImportManifest::Save()
+{
+    // Fingerprint anything imported this round
+    for (auto it=m_staged.begin(), end=m_staged.end(); it != end; ++it) {
+        auto fit = m_files.find(it.key());
+        if (fit == m_files.end()) continue;
+        ImportedFile & rec = fit.value();
+
+        // Only read it again if nothing passed the checksum in along the way
+        if (!it.value().isEmpty()) {
+            rec.checksum = fileChecksum(it.value());
+        }
+
+        // Only keep the sessions that really made it into the machine record (or are queued to),
+        // otherwise the file would be considered stale next time and decoded again for nothing.
+        for (int i=rec.sessions.size()-1; i >= 0; --i) {
+            SessionID sid = rec.sessions.at(i);
+            if (!m_machine->SessionExists(sid) && !m_machine->isStaged(sid)) {
+                rec.sessions.removeAt(i);
+            }
+        }
+    }
+    m_staged.clear();
+
+    if (!m_changed) return true;
+
+    QFile file(filename());
+    if (!file.open(QFile::WriteOnly)) {
+        qDebug() << "Couldn't open" << file.fileName() << "for writing";
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.setVersion(QDataStream::Qt_5_0);
+
+    MachineLoader * loader = m_machine->loader();
+
+    out << magic;
+    out << filetype_importmanifest;
+    out << importmanifest_version;
+    out << (qint32)(loader ? loader->Version() : 0);
+
+    out << (qint32)m_files.size();
+    for (auto it=m_files.begin(), end=m_files.end(); it != end; ++it) {
+        out << it.key();
+        out << it.value();
+    }
+
+    m_changed = false;
+    return true;
+}
+
+bool ImportManifest::isUnchanged(const QString & key, const QFileInfo & fi)
+{
+    auto it = m_files.find(key);
+    if (it == m_files.end()) {
+        return false;
+    }
+    ImportedFile & rec = it.value();
+
+    // Sessions deleted or purged since, so it has to come in again
+    for (auto & sid : rec.sessions) {
+        if (!m_machine->SessionExists(sid)) {
+            return false;
+        }
+    }
+
+    // Backup copy went missing, decode again so it gets recreated
+    if (!rec.backup.isEmpty() && !QFile::exists(rec.backup)) {
+        return false;
+    }
+
+    if (rec.size != fi.size()) {
+        return false;
+    }
+
+    qint64 modified = fi.lastModified().toMSecsSinceEpoch();
+    if (rec.modified == modified) {
+        return true;
+    }
+
+    // Same size but touched (or copied to another card), so only trust the contents
+    if (fileChecksum(fi.filePath()) != rec.checksum) {
+        return false;
+    }
+
+    rec.modified = modified;
+    m_changed = true;
+    return true;
+}
+
+void ImportManifest::stage(const QString & key, const QFileInfo & fi, const QString & backup)
+{
+    QMutexLocker lock(&m_mutex);
+
+    ImportedFile & rec = m_files[key];
+    rec.size = fi.size();
+    rec.modified = fi.lastModified().toMSecsSinceEpoch();
+    rec.checksum = 0;
+    rec.backup = backup;
+    rec.sessions.clear();
+
+    m_staged[key] = fi.filePath();
+    m_changed = true;
+}
+
+void ImportManifest::stage(const QString & key, const QFileInfo & fi, quint32 checksum, const QString & backup)
+{
+    QMutexLocker lock(&m_mutex);
+
+    ImportedFile & rec = m_files[key];
+    rec.size = fi.size();
+    rec.modified = fi.lastModified().toMSecsSinceEpoch();
+    rec.checksum = checksum;
+    rec.backup = backup;
+    rec.sessions.clear();
+
+    m_staged[key] = QString();
+    m_changed = true;
+}
+
+void ImportManifest::setChecksum(const QString & key, quint32 checksum)
+{
+    QMutexLocker lock(&m_mutex);
+
+    auto sit = m_staged.find(key);
+    auto it = m_files.find(key);
+    if ((sit == m_staged.end()) || (it == m_files.end())) {
+        return;
+    }
+    it.value().checksum = checksum;
+    sit.value().clear();
+}
+
+void ImportManifest::addSession(const QString & key, SessionID sid)
+{
+    QMutexLocker lock(&m_mutex);
+
+    auto it = m_files.find(key);
+    if (it == m_files.end()) {
+        return;
+    }
+    QList<SessionID> & sessions = it.value().sessions;
+    if (!sessions.contains(sid)) {
+        sessions.append(sid);
+        m_changed = true;
+    }
+}
+
+quint32 ImportManifest::fileChecksum(const QString & path)
+{
+    QFile f(path);
+    if (!f.open(QFile::ReadOnly)) {
+        return 0;
+    }
+
+    const int bufsize = 65536;
+    QByteArray buffer(bufsize, 0);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    qint64 len;
+    while ((len = f.read(buffer.data(), bufsize)) > 0) {
+        crc = crc32(crc, (const Bytef *)buffer.constData(), len);
+    }
+    return crc;
+}
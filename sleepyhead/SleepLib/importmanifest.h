@@ -0,0 +1,114 @@
+/* SleepLib Import Manifest Header
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#ifndef IMPORTMANIFEST_H
+#define IMPORTMANIFEST_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QFileInfo>
+#include <QDataStream>
+
+#include "SleepLib/machine_common.h"
+
+class Machine;
+
+/*! \struct ImportedFile
+    \brief Fingerprint of a single card file, and the sessions it ended up in
+    */
+struct ImportedFile
+{
+    ImportedFile() {
+        size = 0;
+        modified = 0;
+        checksum = 0;
+    }
+    ImportedFile(const ImportedFile & copy) {
+        size = copy.size;
+        modified = copy.modified;
+        checksum = copy.checksum;
+        backup = copy.backup;
+        sessions = copy.sessions;
+    }
+
+    qint64 size;
+    qint64 modified;    // msecs since epoch
+    quint32 checksum;   // crc32 of file contents
+    QString backup;     // path of the backup copy made from this file, if any
+    QList<SessionID> sessions;
+};
+
+QDataStream & operator<<(QDataStream & out, const ImportedFile & rec);
+QDataStream & operator>>(QDataStream & in, ImportedFile & rec);
+
+/*! \class ImportManifest
+    \brief Per machine record of already imported card files, so a reimport only decodes new or modified files
+
+    An entry is considered stale (and the file decoded again) when:
+      - the loader version changed since the manifest was written (the whole manifest is dropped)
+      - size or modification time changed, and the content checksum no longer matches
+      - any session it produced no longer exists in the machine record (deleted or purged)
+      - the backup copy made from it has gone missing, or was replaced
+    */
+class ImportManifest
+{
+  public:
+    ImportManifest(Machine * mach);
+    ~ImportManifest() {}
+
+    //! \brief Load the manifest from the machines data folder, discarding it if outdated
+    bool Load();
+
+    //! \brief Fingerprint any staged files and write the manifest back to disk
+    bool Save();
+
+    //! \brief Forget everything, so the next import decodes every file again
+    void clear();
+
+    //! \brief Returns true if key was imported before and fi still matches it
+    bool isUnchanged(const QString & key, const QFileInfo & fi);
+
+    //! \brief Returns true if key has been imported before, changed or not
+    bool contains(const QString & key) { return m_files.contains(key); }
+
+    //! \brief Returns the backup copy recorded for key, if any
+    QString backupOf(const QString & key) { return m_files.value(key).backup; }
+
+    //! \brief Record a file that's about to be imported. Checksum is calculated on Save(), unless setChecksum() gets it first
+    void stage(const QString & key, const QFileInfo & fi, const QString & backup = QString());
+
+    //! \brief Record a file that's about to be imported, with the checksum worked out while it was read anyway
+    void stage(const QString & key, const QFileInfo & fi, quint32 checksum, const QString & backup = QString());
+
+    //! \brief Supply the checksum of a staged file read later on, so Save() doesn't read it again. Safe to call from import threads
+    void setChecksum(const QString & key, quint32 checksum);
+
+    //! \brief Link a session to a recorded file. Safe to call from import threads
+    void addSession(const QString & key, SessionID sid);
+
+    inline int size() const { return m_files.size(); }
+
+    //! \brief Returns the crc32 of the file at path, or 0 if it couldn't be read
+    static quint32 fileChecksum(const QString & path);
+
+  protected:
+    QString filename();
+
+    Machine * m_machine;
+    QHash<QString, ImportedFile> m_files;
+
+    //! \brief Files staged during this import, mapped to their source path while still waiting on a checksum
+    QHash<QString, QString> m_staged;
+
+    QMutex m_mutex;
+    bool m_changed;
+};
+
+#endif // IMPORTMANIFEST_H
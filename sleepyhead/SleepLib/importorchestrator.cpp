@@ -0,0 +1,193 @@
+/* SleepLib Import Orchestrator Implementation
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#include <QApplication>
+#include <QThread>
+#include <QDebug>
+
+#include "importorchestrator.h"
+
+/*! \class ImportLane
+    \brief Works through the paths belonging to one loader, off the main thread
+    */
+class ImportLane:public QThread
+{
+public:
+    ImportLane(ImportOrchestrator * orchestrator, const QList<int> & paths)
+        :QThread(nullptr), m_orchestrator(orchestrator), m_paths(paths) {}
+    virtual ~ImportLane() {}
+
+    virtual void run() {
+        for (int idx : m_paths) {
+            if (m_orchestrator->isAborted()) break;
+            m_orchestrator->importPath(idx);
+        }
+    }
+protected:
+    ImportOrchestrator * m_orchestrator;
+    QList<int> m_paths;
+};
+
+ImportOrchestrator::ImportOrchestrator(QObject * parent)
+    :QObject(parent), m_lanes(0), m_abort(0)
+{
+}
+
+void ImportOrchestrator::run()
+{
+    int size = m_paths.size();
+    m_results.fill(-1, size);
+    m_staged.clear();
+    m_staged.resize(size);
+    m_operations.clear();
+    m_operations.resize(size);
+    m_progressMax.clear();
+    m_progressValue.clear();
+    m_abort.store(0);
+
+    // One lane per loader, as a loader can only work on one path at a time
+    QList<MachineLoader *> loaders;
+    QHash<MachineLoader *, QList<int> > lanes;
+    QList<int> serial;
+
+    bool threaded = AppSetting->multithreading();
+    for (int i=0; i < size; ++i) {
+        MachineLoader * loader = m_paths.at(i).loader;
+        if (!loader) continue;
+
+        if (!loaders.contains(loader)) {
+            loaders.append(loader);
+            loader->resetAbort();
+            connect(loader, SIGNAL(updateMessage(QString)), this, SIGNAL(updateMessage(QString)));
+            connect(loader, SIGNAL(setProgressMax(int)), this, SLOT(loaderProgressMax(int)));
+            connect(loader, SIGNAL(setProgressValue(int)), this, SLOT(loaderProgressValue(int)));
+        }
+        if (threaded && loader->supportsConcurrentImport()) {
+            lanes[loader].append(i);
+        } else {
+            serial.append(i);
+        }
+    }
+
+    m_lanes = 0;
+    for (auto & loader : loaders) {
+        auto it = lanes.find(loader);
+        if (it == lanes.end()) continue;
+
+        loader->setDeferredMerge(true);
+        ImportLane * lane = new ImportLane(this, it.value());
+        connect(lane, SIGNAL(finished()), this, SLOT(laneFinished()));
+        connect(lane, SIGNAL(finished()), lane, SLOT(deleteLater()));
+        m_lanes++;
+        lane->start();
+    }
+    if (m_lanes > 0) {
+        // Keeps the GUI (and the abort button) alive while the lanes run
+        m_loop.exec();
+    }
+
+    for (auto it=lanes.begin(), end=lanes.end(); it != end; ++it) {
+        it.key()->setDeferredMerge(false);
+    }
+
+    // Merged in queued order rather than completion order, so the day list always comes out the same
+    if (!lanes.isEmpty()) {
+        emit updateMessage(tr("Merging sessions..."));
+        QApplication::processEvents();
+        for (int i=0; i < size; ++i) {
+            mergeSessions(i);
+        }
+    }
+
+    // Whatever's left adds its own sessions, so has to run on the main thread
+    for (int idx : serial) {
+        if (m_abort.load()) break;
+        importPath(idx);
+    }
+
+    for (auto & loader : loaders) {
+        disconnect(loader, SIGNAL(updateMessage(QString)), this, SIGNAL(updateMessage(QString)));
+        disconnect(loader, SIGNAL(setProgressMax(int)), this, SLOT(loaderProgressMax(int)));
+        disconnect(loader, SIGNAL(setProgressValue(int)), this, SLOT(loaderProgressValue(int)));
+    }
+}
+
+void ImportOrchestrator::importPath(int idx)
+{
+    const ImportPath & import = m_paths.at(idx);
+    MachineLoader * loader = import.loader;
+
+    int c = loader->Open(import.path);
+    m_results[idx] = c;
+
+    if (loader->deferredMerge()) {
+        m_operations[idx] = loader->takeStagedOperations();
+        m_staged[idx] = loader->takeStagedMachines();
+    }
+    qDebug() << "Finished importing" << import.path << c;
+}
+
+void ImportOrchestrator::mergeSessions(int idx)
+{
+    // Sessions being replaced have to go before their replacements are merged
+    for (auto & op : m_operations[idx]) {
+        op();
+    }
+    m_operations[idx].clear();
+
+    // Each machine merges in start time order, so only the order between machines is up to us
+    for (auto & mach : m_staged[idx]) {
+        mach->mergeStagedSessions();
+    }
+    m_staged[idx].clear();
+}
+
+void ImportOrchestrator::abort()
+{
+    m_abort.store(1);
+    for (auto & import : m_paths) {
+        if (import.loader) import.loader->abort();
+    }
+}
+
+void ImportOrchestrator::loaderProgressMax(int max)
+{
+    MachineLoader * loader = qobject_cast<MachineLoader *>(sender());
+    if (!loader) return;
+
+    m_progressMax[loader] = max;
+    m_progressValue[loader] = 0;
+    updateProgress();
+}
+
+void ImportOrchestrator::loaderProgressValue(int val)
+{
+    MachineLoader * loader = qobject_cast<MachineLoader *>(sender());
+    if (!loader) return;
+
+    m_progressValue[loader] = qMin(val, m_progressMax.value(loader, val));
+    updateProgress();
+}
+
+void ImportOrchestrator::updateProgress()
+{
+    int max = 0, val = 0;
+    for (auto it=m_progressMax.begin(), end=m_progressMax.end(); it != end; ++it) {
+        max += it.value();
+        val += m_progressValue.value(it.key());
+    }
+    emit setProgressMax(max);
+    emit setProgressValue(val);
+}
+
+void ImportOrchestrator::laneFinished()
+{
+    if (--m_lanes <= 0) {
+        m_loop.quit();
+    }
+}
@@ -0,0 +1,89 @@
+/* SleepLib Import Orchestrator Header
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#ifndef IMPORTORCHESTRATOR_H
+#define IMPORTORCHESTRATOR_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QMap>
+#include <QVector>
+#include <QEventLoop>
+#include <QAtomicInt>
+
+#include "SleepLib/machine_loader.h"
+
+/*! \class ImportOrchestrator
+    \brief Imports a batch of card paths, running the loaders that support it side by side
+
+    Each concurrent loader gets a lane thread of its own and works through its paths in order,
+    with the ImportTasks of every lane sharing the global thread pool.
+    New sessions are held back per path, then added to their machines (and the profile day list)
+    on the main thread in the order the paths were queued, so the result doesn't depend on which
+    loader finished first. Loaders that can't run concurrently are imported afterwards, one after another.
+    */
+class ImportOrchestrator:public QObject
+{
+    Q_OBJECT
+    friend class ImportLane;
+  public:
+    ImportOrchestrator(QObject * parent = nullptr);
+    virtual ~ImportOrchestrator() {}
+
+    //! \brief Queue a card path for import
+    void add(const ImportPath & import) { m_paths.append(import); }
+
+    //! \brief Import every queued path, returning once they are all done. Must be called from the main thread
+    void run();
+
+    inline int count() const { return m_paths.size(); }
+    inline const ImportPath & path(int idx) const { return m_paths.at(idx); }
+
+    //! \brief Returns what MachineLoader::Open() returned for path idx, -1 if it never ran
+    inline int result(int idx) const { return m_results.at(idx); }
+
+    inline bool isAborted() const { return m_abort.load() != 0; }
+
+  public slots:
+    //! \brief Abort every running loader, and skip whatever hasn't started yet
+    void abort();
+
+  signals:
+    void updateMessage(QString);
+    void setProgressMax(int max);
+    void setProgressValue(int val);
+
+  protected slots:
+    void loaderProgressMax(int max);
+    void loaderProgressValue(int val);
+    void laneFinished();
+
+  protected:
+    //! \brief Runs the loader for path idx, keeping its new sessions aside if the merge is deferred
+    void importPath(int idx);
+
+    //! \brief Apply the changes held back by path idx, then merge its staged sessions into their machines
+    void mergeSessions(int idx);
+
+    void updateProgress();
+
+    QList<ImportPath> m_paths;
+    QVector<int> m_results;
+    QVector<QList<Machine *> > m_staged;
+    QVector<QList<std::function<void()> > > m_operations;
+
+    QHash<MachineLoader *, int> m_progressMax;
+    QHash<MachineLoader *, int> m_progressValue;
+
+    QEventLoop m_loop;
+    int m_lanes;
+    QAtomicInt m_abort;
+};
+
+#endif // IMPORTORCHESTRATOR_H
@@ -0,0 +1,50 @@
+/* SleepLib Interval Union Implementation
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#include <algorithm>
+
+#include "SleepLib/intervals.h"
+
+static inline bool startsBefore(const Interval & a, const Interval & b)
+{
+    return a.start < b.start;
+}
+
+qint64 unionIntervals(QVector<Interval> & spans)
+{
+    int size = spans.size();
+    if (size == 0) {
+        return 0;
+    }
+
+    Interval * data = spans.data();
+    if (!std::is_sorted(data, data + size, startsBefore)) {
+        std::sort(data, data + size, startsBefore);
+    }
+
+    // Merged spans are written back over the front of the array
+    int out = -1;
+    qint64 total = 0;
+    for (int i = 0; i < size; ++i) {
+        const Interval span = data[i];
+        if (span.end <= span.start) {
+            continue;
+        }
+        if ((out >= 0) && (span.start <= data[out].end)) {
+            if (span.end > data[out].end) {
+                total += span.end - data[out].end;
+                data[out].end = span.end;
+            }
+        } else {
+            data[++out] = span;
+            total += span.length();
+        }
+    }
+    spans.resize(out + 1);
+    return total;
+}
@@ -0,0 +1,33 @@
+/* SleepLib Interval Union Header
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#ifndef INTERVALS_H
+#define INTERVALS_H
+
+#include <QtGlobal>
+#include <QVector>
+
+/*! \struct Interval
+    \brief A [start, end) span of time in milliseconds since epoch
+    */
+struct Interval
+{
+    Interval() :start(0), end(0) {}
+    Interval(qint64 start, qint64 end) :start(start), end(end) {}
+
+    inline qint64 length() const { return end - start; }
+
+    qint64 start;
+    qint64 end;
+};
+
+/*! \brief Sorts spans and merges any that overlap or touch, in place, returning the total time covered
+    Empty and backwards spans are dropped. O(n log n), or O(n) if spans is already sorted */
+qint64 unionIntervals(QVector<Interval> & spans);
+
+#endif // INTERVALS_H
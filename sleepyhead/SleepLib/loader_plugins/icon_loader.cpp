@@ -136,9 +136,8 @@ int FPIconLoader::Open(const QString & path)
             Q_UNUSED(e)
             p_profile->DelMachine(m);
             MachList.erase(MachList.find(info.serial));
-            QMessageBox::warning(nullptr, tr("Import Error"),
-                                 tr("This Machine Record cannot be imported in this profile.")+"\n\n"+tr("The Day records overlap with already existing content."),
-                                 QMessageBox::Ok);
+            informUser(tr("Import Error"),
+                       tr("This Machine Record cannot be imported in this profile.")+"\n\n"+tr("The Day records overlap with already existing content."));
             delete m;
         }
     }
@@ -20,6 +20,7 @@
 #include "prs1_loader.h"
 #include "SleepLib/session.h"
 #include "SleepLib/calcs.h"
+#include "SleepLib/importmanifest.h"
 
 
 // Disable this to cut excess debug messages
@@ -513,7 +514,7 @@ int PRS1Loader::OpenMachine(const QString & path)
     m_abort = false;
 
     emit updateMessage(QObject::tr("Getting Ready..."));
-    QCoreApplication::processEvents();
+    processEvents();
 
     dir.setFilter(QDir::NoDotAndDotDot | QDir::Dirs | QDir::Files | QDir::Hidden | QDir::NoSymLinks);
     dir.setSorting(QDir::Name);
@@ -571,12 +572,10 @@ int PRS1Loader::OpenMachine(const QString & path)
 
         // Assumption is made here all PRS1 machines less than 450P are not data capable.. this could be wrong one day.
         if ((type < 4) && p_profile->cpap->brickWarning()) {
-            QApplication::processEvents();
-            QMessageBox::information(QApplication::activeWindow(),
-                                     QObject::tr("Non Data Capable Machine"),
-                                     QString(QObject::tr("Your Philips Respironics CPAP machine (Model %1) is unfortunately not a data capable model.")+"\n\n"+
-                                             QObject::tr("I'm sorry to report that SleepyHead can only track hours of use and very basic settings for this machine.")).
-                                     arg(info.modelnumber),QMessageBox::Ok);
+            informUser(QObject::tr("Non Data Capable Machine"),
+                       QString(QObject::tr("Your Philips Respironics CPAP machine (Model %1) is unfortunately not a data capable model.")+"\n\n"+
+                               QObject::tr("I'm sorry to report that SleepyHead can only track hours of use and very basic settings for this machine.")).
+                       arg(info.modelnumber));
             p_profile->cpap->setBrickWarning(false);
 
         }
@@ -584,11 +583,9 @@ int PRS1Loader::OpenMachine(const QString & path)
         // A bit of protection against future annoyances..
         if (((series != 5) && (series != 6) && (series != 0) && (series != 3))) { // || (type >= 10)) {
             qDebug() << model << type << series << info.modelnumber << "unsupported";
-            QMessageBox::information(QApplication::activeWindow(),
-                                     QObject::tr("Machine Unsupported"),
-                                     QObject::tr("Sorry, your Philips Respironics CPAP machine (Model %1) is not supported yet.").arg(info.modelnumber) +"\n\n"+
-                                     QObject::tr("JediMark needs a .zip copy of this machines' SD card and matching Encore .pdf reports to make it work with SleepyHead.")
-                                     ,QMessageBox::Ok);
+            informUser(QObject::tr("Machine Unsupported"),
+                       QObject::tr("Sorry, your Philips Respironics CPAP machine (Model %1) is not supported yet.").arg(info.modelnumber) +"\n\n"+
+                       QObject::tr("JediMark needs a .zip copy of this machines' SD card and matching Encore .pdf reports to make it work with SleepyHead."));
 
             return -1;
         }
@@ -611,7 +608,22 @@ int PRS1Loader::OpenMachine(const QString & path)
 
     QString backupPath = m->getBackupPath() + path.section("/", -2);
 
-    if (QDir::cleanPath(path).compare(QDir::cleanPath(backupPath)) != 0) {
+    bool importing_backups = (QDir::cleanPath(path).compare(QDir::cleanPath(backupPath)) == 0);
+
+    ImportManifest * manifest = m->importManifest();
+
+    if (!importing_backups) {
+        // Card files changed since they were last imported need their stale backup copies replaced first
+        for (int p=0; p < paths.size(); ++p) {
+            dir.setPath(paths.at(p));
+            QFileInfoList files = dir.entryInfoList(QDir::Files | QDir::Hidden | QDir::NoSymLinks);
+            for (auto & fi : files) {
+                if (manifest->contains(fi.fileName()) && !manifest->isUnchanged(fi.fileName(), fi)) {
+                    QString oldbackup = manifest->backupOf(fi.fileName());
+                    if (!oldbackup.isEmpty()) QFile::remove(oldbackup);
+                }
+            }
+        }
         copyPath(path, backupPath);
     }
 
@@ -629,7 +641,7 @@ int PRS1Loader::OpenMachine(const QString & path)
     // Note, I have observed p0/p1/etc folders containing duplicates session files (in Robin Sanders data.)
 
     emit updateMessage(QObject::tr("Scanning Files..."));
-    QCoreApplication::processEvents();
+    processEvents();
 
     QDateTime datetime;
 
@@ -671,12 +683,22 @@ int PRS1Loader::OpenMachine(const QString & path)
             }
 
 
+            // Skip anything already imported that hasn't changed since
+            if (manifest->isUnchanged(fi.fileName(), fi)) {
+                continue;
+            }
+
             if (m->SessionExists(sid)) {
                 // Skip already imported session
                 continue;
             }
 
+            QString backupfile = importing_backups ? QString() : (backupPath + "/" + fi.dir().dirName() + "/" + fi.fileName());
+
             if ((ext == 5) || (ext == 6)) {
+                // Not read until the import task gets to it, which hands the checksum over then
+                manifest->stage(fi.fileName(), fi, backupfile);
+
                 // Waveform files aren't grouped... so we just want to add the filename for later
                 QHash<SessionID, PRS1Import *>::iterator it = sesstasks.find(sid);
                 if (it != sesstasks.end()) {
@@ -690,6 +712,8 @@ int PRS1Loader::OpenMachine(const QString & path)
                     queTask(task);
                 }
 
+                manifest->addSession(fi.fileName(), sid);
+
                 if (ext == 5) {
                     if (!task->wavefile.isEmpty()) continue;
                     task->wavefile = fi.canonicalFilePath();
@@ -702,7 +726,9 @@ int PRS1Loader::OpenMachine(const QString & path)
             }
 
             // Parse the data chunks and read the files..
-            QList<PRS1DataChunk *> Chunks = ParseFile(fi.canonicalFilePath());
+            quint32 checksum;
+            QList<PRS1DataChunk *> Chunks = ParseFile(fi.canonicalFilePath(), &checksum);
+            manifest->stage(fi.fileName(), fi, checksum, backupfile);
 
             for (int i=0; i < Chunks.size(); ++i) {
                 if (isAborted()) break;
@@ -719,6 +745,8 @@ int PRS1Loader::OpenMachine(const QString & path)
                 }
 
                 SessionID chunk_sid = chunk->sessionid;
+                manifest->addSession(fi.fileName(), chunk_sid);
+
                 if (m->SessionExists(sid)) {
                     delete chunk;
                     continue;
@@ -761,15 +789,17 @@ int PRS1Loader::OpenMachine(const QString & path)
     unknownCodes.clear();
 
     emit updateMessage(QObject::tr("Importing Sessions..."));
-    QCoreApplication::processEvents();
+    processEvents();
 
     runTasks(AppSetting->multithreading());
 
     emit updateMessage(QObject::tr("Finishing up..."));
-    QCoreApplication::processEvents();
+    processEvents();
 
     finishAddingSessions();
 
+    manifest->Save();
+
     if (unknownCodes.size() > 0) {
         for (auto it = unknownCodes.begin(), end=unknownCodes.end(); it != end; ++it) {
             qDebug() << QString("Unknown CPAP Codes '0x%1' was detected during import").arg((short)it.key(), 2, 16, QChar(0));
@@ -809,7 +839,7 @@ bool PRS1Import::ParseF5EventsFV3()
     int lastpos = 0, startpos = 0, lastpos2 = 0, lastpos3 = 0;
 
     int size = event->m_data.size();
-    unsigned char * buffer = (unsigned char *)event->m_data.data();
+    unsigned char * buffer = (unsigned char *)event->m_data.constData();
     EventList *OA = session->AddEventList(CPAP_Obstructive, EVL_Event);
     EventList *HY = session->AddEventList(CPAP_Hypopnea, EVL_Event);
 
@@ -1059,7 +1089,7 @@ bool PRS1Import::ParseF5Events()
     int lastpos = 0, startpos = 0, lastpos2 = 0, lastpos3 = 0;
 
     int size = event->m_data.size();
-    unsigned char * buffer = (unsigned char *)event->m_data.data();
+    unsigned char * buffer = (unsigned char *)event->m_data.constData();
 
     while (pos < size) {
         lastcode3 = lastcode2;
@@ -1457,7 +1487,7 @@ bool PRS1Import::ParseF3EventsV3()
     int pos = 0;
     int datasize = event->m_data.size();
 
-    unsigned char * data = (unsigned char *)event->m_data.data();
+    unsigned char * data = (unsigned char *)event->m_data.constData();
     unsigned char code;
     unsigned short delta;
     bool failed = false;
@@ -1609,7 +1639,7 @@ bool PRS1Import::ParseF3Events()
     EventList *FLOW = session->AddEventList(CPAP_FlowRate, EVL_Event);
 
     int size = event->m_data.size()/0x10;
-    unsigned char * h = (unsigned char *)event->m_data.data();
+    unsigned char * h = (unsigned char *)event->m_data.constData();
 
     int hy, oa, ca;
     qint64 div = 0;
@@ -1775,7 +1805,7 @@ bool PRS1Import::ParseF0Events()
     int size = event->m_data.size();
 
     bool FV3 = (event->fileVersion == 3);
-    unsigned char * buffer = (unsigned char *)event->m_data.data();
+    unsigned char * buffer = (unsigned char *)event->m_data.constData();
 
     EventDataType currentPressure=0, leak; //, p;
 
@@ -3023,7 +3053,7 @@ bool PRS1Import::ParseOximetery()
         PRS1DataChunk * oxi = oximetry.at(i);
         int num = oxi->waveformInfo.size();
 
-        int size = oxi->m_data.size();
+        int size = oxi->blocksSize();
         if (size == 0) {
             continue;
         }
@@ -3031,29 +3061,39 @@ bool PRS1Import::ParseOximetery()
         qint64 dur = qint64(oxi->duration) * 1000L;
 
         if (num > 1) {
-            // Process interleaved samples
-            QVector<QByteArray> data;
-            data.resize(num);
-
-            int pos = 0;
-            do {
+            // Process interleaved samples, straight from the file buffer into the EventLists
+            int cycle = 0;
+            QVector<int> offsets(num), counts(num, 0);
+            for (int n=0; n < num; n++) {
+                offsets[n] = cycle;
+                cycle += oxi->waveformInfo.at(n).interleave;
+            }
+            for (auto & block : oxi->m_blocks) {
                 for (int n=0; n < num; n++) {
-                    int interleave = oxi->waveformInfo.at(n).interleave;
-                    data[n].append(oxi->m_data.mid(pos, interleave));
-                    pos += interleave;
+                    counts[n] += EventList::interleavedCount(block.size(), offsets[n], oxi->waveformInfo.at(n).interleave, cycle);
                 }
-            } while (pos < size);
-
-            if (data[0].size() > 0) {
-                EventList * pulse = session->AddEventList(OXI_Pulse, EVL_Waveform, 1.0, 0.0, 0.0, 0.0, dur / data[0].size());
-                pulse->AddWaveform(ti, (unsigned char *)data[0].data(), data[0].size(), dur);
             }
 
-            if (data[1].size() > 0) {
-                EventList * spo2 = session->AddEventList(OXI_SPO2, EVL_Waveform, 1.0, 0.0, 0.0, 0.0, dur / data[1].size());
-                spo2->AddWaveform(ti, (unsigned char *)data[1].data(), data[1].size(), dur);
+            EventList * pulse = nullptr, * spo2 = nullptr;
+            if (counts[0] > 0) {
+                pulse = session->AddEventList(OXI_Pulse, EVL_Waveform, 1.0, 0.0, 0.0, 0.0, dur / counts[0]);
+                pulse->getData().reserve(counts[0]);
+            }
+            if (counts[1] > 0) {
+                spo2 = session->AddEventList(OXI_SPO2, EVL_Waveform, 1.0, 0.0, 0.0, 0.0, dur / counts[1]);
+                spo2->getData().reserve(counts[1]);
             }
 
+            qint64 bti = ti;
+            qint64 done = 0;
+            for (auto & block : oxi->m_blocks) {
+                done += block.size();
+                qint64 bend = ti + (dur * done) / size;
+                const unsigned char * bdata = (const unsigned char *)block.constData();
+                if (pulse) pulse->AddInterleavedWaveform(bti, bdata, block.size(), offsets[0], oxi->waveformInfo.at(0).interleave, cycle, bend - bti, false);
+                if (spo2) spo2->AddInterleavedWaveform(bti, bdata, block.size(), offsets[1], oxi->waveformInfo.at(1).interleave, cycle, bend - bti, false);
+                bti = bend;
+            }
         }
     }
     return true;
@@ -3062,7 +3102,6 @@ bool PRS1Import::ParseOximetery()
 bool PRS1Import::ParseWaveforms()
 {
     int size = waveforms.size();
-    quint64 s1, s2;
 
 
     qint64 lastti=0;
@@ -3072,7 +3111,7 @@ bool PRS1Import::ParseWaveforms()
         PRS1DataChunk * waveform = waveforms.at(i);
         int num = waveform->waveformInfo.size();
 
-        int size = waveform->m_data.size();
+        int size = waveform->blocksSize();
         if (size == 0) {
             continue;
         }
@@ -3088,36 +3127,55 @@ bool PRS1Import::ParseWaveforms()
         }
 
         if (num > 1) {
-            // Process interleaved samples
-            QVector<QByteArray> data;
-            data.resize(num);
-
-            int pos = 0;
-            do {
+            // Process interleaved samples. Work out where each signal sits in the interleave cycle
+            // and how many samples it has in total, then de-interleave each block straight into the EventLists.
+            int cycle = 0;
+            QVector<int> offsets(num), counts(num, 0);
+            for (int n=0; n < num; n++) {
+                offsets[n] = cycle;
+                cycle += waveform->waveformInfo.at(n).interleave;
+            }
+            for (auto & block : waveform->m_blocks) {
                 for (int n=0; n < num; n++) {
-                    int interleave = waveform->waveformInfo.at(n).interleave;
-                    data[n].append(waveform->m_data.mid(pos, interleave));
-                    pos += interleave;
+                    counts[n] += EventList::interleavedCount(block.size(), offsets[n], waveform->waveformInfo.at(n).interleave, cycle);
                 }
-            } while (pos < size);
-
-            s1 = data[0].size();
-            s2 = data[1].size();
+            }
 
-            if (s1 > 0) {
-                EventList * flow = session->AddEventList(CPAP_FlowRate, EVL_Waveform, 1.0f, 0.0f, 0.0f, 0.0f, double(dur) / double(s1));
-                flow->AddWaveform(ti, (char *)data[0].data(), data[0].size(), dur);
+            EventList * flow = nullptr, * pres = nullptr;
+            if (counts[0] > 0) {
+                flow = session->AddEventList(CPAP_FlowRate, EVL_Waveform, 1.0f, 0.0f, 0.0f, 0.0f, double(dur) / double(counts[0]));
+                flow->getData().reserve(counts[0]);
+            }
+            if (counts[1] > 0) {
+                pres = session->AddEventList(CPAP_MaskPressureHi, EVL_Waveform, 0.1f, 0.0f, 0.0f, 0.0f, double(dur) / double(counts[1]));
+                pres->getData().reserve(counts[1]);
             }
 
-            if (s2 > 0) {
-                EventList * pres = session->AddEventList(CPAP_MaskPressureHi, EVL_Waveform, 0.1f, 0.0f, 0.0f, 0.0f, double(dur) / double(s2));
-                pres->AddWaveform(ti, (unsigned char *)data[1].data(), data[1].size(), dur);
+            qint64 bti = ti;
+            qint64 done = 0;
+            for (auto & block : waveform->m_blocks) {
+                done += block.size();
+                qint64 bend = ti + (dur * done) / size;
+                const unsigned char * bdata = (const unsigned char *)block.constData();
+
+                // Flow is signed, mask pressure unsigned
+                if (flow) flow->AddInterleavedWaveform(bti, bdata, block.size(), offsets[0], waveform->waveformInfo.at(0).interleave, cycle, bend - bti, true);
+                if (pres) pres->AddInterleavedWaveform(bti, bdata, block.size(), offsets[1], waveform->waveformInfo.at(1).interleave, cycle, bend - bti, false);
+                bti = bend;
             }
 
         } else {
-            // Non interleaved, so can process it much faster
-            EventList * flow = session->AddEventList(CPAP_FlowRate, EVL_Waveform, 1.0f, 0.0f, 0.0f, 0.0f, double(dur) / double(waveform->m_data.size()));
-            flow->AddWaveform(ti, (char *)waveform->m_data.data(), waveform->m_data.size(), dur);
+            // Non interleaved, so can process it much faster, straight out of the file buffer
+            EventList * flow = session->AddEventList(CPAP_FlowRate, EVL_Waveform, 1.0f, 0.0f, 0.0f, 0.0f, double(dur) / double(size));
+
+            qint64 bti = ti;
+            qint64 done = 0;
+            for (auto & block : waveform->m_blocks) {
+                done += block.size();
+                qint64 bend = ti + (dur * done) / size;
+                flow->AddWaveform(bti, (char *)block.constData(), block.size(), bend - bti);
+                bti = bend;
+            }
         }
         lastti = dur+ti;
     }
@@ -3135,8 +3193,12 @@ void PRS1Import::run()
         if (event && !ParseEvents()) {
         }
 
+        ImportManifest * manifest = mach->importManifest();
+        quint32 checksum;
+
         // Parse .005 Waveform file
-        waveforms = loader->ParseFile(wavefile);
+        waveforms = loader->ParseFile(wavefile, &checksum);
+        if (!wavefile.isEmpty()) manifest->setChecksum(QFileInfo(wavefile).fileName(), checksum);
         if (session->eventlist.contains(CPAP_FlowRate)) {
             if (waveforms.size() > 0) {
                 // Delete anything called "Flow rate" picked up in the events file if real data is present
@@ -3146,7 +3208,8 @@ void PRS1Import::run()
         ParseWaveforms();
 
         // Parse .006 Waveform file
-        oximetry = loader->ParseFile(oxifile);
+        oximetry = loader->ParseFile(oxifile, &checksum);
+        if (!oxifile.isEmpty()) manifest->setChecksum(QFileInfo(oxifile).fileName(), checksum);
         ParseOximetery();
 
         if (session->first() > 0) {
@@ -3179,10 +3242,12 @@ void PRS1Import::run()
 }
 
 
-QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
+QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path, quint32 * checksum)
 {
     QList<PRS1DataChunk *> CHUNKS;
 
+    if (checksum) *checksum = 0;
+
     if (path.isEmpty())
         return CHUNKS;
 
@@ -3196,13 +3261,26 @@ QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
         return CHUNKS;
     }
 
+    // Read the whole file in one go. Chunks keep a (shared, not copied) reference to this buffer,
+    // and their data blocks are just views into it.
+    QByteArray filedata = f.readAll();
+    f.close();
+
+    if (checksum) {
+        *checksum = crc32(crc32(0L, Z_NULL, 0), (const Bytef *)filedata.constData(), filedata.size());
+    }
+
+    const unsigned char * fdata = (const unsigned char *)filedata.constData();
+    const int fsize = filedata.size();
+    int fpos = 0;
+
     PRS1DataChunk *chunk = nullptr, *lastchunk = nullptr;
 
     quint8 fileVersion;
     quint16 blocksize;
     quint16 wvfm_signals=0;
 
-    unsigned char * header;
+    const unsigned char * header;
     int cnt = 0;
 
     //int lastheadersize = 0;
@@ -3216,17 +3294,16 @@ QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
 
     int duration=0;
 
-    QByteArray headerBA, headerB2, extra;
+    int hdb_pos = 0, hdb_len = 0;
 
     QList<PRS1Waveform> waveformInfo;
 
     do {
-        headerBA = f.read(16);
-        if (headerBA.size() != 16) {
+        if (fpos + 16 > fsize) {
             break;
         }
 
-        header = (unsigned char *)headerBA.data();
+        header = fdata + fpos;
 
         fileVersion = header[0];    // Correlates to DataFileVersion in PROP[erties].TXT, only 2 or 3 has ever been observed
         blocksize = (header[2] << 8) | header[1];
@@ -3252,6 +3329,7 @@ QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
         waveformInfo.clear();
 
         bool hasHeaderDataBlock = (fileVersion == 3);
+        hdb_len = 0;
         if (ext < 5) { // Not a waveform chunk
 
             // Check if this is a newer machine with a header data block
@@ -3261,29 +3339,22 @@ QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
                 // followed by variable, data byte pairs
                 // then the 8bit Checksum
 
-                int hdb_len = header[15];
+                hdb_len = header[15];
                 int hdb_size = hdb_len * 2;
 
-                headerB2 = f.read(hdb_size+1);  // add extra byte for checksum
-                if (headerB2.size() != hdb_size+1) {
+                if (fpos + header_size + hdb_size + 1 > fsize) { // add extra byte for checksum
                     break;
                 }
-
-                headerBA.append(headerB2);
-                header = (unsigned char *)headerBA.data(); // important because it's memory location could move
+                hdb_pos = fpos + header_size;
 
                 header_size += hdb_size+1;
-            } else headerB2 = QByteArray();
+            }
 
        } else { // Waveform Chunk
-            extra = f.read(4);
-            if (extra.size() != 4) {
+            if (fpos + header_size + 4 > fsize) {
                 break;
             }
             header_size += 4;
-            headerBA.append(extra);
-            // Get the header address again to be safe
-            header = (unsigned char *)headerBA.data();
 
             duration = header[0x0f] | header[0x10] << 8;
             wvfm_signals = header[0x12] | header[0x13] << 8;
@@ -3291,12 +3362,9 @@ QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
             int ws_size = (fileVersion == 3) ? 4 : 3;
             int sbsize = wvfm_signals * ws_size + 1;
 
-            extra = f.read(sbsize);
-            if (extra.size() != sbsize) {
+            if (fpos + header_size + sbsize > fsize) {
                 break;
             }
-            headerBA.append(extra);
-            header = (unsigned char *)headerBA.data();
             header_size += sbsize;
 
             // Read the waveform information in reverse.
@@ -3328,6 +3396,7 @@ QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
            break;
        }
 
+       fpos += header_size;
 
        if (lastchunk != nullptr) {
            // If there's any mismatch between header information, try and skip the block
@@ -3337,9 +3406,9 @@ QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
                || (lastchunk->family != family)
                || (lastchunk->familyVersion != familyVersion)
                || (lastchunk->htype != htype)) {
-                   QByteArray junk = f.read(lastblocksize - header_size);
+                   // Skip over the junk
+                   fpos += qMax(lastblocksize - header_size, 0);
 
-                   Q_UNUSED(junk)
                    if (lastchunk->ext == 5) {
                        // The data is random crap
                        // lastchunk->m_data.append(junk.mid(lastheadersize-16));
@@ -3367,16 +3436,16 @@ QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
         chunk->familyVersion = familyVersion;
         chunk->ext = ext;
         chunk->timestamp = timestamp;
-        if (hasHeaderDataBlock) {
-            const unsigned char * hd = (unsigned char *)headerB2.constData();
+        chunk->m_filedata = filedata;   // shared reference, no copy
+        if (hdb_len > 0) {
+            const unsigned char * hd = fdata + hdb_pos;
             int pos = 0;
-            int recs = header[15];
-            for (int i=0; i<recs; i++) {
+            for (int i=0; i < hdb_len; i++) {
                 chunk->hblock[hd[pos]] = hd[pos+1];
                 pos += 2;
             }
+            chunk->m_headerblock = QByteArray::fromRawData((const char *)hd, hdb_len * 2 + 1);
         }
-        chunk->m_headerblock = headerB2;
 
         lastblocksize = blocksize;
         blocksize -= header_size;
@@ -3390,43 +3459,48 @@ QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
             }
         }
 
-        // Read data block
-        chunk->m_data = f.read(blocksize);
-
-        if (chunk->m_data.size() < blocksize) {
+        // Data block
+        if (fpos + blocksize > fsize) {
             delete chunk;
             break;
         }
 
+        int datasize = blocksize;
         if (chunk->fileVersion==3) {
-            //int ds = chunk->m_data.size();
-            //quint32 crc16 = chunk->m_data.at(ds-2) | chunk->m_data.at(ds-1) << 8;
-            chunk->m_data.chop(4);
+            //quint32 crc16 = fdata[fpos+datasize-2] | fdata[fpos+datasize-1] << 8;
+            datasize -= 4;
         } else {
             // last two bytes contain crc16 checksum.
-            int ds = chunk->m_data.size();
-            quint16 crc16 = chunk->m_data.at(ds-2) | chunk->m_data.at(ds-1) << 8;
-            chunk->m_data.chop(2);
+#ifdef PRS1_CRC_CHECK
+            quint16 crc16 = fdata[fpos+datasize-2] | fdata[fpos+datasize-1] << 8;
+#endif
+            datasize -= 2;
 #ifdef PRS1_CRC_CHECK
             // This fails.. it needs to include the header!
-            quint16 calc16 = CRC16((unsigned char *)chunk->m_data.data(), chunk->m_data.size());
+            quint16 calc16 = CRC16(fdata + fpos, datasize);
             if (calc16 != crc16) {
                 // corrupt data block.. bleh..
             //   qDebug() << "CRC16 doesn't match for chunk" << chunk->sessionid << "for" << path;
             }
 #endif
         }
+        if (datasize < 0) datasize = 0;
+
+        // View into the file buffer, parsed in place
+        chunk->m_data = QByteArray::fromRawData((const char *)(fdata + fpos), datasize);
+        fpos += blocksize;
 
         if ((chunk->ext == 5) || (chunk->ext == 6)) {  // if Flow/MaskPressure Waveform or OXI Waveform file
             if (lastchunk != nullptr) {
                 if (lastchunk->sessionid != chunk->sessionid) {
                     qWarning() << "lastchunk->sessionid != chunk->sessionid in PRS1Loader::ParseFile2()";
+                    delete chunk;
                     break;
                 }
 
                 if (diff == 0) {
-                    // In sync, so append waveform data to previous chunk
-                    lastchunk->m_data.append(chunk->m_data);
+                    // In sync, so tack this block onto the previous chunk instead of copying it across
+                    lastchunk->m_blocks.append(chunk->m_data);
                     lastchunk->duration += chunk->duration;
                     delete chunk;
                     cnt++;
@@ -3435,6 +3509,7 @@ QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
                 }
                 // else start a new chunk to resync
             }
+            chunk->m_blocks.append(chunk->m_data);
         }
 
         CHUNKS.append(chunk);
@@ -3442,7 +3517,7 @@ QList<PRS1DataChunk *> PRS1Loader::ParseFile(const QString & path)
         lastchunk = chunk;
         cnt++;
 
-    } while (!f.atEnd());
+    } while (fpos < fsize);
 
     return CHUNKS;
 }
@@ -70,9 +70,23 @@ public:
     }
     inline int size() const { return m_data.size(); }
 
+    //! \brief Shared reference to the whole file this chunk was read from, which keeps the views below valid
+    QByteArray m_filedata;
+
+    //! \brief Data block, as a read-only view into m_filedata. Use constData(), data() would deep copy it.
     QByteArray m_data;
     QByteArray m_headerblock;
 
+    //! \brief Waveform chunks only: data blocks of this and any following in-sync chunks, in order
+    QList<QByteArray> m_blocks;
+
+    //! \brief Returns the total size of all waveform data blocks
+    int blocksSize() const {
+        int total = 0;
+        for (int i=0; i < m_blocks.size(); ++i) total += m_blocks.at(i).size();
+        return total;
+    }
+
     SessionID sessionid;
 
     quint8 fileVersion;
@@ -209,8 +223,12 @@ class PRS1Loader : public CPAPLoader
     //! \brief Return the loaderName, in this case "PRS1"
     virtual const QString &loaderName() { return prs1_class_name; }
 
-    //! \brief Parse a PRS1 summary/event/waveform file and break into invidivual session or waveform chunks
-    QList<PRS1DataChunk *> ParseFile(const QString & path);
+    //! \brief Sessions are queued with addSession(), so Open() can run alongside other loaders
+    virtual bool supportsConcurrentImport() { return true; }
+
+    /*! \brief Parse a PRS1 summary/event/waveform file and break into invidivual session or waveform chunks
+        If checksum is given, it gets the crc32 of the file contents (0 if it couldn't be read) */
+    QList<PRS1DataChunk *> ParseFile(const QString & path, quint32 * checksum = nullptr);
 
     //! \brief Register this Module to the list of Loaders, so it knows to search for PRS1 data.
     static void Register();
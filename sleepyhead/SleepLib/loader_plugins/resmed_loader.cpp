@@ -21,6 +21,7 @@
 
 #include "SleepLib/session.h"
 #include "SleepLib/calcs.h"
+#include "SleepLib/importmanifest.h"
 
 #ifdef DEBUG_EFFICIENCY
 #include <QElapsedTimer>  // only available in 4.8
@@ -122,7 +123,7 @@ void ResmedLoader::ParseSTR(Machine *mach, QMap<QDate, STRFile> & STRmap)
 
     emit updateMessage("Parsing STR.edf records...");
     emit setProgressMax(totalRecs);
-    QCoreApplication::processEvents();
+    processEvents();
 
     int currentRec = 0;
 
@@ -152,7 +153,7 @@ void ResmedLoader::ParseSTR(Machine *mach, QMap<QDate, STRFile> & STRmap)
         // For each data record, representing 1 day each
         for (int rec = 0; rec < size; ++rec, date = date.addDays(1)) {
             emit setProgressValue(++currentRec);
-            QCoreApplication::processEvents();
+            processEvents();
 
             if (ignoreOldSessions) {
                 if (date < ignoreBefore.date()) {
@@ -1025,12 +1026,14 @@ int ResmedLoader::scanFiles(Machine * mach, const QString & datalog_path)
 
     emit setProgressValue(0);
     emit setProgressMax(totalfiles);
-    QCoreApplication::processEvents();
+    processEvents();
 
     // Scan through all folders looking for EDF files, skip any already imported and peek inside to get durations
     QDateTime ignoreBefore = p_profile->session->ignoreOlderSessionsDate();
     bool ignoreOldSessions = p_profile->session->ignoreOlderSessions();
 
+    ImportManifest * manifest = mach->importManifest();
+
     qDebug() << "Starting EDF duration scan pass";
     for (int i=0; i < totalfiles; ++i) {
         if (isAborted()) return 0;
@@ -1040,7 +1043,7 @@ int ResmedLoader::scanFiles(Machine * mach, const QString & datalog_path)
         // Update progress bar
         if ((i % pbarFreq) == 0) {
             emit setProgressValue(i);
-            QCoreApplication::processEvents();
+            processEvents();
         }
 
         // Forget about it if it can't be read.
@@ -1070,11 +1073,9 @@ int ResmedLoader::scanFiles(Machine * mach, const QString & datalog_path)
         }
         QString fullpath = fi.filePath();
 
-        QString newpath = create_backups ? backup(fullpath, backup_path) : fullpath;
-
-
         // Accept only .edf and .edf.gz files
         if (filename.right(4).toLower() != ("."+STR_ext_EDF)) {
+            if (create_backups) backup(fullpath, backup_path);
             continue;
         }
 
@@ -1093,8 +1094,32 @@ int ResmedLoader::scanFiles(Machine * mach, const QString & datalog_path)
         }
         ResMedDay & resday = rd.value();
 
-        if (!resday.files.contains(filename)) {
-            resday.files[filename] = newpath;
+        // Already imported and untouched since, so don't back it up or decode it again
+        if (manifest->isUnchanged(filename, fi)) {
+            resday.imported = true;
+            continue;
+        }
+
+        if (resday.files.contains(filename)) {
+            continue;
+        }
+
+        if (create_backups && manifest->contains(filename)) {
+            // Card file changed since it was last imported, so replace the old backup copy
+            QString oldbackup = manifest->backupOf(filename);
+            if (!oldbackup.isEmpty()) QFile::remove(oldbackup);
+        }
+
+        // Making the backup copy reads the whole file, so fingerprint it on the way through
+        quint32 checksum = 0;
+        bool checksummed = false;
+        QString newpath = create_backups ? backup(fullpath, backup_path, &checksum, &checksummed) : fullpath;
+
+        resday.files[filename] = newpath;
+        if (checksummed) {
+            manifest->stage(filename, fi, checksum, newpath);
+        } else {
+            manifest->stage(filename, fi, create_backups ? newpath : QString());
         }
     }
 #ifdef DEBUG_EFFICIENCY
@@ -1355,10 +1380,11 @@ void ResDayTask::run()
 
                 loader->sessionMutex.lock();
                 sess->Store(mach->getDataPath());
-                mach->AddSession(sess);
                 loader->sessionCount++;
                 loader->sessionMutex.unlock();
 
+                loader->addSession(sess);
+
                 //sess->TrashEvents();
             }
         }
@@ -1583,10 +1609,24 @@ void ResDayTask::run()
 
         loader->sessionMutex.lock();
         sess->Store(mach->getDataPath());
-        mach->AddSession(sess);  // AddSession definitely ain't threadsafe.
         loader->sessionCount++;
         loader->sessionMutex.unlock();
 
+        // Staged with the machine, finishAddingSessions() merges them in start time order
+        loader->addSession(sess);
+
+        // Remember which files made up this session, so they can be skipped next import
+        ImportManifest * manifest = mach->importManifest();
+        for (auto mit=ovr.filemap.begin(), mend=ovr.filemap.end(); mit != mend; ++mit) {
+            manifest->addSession(mit.value(), sess->session());
+        }
+        for (auto eit=EVElist.begin(), eveend=EVElist.end(); eit != eveend; ++eit) {
+            manifest->addSession(eit.value(), sess->session());
+        }
+        for (auto eit=CSLlist.begin(), cslend=CSLlist.end(); eit != cslend; ++eit) {
+            manifest->addSession(eit.value(), sess->session());
+        }
+
         // Free the memory used by this session
         sess->TrashEvents();
 
@@ -1642,7 +1682,7 @@ int ResmedLoader::Open(const QString & dirpath)
     MachineInfo info = newInfo();
 
     emit updateMessage(QObject::tr("Parsing Identification File"));
-    QApplication::processEvents();
+    processEvents();
 
     // Parse # entries into idmap.
     while (!f.atEnd()) {
@@ -1741,7 +1781,7 @@ int ResmedLoader::Open(const QString & dirpath)
     resdayList.clear();
 
     emit updateMessage(QObject::tr("Locating STR.edf File(s)..."));
-    QCoreApplication::processEvents();
+    processEvents();
 
     // List all STR.edf backups and tag on latest for processing
 
@@ -1916,7 +1956,7 @@ int ResmedLoader::Open(const QString & dirpath)
     if (impfile.exists()) impfile.remove();
 
     emit updateMessage(QObject::tr("Cataloguing EDF Files..."));
-    QApplication::processEvents();
+    processEvents();
 
     if (isAborted()) return 0;
 
@@ -1927,7 +1967,9 @@ int ResmedLoader::Open(const QString & dirpath)
     // that can be processed in threads..
 
     emit updateMessage(QObject::tr("Queueing Import Tasks..."));
-    QApplication::processEvents();
+    processEvents();
+
+    ImportManifest * manifest = mach->importManifest();
 
     for (auto rdi=resdayList.begin(), rend=resdayList.end(); rdi != rend; rdi++) {
         if (isAborted()) return 0;
@@ -1947,30 +1989,50 @@ int ResmedLoader::Open(const QString & dirpath)
                 // but the worst case scenario is this session is deleted and reimported.. this just slows things down a bit in that case
 
                 // This day was first imported as a summary from STR.edf, so we now totally want to redo this day
-                QList<Session *> sessions = day->getSessions(MT_CPAP);
-                for (auto & sess : sessions) {
-                    day->removeSession(sess);
-                    delete sess;
-                }
+                // The GUI may be showing it, so the old sessions go on the main thread, before the new ones are merged
+                stageOperation([day]() {
+                    QList<Session *> sessions = day->getSessions(MT_CPAP);
+                    for (auto & sess : sessions) {
+                        day->removeSession(sess);
+                        delete sess;
+                    }
+                });
 
                 reimporting = true;
             } else if (day->noSettings(mach) && resday.str.date.isValid()) {
                 // STR is present now, it wasn't before... we don't need to trash the files, but we do want the official settings.
-                // Do it right here
-                for (auto & sess : day->sessions) {
-                    if (sess->machine() != mach) continue;
-
-                    qDebug() << "Adding STR.edf information to session" << sess->session();
-                    StoreSettings(sess, resday.str);
-                    sess->setNoSettings(false);
-                    sess->SetChanged(true);
-                    sess->StoreSummary();
-                }
+                // Done on the main thread with the merge, with a copy of the record as resdayList is gone by then
+                STRRecord str = resday.str;
+                stageOperation([day, mach, str]() mutable {
+                    for (auto & sess : day->sessions) {
+                        if (sess->machine() != mach) continue;
+
+                        qDebug() << "Adding STR.edf information to session" << sess->session();
+                        StoreSettings(sess, str);
+                        sess->setNoSettings(false);
+                        sess->SetChanged(true);
+                        sess->StoreSummary();
+                    }
+                    // Settings feed the cached totals and the statistics cube
+                    day->invalidate();
+                });
             } else {
+                // Already imported, so tie these files to the existing sessions
+                QList<Session *> sessions = day->getSessions(MT_CPAP);
+                for (auto fit=resday.files.begin(), fend=resday.files.end(); fit != fend; ++fit) {
+                    for (auto & sess : sessions) {
+                        if (sess->machine() == mach) manifest->addSession(fit.key(), sess->session());
+                    }
+                }
                 continue;
             }
         }
 
+        if (resday.imported && (resday.files.size() == 0)) {
+            // Nothing new for this day, don't go making summary only sessions for it
+            continue;
+        }
+
         ResDayTask * rdt = new ResDayTask(this, mach, &resday);
         queTask(rdt);
         rdt->reimporting = reimporting;
@@ -1987,10 +2049,12 @@ int ResmedLoader::Open(const QString & dirpath)
     ////////////////////////////////////////////////////////////////////////////////////
 
     emit updateMessage(QObject::tr("Finishing Up..."));
-    QApplication::processEvents();
+    processEvents();
 
     finishAddingSessions();
 
+    manifest->Save();
+
 #ifdef DEBUG_EFFICIENCY
     {
         qint64 totalbytes = 0;
@@ -2035,8 +2099,10 @@ int ResmedLoader::Open(const QString & dirpath)
 }
 
 
-QString ResmedLoader::backup(const QString & fullname, const QString & backup_path)
+QString ResmedLoader::backup(const QString & fullname, const QString & backup_path, quint32 * checksum, bool * checksummed)
 {
+    if (checksummed) *checksummed = false;
+
     QDir dir;
     QString filename, yearstr, newname, oldname;
 
@@ -2073,13 +2139,17 @@ QString ResmedLoader::backup(const QString & fullname, const QString & backup_pa
 
     // First make sure the correct backup exists in the right place
     if (!QFile::exists(newname)) {
+        bool read = false;
         if (compress) {
             // If input file is already compressed.. copy it to the right location, otherwise compress it
-            gz ? QFile::copy(fullname, newname) : compressFile(fullname, newname);
+            read = gz ? copyFile(fullname, newname, checksum) : compressFile(fullname, newname, checksum);
+        } else if (gz) {
+            // If inputs a gz, uncompress it. zlib does the reading there, so no checksum of the card file
+            uncompressFile(fullname, newname);
         } else {
-            // If inputs a gz, uncompress it, otherwise copy is raw
-            gz ? uncompressFile(fullname, newname) : QFile::copy(fullname, newname);
+            read = copyFile(fullname, newname, checksum);
         }
+        if (checksummed) *checksummed = read;
     } // else backup already exists... good.
 
     // Now the correct backup is in place, we can trash any
@@ -321,9 +321,13 @@ struct EDFduration {
 };
 
 struct ResMedDay {
+    ResMedDay() : imported(false) {}
     QDate date;
     STRRecord str;
     QHash<QString, QString> files;
+
+    //! \brief Set when some of this days files were skipped because they were already imported
+    bool imported;
 //    QHash<QString, EDFduration> durations;
 
 };
@@ -415,6 +419,9 @@ class ResmedLoader : public CPAPLoader
     //! \brief Returns the Machine class name of this loader. ("ResMed")
     virtual const QString &loaderName() { return resmed_class_name; }
 
+    //! \brief Sessions are queued with addSession(), so Open() can run alongside other loaders
+    virtual bool supportsConcurrentImport() { return true; }
+
     //! \brief Converts EDFSignal data to time delta packed EventList, and adds to Session
     void ToTimeDelta(Session *sess, ResMedEDFParser &edf, EDFSignal &es, ChannelID code, long recs,
                      qint64 duration, EventDataType min = 0, EventDataType max = 0, bool square = false);
@@ -469,7 +476,9 @@ protected:
     //! \brief Scan for new files to import, group into sessions and add to task que
     int scanFiles(Machine * mach, const QString & datalog_path);
 
-    QString backup(const QString & file, const QString & backup_path);
+    /*! \brief Copies file into the backup folder, returning the backup path
+        If making the copy meant reading file, checksummed is set and checksum gets its crc32 */
+    QString backup(const QString & file, const QString & backup_path, quint32 * checksum = nullptr, bool * checksummed = nullptr);
 
     QMap<SessionID, QStringList> sessfiles;
     QMap<quint32, STRRecord> strsess;
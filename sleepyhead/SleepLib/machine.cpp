@@ -30,6 +30,7 @@
 
 #include "machine.h"
 #include "profiles.h"
+#include "importmanifest.h"
 #include <algorithm>
 #include "SleepLib/schema.h"
 #include "SleepLib/day.h"
@@ -65,6 +66,7 @@ Machine::Machine(Profile *_profile, MachineID id) : profile(_profile)
 
     } else { m_id = id; }
     m_loader = nullptr;
+    m_manifest = nullptr;
 
    // qDebug() << "Create Machine: " << hex << m_id; //%lx",m_id);
     m_type = MT_UNKNOWN;
@@ -73,6 +75,7 @@ Machine::Machine(Profile *_profile, MachineID id) : profile(_profile)
 Machine::~Machine()
 {
     saveSessionInfo();
+    delete m_manifest;
     qDebug() << "Destroy Machine" << info.loadername << hex << m_id;
 }
 Session *Machine::SessionExists(SessionID session)
@@ -194,6 +197,15 @@ bool Machine::loadSessionInfo()
     return true;
 }
 
+ImportManifest * Machine::importManifest()
+{
+    if (!m_manifest) {
+        m_manifest = new ImportManifest(this);
+        m_manifest->Load();
+    }
+    return m_manifest;
+}
+
 // Find date this session belongs in
 QDate Machine::pickDate(qint64 first)
 {
@@ -236,6 +248,8 @@ bool Machine::AddSession(Session *s)
         return false;
     }
 
+    QMutexLocker lock(&m_addMutex);
+
     if (profile->session->ignoreOlderSessions()) {
         qint64 ignorebefore = profile->session->ignoreOlderSessionsDate().toMSecsSinceEpoch();
         if (s->last() < ignorebefore) {
@@ -283,7 +297,7 @@ bool Machine::AddSession(Session *s)
     int closest_session = 0;
 
 
-    // Multithreaded import screws this up. :(
+    // Order matters here, so threaded imports go through stageSession()/mergeStagedSessions()
 
     if (time < split_time) {
         date = date.addDays(-1);
@@ -333,6 +347,9 @@ bool Machine::AddSession(Session *s)
     }
 
 
+    // Day records are shared with other machines
+    QMutexLocker daylock(&profile->dayMutex);
+
     Day *dd = nullptr;
     dit = day.find(date);
 
@@ -373,6 +390,52 @@ bool Machine::AddSession(Session *s)
     return true;
 }
 
+void Machine::stageSession(Session * sess)
+{
+    QMutexLocker lock(&m_stageMutex);
+    m_staged.append(sess);
+}
+
+bool Machine::isStaged(SessionID sid)
+{
+    QMutexLocker lock(&m_stageMutex);
+    for (auto & sess : m_staged) {
+        if (sess->session() == sid) return true;
+    }
+    return false;
+}
+
+static bool sessionStartLessThan(Session * a, Session * b)
+{
+    if (a->first() != b->first()) {
+        return a->first() < b->first();
+    }
+    return a->session() < b->session();
+}
+
+int Machine::mergeStagedSessions()
+{
+    m_stageMutex.lock();
+    QList<Session *> sessions = m_staged;
+    m_staged.clear();
+    m_stageMutex.unlock();
+
+    std::sort(sessions.begin(), sessions.end(), sessionStartLessThan);
+
+    int added = 0;
+    for (auto & sess : sessions) {
+        if (sessionlist.contains(sess->session())) {
+            // Same card imported twice in the one batch
+            delete sess;
+            continue;
+        }
+        if (AddSession(sess)) {
+            added++;
+        }
+    }
+    return added;
+}
+
 bool Machine::unlinkDay(Day * d)
 {
     return day.remove(day.key(d)) > 0;
@@ -456,9 +519,16 @@ bool Machine::Purge(int secret)
     QFile impfile(getDataPath()+"/imported_files.csv");
     impfile.remove();
 
+    QFile manifestfile(getDataPath()+"/Imported.manifest");
+    manifestfile.remove();
+    if (m_manifest) m_manifest->clear();
+
     QFile rxcache(profile->Get("{" + STR_GEN_DataFolder + "}/RXChanges.cache" ));
     rxcache.remove();
 
+    QFile recordscache(profile->Get("{" + STR_GEN_DataFolder + "}/Records.cache" ));
+    recordscache.remove();
+
     QFile sumfile(getDataPath()+"/Summaries.xml.gz");
     sumfile.remove();
 
@@ -606,11 +676,14 @@ bool Machine::Load(ProgressDialog *progress)
         return false;
     }
 
-    QPixmap image = getPixmap().scaled(64,64);
-    progress->setPixmap(image);
-    progress->setMessage(QObject::tr("Loading %1 data for %2...").arg(info.brand).arg(profile->user->userName()));
+    // Batch jobs load without a progress dialog
+    if (progress) {
+        QPixmap image = getPixmap().scaled(64,64);
+        progress->setPixmap(image);
+        progress->setMessage(QObject::tr("Loading %1 data for %2...").arg(info.brand).arg(profile->user->userName()));
+    }
 
-    if (loader()) {
+    if (loader() && progress) {
         mainwin->connect(loader(), SIGNAL(updateMessage(QString)), progress, SLOT(setMessage(QString)));
         mainwin->connect(loader(), SIGNAL(setProgressMax(int)),   progress, SLOT(setProgressMax(int)));
         mainwin->connect(loader(), SIGNAL(setProgressValue(int)), progress, SLOT(setProgressValue(int)));
@@ -618,8 +691,8 @@ bool Machine::Load(ProgressDialog *progress)
 
     if (!LoadSummary(progress)) {
         // No XML index file, so assume upgrading, or it simply just got screwed up or deleted...
-        progress->setMessage(QObject::tr("Scanning Files"));
-        progress->setProgressValue(0);
+        if (progress) progress->setMessage(QObject::tr("Scanning Files"));
+        if (progress) progress->setProgressValue(0);
         QApplication::processEvents();
 
 
@@ -654,14 +727,14 @@ bool Machine::Load(ProgressDialog *progress)
         dir.setNameFilters(filters);
         filelist = dir.entryList();
         size = filelist.size();
-        progress->setMessage(QObject::tr("Migrating Summary File Location"));
-        progress->setProgressMax(size);
+        if (progress) progress->setMessage(QObject::tr("Migrating Summary File Location"));
+        if (progress) progress->setProgressMax(size);
         QApplication::processEvents();
         if (size > 0) {
             if (!dir.exists(eventpath)) dir.mkpath(eventpath);
             for (int i=0; i< size; i++) {
                 if ((i % 20) == 0) { // This is slow.. :-/
-                    progress->setProgressValue(i);
+                    if (progress) progress->setProgressValue(i);
 
                     QApplication::processEvents();
                 }
@@ -681,8 +754,8 @@ bool Machine::Load(ProgressDialog *progress)
         filelist = dir.entryList();
         size = filelist.size();
 
-        progress->setMessage("Reading summary files");
-        progress->setProgressValue(0);
+        if (progress) progress->setMessage("Reading summary files");
+        if (progress) progress->setProgressValue(0);
         QApplication::processEvents();
 
         QString sesstr;
@@ -692,7 +765,7 @@ bool Machine::Load(ProgressDialog *progress)
         for (int i=0; i < size; i++) {
 
             if ((i % 20) == 0) { // This is slow.. :-/
-                progress->setProgressValue(i);
+                if (progress) progress->setProgressValue(i);
                 QApplication::processEvents();
             }
 
@@ -715,14 +788,14 @@ bool Machine::Load(ProgressDialog *progress)
 
         SaveSummaryCache();
         qDebug() << "Loaded" << info.model.toLocal8Bit().data() << "data in" << time.elapsed() << "ms";
-        progress->setProgressValue(size);
+        if (progress) progress->setProgressValue(size);
     }
-    progress->setMessage("Loading Session Info");
+    if (progress) progress->setMessage("Loading Session Info");
     QApplication::processEvents();
 
     loadSessionInfo();
 
-    if (loader()) {
+    if (loader() && progress) {
         mainwin->disconnect(loader(), SIGNAL(updateMessage(QString)), progress, SLOT(setMessage(QString)));
         mainwin->disconnect(loader(), SIGNAL(setProgressMax(int)),   progress, SLOT(setProgressMax(int)));
         mainwin->disconnect(loader(), SIGNAL(setProgressValue(int)), progress, SLOT(setProgressValue(int)));
@@ -957,7 +1030,7 @@ bool Machine::LoadSummary(ProgressDialog * progress)
     QDomDocument doc;
     QFile file(filename);
     qDebug() << "Loading" << filename.toLocal8Bit().data();
-    progress->setMessage(QObject::tr("Loading Summaries.xml.gz"));
+    if (progress) progress->setMessage(QObject::tr("Loading Summaries.xml.gz"));
     QApplication::processEvents();
 
     if (!file.open(QIODevice::ReadOnly)) {
@@ -1001,10 +1074,10 @@ bool Machine::LoadSummary(ProgressDialog * progress)
 
     QMap<qint64, Session *>  sess_order;
 
-    progress->setProgressMax(size);
+    if (progress) progress->setProgressMax(size);
     for (int s=0; s < size; ++s) {
         if ((s % 20) == 0) {
-            progress->setProgressValue(s);
+            if (progress) progress->setProgressValue(s);
             QApplication::processEvents();
         }
         node = sessionlist.at(s);
@@ -1084,7 +1157,7 @@ bool Machine::LoadSummary(ProgressDialog * progress)
             }
         }
     }
-    progress->setMessage(QObject::tr("Loading Summary Data"));
+    if (progress) progress->setMessage(QObject::tr("Loading Summary Data"));
     QApplication::processEvents();
 
     if (loader()) {
@@ -1092,7 +1165,7 @@ bool Machine::LoadSummary(ProgressDialog * progress)
     } else {
         runTasks();
     }
-    progress->setProgressValue(sess_order.size());
+    if (progress) progress->setProgressValue(sess_order.size());
     QApplication::processEvents();
 
     qDebug() << "Loaded" << info.series.toLocal8Bit().data() << info.model.toLocal8Bit().data() << "data in" << time.elapsed() << "ms";
@@ -36,6 +36,7 @@ class Day;
 class Session;
 class Profile;
 class Machine;
+class ImportManifest;
 
 /*! \class SaveThread
     \brief This class is used in the multithreaded save code.. It accelerates the indexing of summary data.
@@ -221,6 +222,18 @@ class Machine
     bool saveSessionInfo();
     bool loadSessionInfo();
 
+    //! \brief Queue a session for mergeStagedSessions(). Safe to call from import threads
+    void stageSession(Session * sess);
+
+    //! \brief Returns true if sid is queued, waiting to be merged
+    bool isStaged(SessionID sid);
+
+    //! \brief Adds every queued session in start time order, so days split the same however the import threads finished
+    int mergeStagedSessions();
+
+    //! \brief Returns the record of already imported card files, loading it first if needed
+    ImportManifest * importManifest();
+
     void setLoaderName(QString value);
 
     QList<ChannelID> availableChannels(quint32 chantype);
@@ -252,6 +265,13 @@ class Machine
 
     MachineLoader * m_loader;
 
+    //! \brief Sessions waiting on mergeStagedSessions()
+    QList<Session *> m_staged;
+    QMutex m_stageMutex;
+
+    //! \brief Serialises AddSession() on this machine
+    QMutex m_addMutex;
+
     bool changed;
     bool firstsession;
     int m_totaltasks;
@@ -262,6 +282,8 @@ class Machine
 
     QList<ImportTask *> m_tasklist;
 
+    ImportManifest * m_manifest;
+
     QHash<ChannelID, bool> m_availableChannels;
     QHash<ChannelID, bool> m_availableSettings;
 
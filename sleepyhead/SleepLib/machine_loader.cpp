@@ -9,7 +9,10 @@
 #include <QApplication>
 #include <QFile>
 #include <QDir>
+#include <QThread>
 #include <QThreadPool>
+#include <QSemaphore>
+#include <QMessageBox>
 
 #include "machine_loader.h"
 
@@ -80,6 +83,7 @@ MachineLoader::MachineLoader() :QObject(nullptr)
         genpixmapinit = true;
     }
     m_abort = false;
+    m_deferred = false;
     m_type = MT_UNKNOWN;
     m_status = NEUTRAL;
 }
@@ -88,15 +92,77 @@ MachineLoader::~MachineLoader()
 {
 }
 
+void MachineLoader::addSession(Session * sess)
+{
+    Machine * mach = sess->machine();
+    mach->stageSession(sess);
+
+    QMutexLocker lock(&sessionMutex);
+    if (!m_stagedMachines.contains(mach)) {
+        m_stagedMachines.append(mach);
+    }
+}
+
 void MachineLoader::finishAddingSessions()
 {
-    // Using a map specifically so they are inserted in order.
-    for (auto it=new_sessions.begin(), end=new_sessions.end(); it != end; ++it) {
-        Session * sess = it.value();
-        Machine * mach = sess->machine();
-        mach->AddSession(sess);
+    // The import orchestrator merges these itself, once every loader is done
+    if (m_deferred) return;
+
+    for (auto & mach : takeStagedMachines()) {
+        mach->mergeStagedSessions();
+    }
+}
+
+QList<Machine *> MachineLoader::takeStagedMachines()
+{
+    QMutexLocker lock(&sessionMutex);
+    QList<Machine *> machines = m_stagedMachines;
+    m_stagedMachines.clear();
+    return machines;
+}
+
+void MachineLoader::stageOperation(std::function<void()> op)
+{
+    if (!m_deferred) {
+        op();
+        return;
+    }
+    QMutexLocker lock(&sessionMutex);
+    m_stagedOperations.append(op);
+}
+
+QList<std::function<void()> > MachineLoader::takeStagedOperations()
+{
+    QMutexLocker lock(&sessionMutex);
+    QList<std::function<void()> > ops = m_stagedOperations;
+    m_stagedOperations.clear();
+    return ops;
+}
+
+void MachineLoader::processEvents()
+{
+    if (QThread::currentThread() == qApp->thread()) {
+        QApplication::processEvents();
+    }
+}
+
+void MachineLoader::informUser(const QString & title, const QString & text)
+{
+    if (QThread::currentThread() == qApp->thread()) {
+        showInformation(title, text);
+    } else {
+        // Loaders live in the main thread, so this lands in the GUI event loop
+        QMetaObject::invokeMethod(this, "showInformation", Qt::BlockingQueuedConnection, Q_ARG(QString, title), Q_ARG(QString, text));
+    }
+}
+
+void MachineLoader::showInformation(QString title, QString text)
+{
+    if (headless()) {
+        qWarning() << title << "-" << text;
+        return;
     }
-    new_sessions.clear();
+    QMessageBox::information(QApplication::activeWindow(), title, text, QMessageBox::Ok);
 }
 
 bool uncompressFile(QString infile, QString outfile)
@@ -145,7 +211,7 @@ bool uncompressFile(QString infile, QString outfile)
 
 }
 
-bool compressFile(QString infile, QString outfile)
+bool compressFile(QString infile, QString outfile, quint32 * checksum)
 {
     if (outfile.isEmpty()) {
         outfile = infile + ".gz";
@@ -181,6 +247,10 @@ bool compressFile(QString infile, QString outfile)
 
     f.close();
 
+    if (checksum) {
+        *checksum = crc32(crc32(0L, Z_NULL, 0), (const Bytef *)buf, size);
+    }
+
     gzFile gz = gzopen(outfile.toLatin1(), "wb");
 
     //gzbuffer(gz,65536*2);
@@ -196,6 +266,71 @@ bool compressFile(QString infile, QString outfile)
     return true;
 }
 
+bool copyFile(QString infile, QString outfile, quint32 * checksum)
+{
+    if (QFile::exists(outfile)) {
+        qDebug() << "copyFile()" << outfile << "already exists";
+        return false;
+    }
+
+    QFile in(infile);
+    if (!in.open(QFile::ReadOnly)) {
+        qDebug() << "copyFile() Couldn't open" << infile;
+        return false;
+    }
+
+    QFile out(outfile);
+    if (!out.open(QFile::WriteOnly)) {
+        qDebug() << "copyFile() Couldn't open" << outfile << "for writing";
+        return false;
+    }
+
+    const int bufsize = 65536;
+    QByteArray buffer(bufsize, 0);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    qint64 len;
+    while ((len = in.read(buffer.data(), bufsize)) > 0) {
+        if (out.write(buffer.constData(), len) != len) {
+            qDebug() << "copyFile() Couldn't write all of" << outfile;
+            out.close();
+            out.remove();
+            return false;
+        }
+        crc = crc32(crc, (const Bytef *)buffer.constData(), len);
+    }
+    if (len < 0) {
+        qDebug() << "copyFile() Couldn't read all of" << infile;
+        out.close();
+        out.remove();
+        return false;
+    }
+
+    if (checksum) {
+        *checksum = crc;
+    }
+    return true;
+}
+
+/*! \class LoaderTask
+    \brief Runs an ImportTask on the shared thread pool, handing its slot back when done
+    */
+class LoaderTask:public QRunnable
+{
+public:
+    LoaderTask(ImportTask * task, QSemaphore & threads) : m_task(task), m_threads(threads) {}
+    virtual ~LoaderTask() { delete m_task; }
+    virtual void run() {
+        m_task->run();
+        delete m_task;
+        m_task = nullptr;
+        m_threads.release();
+    }
+protected:
+    ImportTask * m_task;
+    QSemaphore & m_threads;
+};
+
 void MachineLoader::queTask(ImportTask * task)
 {
     m_tasklist.push_back(task);
@@ -219,35 +354,29 @@ void MachineLoader::runTasks(bool threaded)
             // update progress bar
             m_currenttask++;
             emit setProgressValue(++m_currenttask);
-            QApplication::processEvents();
+            processEvents();
 
             delete task;
         }
     } else {
-        ImportTask * task = m_tasklist[0];
-
         QThreadPool * threadpool = QThreadPool::globalInstance();
 
-        while (!m_abort) {
-
-            if (threadpool->tryStart(task)) {
-                m_tasklist.pop_front();
+        // One slot per pool thread, so tasks are only handed over as threads free up and the progress bar
+        // follows along. Other loaders may be sharing the pool, so only our own tasks are waited on
+        int threads = qMax(threadpool->maxThreadCount(), 1);
+        QSemaphore available(threads);
 
-                if (!m_tasklist.isEmpty()) {
-                    // next task to be run
-                    task = m_tasklist[0];
+        while (!m_abort && !m_tasklist.isEmpty()) {
+            available.acquire();
+            threadpool->start(new LoaderTask(m_tasklist.takeFirst(), available));
 
-                    // update progress bar
-                    emit setProgressValue(++m_currenttask);
-                    QApplication::processEvents();
-                } else {
-                    // job list finished
-                    break;
-                }
-            }
-            //QThread::sleep(100);
+            // update progress bar
+            emit setProgressValue(++m_currenttask);
+            processEvents();
         }
-        QThreadPool::globalInstance()->waitForDone(-1);
+
+        // All slots back means every task has finished
+        available.acquire(threads);
     }
     if (m_abort) {
         // delete remaining tasks and clear task list
@@ -12,6 +12,7 @@
 #include <QMutex>
 #include <QRunnable>
 #include <QPixmap>
+#include <functional>
 
 
 #include "profiles.h"
@@ -72,12 +73,25 @@ class MachineLoader: public QObject
 
     void queTask(ImportTask * task);
 
-    void addSession(Session * sess)
-    {
-        sessionMutex.lock();
-        new_sessions[sess->session()] = sess;
-        sessionMutex.unlock();
-    }
+    //! \brief Stage a new session with its machine, to be merged by finishAddingSessions(). Safe to call from import threads
+    void addSession(Session * sess);
+
+    //! \brief Returns true if this loader can run Open() off the main thread, leaving its new sessions for a deferred merge
+    virtual bool supportsConcurrentImport() { return false; }
+
+    //! \brief When set, finishAddingSessions() leaves staged sessions for whoever calls takeStagedMachines()
+    void setDeferredMerge(bool b) { m_deferred = b; }
+    inline bool deferredMerge() { return m_deferred; }
+
+    //! \brief Hands over the machines this loader staged sessions with, leaving their merge to the caller
+    QList<Machine *> takeStagedMachines();
+
+    /*! \brief Runs op now, or while the merge is deferred, holds it for the main thread
+        For changes to Days and Sessions already in the profile, which the GUI may be reading meanwhile */
+    void stageOperation(std::function<void()> op);
+
+    //! \brief Hands over the operations held back by stageOperation(), to be run before the staged sessions are merged
+    QList<std::function<void()> > takeStagedOperations();
 
     //! \brief Process Task list using all available threads.
     void runTasks(bool threaded=true);
@@ -86,6 +100,7 @@ class MachineLoader: public QObject
 
     inline bool isAborted() { return m_abort; }
     void abort() { m_abort = true; }
+    void resetAbort() { m_abort = false; }
 
     virtual void process() {}
 
@@ -110,9 +125,15 @@ class MachineLoader: public QObject
         }
         return genericPixmapPath;
     }
+    //! \brief Show an information box to the user, safe to call from import threads
+    void informUser(const QString & title, const QString & text);
+
 public slots:
     void abortImport() { abort(); }
 
+protected slots:
+    void showInformation(QString title, QString text);
+
 signals:
     void updateProgress(int cnt, int total);
     void setProgressMax(int max);
@@ -131,11 +152,20 @@ protected:
     int m_totaltasks;
 
     bool m_abort;
+    bool m_deferred;
 
     DeviceStatus m_status;
 
     void finishAddingSessions();
-    QMap<SessionID, Session *> new_sessions;
+
+    //! \brief Keeps the GUI going while a loader runs on the main thread, does nothing on import threads
+    void processEvents();
+
+    //! \brief Machines with sessions staged by this loader, waiting on finishAddingSessions()
+    QList<Machine *> m_stagedMachines;
+
+    //! \brief Changes to existing Days and Sessions, waiting on the deferred merge
+    QList<std::function<void()> > m_stagedOperations;
 
     QHash<QString, QPixmap> m_pixmaps;
     QHash<QString, QString> m_pixmap_paths;
@@ -187,9 +217,13 @@ MachineLoader * lookupLoader(QString loaderName);
 
 void DestroyLoaders();
 
-bool compressFile(QString inpath, QString outpath = "");
+//! \brief Gzips inpath to outpath. If checksum is given, it gets the crc32 of the uncompressed input
+bool compressFile(QString inpath, QString outpath = "", quint32 * checksum = nullptr);
 bool uncompressFile(QString infile, QString outfile);
 
+//! \brief Copies inpath to outpath unless it already exists. If checksum is given, it gets the crc32 of the copied data
+bool copyFile(QString inpath, QString outpath, quint32 * checksum = nullptr);
+
 QList<MachineLoader *> GetLoaders(MachineType mt = MT_UNKNOWN);
 
 #endif //MACHINE_LOADER_H
@@ -57,8 +57,19 @@ const QString &getUserName()
 }
 
 
+static QString appRootOverride;
+
+void setAppRootOverride(const QString & path)
+{
+    appRootOverride = path;
+}
+
 QString GetAppRoot()
 {
+    if (!appRootOverride.isEmpty()) {
+        return appRootOverride;
+    }
+
     QSettings settings;
 
     QString HomeAppRoot = settings.value("Settings/AppRoot").toString();
@@ -20,6 +20,9 @@ const QString STR_ext_XML = ".xml";
 
 extern QString GetAppRoot(); //returns app root path plus trailing path separator.
 
+//! \brief Use path as the app root for this process only, leaving the saved setting alone. Empty to go back to it
+extern void setAppRootOverride(const QString & path);
+
 inline QString PrefMacro(QString s)
 {
     return "{" + s + "}";
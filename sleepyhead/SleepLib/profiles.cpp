@@ -25,6 +25,7 @@
 #include "machine_common.h"
 
 #include "machine_loader.h"
+#include "aggregatecube.h"
 
 #include "mainwindow.h"
 #include "translation.h"
@@ -35,9 +36,12 @@ Preferences *p_layout;
 Profile *p_profile;
 
 Profile::Profile(QString path)
-  : is_first_day(true),
+  : dayMutex(QMutex::Recursive),
+     is_first_day(true),
      m_opened(false),
-     m_machopened(false)
+     m_machopened(false),
+     m_lockOwned(false),
+     m_allDaysChanged(true)
 {
     p_name = STR_GEN_Profile;
 
@@ -56,6 +60,7 @@ Profile::Profile(QString path)
 
     p_filename = p_path + p_name + STR_ext_XML;
     m_machlist.clear();
+    aggregates = new AggregateCube(this);
 
     Open(p_filename);
 
@@ -69,13 +74,15 @@ Profile::Profile(QString path)
     session = new SessionSettings(this);
     general = new UserSettings(this);
 
+    invalidateIndices();
+
     OpenMachines();
     m_opened=true;
 }
 
 Profile::~Profile()
 {
-    removeLock();
+    releaseLock();
 
     delete user;
     delete doctor;
@@ -94,6 +101,7 @@ Profile::~Profile()
         delete day;
     }
 
+    delete aggregates;
 }
 
 bool Profile::Save(QString filename)
@@ -136,11 +144,24 @@ const QString STR_PROP_LastImported = "lastimported";
 void Profile::addLock()
 {
     QFile lockfile(p_path+"lockfile");
+    if (lockfile.exists()) {
+        // Opened regardless (batch mode's --ignore-lock), so the other instance still owns it
+        return;
+    }
     lockfile.open(QFile::WriteOnly);
     QByteArray ba;
     ba.append(QHostInfo::localHostName());
     lockfile.write(ba);
     lockfile.close();
+    m_lockOwned = true;
+}
+
+void Profile::releaseLock()
+{
+    if (m_lockOwned) {
+        removeLock();
+        m_lockOwned = false;
+    }
 }
 
 bool Profile::OpenMachines()
@@ -491,6 +512,12 @@ int dirCount(QString path)
 
 void Profile::DataFormatError(Machine *m)
 {
+    if (headless()) {
+        // The upgrade needs the import dialog, so this machine just isn't loaded
+        qWarning() << "Skipping" << m->brand() << m->model() << m->serial() << "as its data needs upgrading, open this profile in SleepyHead first";
+        return;
+    }
+
     QString msg;
 
     msg = "<font size=+1>"+QObject::tr("SleepyHead (%1) needs to upgrade its database for %2 %3 %4").
@@ -584,13 +611,60 @@ void Profile::UnloadMachineData()
         delete day;
     }
     daylist.clear();
+    aggregates->clear();
+    {
+        QMutexLocker lock(&m_changedMutex);
+        m_changedDays.clear();
+        m_allDaysChanged = true;
+    }
 
     for (auto & mach : m_machlist) {
         mach->sessionlist.clear();
         mach->day.clear();
     }
-    removeLock();
+    releaseLock();
 }
+
+void Profile::reprocessEvents(Day * day)
+{
+    for (Session * sess : day->sessions) {
+        bool isopen = sess->eventsLoaded();
+
+        // Load the events if they aren't loaded already
+        sess->LoadSummary();
+        sess->OpenEvents();
+
+        // Destroy any current user flags..
+        sess->destroyEvent(CPAP_UserFlag1);
+        sess->destroyEvent(CPAP_UserFlag2);
+        sess->destroyEvent(CPAP_UserFlag3);
+
+        // AHI flags
+        sess->destroyEvent(CPAP_AHI);
+        sess->destroyEvent(CPAP_RDI);
+
+        if (sess->machine()->loaderName() != STR_MACH_PRS1) {
+            sess->destroyEvent(CPAP_LargeLeak);
+        } else {
+            sess->destroyEvent(CPAP_Leak);
+        }
+
+        sess->SetChanged(true);
+
+        sess->UpdateSummaries();
+        sess->machine()->SaveSession(sess);
+
+        if (!isopen) {
+            sess->TrashEvents();
+        }
+    }
+    day->invalidate();
+
+    // Every best/worst value this day had is now suspect
+    QFile recordscache(Get("{" + STR_GEN_DataFolder + "}/Records.cache" ));
+    recordscache.remove();
+}
+
 void Profile::LoadMachineData(ProgressDialog *progress)
 {
     addLock();
@@ -613,7 +687,7 @@ void Profile::LoadMachineData(ProgressDialog *progress)
             mach->Load(progress);
         }
     }
-    progress->setMessage("Loading Channel Information");
+    if (progress) progress->setMessage("Loading Channel Information");
     loadChannels();
 }
 
@@ -648,6 +722,8 @@ Machine * Profile::lookupMachine(QString serial, QString loadername)
 
 Machine * Profile::CreateMachine(MachineInfo info, MachineID id)
 {
+    QMutexLocker lock(&machineMutex);
+
     Machine *m = nullptr;
 
     auto mlit = MachineList.find(info.loadername);
@@ -729,6 +805,8 @@ void Profile::DelMachine(Machine *m)
 
 Day *Profile::addDay(QDate date)
 {
+    QMutexLocker lock(&dayMutex);
+
     auto dit = daylist.find(date);
     if (dit == daylist.end()) {
         dit = daylist.insert(date, new Day());
@@ -748,9 +826,34 @@ Day *Profile::addDay(QDate date)
     if (m_last < date) {
         m_last = date;
     }
+    dayChanged(date);
     return day;
 }
 
+void Profile::dayChanged(QDate date)
+{
+    if (!date.isValid()) {
+        return;
+    }
+    aggregates->invalidate(date);
+
+    QMutexLocker lock(&m_changedMutex);
+    if (!m_allDaysChanged) {
+        m_changedDays.insert(date);
+    }
+}
+
+QSet<QDate> Profile::takeChangedDays(bool & all)
+{
+    QMutexLocker lock(&m_changedMutex);
+    all = m_allDaysChanged;
+    m_allDaysChanged = false;
+
+    QSet<QDate> changed;
+    changed.swap(m_changedDays);
+    return changed;
+}
+
 // Get Day record if data available for date and machine type,
 // and has enabled session data, else return nullptr
 Day *Profile::GetGoodDay(QDate date, MachineType type)
@@ -934,6 +1037,7 @@ bool Profile::unlinkDay(Day * day)
     for (auto it = daylist.begin(), it_end = daylist.end(); it != it_end; ++it) {
         if (it.value() == day) {
             daylist.erase(it);
+            dayChanged(day->date());
             return true;
         }
     }
@@ -1154,67 +1258,21 @@ QList<Day *> Profile::getDays(MachineType mt, QDate start, QDate end)
 
 int Profile::countDays(MachineType mt, QDate start, QDate end)
 {
-    if (!start.isValid()) {
+    if (!start.isValid() || !end.isValid()) {
         return 0;
     }
 
-    if (!end.isValid()) {
-        return 0;
-    }
-
-    QDate date = start;
-
-    if (date.isNull()) {
-        return 0;
-    }
-
-    int days = 0;
-
-    do {
-        Day *day = FindGoodDay(date, mt);
-
-        if (day) {
-            days++;
-        }
-
-        date = date.addDays(1);
-    } while (date <= end);
-
-    return days;
-
+    return qRound(aggregates->total(AggregateCube::Days, 0, mt, start, end));
 }
 
 int Profile::countCompliantDays(MachineType mt, QDate start, QDate end)
 {
-    EventDataType compliance = cpap->complianceHours();
-
-    if (!start.isValid()) {
-        return 0;
-    }
-
-    if (!end.isValid()) {
+    if (!start.isValid() || !end.isValid()) {
         return 0;
     }
 
-    QDate date = start;
-
-    if (date.isNull()) {
-        return 0;
-    }
-
-    int days = 0;
-
-    do {
-        Day *day = FindGoodDay(date, mt);
-
-        if (day) {
-            if (day->hours(mt) > compliance) { days++; }
-        }
-
-        date = date.addDays(1);
-    } while (date <= end);
-
-    return days;
+    // Kept against the current compliance hours, a new threshold just rebuilds the column
+    return qRound(aggregates->total(AggregateCube::Compliant, 0, mt, start, end));
 }
 
 
@@ -1228,25 +1286,7 @@ EventDataType Profile::calcCount(ChannelID code, MachineType mt, QDate start, QD
         end = LastGoodDay(mt);
     }
 
-    QDate date = start;
-
-    if (date.isNull()) {
-        return 0;
-    }
-
-    double val = 0;
-
-    do {
-        Day *day = GetGoodDay(date, mt);
-
-        if (day) {
-            val += day->count(code);
-        }
-
-        date = date.addDays(1);
-    } while (date <= end);
-
-    return val;
+    return aggregates->total(AggregateCube::Count, code, mt, start, end);
 }
 
 double Profile::calcSum(ChannelID code, MachineType mt, QDate start, QDate end)
@@ -1259,21 +1299,7 @@ double Profile::calcSum(ChannelID code, MachineType mt, QDate start, QDate end)
         end = LastGoodDay(mt);
     }
 
-    QDate date = start;
-
-    double val = 0;
-
-    do {
-        Day *day = GetGoodDay(date, mt);
-
-        if (day) {
-            val += day->sum(code);
-        }
-
-        date = date.addDays(1);
-    } while (date <= end);
-
-    return val;
+    return aggregates->total(AggregateCube::Sum, code, mt, start, end);
 }
 
 EventDataType Profile::calcHours(MachineType mt, QDate start, QDate end)
@@ -1286,25 +1312,32 @@ EventDataType Profile::calcHours(MachineType mt, QDate start, QDate end)
         end = LastGoodDay(mt);
     }
 
-    QDate date = start;
+    return aggregates->total(AggregateCube::Hours, 0, mt, start, end);
+}
 
-    if (date.isNull()) {
-        return 0;
+EventDataType Profile::calcEventIndex(MachineType mt, QDate start, QDate end)
+{
+    if (!start.isValid()) {
+        start = LastGoodDay(mt);
     }
 
-    double val = 0;
-
-    do {
-        Day *day = GetGoodDay(date, mt);
+    if (!end.isValid()) {
+        end = LastGoodDay(mt);
+    }
 
-        if (day) {
-            val += day->hours();
-        }
+    EventDataType hours = calcHours(mt, start, end);
+    if (hours <= 0) {
+        return 0;
+    }
 
-        date = date.addDays(1);
-    } while (date <= end);
+    return aggregates->total(AggregateCube::Index, m_eventIndex, mt, start, end) / hours;
+}
 
-    return val;
+void Profile::invalidateIndices()
+{
+    // Days and the aggregate cube keep totals for every index, so only the choice between them changes here.
+    // User flag settings change the totals themselves, which goes through reprocessEvents()
+    m_eventIndex = general->calculateRDI() ? IDX_RDI : IDX_AHI;
 }
 
 EventDataType Profile::calcAboveThreshold(ChannelID code, EventDataType threshold, MachineType mt,
@@ -1395,27 +1428,8 @@ EventDataType Profile::calcAvg(ChannelID code, MachineType mt, QDate start, QDat
         end = LastGoodDay(mt);
     }
 
-    QDate date = start;
-
-    if (date.isNull()) {
-        return 0;
-    }
-
-    double val = 0;
-    int cnt = 0;
-
-    do {
-        Day *day = GetGoodDay(date, mt);
-
-        if (day) {
-            if (!day->summaryOnly() || day->hasData(code, ST_AVG)) {
-                val += day->sum(code);
-                cnt += day->count(code);
-            }
-        }
-
-        date = date.addDays(1);
-    } while (date <= end);
+    double val, cnt;
+    aggregates->totals(AggregateCube::Avg, code, mt, start, end, val, cnt);
 
     if (!cnt) {
         return 0;
@@ -1434,28 +1448,8 @@ EventDataType Profile::calcWavg(ChannelID code, MachineType mt, QDate start, QDa
         end = LastGoodDay(mt);
     }
 
-    QDate date = start;
-
-    if (date.isNull()) {
-        return 0;
-    }
-
-    double val = 0, tmp, tmph, hours = 0;
-
-    do {
-        Day *day = GetGoodDay(date, mt);
-
-        if (day) {
-            if (!day->summaryOnly() || day->hasData(code, ST_WAVG)) {
-                tmph = day->hours();
-                tmp = day->wavg(code);
-                val += tmp * tmph;
-                hours += tmph;
-            }
-        }
-
-        date = date.addDays(1);
-    } while (date <= end);
+    double val, hours;
+    aggregates->totals(AggregateCube::Wavg, code, mt, start, end, val, hours);
 
     if (!hours) {
         return 0;
@@ -1475,37 +1469,9 @@ EventDataType Profile::calcMin(ChannelID code, MachineType mt, QDate start, QDat
         end = LastGoodDay(mt);
     }
 
-    QDate date = start;
-
-    if (date.isNull()) {
-        return 0;
-    }
-
-    bool first = true;
-
-    double min = 0, tmp;
-
-    do {
-        Day *day = GetGoodDay(date, mt);
-
-        if (day) {
-            if (!day->summaryOnly() || day->hasData(code, ST_MIN)) {
-                tmp = day->Min(code);
-
-                if (first || (min > tmp)) {
-                    min = tmp;
-                    first = false;
-                }
-            }
-
-        }
-
-        date = date.addDays(1);
-    } while (date <= end);
-
-    if (first) {
-        min = 0;
-    }
+    // Left at 0 when there's nothing in range
+    double min = 0;
+    aggregates->extreme(AggregateCube::Min, code, mt, start, end, min);
 
     return min;
 }
@@ -1519,31 +1485,9 @@ EventDataType Profile::calcMax(ChannelID code, MachineType mt, QDate start, QDat
         end = LastGoodDay(mt);
     }
 
-    QDate date = start;
-
-    bool first = true;
-    double max = 0, tmp;
-
-    do {
-        Day *day = GetGoodDay(date, mt);
-
-        if (day) {
-            if (!day->summaryOnly() || day->hasData(code, ST_MAX)) {
-                tmp = day->Max(code);
-
-                if (first || (max < tmp)) {
-                    max = tmp;
-                    first = false;
-                }
-            }
-        }
-
-        date = date.addDays(1);
-    } while (date <= end);
-
-    if (first) {
-        max = 0;
-    }
+    // Left at 0 when there's nothing in range
+    double max = 0;
+    aggregates->extreme(AggregateCube::Max, code, mt, start, end, max);
 
     return max;
 }
@@ -1557,33 +1501,9 @@ EventDataType Profile::calcSettingsMin(ChannelID code, MachineType mt, QDate sta
         end = LastGoodDay(mt);
     }
 
-    QDate date = start;
-
-    if (date.isNull()) {
-        return 0;
-    }
-
-    bool first = true;
-    double min = 0, tmp;
-
-    do {
-        Day *day = GetGoodDay(date, mt);
-
-        if (day) {
-            tmp = day->settings_min(code);
-
-            if (first || (min > tmp)) {
-                min = tmp;
-                first = false;
-            }
-        }
-
-        date = date.addDays(1);
-    } while (date <= end);
-
-    if (first) {
-        min = 0;
-    }
+    // Left at 0 when there's nothing in range
+    double min = 0;
+    aggregates->extreme(AggregateCube::SettingsMin, code, mt, start, end, min);
 
     return min;
 }
@@ -1598,33 +1518,9 @@ EventDataType Profile::calcSettingsMax(ChannelID code, MachineType mt, QDate sta
         end = LastGoodDay(mt);
     }
 
-    QDate date = start;
-
-    if (date.isNull()) {
-        return 0;
-    }
-
-    bool first = true;
-    double max = 0, tmp;
-
-    do {
-        Day *day = GetGoodDay(date, mt);
-
-        if (day) {
-            tmp = day->settings_max(code);
-
-            if (first || (max < tmp)) {
-                max = tmp;
-                first = false;
-            }
-        }
-
-        date = date.addDays(1);
-    } while (date <= end);
-
-    if (first) {
-        max = 0;
-    }
+    // Left at 0 when there's nothing in range
+    double max = 0;
+    aggregates->extreme(AggregateCube::SettingsMax, code, mt, start, end, max);
 
     return max;
 }
@@ -1647,94 +1543,16 @@ EventDataType Profile::calcPercentile(ChannelID code, EventDataType percent, Mac
         end = LastGoodDay(mt);
     }
 
-    QDate date = start;
-
-    if (date.isNull()) {
+    if (start.isNull()) {
         return 0;
     }
 
     QMap<EventDataType, qint64> wmap;
     QMap<EventDataType, qint64>::iterator wmi;
 
-    QHash<ChannelID, QHash<EventStoreType, EventStoreType> >::iterator vsi;
-    QHash<ChannelID, QHash<EventStoreType, quint32> >::iterator tsi;
-    EventDataType gain;
-    //bool setgain=false;
-    EventDataType value;
-    int weight;
-
-    qint64 SN = 0;
-    bool timeweight;
-    bool summaryOnly = false;
-
-    do {
-        Day *day = GetGoodDay(date, mt);
-
-        if (day) {
-            if (day->summaryOnly()) {
-                summaryOnly = true;
-                break;
-            }
-
-            // why was this nested like this???
-            //for (int i = 0; i < day->size(); i++) {
-                for (auto & sess : day->sessions) {
-                    if (!sess->enabled()) {
-                        continue;
-                    }
-
-                    gain = sess->m_gain[code];
-
-                    if (!gain) { gain = 1; }
-
-                    vsi = sess->m_valuesummary.find(code);
-
-                    if (vsi == sess->m_valuesummary.end()) { continue; }
-
-                    tsi = sess->m_timesummary.find(code);
-                    timeweight = (tsi != sess->m_timesummary.end());
-
-                    QHash<EventStoreType, EventStoreType> &vsum = vsi.value();
-                    QHash<EventStoreType, quint32> &tsum = tsi.value();
-
-                    if (timeweight) {
-                        for (auto k=tsum.begin(), tsumend=tsum.end(); k != tsumend; k++) {
-                            weight = k.value();
-                            value = EventDataType(k.key()) * gain;
-
-                            SN += weight;
-                            wmi = wmap.find(value);
-
-                            if (wmi == wmap.end()) {
-                                wmap[value] = weight;
-                            } else {
-                                wmi.value() += weight;
-                            }
-                        }
-                    } else {
-                        for (auto k=vsum.begin(), vsumend=vsum.end(); k!=vsumend; k++) {
-                            weight = k.value();
-                            value = EventDataType(k.key()) * gain;
-
-                            SN += weight;
-                            wmi = wmap.find(value);
-
-                            if (wmi == wmap.end()) {
-                                wmap[value] = weight;
-                            } else {
-                                wmi.value() += weight;
-                            }
-                        }
-                    }
-                }
-           // }
-        }
-
-        date = date.addDays(1);
-    } while (date <= end);
-
+    qint64 SN = aggregates->histogram(code, mt, start, end, wmap);
 
-    if (summaryOnly) {
+    if (SN < 0) {
         // abort percentile calculation, there is not enough data
         return 0;
     }
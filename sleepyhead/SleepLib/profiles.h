@@ -12,6 +12,8 @@
 #include <QString>
 #include <QCryptographicHash>
 #include <QThread>
+#include <QMutex>
+#include <QSet>
 
 #include "version.h"
 #include "progressdialog.h"
@@ -32,6 +34,7 @@ class OxiSettings;
 class CPAPSettings;
 class AppearanceSettings;
 class SessionSettings;
+class AggregateCube;
 
 
 /*!
@@ -63,8 +66,12 @@ class Profile : public Preferences
     //! \brief Removes a lockfile
     bool removeLock();
 
+    //! \brief Creates the lockfile, unless there already is one, in which case it's left to whoever made it
     void addLock();
 
+    //! \brief Removes the lockfile only if addLock() created it
+    void releaseLock();
+
     //! \brief Save Profile object (This is an extension to Preference::Save(..))
     virtual bool Save(QString filename = "");
 
@@ -80,6 +87,9 @@ class Profile : public Preferences
     //! \brief Unloads all machine (summary) data for this profile to free up memory;
     void UnloadMachineData();
 
+    //! \brief Recalculates day's calculated events and session summaries from the raw event data, and saves them
+    void reprocessEvents(Day * day);
+
     //! \brief Barf because data format has changed. This does a purge of CPAP data for machine *m
     void DataFormatError(Machine *m);
 
@@ -144,6 +154,15 @@ class Profile : public Preferences
     //! \brief Returns a sum of all session durations for machine type, between start and end dates
     EventDataType calcHours(MachineType mt = MT_CPAP, QDate start = QDate(), QDate end = QDate());
 
+    //! \brief Returns the AHI, or RDI as per preferences, across all days of machine type between start and end dates
+    EventDataType calcEventIndex(MachineType mt = MT_CPAP, QDate start = QDate(), QDate end = QDate());
+
+    //! \brief Which index the AHI figures show, as of the last invalidateIndices()
+    SessionIndex eventIndex() const { return m_eventIndex; }
+
+    //! \brief Pick up changes to the preferences the event index depends on, call after changing any of them
+    void invalidateIndices();
+
     //! \brief Calculates Channel Average (Sums and counts all events, returning the sum divided by the count.)
     EventDataType calcAvg(ChannelID code, MachineType mt = MT_CPAP, QDate start = QDate(),
                           QDate end = QDate());
@@ -212,6 +231,9 @@ class Profile : public Preferences
     //! \brief QMap of day records (iterates in order).
     QMap<QDate, Day *> daylist;
 
+    //! \brief Held while daylist or the session lists of its Days are being changed, so machines can add sessions from import threads
+    QMutex dayMutex;
+
     void removeMachine(Machine *);
     Machine * lookupMachine(QString serial, QString loadername);
     Machine * CreateMachine(MachineInfo info, MachineID id = 0);
@@ -231,15 +253,33 @@ class Profile : public Preferences
     SessionSettings *session;
     QList<Machine *> m_machlist;
 
+    //! \brief Date indexed summary values behind the calc* functions, kept up to date by Day::invalidate()
+    AggregateCube *aggregates;
+
+    //! \brief Marks date as changed in the aggregate cube and for takeChangedDays(), safe to call from import threads
+    void dayChanged(QDate date);
+
+    //! \brief Returns the dates changed since the last call, setting all instead if the whole daylist was reloaded since
+    QSet<QDate> takeChangedDays(bool & all);
+
   protected:
     QDate m_first;
     QDate m_last;
 
     bool m_opened;
     bool m_machopened;
+    bool m_lockOwned;
 
     QHash<QString, QHash<QString, Machine *> > MachineList;
 
+    SessionIndex m_eventIndex;
+
+    //! \brief Guards MachineList, as loaders may be creating machines from import threads
+    QMutex machineMutex;
+
+    QSet<QDate> m_changedDays;
+    bool m_allDaysChanged;
+    QMutex m_changedMutex;
 };
 
 class MachineLoader;
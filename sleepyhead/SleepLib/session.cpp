@@ -13,17 +13,19 @@
 #include <QDebug>
 #include <QMessageBox>
 #include <QMetaType>
+#include <QAtomicInt>
 #include <algorithm>
 #include <limits>
 
 #include "SleepLib/calcs.h"
 #include "SleepLib/profiles.h"
+#include "Graphs/gProfiler.h"
 
 using namespace std;
 
 // This is the uber important database version for SleepyHeads internal storage
 // Increment this after stuffing with Session's save & load code.
-const quint16 summary_version = 18;
+const quint16 summary_version = 19;
 const quint16 events_version = 10;
 
 Session::Session(Machine *m, SessionID session)
@@ -49,6 +51,15 @@ Session::Session(Machine *m, SessionID session)
     s_noSettings = s_summaryOnly = false;
 
     destroyed = false;
+    eventsChanged();
+}
+
+// Shared by every session, so a new or reloaded one never repeats a generation a graph has cached
+static QAtomicInt eventGenerations;
+
+void Session::eventsChanged()
+{
+    s_eventGeneration = quint32(eventGenerations.fetchAndAddOrdered(1) + 1);
 }
 
 Session::~Session()
@@ -84,6 +95,7 @@ void Session::TrashEvents()
     s_events_loaded = false;
     eventlist.clear();
     eventlist.squeeze();
+    eventsChanged();
 }
 
 void Session::setEnabled(bool b)
@@ -117,6 +129,9 @@ bool Session::OpenEvents()
 
 
     QString filename = eventFile();
+
+    // Shows up as a stall in the performance overlay when it holds up drawing
+    gProfiler::Scope scope("stall", QString("Load events %1").arg(s_session));
     bool b = LoadEvents(filename);
 
     if (!b) {
@@ -125,6 +140,7 @@ bool Session::OpenEvents()
     }
     qDebug() << "Loading" << s_machine->loaderName().toLocal8Bit().data() << "Events:" << filename.toLocal8Bit().data();
 
+    eventsChanged();
     return s_events_loaded = true;
 }
 
@@ -365,6 +381,10 @@ bool Session::StoreSummary()
 
     out << m_slices;
 
+    // Summary only loaders just set the counts, so make sure these match whatever they left
+    updateIndices();
+    out << m_indices; // 19
+
     file.close();
     return true;
 }
@@ -629,8 +649,15 @@ bool Session::LoadSummary()
         }
     }
 
+    if (version >= 19) {
+        in >> m_indices;
+    } else {
+        updateIndices();
+    }
+
     // not really a good idea to do this... should flag and do a reindex
-    if (upgrade || (version < summary_version)) {
+    // Version 18 only lacks the index totals, which were just worked out from the counts, the next save keeps them
+    if (upgrade || (version < 18)) {
 
         qDebug() << "Upgrading Summary file to version" << summary_version;
         if (!s_summaryOnly) {
@@ -978,6 +1005,9 @@ bool Session::LoadEvents(QString filename)
                 //                    in >> x;
                 //                    *tptr++=x;
                 //                }
+            } else {
+                // Summarise it now, rather than on the first paint
+                evec.buildPyramid();
             }
         }
     }
@@ -1002,6 +1032,7 @@ void Session::destroyEvent(ChannelID code)
 
         eventlist.erase(it);
     }
+    eventsChanged();
 
     m_gain.erase(m_gain.find(code));
     m_firstchan.erase(m_firstchan.find(code));
@@ -1106,6 +1137,9 @@ void Session::UpdateSummaries()
 {
     ChannelID id;
 
+    // The calculations below add and replace event lists
+    eventsChanged();
+
     // Generate that AHI per hour graph in daily view.
     calcAHIGraph(this);
 
@@ -1165,9 +1199,22 @@ void Session::UpdateSummaries()
     }
     timeAboveThreshold(CPAP_Leak, p_profile->cpap->leakRedline());
 
+    updateIndices();
+
     s_machine->updateChannels(this);
 }
 
+void Session::updateIndices()
+{
+    EventDataType ahi = m_cnt.value(CPAP_Obstructive, 0) + m_cnt.value(CPAP_Hypopnea, 0)
+                      + m_cnt.value(CPAP_ClearAirway, 0) + m_cnt.value(CPAP_Apnea, 0);
+
+    m_indices.resize(IDX_Count);
+    m_indices[IDX_AHI] = ahi;
+    m_indices[IDX_RDI] = ahi + m_cnt.value(CPAP_RERA, 0);
+    m_indices[IDX_SHEI] = ahi + m_cnt.value(CPAP_UserFlag1, 0) + m_cnt.value(CPAP_UserFlag2, 0);
+}
+
 EventDataType Session::SearchValue(ChannelID code, qint64 time, bool square)
 {
     qint64 t1, t2, start;
@@ -2245,6 +2292,7 @@ EventList *Session::AddEventList(ChannelID code, EventListType et, EventDataType
     EventList *el = new EventList(et, gain, offset, min, max, rate, second_field);
 
     eventlist[code].push_back(el);
+    eventsChanged();
     //s_machine->registerChannel(chan);
     return el;
 }
@@ -46,6 +46,14 @@ public:
     SliceStatus status;
 };
 
+//! \brief Event totals behind the respiratory indices, worked out with the summaries and kept in the summary cache
+enum SessionIndex {
+    IDX_AHI = 0,    // Obstructive, Hypopnea, ClearAirway and Apnea events
+    IDX_RDI,        // AHI events plus RERA
+    IDX_SHEI,       // AHI events plus UserFlag1 and UserFlag2
+    IDX_Count
+};
+
 /*! \class Session
     \brief Contains a single Sessions worth of machine event/waveform information.
 
@@ -242,6 +250,9 @@ class Session
 
     QVector<SessionSlice> m_slices;
 
+    //! \brief Event totals for each SessionIndex, see updateIndices()
+    QVector<EventDataType> m_indices;
+
     //! \brief Generates sum and time data for each distinct value in 'code' events..
     void updateCountSummary(ChannelID code);
 
@@ -362,6 +373,12 @@ class Session
 
     bool eventsLoaded() { return s_events_loaded; }
 
+    //! \brief Returns a number that changes whenever this sessions event lists are loaded, added to or thrown away
+    inline quint32 eventGeneration() const { return s_eventGeneration; }
+
+    //! \brief Marks the event lists as changed, so anything keyed on eventGeneration() rebuilds
+    void eventsChanged();
+
     //! \brief Update this sessions first time if it's less than the current record
     inline void updateFirst(qint64 v) { if (!s_first) { s_first = v; } else if (s_first > v) { s_first = v; } }
 
@@ -377,6 +394,12 @@ class Session
     //! \brief Regenerates the Session Index Caches, and calls the fun calculation functions
     void UpdateSummaries();
 
+    //! \brief Works out the SessionIndex totals from the event counts
+    void updateIndices();
+
+    //! \brief Returns the number of events making up index idx
+    EventDataType indexCount(SessionIndex idx) const { return m_indices.value(idx, 0); }
+
     //! \brief Creates and returns a new EventList for the supplied Channel code
     EventList *AddEventList(ChannelID code, EventListType et, EventDataType gain = 1.0,
                             EventDataType offset = 0.0, EventDataType min = 0.0, EventDataType max = 0.0,
@@ -406,6 +429,7 @@ class Session
         m_cph.clear();
         m_sum.clear();
         m_cnt.clear();
+        m_indices.clear();
     }
 
 
@@ -435,6 +459,7 @@ protected:
     bool s_summary_loaded;
     bool s_events_loaded;
     bool s_enabled;
+    quint32 s_eventGeneration;
 
     // for debugging
     bool destroyed;
@@ -0,0 +1,304 @@
+/* SleepyHead Batch Mode Implementation
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#include <QFile>
+#include <QTextStream>
+#include <QDebug>
+#include <cstdio>
+
+#include "batchmode.h"
+#include "SleepLib/profiles.h"
+#include "SleepLib/importorchestrator.h"
+#include "SleepLib/columnexport.h"
+
+BatchMode::BatchMode(const QStringList & args)
+    :m_args(args), m_recalc(false), m_ignoreLock(false), m_csvmode(CSVExport::Summary)
+{
+}
+
+bool BatchMode::requested(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--batch") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BatchMode::usage()
+{
+    fprintf(stderr,
+            "Usage: SleepyHead --batch --profile NAME [options]\n"
+            "  --datadir PATH         SleepyHead data folder to use\n"
+            "  --password TEXT        profile password, if it has one\n"
+            "  --ignore-lock          open the profile even if another instance has it locked\n"
+            "  --import PATH          import CPAP card data from PATH, can be given more than once\n"
+            "  --recalc               recalculate every day's summaries\n"
+            "  --from YYYY-MM-DD      first day for statistics and exports (default: the first day with data)\n"
+            "  --to YYYY-MM-DD        last day for statistics and exports (default: the last day with data)\n"
+            "  --stats FILE           write summary statistics as tab separated text, - for stdout\n"
+            "  --csv FILE             write a CSV export\n"
+            "  --csv-mode MODE        summary, sessions or details (default: summary)\n"
+            "  --columns FILE         write every session's events and waveforms as a column file\n");
+}
+
+bool BatchMode::parse()
+{
+    for (int i = 1; i < m_args.size(); ++i) {
+        const QString & arg = m_args.at(i);
+
+        if (arg == "--batch") {
+            continue;
+        } else if (arg == "--recalc") {
+            m_recalc = true;
+            continue;
+        } else if (arg == "--ignore-lock") {
+            m_ignoreLock = true;
+            continue;
+        }
+
+        // Everything else takes a value
+        if ((i + 1) >= m_args.size()) {
+            fprintf(stderr, "Missing argument to %s\n", arg.toLocal8Bit().data());
+            usage();
+            return false;
+        }
+        const QString & value = m_args.at(++i);
+
+        if (arg == "--datadir") {
+            m_datadir = value;
+        } else if (arg == "--profile") {
+            m_profile = value;
+        } else if (arg == "--password") {
+            m_password = value;
+        } else if (arg == "--import") {
+            m_imports.append(value);
+        } else if ((arg == "--from") || (arg == "--to")) {
+            QDate date = QDate::fromString(value, Qt::ISODate);
+            if (!date.isValid()) {
+                fprintf(stderr, "Invalid date %s\n", value.toLocal8Bit().data());
+                return false;
+            }
+            (arg == "--from" ? m_start : m_end) = date;
+        } else if (arg == "--stats") {
+            m_stats = value;
+        } else if (arg == "--csv") {
+            m_csv = value;
+        } else if (arg == "--csv-mode") {
+            if (value == "summary") {
+                m_csvmode = CSVExport::Summary;
+            } else if (value == "sessions") {
+                m_csvmode = CSVExport::Sessions;
+            } else if (value == "details") {
+                m_csvmode = CSVExport::Details;
+            } else {
+                fprintf(stderr, "Unknown CSV mode %s\n", value.toLocal8Bit().data());
+                return false;
+            }
+        } else if (arg == "--columns") {
+            m_columns = value;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", arg.toLocal8Bit().data());
+            usage();
+            return false;
+        }
+    }
+
+    if (m_profile.isEmpty()) {
+        fprintf(stderr, "No profile given\n");
+        usage();
+        return false;
+    }
+    return true;
+}
+
+bool BatchMode::openProfile()
+{
+    Profile * prof = Profiles::Get(m_profile);
+    if (!prof) {
+        fprintf(stderr, "No profile named %s\n", m_profile.toLocal8Bit().data());
+        return false;
+    }
+
+    if (prof->user->hasPassword() && !prof->user->checkPassword(m_password)) {
+        fprintf(stderr, "Wrong password for profile %s\n", m_profile.toLocal8Bit().data());
+        return false;
+    }
+
+    QString lockhost = prof->checkLock();
+    if (!lockhost.isEmpty() && !m_ignoreLock) {
+        fprintf(stderr, "Profile %s is locked by %s, close SleepyHead there or use --ignore-lock\n",
+                m_profile.toLocal8Bit().data(), lockhost.toLocal8Bit().data());
+        return false;
+    }
+
+    p_profile = prof;
+
+    // Same as MainWindow::OpenProfile
+    if (p_profile->cpap->AHIWindow() < 30.0) {
+        p_profile->cpap->setAHIWindow(60.0);
+    }
+    p_profile->LoadMachineData(nullptr);
+    return true;
+}
+
+void BatchMode::closeProfile()
+{
+    p_profile->StoreMachines();
+    p_profile->UnloadMachineData();
+    p_profile->saveChannels();
+    p_profile->Save();
+    p_profile->releaseLock();
+    p_profile = nullptr;
+}
+
+bool BatchMode::importPaths()
+{
+    ImportOrchestrator importer;
+    bool ok = true;
+
+    QList<MachineLoader *> loaders = GetLoaders(MT_CPAP);
+    for (const auto & path : m_imports) {
+        bool found = false;
+        for (auto & loader : loaders) {
+            if (loader->Detect(path)) {
+                importer.add(ImportPath(path, loader));
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "No machine data found at %s\n", path.toLocal8Bit().data());
+            ok = false;
+        }
+    }
+    if (importer.count() == 0) {
+        return ok;
+    }
+
+    importer.run();
+
+    for (int i = 0; i < importer.count(); ++i) {
+        int c = importer.result(i);
+        QByteArray path = importer.path(i).path.toLocal8Bit();
+        if (c < 0) {
+            fprintf(stderr, "Couldn't import %s\n", path.data());
+            ok = false;
+        } else {
+            printf("Imported %d session(s) from %s\n", c, path.data());
+        }
+    }
+
+    // Same as MainWindow::finishCPAPImport
+    p_profile->StoreMachines();
+    for (Machine * mach : p_profile->GetMachines(MT_CPAP)) {
+        mach->saveSessionInfo();
+        mach->SaveSummaryCache();
+    }
+    return ok;
+}
+
+void BatchMode::recalculate()
+{
+    for (Day * day : p_profile->daylist) {
+        p_profile->reprocessEvents(day);
+    }
+}
+
+bool BatchMode::writeStatistics()
+{
+    QFile file(m_stats);
+    bool ok;
+    if (m_stats == "-") {
+        ok = file.open(stdout, QFile::WriteOnly | QFile::Text);
+    } else {
+        ok = file.open(QFile::WriteOnly | QFile::Text);
+    }
+    if (!ok) {
+        fprintf(stderr, "Couldn't open %s for writing\n", m_stats.toLocal8Bit().data());
+        return false;
+    }
+
+    QTextStream out(&file);
+    const QDate & start = m_start;
+    const QDate & end = m_end;
+
+    EventDataType hours = p_profile->calcHours(MT_CPAP, start, end);
+    EventDataType percent = p_profile->general->prefCalcPercentile() / 100.0;
+
+    auto line = [&out](const QString & name, double value, int decimals) {
+        out << name << '\t' << QString::number(value, 'f', decimals) << '\n';
+    };
+
+    out << "Statistic\tValue\n";
+    out << "From\t" << start.toString(Qt::ISODate) << '\n';
+    out << "To\t" << end.toString(Qt::ISODate) << '\n';
+    line("Days", p_profile->countDays(MT_CPAP, start, end), 0);
+    line("Compliant Days", p_profile->countCompliantDays(MT_CPAP, start, end), 0);
+    line("Hours", hours, 2);
+    line("AHI", p_profile->calcEventIndex(MT_CPAP, start, end), 2);
+
+    const ChannelID counts[] = { CPAP_Obstructive, CPAP_Hypopnea, CPAP_ClearAirway, CPAP_Apnea, CPAP_RERA, CPAP_FlowLimit };
+    for (const auto code : counts) {
+        double count = p_profile->calcCount(code, MT_CPAP, start, end);
+        line(schema::channel[code].code() + " Index", (hours > 0) ? count / hours : 0, 2);
+    }
+
+    const ChannelID pressures[] = { CPAP_Pressure, CPAP_EPAP, CPAP_IPAP, CPAP_Leak };
+    for (const auto code : pressures) {
+        if (!p_profile->channelAvailable(code)) continue;
+        const QString & name = schema::channel[code].code();
+        line(name + " Average", p_profile->calcWavg(code, MT_CPAP, start, end), 2);
+        line(name + QString(" %1%").arg(percent * 100.0, 0, 'f', 0), p_profile->calcPercentile(code, percent, MT_CPAP, start, end), 2);
+        line(name + " Max", p_profile->calcMax(code, MT_CPAP, start, end), 2);
+    }
+
+    out.flush();
+    return file.error() == QFile::NoError;
+}
+
+int BatchMode::run()
+{
+    if (!openProfile()) {
+        return 1;
+    }
+    qDebug() << "Running batch job for profile" << m_profile;
+
+    bool ok = true;
+    if (!m_imports.isEmpty()) {
+        ok &= importPaths();
+    }
+    if (m_recalc) {
+        recalculate();
+    }
+
+    if (!m_start.isValid()) m_start = p_profile->FirstDay();
+    if (!m_end.isValid()) m_end = p_profile->LastDay();
+
+    if (!m_stats.isEmpty()) {
+        ok &= writeStatistics();
+    }
+    if (!m_csv.isEmpty()) {
+        CSVExport exporter(m_csvmode);
+        if (!exporter.exportRange(m_csv, m_start, m_end)) {
+            fprintf(stderr, "Couldn't write %s\n", m_csv.toLocal8Bit().data());
+            ok = false;
+        }
+    }
+    if (!m_columns.isEmpty()) {
+        ColumnExport exporter;
+        if (!exporter.exportRange(m_columns, m_start, m_end)) {
+            fprintf(stderr, "Couldn't write %s\n", m_columns.toLocal8Bit().data());
+            ok = false;
+        }
+    }
+
+    closeProfile();
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,73 @@
+/* SleepyHead Batch Mode Header
+ *
+ * Copyright (c) 2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#ifndef BATCHMODE_H
+#define BATCHMODE_H
+
+#include <QDate>
+#include <QString>
+#include <QStringList>
+
+#include "SleepLib/csvexport.h"
+
+/*! \class BatchMode
+    \brief Runs an import, summary recalculation and exports against one profile from the command line
+
+    Only SleepLib is used, so nothing here creates a widget or an OpenGL context and jobs can run without a display.
+    Each job only locks and writes its own profile, so jobs for different profiles can run side by side.
+    */
+class BatchMode
+{
+  public:
+    BatchMode(const QStringList & args);
+
+    //! \brief Returns true if args asks for batch mode
+    static bool requested(int argc, char *argv[]);
+
+    //! \brief Reads the command line, printing usage and returning false if it doesn't make sense
+    bool parse();
+
+    //! \brief Run the job, with preferences, loaders and profiles already set up. Returns the process exit code
+    int run();
+
+    //! \brief The --datadir argument, if one was given
+    const QString & dataDir() const { return m_datadir; }
+
+  protected:
+    void usage();
+
+    //! \brief Open the profile and load its summaries, returns false if it can't be used
+    bool openProfile();
+    void closeProfile();
+
+    //! \brief Import every --import path with whichever loaders recognize it, returns false if any failed
+    bool importPaths();
+
+    //! \brief Recalculate every day's summaries
+    void recalculate();
+
+    //! \brief Write tab separated summary statistics for the range to m_stats ("-" for stdout)
+    bool writeStatistics();
+
+    QStringList m_args;
+
+    QString m_datadir;
+    QString m_profile;
+    QString m_password;
+    QStringList m_imports;
+    bool m_recalc;
+    bool m_ignoreLock;
+    QDate m_start, m_end;
+
+    QString m_stats;
+    QString m_csv;
+    CSVExport::Mode m_csvmode;
+    QString m_columns;
+};
+
+#endif // BATCHMODE_H
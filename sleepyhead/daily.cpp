@@ -131,6 +131,7 @@ Daily::Daily(QWidget *parent,gGraphView * shared)
     ui->graphMainArea->setAutoFillBackground(false);
 
     GraphView=new gGraphView(ui->graphFrame,shared);
+    GraphView->setObjectName("DailyGraphView");
     GraphView->setSizePolicy(QSizePolicy::Expanding,QSizePolicy::Expanding);
 
     snapGV=new gGraphView(GraphView);
@@ -1382,9 +1383,7 @@ void Daily::Load(QDate date)
 
         modestr=schema::channel[CPAP_Mode].m_options[mode];
 
-        EventDataType ahi=(day->count(CPAP_Obstructive)+day->count(CPAP_Hypopnea)+day->count(CPAP_ClearAirway)+day->count(CPAP_Apnea));
-        if (p_profile->general->calculateRDI()) ahi+=day->count(CPAP_RERA);
-        ahi/=hours;
+        EventDataType ahi=day->eventCount() / hours;
 
         if (hours>0) {
             html+="<table cellspacing=0 cellpadding=0 border=0 width='100%'>\n";
@@ -1392,7 +1391,7 @@ void Daily::Load(QDate date)
             if (!isBrick) {
                 ChannelID ahichan=CPAP_AHI;
                 QString ahiname=STR_TR_AHI;
-                if (p_profile->general->calculateRDI()) {
+                if (p_profile->eventIndex() == IDX_RDI) {
                     ahichan=CPAP_RDI;
                     ahiname=STR_TR_RDI;
                 }
@@ -1876,6 +1875,7 @@ void Daily::RedrawGraphs()
         schema::channel[CPAP_Leak].setUpperThreshold(0); // switch it off
     }
 
+    GraphView->invalidateTiles();
     GraphView->redraw();
 }
 
@@ -2377,6 +2377,7 @@ void Daily::on_eventsCombo_activated(int index)
 
     ui->eventsCombo->setItemIcon(index,b ? *icon_on : *icon_off);
 
+    GraphView->invalidateTiles();
     GraphView->redraw();
 }
 
@@ -2399,6 +2400,7 @@ void Daily::on_toggleEvents_clicked(bool checked)
     }
 
     updateCube();
+    GraphView->invalidateTiles();
     GraphView->redraw();
 }
 
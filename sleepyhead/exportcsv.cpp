@@ -13,6 +13,7 @@
 #include <QTextCharFormat>
 #include "SleepLib/profiles.h"
 #include "SleepLib/day.h"
+#include "SleepLib/csvexport.h"
 #include "exportcsv.h"
 #include "ui_exportcsv.h"
 #include "mainwindow.h"
@@ -142,228 +143,23 @@ void ExportCSV::on_quickRangeCombo_activated(const QString &arg1)
 
 void ExportCSV::on_exportButton_clicked()
 {
-    QFile file(ui->filenameEdit->text());
-    file.open(QFile::WriteOnly);
-    QString header;
-    const QString sep = ",";
-    const QString newline = "\n";
-
-    //    if (ui->rb1_details->isChecked()) {
-    //        fields.append(DumpField(NoChannel,MT_CPAP,ST_DATE));
-    //    } else {
-    //        header=tr("DateTime")+sep+tr("Session")+sep+tr("Event")+sep+tr("Data/Duration");
-    //    } else {
-    //        if (ui->rb1_Summary->isChecked()) {
-    //            header=tr("Date")+sep+tr("Session Count")+sep+tr("Start")+sep+tr("End")+sep+tr("Total Time")+sep+tr("AHI");
-    //        } else if (ui->rb1_Sessions->isChecked()) {
-    //            header=tr("Date")+sep+tr("Session")+sep+tr("Start")+sep+tr("End")+sep+tr("Total Time")+sep+tr("AHI");
-    //        }
-    //    }
-    //    fields.append(DumpField(NoChannel,MT_CPAP,ST_SESSIONS));
-
-
-    QList<ChannelID> countlist, avglist, p90list, maxlist;
-    countlist.append(CPAP_Hypopnea);
-    countlist.append(CPAP_Obstructive);
-    countlist.append(CPAP_Apnea);
-    countlist.append(CPAP_ClearAirway);
-    countlist.append(CPAP_VSnore);
-    countlist.append(CPAP_VSnore2);
-    countlist.append(CPAP_RERA);
-    countlist.append(CPAP_FlowLimit);
-    countlist.append(CPAP_SensAwake);
-    countlist.append(CPAP_NRI);
-    countlist.append(CPAP_ExP);
-    countlist.append(CPAP_LeakFlag);
-    countlist.append(CPAP_UserFlag1);
-    countlist.append(CPAP_UserFlag2);
-    countlist.append(CPAP_PressurePulse);
-
-    avglist.append(CPAP_Pressure);
-    avglist.append(CPAP_IPAP);
-    avglist.append(CPAP_EPAP);
-    avglist.append(CPAP_FLG);        // Pholynyk, 25Aug2015, add ResMed Flow Limitation
-
-    p90list.append(CPAP_Pressure);
-    p90list.append(CPAP_IPAP);
-    p90list.append(CPAP_EPAP);
-    p90list.append(CPAP_FLG);
-       
-    float percentile=p_profile->general->prefCalcPercentile()/100.0;                   // Pholynyk, 18Aug2015
-    EventDataType percent = percentile;                                                // was 0.90F
-
-    maxlist.append(CPAP_Pressure);    // Pholynyk, 18Aug2015, add maximums
-    maxlist.append(CPAP_IPAP);
-    maxlist.append(CPAP_EPAP);
-    maxlist.append(CPAP_FLG);
-
-    // Not sure this section should be translateable.. :-/
+    CSVExport::Mode mode = CSVExport::Summary;
     if (ui->rb1_details->isChecked()) {
-        header = tr("DateTime") + sep + tr("Session") + sep + tr("Event") + sep + tr("Data/Duration");
-    } else {
-        if (ui->rb1_Summary->isChecked()) {
-            header = tr("Date") + sep + tr("Session Count") + sep + tr("Start") + sep + tr("End") + sep +
-                     tr("Total Time") + sep + tr("AHI");
-        } else if (ui->rb1_Sessions->isChecked()) {
-            header = tr("Date") + sep + tr("Session") + sep + tr("Start") + sep + tr("End") + sep +
-                     tr("Total Time") + sep + tr("AHI");
-        }
-
-        for (int i = 0; i < countlist.size(); i++) {
-            header += sep + schema::channel[countlist[i]].label() + tr(" Count");
-        }
-
-        for (int i = 0; i < avglist.size(); i++) {
-            header += sep + Day::calcMiddleLabel(avglist[i]);        // Pholynyk, 18Aug2015
-        }
-
-        for (int i = 0; i < p90list.size(); i++) {
-            header += sep + tr("%1% ").arg(percent*100.0, 0, 'f', 0) + schema::channel[p90list[i]].label();
-        }
-
-        for (int i = 0; i < maxlist.size(); i++) {
-            header += sep + Day::calcMaxLabel(maxlist[i]);                                     // added -- Pholynyk, 18Aug2015
-        }
+        mode = CSVExport::Details;
+    } else if (ui->rb1_Sessions->isChecked()) {
+        mode = CSVExport::Sessions;
     }
 
-    header += newline;
-    file.write(header.toLatin1());
-    QDate date = ui->startDate->date();
-    Daily *daily = mainwin->getDaily();
-    QDate daily_date = daily->getDate();
-
-    ui->progressBar->setValue(0);
-    ui->progressBar->setMaximum(p_profile->daylist.count());
-
-    do {
-        ui->progressBar->setValue(ui->progressBar->value() + 1);
-        QApplication::processEvents();
-
-        Day *day = p_profile->GetDay(date, MT_CPAP);
-
-        if (day) {
-            QString data;
-
-            if (ui->rb1_Summary->isChecked()) {
-                QDateTime start = QDateTime::fromTime_t(day->first() / 1000L);
-                QDateTime end = QDateTime::fromTime_t(day->last() / 1000L);
-                data = date.toString(Qt::ISODate);
-                data += sep + QString::number(day->size(), 10);
-                data += sep + start.toString(Qt::ISODate);
-                data += sep + end.toString(Qt::ISODate);
-                int time = day->total_time() / 1000L;
-                int h = time / 3600;
-                int m = int(time / 60) % 60;
-                int s = int(time) % 60;
-                data += sep + QString().sprintf("%02i:%02i:%02i", h, m, s);
-                float ahi = day->count(CPAP_Obstructive) + day->count(CPAP_Hypopnea) + day->count(
-                                CPAP_Apnea) + day->count(CPAP_ClearAirway);
-                ahi /= day->hours();
-                data += sep + QString::number(ahi, 'f', 3);
-
-                for (int i = 0; i < countlist.size(); i++) {
-                    data += sep + QString::number(day->count(countlist.at(i)));
-                }
-
-                for (int i = 0; i < avglist.size(); i++) {
-                    float avg = day->calcMiddle(avglist.at(i));
-                    data += sep + QString::number(avg);                // Pholynyk, 11Aug2015
-                }
-
-                for (int i = 0; i < p90list.size(); i++) {
-                    float p90 = day->percentile(p90list.at(i), percent);
-                    data += sep + QString::number(p90);                // Pholynyk, 11Aug2015
-                }
-
-                for (int i = 0; i < maxlist.size(); i++) {
-                    float max = day->calcMax(maxlist.at(i));
-                    data += sep + QString::number(max);                // added -- Pholynyk, 18Aug2015
-                }
-
-                data += newline;
-                file.write(data.toLatin1());
-
-            } else if (ui->rb1_Sessions->isChecked()) {
-                for (int i = 0; i < day->size(); i++) {
-                    Session *sess = (*day)[i];
-                    QDateTime start = QDateTime::fromTime_t(sess->first() / 1000L);
-                    QDateTime end = QDateTime::fromTime_t(sess->last() / 1000L);
-
-                    data = date.toString(Qt::ISODate);
-                    data += sep + QString::number(sess->session(), 10);
-                    data += sep + start.toString(Qt::ISODate);
-                    data += sep + end.toString(Qt::ISODate);
-                    int time = sess->length() / 1000L;
-                    int h = time / 3600;
-                    int m = int(time / 60) % 60;
-                    int s = int(time) % 60;
-                    data += sep + QString().sprintf("%02i:%02i:%02i", h, m, s);
-
-                    float ahi = sess->count(CPAP_Obstructive) + sess->count(CPAP_Hypopnea) + sess->count(
-                                    CPAP_Apnea) + sess->count(CPAP_ClearAirway);
-                    ahi /= sess->hours();
-                    data += sep + QString::number(ahi, 'f', 3);
-
-                    for (int j = 0; j < countlist.size(); j++) {
-                        data += sep + QString::number(sess->count(countlist.at(j)));
-                    }
-
-                    for (int j = 0; j < avglist.size(); j++) {
-                        data += sep + QString::number(sess->calcMiddle(avglist.at(j)));                // Pholynyk, 11Aug2015
-                    }
-
-                    for (int j = 0; j < p90list.size(); j++) {
-                        data += sep + QString::number(sess->percentile(p90list.at(j), percent));               // Pholynyk, 11Aug2015
-                    }
-
-                    for (int i = 0; i < maxlist.size(); i++) {
-                        data += sep + QString::number(sess->calcMax(maxlist.at(i)));                // Pholynyk, 11Aug2015
-                    }
-
-                    data += newline;
-                    file.write(data.toLatin1());
-                }
-            } else if (ui->rb1_details->isChecked()) {
-                QList<ChannelID> all = countlist;
-                all.append(avglist);
-
-                for (int i = 0; i < day->size(); i++) {
-                    Session *sess = (*day)[i];
-                    sess->OpenEvents();
-                    QHash<ChannelID, QVector<EventList *> >::iterator fnd;
-
-                    for (int j = 0; j < all.size(); j++) {
-                        ChannelID key = all.at(j);
-                        fnd = sess->eventlist.find(key);
-
-                        if (fnd != sess->eventlist.end()) {
-                            //header="DateTime"+sep+"Session"+sep+"Event"+sep+"Data/Duration";
-                            for (int e = 0; e < fnd.value().size(); e++) {
-                                EventList *ev = fnd.value()[e];
-
-                                for (quint32 q = 0; q < ev->count(); q++) {
-                                    data = QDateTime::fromTime_t(ev->time(q) / 1000L).toString(Qt::ISODate);
-                                    data += sep + QString::number(sess->session());
-                                    data += sep + schema::channel[key].code();
-                                    data += sep + QString::number(ev->data(q), 'f', 2);
-                                    data += newline;
-                                    file.write(data.toLatin1());
-                                }
-                            }
-                        }
-                    }
-
-                    if (daily_date != date) {
-                        sess->TrashEvents();
-                    }
-                }
-            }
-        }
-
-        date = date.addDays(1);
-    } while (date <= ui->endDate->date());
+    CSVExport exporter(mode);
+    connect(&exporter, SIGNAL(setProgressMax(int)), ui->progressBar, SLOT(setMaximum(int)));
+    connect(&exporter, SIGNAL(setProgressValue(int)), ui->progressBar, SLOT(setValue(int)));
 
-    file.close();
+    ui->exportButton->setEnabled(false);
+    if (!exporter.exportRange(ui->filenameEdit->text(), ui->startDate->date(), ui->endDate->date())) {
+        QMessageBox::warning(this, STR_MessageBox_Error, tr("Couldn't write to %1").arg(ui->filenameEdit->text()), QMessageBox::Ok);
+        ui->exportButton->setEnabled(true);
+        return;
+    }
     ExportCSV::accept();
 }
 
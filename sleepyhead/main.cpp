@@ -13,12 +13,14 @@
 #include <QSettings>
 #include <QFileDialog>
 #include <QFontDatabase>
+#include <QGuiApplication>
 
 #include "version.h"
 #include "logger.h"
 #include "mainwindow.h"
 #include "SleepLib/profiles.h"
 #include "translation.h"
+#include "batchmode.h"
 
 // Gah! I must add the real darn plugin system one day.
 #include "SleepLib/loader_plugins/prs1_loader.h"
@@ -51,12 +53,77 @@ void sDelay(int s)
 
 int compareVersion(QString version);
 
+//! \brief Sets up the channel schema and registers the importer modules for the autoscanner
+void registerLoaders()
+{
+    schema::init();
+    PRS1Loader::Register();
+    ResmedLoader::Register();
+    IntellipapLoader::Register();
+    FPIconLoader::Register();
+    WeinmannLoader::Register();
+    CMS50Loader::Register();
+    CMS50F37Loader::Register();
+    MD300W1Loader::Register();
+
+    schema::setOrders(); // could be called in init...
+}
+
+//! \brief Runs a --batch job without any windows, returning the process exit code
+int batchMain(int argc, char *argv[])
+{
+    // The loaders still need QPixmap, so there has to be a QGuiApplication, just not a screen
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication a(argc, argv);
+    a.setApplicationName(getAppName());
+    a.setOrganizationName(getDeveloperName());
+    setHeadless(true);
+
+    BatchMode job(a.arguments());
+    if (!job.parse()) {
+        return 1;
+    }
+    if (!job.dataDir().isEmpty()) {
+        // Only for this process, so the desktop app and other jobs keep their own
+        setAppRootOverride(job.dataDir());
+    }
+
+    initializeLogger();
+    initTranslations();
+    initializeStrings();
+
+    if (!QDir(GetAppRoot()).exists()) {
+        fprintf(stderr, "No SleepyHead data folder at %s\n", QDir::toNativeSeparators(GetAppRoot()).toLocal8Bit().data());
+        return 1;
+    }
+
+    p_pref = new Preferences("Preferences");
+    PREF.Open();
+    AppSetting = new AppWideSetting(p_pref);
+
+    registerLoaders();
+    Profiles::Scan();
+
+    int result = job.run();
+
+    // Application wide preferences are left alone, so jobs can run side by side
+    DestroyLoaders();
+    shutdownLogger();
+    return result;
+}
+
 int main(int argc, char *argv[])
 {
 #ifdef Q_WS_X11
     XInitThreads();
 #endif
 
+    if (BatchMode::requested(argc, argv)) {
+        return batchMain(argc, argv);
+    }
+
     bool dont_load_profile = false;
     bool force_data_dir = false;
     bool changing_language = false;
@@ -320,17 +387,7 @@ retry_directory:
     ////////////////////////////////////////////////////////////////////////////////////////////
     // Register Importer Modules for autoscanner
     ////////////////////////////////////////////////////////////////////////////////////////////
-    schema::init();
-    PRS1Loader::Register();
-    ResmedLoader::Register();
-    IntellipapLoader::Register();
-    FPIconLoader::Register();
-    WeinmannLoader::Register();
-    CMS50Loader::Register();
-    CMS50F37Loader::Register();
-    MD300W1Loader::Register();
-
-    schema::setOrders(); // could be called in init...
+    registerLoaders();
 
     // Scan for user profiles
     Profiles::Scan();
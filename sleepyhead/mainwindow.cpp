@@ -55,9 +55,12 @@
 #include "UpdaterWindow.h"
 #include "SleepLib/calcs.h"
 #include "SleepLib/progressdialog.h"
+#include "SleepLib/importorchestrator.h"
+#include "SleepLib/columnexport.h"
 #include "version.h"
 
 #include "reports.h"
+#include "Graphs/gOffscreenRenderer.h"
 #include "statistics.h"
 
 #if QT_VERSION >= QT_VERSION_CHECK(5,4,0)
@@ -120,6 +123,7 @@ void MainWindow::SetupGUI()
 
     overview = nullptr;
     daily = nullptr;
+    statistics = nullptr;
     prefdialog = nullptr;
     profileSelector = nullptr;
     welcome = nullptr;
@@ -513,6 +517,7 @@ void MainWindow::CloseProfile()
         delete overview;
         overview = nullptr;
     }
+    stopStatistics();
 
     p_profile->StoreMachines();
     p_profile->UnloadMachineData();
@@ -550,14 +555,28 @@ int MainWindow::importCPAP(ImportPath import, const QString &message)
     if (!import.loader) {
         return 0;
     }
+    return importCPAP(QList<ImportPath>() << import, message).at(0);
+}
+
+QList<int> MainWindow::importCPAP(const QList<ImportPath> & imports, const QString &message)
+{
+    stopStatistics();
+    ImportOrchestrator importer;
+    for (auto & import : imports) {
+        importer.add(import);
+    }
 
     ui->tabWidget->setCurrentWidget(welcome);
     QApplication::processEvents();
     ProgressDialog * progdlg = new ProgressDialog(this);
 
-    QPixmap image = import.loader->getPixmap(import.loader->PeekInfo(import.path).series);
-    image = image.scaled(64,64);
-    progdlg->setPixmap(image);
+    for (auto & import : imports) {
+        if (!import.loader) continue;
+        QPixmap image = import.loader->getPixmap(import.loader->PeekInfo(import.path).series);
+        image = image.scaled(64,64);
+        progdlg->setPixmap(image);
+        break;
+    }
 
     progdlg->addAbortButton();
 
@@ -565,25 +584,32 @@ int MainWindow::importCPAP(ImportPath import, const QString &message)
     progdlg->open();
     progdlg->setMessage(message);
 
+    connect(&importer, SIGNAL(updateMessage(QString)), progdlg, SLOT(setMessage(QString)));
+    connect(&importer, SIGNAL(setProgressMax(int)), progdlg, SLOT(setProgressMax(int)));
+    connect(&importer, SIGNAL(setProgressValue(int)), progdlg, SLOT(setProgressValue(int)));
+    connect(progdlg, SIGNAL(abortClicked()), &importer, SLOT(abort()));
 
-    connect(import.loader, SIGNAL(updateMessage(QString)), progdlg, SLOT(setMessage(QString)));
-    connect(import.loader, SIGNAL(setProgressMax(int)), progdlg, SLOT(setProgressMax(int)));
-    connect(import.loader, SIGNAL(setProgressValue(int)), progdlg, SLOT(setProgressValue(int)));
-    connect(progdlg, SIGNAL(abortClicked()), import.loader, SLOT(abortImport()));
+    importer.run();
 
-    int c = import.loader->Open(import.path);
+    QList<int> results;
+    for (int i=0; i < importer.count(); ++i) {
+        const ImportPath & import = importer.path(i);
+        int c = import.loader ? importer.result(i) : 0;
+        results.append(c);
+        if (!import.loader) continue;
 
-    if (c > 0) {
-        Notify(tr("Imported %1 CPAP session(s) from\n\n%2").arg(c).arg(import.path), tr("Import Success"));
-    } else if (c == 0) {
-        Notify(tr("Already up to date with CPAP data at\n\n%1").arg(import.path), tr("Up to date"));
-    } else {
-        Notify(tr("Couldn't find any valid Machine Data at\n\n%1").arg(import.path),tr("Import Problem"));
+        if (c > 0) {
+            Notify(tr("Imported %1 CPAP session(s) from\n\n%2").arg(c).arg(import.path), tr("Import Success"));
+        } else if (c == 0) {
+            Notify(tr("Already up to date with CPAP data at\n\n%1").arg(import.path), tr("Up to date"));
+        } else {
+            Notify(tr("Couldn't find any valid Machine Data at\n\n%1").arg(import.path),tr("Import Problem"));
+        }
     }
-    disconnect(progdlg, SIGNAL(abortClicked()), import.loader, SLOT(abortImport()));
-    disconnect(import.loader, SIGNAL(setProgressMax(int)), progdlg, SLOT(setProgressMax(int)));
-    disconnect(import.loader, SIGNAL(setProgressValue(int)), progdlg, SLOT(setProgressValue(int)));
-    disconnect(import.loader, SIGNAL(updateMessage(QString)), progdlg, SLOT(setMessage(QString)));
+    disconnect(progdlg, SIGNAL(abortClicked()), &importer, SLOT(abort()));
+    disconnect(&importer, SIGNAL(setProgressMax(int)), progdlg, SLOT(setProgressMax(int)));
+    disconnect(&importer, SIGNAL(setProgressValue(int)), progdlg, SLOT(setProgressValue(int)));
+    disconnect(&importer, SIGNAL(updateMessage(QString)), progdlg, SLOT(setMessage(QString)));
 
     progdlg->close();
 
@@ -593,7 +619,7 @@ int MainWindow::importCPAP(ImportPath import, const QString &message)
         ui->tabWidget->setCurrentIndex(AppSetting->openTabAfterImport());
     }
 
-    return c;
+    return results;
 }
 
 void MainWindow::finishCPAPImport()
@@ -632,8 +658,9 @@ void MainWindow::importCPAPBackups()
 
     if (paths.size() > 0) {
         int c=0;
-        Q_FOREACH(ImportPath path, paths) {
-            c+=importCPAP(path, tr("Please wait, importing from backup folder(s)..."));
+        QList<int> results = importCPAP(paths, tr("Please wait, importing from backup folder(s)..."));
+        for (int r : results) {
+            if (r > 0) c += r;
         }
         if (c>0) {
             finishCPAPImport();
@@ -943,38 +970,29 @@ void MainWindow::on_action_Import_Data_triggered()
 
     prog->open();
 
-    int c = -1;
+    QList<ImportPath> imports;
     for (int i = 0; i < datacards.size(); i++) {
-        QString dir = datacards[i].path;
-        MachineLoader * loader = datacards[i].loader;
-        if (!loader) continue;
-        connect(loader, SIGNAL(updateMessage(QString)), prog, SLOT(setMessage(QString)));
-        connect(loader, SIGNAL(setProgressMax(int)), prog, SLOT(setProgressMax(int)));
-        connect(loader, SIGNAL(setProgressValue(int)), prog, SLOT(setProgressValue(int)));
-        connect(prog, SIGNAL(abortClicked()), loader, SLOT(abortImport()));
-
-        QPixmap image = loader->getPixmap(loader->PeekInfo(dir).series);
-        image = image.scaled(64,64);
-        prog->setPixmap(image);
+        if (!datacards[i].loader || datacards[i].path.isEmpty()) continue;
+        imports.append(datacards[i]);
+    }
 
-        if (!dir.isEmpty()) {
-            c = importCPAP(datacards[i], tr("Importing Data"));
-            qDebug() << "Finished Importing data" << c;
+    // Every card goes in together, loaders that can run side by side will
+    QList<int> results = importCPAP(imports, tr("Importing Data"));
 
-            if (c >= 0) {
-            //    goodlocations.push_back(dir);
-                QDir d(dir.section("/",0,-1));
-                (*p_profile)[STR_PREF_LastCPAPPath] = d.absolutePath();
-            }
+    for (int i = 0; i < imports.size(); i++) {
+        int c = results.at(i);
+        QString dir = imports[i].path;
+        qDebug() << "Finished Importing data" << c;
 
-            if (c > 0) {
-                newdata = true;
-            }
+        if (c >= 0) {
+        //    goodlocations.push_back(dir);
+            QDir d(dir.section("/",0,-1));
+            (*p_profile)[STR_PREF_LastCPAPPath] = d.absolutePath();
+        }
+
+        if (c > 0) {
+            newdata = true;
         }
-        disconnect(prog, SIGNAL(abortClicked()), loader, SLOT(abortImport()));
-        disconnect(loader, SIGNAL(setProgressMax(int)), prog, SLOT(setProgressMax(int)));
-        disconnect(loader, SIGNAL(setProgressValue(int)), prog, SLOT(setProgressValue(int)));
-        disconnect(loader, SIGNAL(updateMessage(QString)), prog, SLOT(setMessage(QString)));
     }
 
     if (newdata)  {
@@ -1709,6 +1727,7 @@ void MainWindow::RestartApplication(bool force_login, QString cmdline)
 void MainWindow::on_actionPurge_Current_Day_triggered()
 {
     if (!daily) return;
+    stopStatistics();
     QDate date = daily->getDate();
     daily->Unload(date);
     Day *day = p_profile->GetDay(date, MT_CPAP);
@@ -1771,6 +1790,9 @@ void MainWindow::on_actionPurge_Current_Day_triggered()
         QFile rxcache(p_profile->Get("{" + STR_GEN_DataFolder + "}/RXChanges.cache" ));
         rxcache.remove();
 
+        QFile recordscache(p_profile->Get("{" + STR_GEN_DataFolder + "}/Records.cache" ));
+        recordscache.remove();
+
         QFile sumfile(cpap->getDataPath()+"Summaries.xml.gz");
         sumfile.remove();
 
@@ -1792,6 +1814,7 @@ void MainWindow::on_actionPurge_Current_Day_triggered()
 
 void MainWindow::on_actionRebuildCPAP(QAction *action)
 {
+    stopStatistics();
     ui->tabWidget->setCurrentWidget(welcome); // Daily view can't run during rebuild
     QApplication::processEvents();
 
@@ -1893,6 +1916,7 @@ void MainWindow::on_actionPurgeMachine(QAction *action)
 
 void MainWindow::purgeMachine(Machine * mach)
 {
+    stopStatistics();
     // detect backups
     daily->Unload(daily->getDate());
 
@@ -1954,6 +1978,9 @@ void MainWindow::purgeMachine(Machine * mach)
     QFile rxcache(p_profile->Get("{" + STR_GEN_DataFolder + "}/RXChanges.cache" ));
     rxcache.remove();
 
+    QFile recordscache(p_profile->Get("{" + STR_GEN_DataFolder + "}/Records.cache" ));
+    recordscache.remove();
+
     if (daily) {
         daily->clearLastDay(); // otherwise Daily will crash
         daily->ReloadGraphs();
@@ -2102,39 +2129,10 @@ void MainWindow::doReprocessEvents()
         delete overview;
         overview = nullptr;
     }
+    stopStatistics();
 
     for (Day * day : p_profile->daylist) {
-        for (Session * sess : day->sessions) {
-            bool isopen = sess->eventsLoaded();
-
-            // Load the events if they aren't loaded already
-            sess->LoadSummary();
-            sess->OpenEvents();
-
-            // Destroy any current user flags..
-            sess->destroyEvent(CPAP_UserFlag1);
-            sess->destroyEvent(CPAP_UserFlag2);
-            sess->destroyEvent(CPAP_UserFlag3);
-
-            // AHI flags
-            sess->destroyEvent(CPAP_AHI);
-            sess->destroyEvent(CPAP_RDI);
-
-            if (sess->machine()->loaderName() != STR_MACH_PRS1) {
-                sess->destroyEvent(CPAP_LargeLeak);
-            } else {
-                sess->destroyEvent(CPAP_Leak);
-            }
-
-            sess->SetChanged(true);
-
-            sess->UpdateSummaries();
-            sess->machine()->SaveSession(sess);
-
-            if (!isopen) {
-                sess->TrashEvents();
-            }
-        }
+        p_profile->reprocessEvents(day);
     }
     progress.close();
 
@@ -2276,16 +2274,27 @@ void MainWindow::GenerateStatistics()
     ui->statEndDate->setMinimumDate(first);
     ui->statEndDate->setMaximumDate(last);
 
-    Statistics stats;
-    QString html = stats.GenerateHTML();
+    stopStatistics();
+    statistics = new Statistics(this);
+    connect(statistics, SIGNAL(htmlReady(QString)), this, SLOT(setStatisticsHTML(QString)));
+    statistics->GenerateHTML();
 
     updateFavourites();
+}
 
+void MainWindow::stopStatistics()
+{
+    // Its destructor waits for any jobs still running
+    delete statistics;
+    statistics = nullptr;
+}
+
+void MainWindow::setStatisticsHTML(QString html)
+{
     //QWebFrame *frame=ui->statisticsView->page()->currentFrame();
     //frame->addToJavaScriptWindowObject("mainwin",this);
     //ui->statisticsView->setHtml(html);
     ui->statisticsView->setHtml(html);
-
 }
 
 
@@ -2353,6 +2362,7 @@ void MainWindow::on_actionPurgeCurrentDaysOximetry_triggered()
 {
     if (!daily)
         return;
+    stopStatistics();
     QDate date = daily->getDate();
     Day * day = p_profile->GetDay(date, MT_OXIMETER);
     if (day) {
@@ -2438,9 +2448,89 @@ void MainWindow::on_actionExport_CSV_triggered()
     }
 }
 
+void MainWindow::on_actionExport_Columns_triggered()
+{
+    if (!p_profile) return;
+
+    QDate start = p_profile->FirstDay();
+    QDate end = p_profile->LastDay();
+
+    QString folder = QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation);
+    folder += QDir::separator() + tr("%1 Event Data %2 to %3").arg(p_profile->user->userName())
+            .arg(start.toString(Qt::ISODate)).arg(end.toString(Qt::ISODate)) + ".shcols";
+
+    QString filename = QFileDialog::getSaveFileName(this, tr("Export all sessions' events and waveforms"), folder,
+                                                    tr("SleepyHead Column Files (*.shcols)"));
+    if (filename.isEmpty()) return;
+    if (!filename.endsWith(".shcols", Qt::CaseInsensitive)) {
+        filename += ".shcols";
+    }
+
+    ColumnExport exporter;
+
+    ProgressDialog progress(this);
+    progress.setMessage(tr("Exporting event and waveform data..."));
+    progress.addAbortButton();
+    progress.setWindowModality(Qt::ApplicationModal);
+    progress.open();
+
+    connect(&exporter, SIGNAL(setProgressMax(int)), &progress, SLOT(setProgressMax(int)));
+    connect(&exporter, SIGNAL(setProgressValue(int)), &progress, SLOT(setProgressValue(int)));
+    connect(&progress, SIGNAL(abortClicked()), &exporter, SLOT(abort()));
+
+    bool ok = exporter.exportRange(filename, start, end);
+    progress.close();
+
+    if (!ok) {
+        Notify(tr("There was a problem writing %1").arg(filename), tr("Export Problem"));
+    }
+}
+
 void MainWindow::on_actionExport_Review_triggered()
 {
-    QMessageBox::information(nullptr, STR_MessageBox_Information, QObject::tr("Sorry, this feature is not implemented yet"), QMessageBox::Ok);
+    if (!daily || !overview) return;
+
+    QDate start = overview->startDate();
+    QDate end = overview->endDate();
+
+    QString folder = QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation);
+    folder += QDir::separator() + tr("%1 Daily Graphs %2 to %3").arg(p_profile->user->userName())
+            .arg(start.toString(Qt::ISODate)).arg(end.toString(Qt::ISODate)) + ".pdf";
+
+    QString filter;
+    QString filename = QFileDialog::getSaveFileName(this, tr("Export the daily graphs for the Overview's date range"), folder,
+                                                    tr("PDF Files (*.pdf);;PNG Images, one per day (*.png)"), &filter);
+    if (filename.isEmpty()) return;
+
+    // Rendered offscreen from copies of the Daily graphs, so the live view is left alone
+    gOffscreenRenderer renderer(daily->graphView());
+
+    ProgressDialog progress(this);
+    progress.setMessage(tr("Rendering daily graphs..."));
+    progress.addAbortButton();
+    progress.setWindowModality(Qt::ApplicationModal);
+    progress.open();
+
+    connect(&renderer, SIGNAL(setProgressMax(int)), &progress, SLOT(setProgressMax(int)));
+    connect(&renderer, SIGNAL(setProgressValue(int)), &progress, SLOT(setProgressValue(int)));
+    connect(&progress, SIGNAL(abortClicked()), &renderer, SLOT(abort()));
+
+    bool ok;
+    if (filename.endsWith(".png", Qt::CaseInsensitive)) {
+        // A folder named after the file, holding an image per day
+        filename.chop(4);
+        ok = renderer.exportImages(filename, start, end);
+    } else {
+        if (!filename.endsWith(".pdf", Qt::CaseInsensitive)) {
+            filename += ".pdf";
+        }
+        ok = renderer.exportPDF(filename, start, end);
+    }
+    progress.close();
+
+    if (!ok) {
+        Notify(tr("There was a problem writing %1").arg(filename), tr("Export Problem"));
+    }
 }
 
 void MainWindow::on_mainsplitter_splitterMoved(int, int)
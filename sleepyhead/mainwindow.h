@@ -66,6 +66,7 @@ extern QStatusBar *qstatusbar;
 
 class Daily;
 class Report;
+class Statistics;
 class Overview;
 
 
@@ -149,6 +150,9 @@ class MainWindow : public QMainWindow
     void setRecBoxHTML(QString html);
     int importCPAP(ImportPath import, const QString &message);
 
+    //! \brief Import several card/backup paths at once, returning the session count (or -1) for each
+    QList<int> importCPAP(const QList<ImportPath> & imports, const QString &message);
+
     void startImportDialog() { on_action_Import_Data_triggered(); }
 
     void log(QString text);
@@ -170,6 +174,9 @@ class MainWindow : public QMainWindow
     void keyPressEvent(QKeyEvent *event) override;
 
   private slots:
+    //! \brief Shows a finished Statistics page
+    void setStatisticsHTML(QString html);
+
     /*! \fn void on_action_Import_Data_triggered();
         \brief Provide the file dialog for selecting import location, and start the import process
         This is called when the Import button is clicked
@@ -302,6 +309,8 @@ class MainWindow : public QMainWindow
 
     void on_actionExport_CSV_triggered();
 
+    void on_actionExport_Columns_triggered();
+
     void on_actionExport_Review_triggered();
 
     void on_mainsplitter_splitterMoved(int pos, int index);
@@ -330,6 +339,7 @@ private:
     Ui::MainWindow *ui;
     Daily *daily;
     Overview *overview;
+    Statistics *statistics;
     ProfileSelector *profileSelector;
     Welcome * welcome;
     Help * help;
@@ -345,6 +355,9 @@ private:
 
     void PopulatePurgeMenu();
 
+    //! \brief Drop the Statistics page being worked out, waiting for its jobs, before the daylist changes under them
+    void stopStatistics();
+
     //! \brief Destroy ALL the CPAP data for the selected machine
     void purgeMachine(Machine *);
 
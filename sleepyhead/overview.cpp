@@ -82,6 +82,7 @@ Overview::Overview(QWidget *parent, gGraphView *shared) :
 
     // Create the GraphView Object
     GraphView = new gGraphView(ui->graphArea, m_shared);
+    GraphView->setObjectName("OverviewGraphView");
     GraphView->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
 
     GraphView->setEmptyText(STR_Empty_NoData);
@@ -323,6 +324,7 @@ void Overview::ResetGraph(QString name)
 
 void Overview::RedrawGraphs()
 {
+    GraphView->invalidateTiles();
     GraphView->redraw();
 }
 
@@ -453,6 +455,16 @@ void Overview::on_rangeCombo_activated(int index)
 
     setRange(start, end);
 }
+QDate Overview::startDate()
+{
+    return ui->dateStart->date();
+}
+
+QDate Overview::endDate()
+{
+    return ui->dateEnd->date();
+}
+
 void Overview::setRange(QDate start, QDate end)
 {
     ui->dateEnd->blockSignals(true);
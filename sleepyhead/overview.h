@@ -56,6 +56,12 @@ class Overview : public QWidget
     //! \brief Sets the currently selected date range of the overview display
     void setRange(QDate start, QDate end);
 
+    //! \brief Returns the first day of the currently selected date range
+    QDate startDate();
+
+    //! \brief Returns the last day of the currently selected date range
+    QDate endDate();
+
     /*! \brief Create an overview graph, adding it to the overview gGraphView object
         \param QString name  The title of the graph
         \param QString units The units of measurements to show in the popup */
@@ -27,9 +27,9 @@
 #include "ui_preferencesdialog.h"
 #include "SleepLib/machine_common.h"
 
-extern QFont *defaultfont;
-extern QFont *mediumfont;
-extern QFont *bigfont;
+extern thread_local QFont *defaultfont;
+extern thread_local QFont *mediumfont;
+extern thread_local QFont *bigfont;
 extern MainWindow *mainwin;
 
 typedef QMessageBox::StandardButton StandardButton;
@@ -800,6 +800,7 @@ bool PreferencesDialog::Save()
     profile->general->setPrefCalcPercentile(ui->prefCalcPercentile->value());
 
     profile->general->setCalculateRDI((ui->eventIndexCombo->currentIndex() == 1));
+    profile->invalidateIndices();
     profile->session->setBackupCardData(ui->createSDBackups->isChecked());
     profile->session->setCompressBackupData(ui->compressSDBackups->isChecked());
     profile->session->setCompressSessionData(ui->compressSessionData->isChecked());
@@ -16,6 +16,7 @@
 #include "reports.h"
 #include "mainwindow.h"
 #include "common_gui.h"
+#include "Graphs/gOffscreenRenderer.h"
 #include "SleepLib/progressdialog.h"
 
 extern MainWindow *mainwin;
@@ -63,10 +64,6 @@ void Report::PrintReport(gGraphView *gv, QString name, QDate date)
 
     QPrinter *printer;
 
-    bool aa_setting = AppSetting->antiAliasing();
-
-    bool force_antialiasing = aa_setting;
-
     printer = new QPrinter(QPrinter::HighResolution);
 
 #ifdef Q_WS_X11
@@ -203,13 +200,8 @@ void Report::PrintReport(gGraphView *gv, QString name, QDate date)
                 cpapinfo += /*QObject::tr("Pressure Relief")+": "+ */day->getPressureRelief() + "\n";
             }
 
-            float ahi = (day->count(CPAP_Obstructive) + day->count(CPAP_Hypopnea) +
-                         day->count(CPAP_ClearAirway) + day->count(CPAP_Apnea));
-
-            if (p_profile->general->calculateRDI()) { ahi += day->count(CPAP_RERA); }
-
             float hours = day->hours(MT_CPAP);
-            ahi /= hours;
+            float ahi = day->eventCount() / hours;
             float csr = (100.0 / hours) * (day->sum(CPAP_CSR) / 3600.0);
             //float pb = (100.0 / hours) * (day->sum(CPAP_PB) / 3600.0);
             float uai = day->count(CPAP_Apnea) / hours;
@@ -232,7 +224,7 @@ void Report::PrintReport(gGraphView *gv, QString name, QDate date)
             QString stats;
             painter.setFont(medium_font);
 
-            if (p_profile->general->calculateRDI()) {
+            if (p_profile->eventIndex() == IDX_RDI) {
                 stats = QObject::tr("RDI\t%1\n").arg(ahi, 0, 'f', 2);
             } else {
                 stats = QObject::tr("AHI\t%1\n").arg(ahi, 0, 'f', 2);
@@ -242,21 +234,23 @@ void Report::PrintReport(gGraphView *gv, QString name, QDate date)
             painter.drawText(bounds, stats, QTextOption(Qt::AlignRight));
 
 
-            mainwin->getDaily()->eventBreakdownPie()->setShowTitle(false);
-            mainwin->getDaily()->eventBreakdownPie()->setMargins(0, 0, 0, 0);
-            QPixmap ebp;
+            gGraph * pie = mainwin->getDaily()->eventBreakdownPie();
+            pie->setShowTitle(false);
+            pie->setMargins(0, 0, 0, 0);
+            QImage ebp;
 
             if (ahi > 0) {
-                ebp = mainwin->getDaily()->eventBreakdownPie()->renderPixmap(piesize, piesize, true);
+                gOffscreenRenderer renderer(pie->graphView());
+                ebp = renderer.renderGraphs({ pie }, { pie->min_x }, { pie->max_x }, piesize, piesize).value(0);
             } else {
-                ebp = QPixmap(":/icons/smileyface.png");
+                ebp = QImage(":/icons/smileyface.png");
             }
 
             if (!ebp.isNull()) {
-                painter.drawPixmap(virt_width - piesize, bounds.height(), piesize, piesize, ebp);
+                painter.drawImage(QRect(virt_width - piesize, bounds.height(), piesize, piesize), ebp);
             }
 
-            mainwin->getDaily()->eventBreakdownPie()->setShowTitle(true);
+            pie->setShowTitle(true);
 
             cpapinfo += "\n\n";
 
@@ -392,9 +386,6 @@ void Report::PrintReport(gGraphView *gv, QString name, QDate date)
     }
     qint64 st = savest, et = saveet;
 
-    bool lineCursorMode = AppSetting->lineCursorMode();
-    AppSetting->setLineCursorMode(false);
-
     if (name == STR_TR_Daily) {
         if (!print_bookmarks) {
             for (int i = 0; i < gv->size(); i++) {
@@ -529,6 +520,18 @@ void Report::PrintReport(gGraphView *gv, QString name, QDate date)
 
     progress.setProgressMax(graphs.size());
 
+    for (int i = 0; i < graphs.size(); i++) {
+        // Snapshots keep the range they were taken over
+        if (graphs[i]->isSnapshot()) {
+            start[i] = graphs[i]->min_x;
+            end[i] = graphs[i]->max_x;
+        }
+    }
+
+    // Copies get rendered several at a time, so the graphs on screen keep their ranges and fonts
+    gOffscreenRenderer renderer(gv);
+    QVector<QImage> images = renderer.renderGraphs(graphs, start, end, virt_width, full_graph_height - normal_height);
+
     int page = 1;
     int gcnt = 0;
 
@@ -566,12 +569,6 @@ void Report::PrintReport(gGraphView *gv, QString name, QDate date)
             page++;
         }
 
-        gGraph *g = graphs[i];
-        if (!g->isSnapshot()) {
-            g->SetXBounds(start[i], end[i]);
-        }
-        g->deselect();
-
         QString label = labels[i];
 
         if (!label.isEmpty()) {
@@ -584,22 +581,7 @@ void Report::PrintReport(gGraphView *gv, QString name, QDate date)
             top += bounds.height();
         } else { top += normal_height / 2; }
 
-        AppSetting->setAntiAliasing(force_antialiasing);
-        int tmb = g->m_marginbottom;
-        g->m_marginbottom = 0;
-
-
-        //painter.beginNativePainting();
-        //g->showTitle(false);
-        int hhh = full_graph_height - normal_height;
-        QPixmap pm2 = g->renderPixmap(virt_width, hhh, 1);
-        QImage pm = pm2.toImage(); //fscale);
-        pm2.detach();
-        //g->showTitle(true);
-        //painter.endNativePainting();
-        g->m_marginbottom = tmb;
-        AppSetting->setAntiAliasing(aa_setting);
-
+        const QImage & pm = images.at(i);
 
         if (!pm.isNull()) {
             painter.drawImage(QRect(0, top, pm.width(), pm.height()), pm);
@@ -615,10 +597,8 @@ void Report::PrintReport(gGraphView *gv, QString name, QDate date)
         QApplication::processEvents();
     }
 
-    gv->SetXBounds(savest, saveet);
     painter.end();
     progress.close();
     delete printer;
-    AppSetting->setLineCursorMode(lineCursorMode);
 }
 
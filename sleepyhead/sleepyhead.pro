@@ -156,6 +156,7 @@ macx {
 }
 
 SOURCES += \
+    batchmode.cpp \
     common_gui.cpp \
     daily.cpp \
     exportcsv.cpp \
@@ -173,6 +174,9 @@ SOURCES += \
     Graphs/gFooBar.cpp \
     Graphs/gGraph.cpp \
     Graphs/gGraphView.cpp \
+    Graphs/gGlyphAtlas.cpp \
+    Graphs/gProfiler.cpp \
+    Graphs/gOffscreenRenderer.cpp \
     Graphs/glcommon.cpp \
     Graphs/gLineChart.cpp \
     Graphs/gLineOverlay.cpp \
@@ -183,10 +187,16 @@ SOURCES += \
     Graphs/gXAxis.cpp \
     Graphs/gYAxis.cpp \
     Graphs/layer.cpp \
+    SleepLib/aggregatecube.cpp \
     SleepLib/calcs.cpp \
+    SleepLib/columnexport.cpp \
     SleepLib/common.cpp \
+    SleepLib/csvexport.cpp \
     SleepLib/day.cpp \
     SleepLib/event.cpp \
+    SleepLib/importmanifest.cpp \
+    SleepLib/importorchestrator.cpp \
+    SleepLib/intervals.cpp \
     SleepLib/machine.cpp \
     SleepLib/machine_loader.cpp \
     SleepLib/preferences.cpp \
@@ -222,6 +232,7 @@ SOURCES += \
     help.cpp
 
 HEADERS  += \
+    batchmode.h \
     common_gui.h \
     daily.h \
     exportcsv.h \
@@ -239,6 +250,9 @@ HEADERS  += \
     Graphs/gFooBar.h \
     Graphs/gGraph.h \
     Graphs/gGraphView.h \
+    Graphs/gGlyphAtlas.h \
+    Graphs/gProfiler.h \
+    Graphs/gOffscreenRenderer.h \
     Graphs/glcommon.h \
     Graphs/gLineChart.h \
     Graphs/gLineOverlay.h \
@@ -249,10 +263,16 @@ HEADERS  += \
     Graphs/gXAxis.h \
     Graphs/gYAxis.h \
     Graphs/layer.h \
+    SleepLib/aggregatecube.h \
     SleepLib/calcs.h \
+    SleepLib/columnexport.h \
     SleepLib/common.h \
+    SleepLib/csvexport.h \
     SleepLib/day.h \
     SleepLib/event.h \
+    SleepLib/importmanifest.h \
+    SleepLib/importorchestrator.h \
+    SleepLib/intervals.h \
     SleepLib/machine.h \
     SleepLib/machine_common.h \
     SleepLib/machine_loader.h \
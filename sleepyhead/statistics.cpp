@@ -10,10 +10,14 @@
 #include <QFile>
 #include <QDataStream>
 #include <QBuffer>
+#include <QRunnable>
+#include <QSet>
+#include <QThreadPool>
 #include <cmath>
 
 #include "mainwindow.h"
 #include "statistics.h"
+#include "SleepLib/aggregatecube.h"
 
 extern MainWindow *mainwin;
 
@@ -95,6 +99,9 @@ QDataStream & operator<<(QDataStream & out, const RXItem & rx)
 
     return out;
 }
+// Bump whenever RXItem or the cache layout changes, older caches are thrown away and rebuilt
+const quint16 rxcache_version = 1;
+
 void Statistics::loadRXChanges()
 {
     QString path = p_profile->Get("{" + STR_GEN_DataFolder + "}/RXChanges.cache" );
@@ -104,11 +111,9 @@ void Statistics::loadRXChanges()
     }
     QDataStream in(&file);
     in.setByteOrder(QDataStream::LittleEndian);
+    in.setVersion(QDataStream::Qt_5_0);
 
     quint32 mag32;
-    if (in.version() != QDataStream::Qt_5_0) {
-    }
-
     in >> mag32;
 
     if (mag32 != magic) {
@@ -117,8 +122,24 @@ void Statistics::loadRXChanges()
     quint16 version;
     in >> version;
 
+    if (version != rxcache_version) {
+        return;
+    }
+
     in >> rxitems;
+    in >> rxdays;
 
+    // Machine records that have since gone, along with every day they covered
+    for (auto ri = rxitems.begin(); ri != rxitems.end();) {
+        if (ri.value().machine == nullptr) {
+            for (auto di = ri.value().dates.begin(), end = ri.value().dates.end(); di != end; ++di) {
+                rxdays.remove(di.key());
+            }
+            ri = rxitems.erase(ri);
+        } else {
+            ++ri;
+        }
+    }
 }
 void Statistics::saveRXChanges()
 {
@@ -131,8 +152,9 @@ void Statistics::saveRXChanges()
     out.setByteOrder(QDataStream::LittleEndian);
     out.setVersion(QDataStream::Qt_5_0);
     out << magic;
-    out << (quint16)0;
+    out << rxcache_version;
     out << rxitems;
+    out << rxdays;
 
 }
 
@@ -142,335 +164,233 @@ bool rxAHILessThan(const RXItem * rx1, const RXItem * rx2)
     return (double(rx1->ahi) / rx1->hours) < (double(rx2->ahi) / rx2->hours);
 }
 
-void Statistics::updateRXChanges()
+//! \brief Returns a cheap in memory signature of a days CPAP sessions, which changes when any are added, removed, trimmed or disabled
+static quint32 rxSignature(Day * day)
 {
-    rxitems.clear();
-
-    // Read the cache from disk
-    loadRXChanges();
-    QMap<QDate, Day *>::iterator di;
-
-    QMap<QDate, Day *>::iterator it;
-    QMap<QDate, Day *>::iterator it_end = p_profile->daylist.end();
-
-    QMap<QDate, RXItem>::iterator ri;
-    QMap<QDate, RXItem>::iterator ri_end = rxitems.end();
-
-
-    quint64 tmp;
-
-    // Scan through each daylist in ascending date order
-    for (it = p_profile->daylist.begin(); it != it_end; ++it) {
-        const QDate & date = it.key();
-        Day * day = it.value();
-
-        Machine * mach = day->machine(MT_CPAP);
-        if (mach == nullptr)
-            continue;
-
-        bool fnd = false;
-
-
-        // Scan through pre-existing rxitems list and see if this day is already there.
-        ri_end = rxitems.end();
-        for (ri = rxitems.begin(); ri != ri_end; ++ri) {
-            RXItem & rx = ri.value();
-
-            // Is it date between this rxitems entry date range?
-            if ((date >= rx.start) && (date <= rx.end)) {
-
-                if (rx.dates.contains(date)) {
-                    // Already there, abort.
-                    fnd = true;
-                    break;
-                }
-
-                // First up, check if fits in date range, but isn't loaded for some reason
-
-                // Need summaries for this, so load them if not present.
-                day->OpenSummary();
-
-                // Get list of Event Flags used in this day
-                QList<ChannelID> flags = day->getSortedMachineChannels(MT_CPAP, schema::FLAG | schema::MINOR_FLAG | schema::SPAN);
-
-                // Generate the pressure/mode/relief strings
-                QString relief = day->getPressureRelief();
-                QString mode = day->getCPAPMode();
-                QString pressure = day->getPressureSettings();
-
-                // Do this days settings match this rx cache entry?
-                if ((rx.relief == relief) && (rx.mode == mode) && (rx.pressure == pressure) && (rx.machine == mach)) {
-
-                    // Update rx cache summaries for each event flag
-                    for (int i=0; i < flags.size(); i++) {
-                        ChannelID code  = flags.at(i);
-                        rx.s_count[code] += day->count(code);
-                        rx.s_sum[code] += day->sum(code);
-                    }
-
-                    // Update AHI/RDI/Time counts
-                    tmp = day->count(CPAP_Hypopnea) + day->count(CPAP_Obstructive) + day->count(CPAP_Apnea) + day->count(CPAP_ClearAirway);
-                    rx.ahi += tmp;
-                    rx.rdi += tmp + day->count(CPAP_RERA);
-                    rx.hours += day->hours(MT_CPAP);
-
-                    // Add this date to RX cache
-                    rx.dates[date] = day;
-                    rx.days = rx.dates.size();
-
-                    // and we are done
-                    fnd = true;
-                    break;
-                } else {
-                    // In this case, the day is within the rx date range, but settings doesn't match the others
-                    // So we need to split the rx cache record and insert the new record as it's own.
-
-                    RXItem rx1, rx2;
-
-                    // So first create the new cache entry for current day we are looking at.
-                    rx1.start = date;
-                    rx1.end = date;
-                    rx1.days = 1;
-
-                    // Only this days AHI/RDI counts
-                    tmp = day->count(CPAP_Hypopnea) + day->count(CPAP_Obstructive) + day->count(CPAP_Apnea) + day->count(CPAP_ClearAirway);
-                    rx1.ahi = tmp;
-                    rx1.rdi = tmp + day->count(CPAP_RERA);
-
-                    // Sum and count event flags for this day
-                    for (int i=0; i < flags.size(); i++) {
-                        ChannelID code  = flags.at(i);
-                        rx1.s_count[code] = day->count(code);
-                        rx1.s_sum[code] = day->sum(code);
-                    }
-
-                    //The rest of this cache record for this day
-                    rx1.hours = day->hours(MT_CPAP);
-                    rx1.relief = relief;
-                    rx1.mode = mode;
-                    rx1.pressure = pressure;
-                    rx1.machine = mach;
-                    rx1.dates[date] = day;
-
-                    // Insert new entry into rx cache
-                    rxitems.insert(date, rx1);
-
-                    // now zonk it so we can reuse the variable later
-                    //rx1 = RXItem();
-
-                    // Now that's out of the way, we need to splitting the old rx into two,
-                    // and recalculate everything before and after today
-
-                    // Copy the old rx.dates, which contains the list of Day records
-                    QMap<QDate, Day *> datecopy = rx.dates;
-
-                    // now zap it so we can start fresh
-                    rx.dates.clear();
-
-                    rx2.end = rx2.start = rx.end;
-                    rx.end = rx.start;
-
-                    // Zonk the summary data, as it needs redoing
-                    rx2.ahi = 0;
-                    rx2.rdi = 0;
-                    rx2.hours = 0;
-                    rx.ahi = 0;
-                    rx.rdi = 0;
-                    rx.hours = 0;
-                    rx.s_count.clear();
-                    rx2.s_count.clear();
-                    rx.s_sum.clear();
-                    rx2.s_sum.clear();
-
-                    // Now go through day list and recalculate according to split
-                    for (di = datecopy.begin(); di != datecopy.end(); ++di) {
-
-                        // Split everything before date
-                        if (di.key() < date) {
-                            // Get the day record for this date
-                            Day * dy = rx.dates[di.key()] = p_profile->GetDay(di.key(), MT_CPAP);
-
-                            // Update AHI/RDI counts
-                            tmp = dy->count(CPAP_Hypopnea) + dy->count(CPAP_Obstructive) + dy->count(CPAP_Apnea) + dy->count(CPAP_ClearAirway);;
-                            rx.ahi += tmp;
-                            rx.rdi += tmp + dy->count(CPAP_RERA);
-
-                            // Get Event Flags list
-                            QList<ChannelID> flags2 = dy->getSortedMachineChannels(MT_CPAP, schema::FLAG | schema::MINOR_FLAG | schema::SPAN);
-
-                            // Update flags counts and sums
-                            for (int i=0; i < flags2.size(); i++) {
-                                ChannelID code  = flags2.at(i);
-                                rx.s_count[code] += dy->count(code);
-                                rx.s_sum[code] += dy->sum(code);
-                            }
-
-                            // Update time sum
-                            rx.hours += dy->hours(MT_CPAP);
-
-                            // Update the last date of this cache entry
-                            // (Max here should be unnessary, this should be sequential because we are processing a QMap.)
-                            rx.end = di.key(); //qMax(di.key(), rx.end);
-                        }
-
-                        // Split everything after date
-                        if (di.key() > date) {
-                            // Get the day record for this date
-                            Day * dy = rx2.dates[di.key()] = p_profile->GetDay(di.key(), MT_CPAP);
-
-                            // Update AHI/RDI counts
-                            tmp = dy->count(CPAP_Hypopnea) + dy->count(CPAP_Obstructive) + dy->count(CPAP_Apnea) + dy->count(CPAP_ClearAirway);;
-                            rx2.ahi += tmp;
-                            rx2.rdi += tmp + dy->count(CPAP_RERA);
-
-                            // Get Event Flags list
-                            QList<ChannelID> flags2 = dy->getSortedMachineChannels(MT_CPAP, schema::FLAG | schema::MINOR_FLAG | schema::SPAN);
-
-                            // Update flags counts and sums
-                            for (int i=0; i < flags2.size(); i++) {
-                                ChannelID code  = flags2.at(i);
-                                rx2.s_count[code] += dy->count(code);
-                                rx2.s_sum[code] += dy->sum(code);
-                            }
-
-                            // Update time sum
-                            rx2.hours += dy->hours(MT_CPAP);
-
-                            // Update start and end
-                            //rx2.end = qMax(di.key(), rx2.end); // don't need to do this, the end won't change from what the old one was.
-
-                            // technically only need to capture the first??
-                            rx2.start = qMin(di.key(), rx2.start);
-                        }
-                    }
-
-                    // Set rx records day counts
-                    rx.days = rx.dates.size();
-                    rx2.days = rx2.dates.size();
-
-                    // Copy the pressure/mode/etc settings, because they haven't changed.
-                    rx2.pressure = rx.pressure;
-                    rx2.mode = rx.mode;
-                    rx2.relief = rx.relief;
-                    rx2.machine = rx.machine;
+    quint32 hash = 0;
+    for (auto & sess : day->sessions) {
+        if (sess->type() != MT_CPAP) continue;
+        hash = hash * 31 + qHash(sess->session());
+        hash = hash * 31 + qHash(sess->first() ^ (sess->last() << 1));
+        hash = hash * 31 + (sess->enabled() ? 1 : 2);
+    }
+    return hash;
+}
 
-                    // Insert the newly split rx record
-                    rxitems.insert(rx2.start, rx2);  // hmmm. this was previously set to the end date.. that was a silly plan.
-                    fnd = true;
+//! \brief Add day's AHI/RDI, usage and event flag totals into rx
+static void rxAccumulate(RXItem & rx, Day * day)
+{
+    rx.ahi += quint64(day->indexCount(IDX_AHI));
+    rx.rdi += quint64(day->indexCount(IDX_RDI));
+    rx.hours += day->hours(MT_CPAP);
+
+    QList<ChannelID> flags = day->getSortedMachineChannels(MT_CPAP, schema::FLAG | schema::MINOR_FLAG | schema::SPAN);
+    for (const auto code : flags) {
+        rx.s_count[code] += day->count(code);
+        rx.s_sum[code] += day->sum(code);
+    }
+}
 
-                    break;
-                }
-            }
+//! \brief Redo rx's totals and date range from the days it still holds
+static void rxRecalculate(RXItem & rx)
+{
+    rx.ahi = rx.rdi = 0;
+    rx.hours = 0;
+    rx.s_count.clear();
+    rx.s_sum.clear();
+
+    for (auto di = rx.dates.begin(); di != rx.dates.end(); ++di) {
+        Day * day = di.value() = p_profile->GetDay(di.key(), MT_CPAP);
+        if (day) {
+            rxAccumulate(rx, day);
         }
+    }
+    rx.days = rx.dates.size();
+    if (!rx.dates.isEmpty()) {
+        rx.start = rx.dates.firstKey();
+        rx.end = rx.dates.lastKey();
+    }
+}
 
+static inline bool rxMatches(const RXItem & rx, Machine * mach, const QString & relief, const QString & mode, const QString & pressure)
+{
+    return (rx.relief == relief) && (rx.mode == mode) && (rx.pressure == pressure) && (rx.machine == mach);
+}
 
-        if (fnd) continue; // already in rx list, move onto the next daylist entry
-
-        // So in this condition, daylist isn't in rx cache, and doesn't match date range of any previous rx cache entry.
-
-
-        // Need to bring in summaries for this
-        day->OpenSummary();
-
-        // Get Event flags list
-        QList<ChannelID> flags3 = day->getSortedMachineChannels(MT_CPAP, schema::FLAG | schema::MINOR_FLAG | schema::SPAN);
-
-        // Generate pressure/mode/relief strings
-        QString relief = day->getPressureRelief();
-        QString mode = day->getCPAPMode();
-        QString pressure = day->getPressureSettings();
-
-        // Now scan the rxcache to find the most previous entry, and the right place to insert
+QMap<QDate, RXItem>::iterator Statistics::findRX(QDate date)
+{
+    // rxitems is keyed by start date and the periods never overlap, so it's the last one starting on or before date
+    auto ri = rxitems.upperBound(date);
+    if (ri == rxitems.begin()) {
+        return rxitems.end();
+    }
+    --ri;
+    return (date <= ri.value().end) ? ri : rxitems.end();
+}
 
-        QMap<QDate, RXItem>::iterator lastri = rxitems.end();
+void Statistics::removeRXDay(QDate date)
+{
+    auto ri = findRX(date);
+    if (ri == rxitems.end()) {
+        return;
+    }
 
-        for (ri = rxitems.begin(); ri != ri_end; ++ri) {
-//            RXItem & rx = ri.value();
+    RXItem rx = ri.value();
+    rxitems.erase(ri);
 
-            // break after any date newer
-            if (ri.key() > date)
-                break;
+    rx.dates.remove(date);
+    if (rx.dates.isEmpty()) {
+        return;
+    }
+    rxRecalculate(rx);
+    rxitems.insert(rx.start, rx);
+}
 
-            // Keep this.. we need the last one.
-            lastri = ri;
+void Statistics::addRXDay(QDate date, Day * day, Machine * mach)
+{
+    // Need summaries for this, so load them if not present.
+    day->OpenSummary();
+
+    // Generate the pressure/mode/relief strings
+    QString relief = day->getPressureRelief();
+    QString mode = day->getCPAPMode();
+    QString pressure = day->getPressureSettings();
+
+    RXItem rx1;
+    rx1.start = rx1.end = date;
+    rx1.relief = relief;
+    rx1.mode = mode;
+    rx1.pressure = pressure;
+    rx1.machine = mach;
+    rx1.dates[date] = day;
+    rx1.days = 1;
+    rxAccumulate(rx1, day);
+
+    auto ri = findRX(date);
+    if (ri != rxitems.end()) {
+        RXItem & rx = ri.value();
+
+        // Within an existing prescription with the same settings, so just add it in
+        if (rxMatches(rx, mach, relief, mode, pressure)) {
+            rxAccumulate(rx, day);
+            rx.dates[date] = day;
+            rx.days = rx.dates.size();
+            return;
         }
 
-        // lastri should no be the last entry before this date, or the end
-        if (lastri != rxitems.end()) {
-            RXItem & rx = lastri.value();
-
-            // Does it match here?
-            if ((rx.relief == relief) && (rx.mode == mode) && (rx.pressure == pressure) && (rx.machine == mach) ) {
+        // Settings changed for this day only, so split the old record either side of it
+        RXItem before = rx, after = rx;
+        before.dates.clear();
+        after.dates.clear();
+        for (auto di = rx.dates.begin(), end = rx.dates.end(); di != end; ++di) {
+            ((di.key() < date) ? before : after).dates.insert(di.key(), di.value());
+        }
+        rxitems.erase(ri);
 
-                // Update AHI/RDI
-                tmp = day->count(CPAP_Hypopnea) + day->count(CPAP_Obstructive) + day->count(CPAP_Apnea) + day->count(CPAP_ClearAirway);
-                rx.ahi += tmp;
-                rx.rdi += tmp + day->count(CPAP_RERA);
+        if (!before.dates.isEmpty()) {
+            rxRecalculate(before);
+            rxitems.insert(before.start, before);
+        }
+        if (!after.dates.isEmpty()) {
+            rxRecalculate(after);
+            rxitems.insert(after.start, after);
+        }
+        rxitems.insert(date, rx1);
+        return;
+    }
 
-                // Update event flags
-                for (int i=0; i < flags3.size(); i++) {
-                    ChannelID code  = flags3.at(i);
-                    rx.s_count[code] += day->count(code);
-                    rx.s_sum[code] += day->sum(code);
-                }
+    // Between prescriptions, see if it continues the one before or leads into the one after
+    auto next = rxitems.upperBound(date);
+    auto prev = (next == rxitems.begin()) ? rxitems.end() : (next - 1);
 
-                // Update hours
-                rx.hours += day->hours(MT_CPAP);
+    bool joinprev = (prev != rxitems.end()) && rxMatches(prev.value(), mach, relief, mode, pressure);
+    bool joinnext = (next != rxitems.end()) && rxMatches(next.value(), mach, relief, mode, pressure);
 
-                // Add day to this RX Cache
-                rx.dates[date] = day;
-                rx.end = date;
-                rx.days = rx.dates.size();
+    if (joinprev) {
+        RXItem & rx = prev.value();
+        rxAccumulate(rx, day);
+        rx.dates[date] = day;
+        rx.end = date;
 
-                fnd = true;
+        if (joinnext) {
+            // Whatever split these two up has gone, so they're one again
+            const RXItem & rx2 = next.value();
+            for (auto di = rx2.dates.begin(), end = rx2.dates.end(); di != end; ++di) {
+                rx.dates.insert(di.key(), di.value());
             }
+            rx.ahi += rx2.ahi;
+            rx.rdi += rx2.rdi;
+            rx.hours += rx2.hours;
+            for (auto it = rx2.s_count.begin(), end = rx2.s_count.end(); it != end; ++it) {
+                rx.s_count[it.key()] += it.value();
+            }
+            for (auto it = rx2.s_sum.begin(), end = rx2.s_sum.end(); it != end; ++it) {
+                rx.s_sum[it.key()] += it.value();
+            }
+            rx.end = rx2.end;
+            rxitems.erase(next);
         }
+        rx.days = rx.dates.size();
+    } else if (joinnext) {
+        RXItem rx = next.value();
+        rxitems.erase(next);
+
+        rxAccumulate(rx, day);
+        rx.dates[date] = day;
+        rx.start = date;
+        rx.days = rx.dates.size();
+        rxitems.insert(date, rx);
+    } else {
+        rxitems.insert(date, rx1);
+    }
+}
 
-        if (!fnd) {
-            // Okay, couldn't find a match, create a new rx cache record for this day.
-
-            RXItem rx;
-            rx.start = date;
-            rx.end = date;
-            rx.days = 1;
-
-            // Set AHI/RDI for just this day
-            tmp = day->count(CPAP_Hypopnea) + day->count(CPAP_Obstructive) + day->count(CPAP_Apnea) + day->count(CPAP_ClearAirway);
-            rx.ahi = tmp;
-            rx.rdi = tmp + day->count(CPAP_RERA);
+void Statistics::updateRXChanges()
+{
+    rxitems.clear();
+    rxdays.clear();
 
-            // Set counts and sums for this day
-            for (int i=0; i < flags3.size(); i++) {
-                ChannelID code  = flags3.at(i);
-                rx.s_count[code] = day->count(code);
-                rx.s_sum[code] = day->sum(code);
-            }
+    // Read the cache from disk
+    loadRXChanges();
 
-            rx.hours = day->hours();
+    bool changed = false;
 
-            // Store settings, etc..
-            rx.relief = relief;
-            rx.mode = mode;
-            rx.pressure = pressure;
-            rx.machine = mach;
+    // Take out any days that have gone, or changed since the cache was written
+    for (auto si = rxdays.begin(); si != rxdays.end();) {
+        Day * day = p_profile->FindDay(si.key(), MT_CPAP);
+        if (day && (rxSignature(day) == si.value())) {
+            ++si;
+            continue;
+        }
+        removeRXDay(si.key());
+        si = rxdays.erase(si);
+        changed = true;
+    }
 
-            // add this day to this rx record
-            rx.dates.insert(date, day);
+    // Then (re)add only those not in the cache
+    for (auto it = p_profile->daylist.begin(), it_end = p_profile->daylist.end(); it != it_end; ++it) {
+        const QDate & date = it.key();
+        Day * day = it.value();
 
-            // And insert into rx record into the rx cache
-            rxitems.insert(date, rx);
-        }
+        Machine * mach = day->machine(MT_CPAP);
+        if ((mach == nullptr) || rxdays.contains(date))
+            continue;
 
+        addRXDay(date, day, mach);
+        rxdays[date] = rxSignature(day);
+        changed = true;
     }
+
     // Store RX cache to disk
-    saveRXChanges();
+    if (changed) {
+        saveRXChanges();
+    }
 
 
     // Now do the setup for the best worst highlighting
     QList<RXItem *> list;
-    ri_end = rxitems.end();
 
-    for (ri = rxitems.begin(); ri != ri_end; ++ri) {
+    for (auto ri = rxitems.begin(), ri_end = rxitems.end(); ri != ri_end; ++ri) {
         list.append(&ri.value());
         ri.value().highlight = 0;
     }
@@ -496,8 +416,10 @@ void Statistics::updateRXChanges()
 }
 
 
+RecordsIndex Statistics::records;
+
 Statistics::Statistics(QObject *parent) :
-    QObject(parent)
+    QObject(parent), m_havedata(false), m_cache(nullptr)
 {
     rows.push_back(StatisticsRow(tr("CPAP Statistics"), SC_HEADING, MT_CPAP));
     rows.push_back(StatisticsRow("",   SC_DAYS, MT_CPAP));
@@ -665,24 +587,7 @@ QString htmlFooter(bool showinfo=true)
 
 EventDataType calcAHI(QDate start, QDate end)
 {
-    EventDataType val = (p_profile->calcCount(CPAP_Obstructive, MT_CPAP, start, end)
-                         + p_profile->calcCount(CPAP_Hypopnea, MT_CPAP, start, end)
-                         + p_profile->calcCount(CPAP_ClearAirway, MT_CPAP, start, end)
-                         + p_profile->calcCount(CPAP_Apnea, MT_CPAP, start, end));
-
-    if (p_profile->general->calculateRDI()) {
-        val += p_profile->calcCount(CPAP_RERA, MT_CPAP, start, end);
-    }
-
-    EventDataType hours = p_profile->calcHours(MT_CPAP, start, end);
-
-    if (hours > 0) {
-        val /= hours;
-    } else {
-        val = 0;
-    }
-
-    return val;
+    return p_profile->calcEventIndex(MT_CPAP, start, end);
 }
 
 EventDataType calcFL(QDate start, QDate end)
@@ -713,6 +618,131 @@ EventDataType calcSA(QDate start, QDate end)
     return val;
 }
 
+enum StatisticsCacheKind { SCK_Days, SCK_Hours, SCK_Count, SCK_AHI };
+
+static inline QPair<quint64, quint64> statisticsKey(StatisticsCacheKind kind, ChannelID code, MachineType type,
+                                                    QDate start, QDate end)
+{
+    return qMakePair((quint64(kind) << 40) | (quint64(type) << 32) | quint64(code),
+                     (quint64(start.toJulianDay()) << 32) | quint64(end.toJulianDay()));
+}
+
+StatisticsCache::StatisticsCache()
+{
+    m_percentile = p_profile->general->prefCalcPercentile() / 100.0;
+}
+
+double StatisticsCache::lookup(const Key & key, const std::function<double()> & calc)
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        auto it = m_values.find(key);
+        if (it != m_values.end()) {
+            return it.value();
+        }
+    }
+
+    // Worked out unlocked, at worst two cells race and both do it
+    double value = calc();
+
+    QMutexLocker lock(&m_mutex);
+    m_values[key] = value;
+    return value;
+}
+
+int StatisticsCache::days(MachineType type, QDate start, QDate end)
+{
+    return lookup(statisticsKey(SCK_Days, 0, type, start, end), [=]() {
+        return double(p_profile->countDays(type, start, end));
+    });
+}
+
+EventDataType StatisticsCache::hours(MachineType type, QDate start, QDate end)
+{
+    return lookup(statisticsKey(SCK_Hours, 0, type, start, end), [=]() {
+        return double(p_profile->calcHours(type, start, end));
+    });
+}
+
+EventDataType StatisticsCache::count(ChannelID code, MachineType type, QDate start, QDate end)
+{
+    return lookup(statisticsKey(SCK_Count, code, type, start, end), [=]() {
+        return double(p_profile->calcCount(code, type, start, end));
+    });
+}
+
+EventDataType StatisticsCache::ahi(QDate start, QDate end)
+{
+    return lookup(statisticsKey(SCK_AHI, 0, MT_CPAP, start, end), [=]() {
+        return double(p_profile->calcEventIndex(MT_CPAP, start, end));
+    });
+}
+
+/*! \class StatisticsJob
+    \brief Runs part of a Statistics page on the worker pool
+    */
+class StatisticsJob:public QRunnable
+{
+  public:
+    StatisticsJob(std::function<void()> work) :m_work(work) {}
+    virtual ~StatisticsJob() {}
+
+    virtual void run() { m_work(); }
+  protected:
+    std::function<void()> m_work;
+};
+
+void Statistics::startJob(std::function<void()> work)
+{
+    m_pending.ref();
+    m_pool.start(new StatisticsJob([this, work]() {
+        work();
+        if (!m_pending.deref()) {
+            // Last one out hands the page back to the GUI thread
+            QMetaObject::invokeMethod(this, "finishHTML", Qt::QueuedConnection);
+        }
+    }));
+}
+
+void Statistics::evaluateCells()
+{
+    m_pool.setMaxThreadCount(AppSetting->multithreading() ? idealThreads() : 1);
+
+    // Days and their sessions fill their caches unlocked, so anything reading them happens here on the GUI thread.
+    // That's building the cube columns each cell asks for, and working out the cells that go past the cube.
+    QHash<QPair<quint64, quint64>, QVector<StatisticsCell *> > periods;
+    for (auto & cell : m_cells) {
+        StatisticsCell * c = &cell;
+        if (c->row->exclusive()) {
+            c->value = c->row->value(c->start, c->end, *m_cache);
+        } else {
+            c->row->prepare(c->start, c->end);
+            periods[statisticsKey(SCK_Days, 0, c->row->type, c->start, c->end)].append(c);
+        }
+    }
+
+    // Held while the jobs are queued, so the page can't finish before the last one is
+    m_pending.ref();
+    for (auto it = periods.begin(), end = periods.end(); it != end; ++it) {
+        const QVector<StatisticsCell *> period = it.value();
+        startJob([this, period]() {
+            // Days and hours are used by most rows, so work them out before the cells race for them
+            const StatisticsCell * first = period.at(0);
+            m_cache->days(first->row->type, first->start, first->end);
+            m_cache->hours(first->row->type, first->start, first->end);
+
+            for (auto & c : period) {
+                startJob([this, c]() {
+                    c->value = c->row->value(c->start, c->end, *m_cache);
+                });
+            }
+        });
+    }
+    if (!m_pending.deref()) {
+        QMetaObject::invokeMethod(this, "finishHTML", Qt::QueuedConnection);
+    }
+}
+
 
 struct RXChange {
     RXChange() { highlight = 0; machine = nullptr; }
@@ -858,7 +888,7 @@ QString Statistics::GenerateRXChanges()
 
     QString ahitxt;
 
-    bool rdi = p_profile->general->calculateRDI();
+    bool rdi = (p_profile->eventIndex() == IDX_RDI);
     if (rdi) {
         ahitxt = STR_TR_RDI;
     } else {
@@ -944,7 +974,14 @@ QString Statistics::GenerateRXChanges()
     return html;
 }
 
-QString Statistics::GenerateHTML()
+Statistics::~Statistics()
+{
+    // Jobs still running point into the cells and cache
+    m_pool.waitForDone();
+    delete m_cache;
+}
+
+void Statistics::GenerateHTML()
 {
     QList<Machine *> cpap_machines = p_profile->GetMachines(MT_CPAP);
     QList<Machine *> oximeters = p_profile->GetMachines(MT_OXIMETER);
@@ -993,7 +1030,9 @@ QString Statistics::GenerateHTML()
 
         "</table></div>";
         html += htmlFooter(havedata);
-        return html;
+        m_html = html;
+        QMetaObject::invokeMethod(this, "finishHTML", Qt::QueuedConnection);
+        return;
     }
 
 
@@ -1011,7 +1050,7 @@ QString Statistics::GenerateHTML()
 
     QString ahitxt;
 
-    if (p_profile->general->calculateRDI()) {
+    if (p_profile->eventIndex() == IDX_RDI) {
         ahitxt = STR_TR_RDI;
     } else {
         ahitxt = STR_TR_AHI;
@@ -1033,6 +1072,11 @@ QString Statistics::GenerateHTML()
 
     QList<Period> periods;
 
+    // The table is laid out first, with the html between each pair of cells kept in m_segments,
+    // then every cell is worked out on the worker pool and spliced back in by finishHTML()
+    QStringList & segments = m_segments;
+    QVector<StatisticsCell> & cells = m_cells;
+
 
     bool skipsection = false;;
     for (QList<StatisticsRow>::iterator i = rows.begin(); i != rows.end(); ++i) {
@@ -1148,8 +1192,7 @@ QString Statistics::GenerateHTML()
             }
             name = calcnames[row.calc].arg(schema::channel[id].fullname());
         }
-        QString line;
-        line += QString("<tr class=datarow><td width=25%>%1</td>").arg(name);
+        html += QString("<tr class=datarow><td width=25%>%1</td>").arg(name);
         int np = periods.size();
         int width;
         for (int j=0; j < np; j++) {
@@ -1159,21 +1202,46 @@ QString Statistics::GenerateHTML()
                 width = 75/np;
             }
 
-            line += QString("<td width=%1%>").arg(width);
+            html += QString("<td width=%1%>").arg(width);
             if (!periods.at(j).header.isEmpty()) {
-                line += row.value(periods.at(j).start, periods.at(j).end);
+                segments.append(html);
+                html.clear();
+
+                StatisticsCell cell;
+                cell.row = &row;
+                cell.start = periods.at(j).start;
+                cell.end = periods.at(j).end;
+                cells.append(cell);
             } else {
-                line +="&nbsp;";
+                html += "&nbsp;";
             }
-            line += "</td>";
+            html += "</td>";
         }
-        html += line;
         html += "</tr>\n";
     }
 
     html += "</table>";
     html += "</div>";
 
+    m_html = html;
+    m_havedata = true;
+    m_cache = new StatisticsCache();
+    evaluateCells();
+}
+
+void Statistics::finishHTML()
+{
+    QString html;
+    for (int i = 0; i < m_cells.size(); ++i) {
+        html += m_segments.at(i);
+        html += m_cells.at(i).value;
+    }
+    html += m_html;
+
+    if (!m_havedata) {
+        emit htmlReady(html);
+        return;
+    }
 
     html += GenerateRXChanges();
     html += GenerateMachineList();
@@ -1185,7 +1253,237 @@ QString Statistics::GenerateHTML()
     html += "<script type='text/javascript' language='javascript' src='qrc:/docs/script.js'></script>";
     //updateFavourites();
     html += htmlFooter();
-    return html;
+    emit htmlReady(html);
+}
+
+// Bump whenever RecordsIndex::Entry or the cache layout changes
+const quint16 records_version = 3;
+
+void RecordsIndex::load()
+{
+    QString path = p_profile->Get("{" + STR_GEN_DataFolder + "}/Records.cache" );
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        return;
+    }
+    QDataStream in(&file);
+    in.setByteOrder(QDataStream::LittleEndian);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 mag32;
+    in >> mag32;
+    if (mag32 != magic) {
+        return;
+    }
+    quint16 version, metrics;
+    in >> version;
+    in >> metrics;
+    if ((version != records_version) || (metrics != MetricCount)) {
+        return;
+    }
+
+    quint32 size;
+    in >> size;
+    for (quint32 i = 0; (i < size) && (in.status() == QDataStream::Ok); ++i) {
+        QDate date;
+        Entry entry;
+        in >> date;
+        in >> entry.signature;
+        for (int m = 0; m < MetricCount; ++m) {
+            in >> entry.values[m];
+        }
+        insert(date, entry);
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        // Truncated, start again rather than trusting half of it
+        clear();
+    }
+}
+
+void RecordsIndex::save()
+{
+    QString path = p_profile->Get("{" + STR_GEN_DataFolder + "}/Records.cache" );
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly)) {
+        return;
+    }
+    QDataStream out(&file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << magic;
+    out << records_version;
+    out << quint16(MetricCount);
+
+    out << quint32(m_days.size());
+    for (auto it = m_days.begin(), end = m_days.end(); it != end; ++it) {
+        out << it.key();
+        out << it.value().signature;
+        for (int m = 0; m < MetricCount; ++m) {
+            out << it.value().values[m];
+        }
+    }
+}
+
+void RecordsIndex::insert(QDate date, const Entry & entry)
+{
+    m_days.insert(date, entry);
+    for (int m = 0; m < MetricCount; ++m) {
+        m_index[m].insert(entry.values[m], date);
+    }
+}
+
+void RecordsIndex::remove(QDate date)
+{
+    auto di = m_days.find(date);
+    if (di == m_days.end()) return;
+
+    for (int m = 0; m < MetricCount; ++m) {
+        m_index[m].remove(di.value().values[m], date);
+    }
+    m_days.erase(di);
+}
+
+void RecordsIndex::clear()
+{
+    m_days.clear();
+    for (int m = 0; m < MetricCount; ++m) {
+        m_index[m].clear();
+    }
+}
+
+bool RecordsIndex::add(QDate date)
+{
+    Day * day = p_profile->GetGoodDay(date, MT_CPAP);
+    if (!day) {
+        return false;
+    }
+
+    Entry entry;
+    entry.signature = day->fingerprint();
+    for (int m = 0; m < MetricCount; ++m) {
+        entry.values[m] = 0;
+    }
+
+    // The per hour figures are NaN without any hours, and those would sort anywhere in the index
+    float hours = day->hours(MT_CPAP);
+    if (hours > 0) {
+        entry.values[AHI] = day->calcAHI();
+
+        float fl = 0;
+        if (day->channelHasData(CPAP_FlowLimit)) {
+            fl = day->calcIdx(CPAP_FlowLimit);
+        } else if (day->channelHasData(CPAP_FLG)) {
+            // Use 90th percentile
+            fl = day->calcPercentile(CPAP_FLG);
+        }
+        entry.values[FlowLimit] = fl;
+        entry.values[LargeLeak] = day->calcPON(CPAP_LargeLeak);
+        entry.values[CSR] = day->calcPON(CPAP_CSR);
+        entry.values[PB] = day->calcPON(CPAP_PB);
+        entry.values[Usage] = hours;
+    }
+
+    insert(date, entry);
+    return true;
+}
+
+void RecordsIndex::update()
+{
+    bool all;
+    QSet<QDate> changed = p_profile->takeChangedDays(all);
+    bool modified = false;
+
+    if (all) {
+        // Days were (re)loaded, so check each cached day against them once
+        clear();
+        load();
+
+        QList<QDate> stale;
+        for (auto it = m_days.begin(), end = m_days.end(); it != end; ++it) {
+            Day * day = p_profile->FindGoodDay(it.key(), MT_CPAP);
+            if (!day || (day->fingerprint() != it.value().signature)) {
+                stale.append(it.key());
+            }
+        }
+        for (const auto & date : stale) {
+            remove(date);
+            modified = true;
+        }
+
+        // Then work out only the days not already in the index
+        for (auto it = p_profile->daylist.begin(), it_end = p_profile->daylist.end(); it != it_end; ++it) {
+            if (!m_days.contains(it.key()) && add(it.key())) {
+                modified = true;
+            }
+        }
+    } else {
+        for (const auto & date : changed) {
+            if (m_days.contains(date)) {
+                remove(date);
+                modified = true;
+            }
+            if (add(date)) {
+                modified = true;
+            }
+        }
+    }
+
+    if (modified) {
+        save();
+    }
+}
+
+QList<QPair<float, QDate> > RecordsIndex::lowest(Metric metric, int count) const
+{
+    QList<QPair<float, QDate> > list;
+    const QMultiMap<float, QDate> & index = m_index[metric];
+    for (auto it = index.begin(), end = index.end(); (it != end) && (list.size() < count); ++it) {
+        list.append(qMakePair(it.key(), it.value()));
+    }
+    return list;
+}
+
+QList<QPair<float, QDate> > RecordsIndex::highest(Metric metric, int count) const
+{
+    QList<QPair<float, QDate> > list;
+    const QMultiMap<float, QDate> & index = m_index[metric];
+    auto it = index.end();
+    while ((it != index.begin()) && (list.size() < count)) {
+        --it;
+        list.append(qMakePair(it.key(), it.value()));
+    }
+    return list;
+}
+
+int RecordsIndex::countAtLeast(Metric metric, float value) const
+{
+    const QMultiMap<float, QDate> & index = m_index[metric];
+    int count = 0;
+    for (auto it = index.lowerBound(value), end = index.end(); it != end; ++it) {
+        count++;
+    }
+    return count;
+}
+
+//! \brief Adds a heading and a daily link for each record in list, or none if every value is zero and none isn't empty
+static void recordLinks(QString & html, const QString & heading, const QList<QPair<float, QDate> > & list,
+                        const QString & format, const QString & none = QString())
+{
+    html += "<b>"+heading+"</b><br/>";
+
+    int cnt = 0;
+    for (const auto & record : list) {
+        if (!none.isEmpty() && (record.first <= 0)) continue;
+        html += QString("<a href='daily=%1'>").arg(record.second.toString(Qt::ISODate))
+                + format.arg(record.second.toString(Qt::SystemLocaleShortDate)).arg(record.first, 0, 'f', 2) + "</a><br/>";
+        cnt++;
+    }
+    if (!none.isEmpty() && (cnt == 0)) {
+        html += "<i>"+none+"</i><br/>";
+    }
+
+    html += "<br/>";
 }
 
 void Statistics::UpdateRecordsBox()
@@ -1219,212 +1517,52 @@ void Statistics::UpdateRecordsBox()
         /// AHI Records
         /////////////////////////////////////////////////////////////////////////////////////
 
-        if (p_profile->session->preloadSummaries()) {
-            const int show_records = 5;
-            QMultiMap<float, QDate>::iterator it;
-            QMultiMap<float, QDate>::iterator it_end;
-
-            QMultiMap<float, QDate> ahilist;
-            int baddays = 0;
-
-            for (QDate date = first; date <= last; date = date.addDays(1)) {
-                Day * day = p_profile->GetGoodDay(date, MT_CPAP);
-                if (!day) continue;
-
-                float ahi = day->calcAHI();
-                if (ahi >= 5) {
-                    baddays++;
-                }
-                ahilist.insert(ahi, date);
-            }
-            html += QObject::tr("Days AHI of 5 or greater: %1").arg(baddays) + "<br/><br/>";
-
-
-            if (ahilist.size() > (show_records * 2)) {
-                it = ahilist.begin();
-                it_end = ahilist.end();
-
-                html += "<b>"+QObject::tr("Best AHI")+"</b><br/>";
-
-                for (int i=0; (i<show_records) && (it != it_end); ++i, ++it) {
-                    html += QString("<a href='daily=%1'>").arg(it.value().toString(Qt::ISODate))
-                            +QObject::tr("Date: %1 AHI: %2").arg(it.value().toString(Qt::SystemLocaleShortDate)).arg(it.key(), 0, 'f', 2) + "</a><br/>";
-
-                }
-
-                html += "<br/>";
+        records.update();
 
-                html += "<b>"+QObject::tr("Worst AHI")+"</b><br/>";
+        const int show_records = 5;
+        html += QObject::tr("Days AHI of 5 or greater: %1").arg(records.countAtLeast(RecordsIndex::AHI, 5)) + "<br/><br/>";
 
-                it = ahilist.end() - 1;
-                it_end = ahilist.begin();
-                for (int i=0; (i<show_records) && (it != it_end); ++i, --it) {
-                    html += QString("<a href='daily=%1'>").arg(it.value().toString(Qt::ISODate))
-                        +QObject::tr("Date: %1 AHI: %2").arg(it.value().toString(Qt::SystemLocaleShortDate)).arg(it.key(), 0, 'f', 2) + "</a><br/>";
+        if (records.size() > (show_records * 2)) {
+            recordLinks(html, QObject::tr("Best AHI"), records.lowest(RecordsIndex::AHI, show_records),
+                        QObject::tr("Date: %1 AHI: %2"));
+            recordLinks(html, QObject::tr("Worst AHI"), records.highest(RecordsIndex::AHI, show_records),
+                        QObject::tr("Date: %1 AHI: %2"));
 
-                }
-
-                html += "<br/>";
+            /////////////////////////////////////////////////////////////////////////////////////
+            /// Usage Records
+            /////////////////////////////////////////////////////////////////////////////////////
+            html += "<b>"+QObject::tr("Longest Usage")+"</b><br/>";
+            for (const auto & record : records.highest(RecordsIndex::Usage, show_records)) {
+                html += QString("<a href='daily=%1'>").arg(record.second.toString(Qt::ISODate))
+                        +QObject::tr("Date: %1 Usage: %2").arg(record.second.toString(Qt::SystemLocaleShortDate)).arg(formatTime(record.first)) + "</a><br/>";
             }
+            html += "<br/>";
 
             /////////////////////////////////////////////////////////////////////////////////////
             /// Flow Limitation Records
             /////////////////////////////////////////////////////////////////////////////////////
-
-            ahilist.clear();
-            for (QDate date = first; date <= last; date = date.addDays(1)) {
-                Day * day = p_profile->GetGoodDay(date, MT_CPAP);
-                if (!day) continue;
-
-                float val = 0;
-                if (day->channelHasData(CPAP_FlowLimit)) {
-                    val = day->calcIdx(CPAP_FlowLimit);
-                } else if (day->channelHasData(CPAP_FLG)) {
-                    // Use 90th percentile
-                    val = day->calcPercentile(CPAP_FLG);
-                }
-                ahilist.insert(val, date);
-            }
-
-            int cnt = 0;
-            if (ahilist.size() > (show_records * 2)) {
-                it = ahilist.begin();
-                it_end = ahilist.end();
-
-                html += "<b>"+QObject::tr("Best Flow Limitation")+"</b><br/>";
-
-                for (int i=0; (i<show_records) && (it != it_end); ++i, ++it) {
-                    html += QString("<a href='daily=%1'>").arg(it.value().toString(Qt::ISODate))
-                        +QObject::tr("Date: %1 FL: %2").arg(it.value().toString(Qt::SystemLocaleShortDate)).arg(it.key(), 0, 'f', 2) + "</a><br/>";
-
-                }
-
-                html += "<br/>";
-
-                html += "<b>"+QObject::tr("Worst Flow Limtation")+"</b><br/>";
-
-                it = ahilist.end() - 1;
-                it_end = ahilist.begin();
-                for (int i=0; (i<show_records) && (it != it_end); ++i, --it) {
-                    if (it.key() > 0) {
-                        html += QString("<a href='daily=%1'>").arg(it.value().toString(Qt::ISODate))
-                            +QObject::tr("Date: %1 FL: %2").arg(it.value().toString(Qt::SystemLocaleShortDate)).arg(it.key(), 0, 'f', 2) + "</a><br/>";
-                        cnt++;
-                    }
-                }
-                if (cnt == 0) {
-                    html+= "<i>"+QObject::tr("No Flow Limitation on record")+"</i><br/>";
-                }
-
-                html += "<br/>";
-            }
+            recordLinks(html, QObject::tr("Best Flow Limitation"), records.lowest(RecordsIndex::FlowLimit, show_records),
+                        QObject::tr("Date: %1 FL: %2"));
+            recordLinks(html, QObject::tr("Worst Flow Limtation"), records.highest(RecordsIndex::FlowLimit, show_records),
+                        QObject::tr("Date: %1 FL: %2"), QObject::tr("No Flow Limitation on record"));
 
             /////////////////////////////////////////////////////////////////////////////////////
             /// Large Leak Records
             /////////////////////////////////////////////////////////////////////////////////////
-
-            ahilist.clear();
-            for (QDate date = first; date <= last; date = date.addDays(1)) {
-                Day * day = p_profile->GetGoodDay(date, MT_CPAP);
-                if (!day) continue;
-
-                float leak = day->calcPON(CPAP_LargeLeak);
-                ahilist.insert(leak, date);
-            }
-
-            cnt = 0;
-            if (ahilist.size() > (show_records * 2)) {
-                html += "<b>"+QObject::tr("Worst Large Leaks")+"</b><br/>";
-
-                it = ahilist.end() - 1;
-                it_end = ahilist.begin();
-
-                for (int i=0; (i<show_records) && (it != it_end); ++i, --it) {
-                    if (it.key() > 0) {
-                        html += QString("<a href='daily=%1'>").arg(it.value().toString(Qt::ISODate))
-                            +QObject::tr("Date: %1 Leak: %2%").arg(it.value().toString(Qt::SystemLocaleShortDate)).arg(it.key(), 0, 'f', 2) + "</a><br/>";
-                        cnt++;
-                    }
-
-                }
-                if (cnt == 0) {
-                    html+= "<i>"+QObject::tr("No Large Leaks on record")+"</i><br/>";
-                }
-
-                html += "<br/>";
-            }
-
+            recordLinks(html, QObject::tr("Worst Large Leaks"), records.highest(RecordsIndex::LargeLeak, show_records),
+                        QObject::tr("Date: %1 Leak: %2%"), QObject::tr("No Large Leaks on record"));
 
             /////////////////////////////////////////////////////////////////////////////////////
             /// ÇSR Records
             /////////////////////////////////////////////////////////////////////////////////////
-
-            cnt = 0;
             if (p_profile->hasChannel(CPAP_CSR)) {
-                ahilist.clear();
-                for (QDate date = first; date <= last; date = date.addDays(1)) {
-                    Day * day = p_profile->GetGoodDay(date, MT_CPAP);
-                    if (!day) continue;
-
-                    float leak = day->calcPON(CPAP_CSR);
-                    ahilist.insert(leak, date);
-                }
-
-                if (ahilist.size() > (show_records * 2)) {
-                    html += "<b>"+QObject::tr("Worst CSR")+"</b><br/>";
-
-                    it = ahilist.end() - 1;
-                    it_end = ahilist.begin();
-                    for (int i=0; (i<show_records) && (it != it_end); ++i, --it) {
-
-                        if (it.key() > 0) {
-                            html += QString("<a href='daily=%1'>").arg(it.value().toString(Qt::ISODate))
-                                +QObject::tr("Date: %1 CSR: %2%").arg(it.value().toString(Qt::SystemLocaleShortDate)).arg(it.key(), 0, 'f', 2) + "</a><br/>";
-                            cnt++;
-                        }
-                    }
-                    if (cnt == 0) {
-                        html+= "<i>"+QObject::tr("No CSR on record")+"</i><br/>";
-                    }
-
-                    html += "<br/>";
-                }
+                recordLinks(html, QObject::tr("Worst CSR"), records.highest(RecordsIndex::CSR, show_records),
+                            QObject::tr("Date: %1 CSR: %2%"), QObject::tr("No CSR on record"));
             }
             if (p_profile->hasChannel(CPAP_PB)) {
-                ahilist.clear();
-                for (QDate date = first; date <= last; date = date.addDays(1)) {
-                    Day * day = p_profile->GetGoodDay(date, MT_CPAP);
-                    if (!day) continue;
-
-                    float leak = day->calcPON(CPAP_PB);
-                    ahilist.insert(leak, date);
-                }
-
-                if (ahilist.size() > (show_records * 2)) {
-                    html += "<b>"+QObject::tr("Worst PB")+"</b><br/>";
-
-                    it = ahilist.end() - 1;
-                    it_end = ahilist.begin();
-                    for (int i=0; (i < show_records) && (it != it_end); ++i, --it) {
-
-                        if (it.key() > 0) {
-                            html += QString("<a href='daily=%1'>").arg(it.value().toString(Qt::ISODate))
-                                +QObject::tr("Date: %1 PB: %2%").arg(it.value().toString(Qt::SystemLocaleShortDate)).arg(it.key(), 0, 'f', 2) + "</a><br/>";
-                            cnt++;
-                        }
-                    }
-                    if (cnt == 0) {
-                        html+= "<i>"+QObject::tr("No PB on record")+"</i><br/>";
-                    }
-
-                    html += "<br/>";
-                }
+                recordLinks(html, QObject::tr("Worst PB"), records.highest(RecordsIndex::PB, show_records),
+                            QObject::tr("Date: %1 PB: %2%"), QObject::tr("No PB on record"));
             }
-
-        } else {
-            html += "<br/><b>"+QObject::tr("Want more information?")+"</b><br/>";
-            html += "<i>"+QObject::tr("SleepyHead needs all summary data loaded to calculate best/worst data for individual days.")+"</i><br/><br/>";
-            html += "<i>"+QObject::tr("Please enable Pre-Load Summaries checkbox in preferences to make sure this data is available.")+"</i><br/><br/>";
         }
 
 
@@ -1478,26 +1616,76 @@ void Statistics::UpdateRecordsBox()
 
 
 
-QString StatisticsRow::value(QDate start, QDate end)
+void StatisticsRow::prepare(QDate start, QDate end)
+{
+    AggregateCube * cube = p_profile->aggregates;
+    cube->prepare(AggregateCube::Days, 0, type, start, end);
+    cube->prepare(AggregateCube::Hours, 0, type, start, end);
+
+    ChannelID code = channel();
+    switch (calc) {
+    case SC_AHI:
+        cube->prepare(AggregateCube::Hours, 0, MT_CPAP, start, end);
+        cube->prepare(AggregateCube::Index, p_profile->eventIndex(), MT_CPAP, start, end);
+        return;
+    case SC_COMPLIANCE:
+        cube->prepare(AggregateCube::Compliant, 0, type, start, end);
+        return;
+    default:
+        break;
+    }
+    if (code == NoChannel) {
+        return;
+    }
+
+    switch (calc) {
+    case SC_AVG:
+        cube->prepare(AggregateCube::Avg, code, type, start, end);
+        break;
+    case SC_WAVG:
+        cube->prepare(AggregateCube::Wavg, code, type, start, end);
+        break;
+    case SC_MEDIAN:
+    case SC_90P:
+        cube->prepare(AggregateCube::Percentile, code, type, start, end);
+        break;
+    case SC_MIN:
+        cube->prepare(AggregateCube::Min, code, type, start, end);
+        break;
+    case SC_MAX:
+        cube->prepare(AggregateCube::Max, code, type, start, end);
+        break;
+    case SC_CPH:
+        cube->prepare(AggregateCube::Count, code, type, start, end);
+        break;
+    case SC_SPH:
+        cube->prepare(AggregateCube::Sum, code, type, start, end);
+        break;
+    default:
+        break;
+    }
+}
+
+QString StatisticsRow::value(QDate start, QDate end, StatisticsCache & cache)
 {
     const int decimals=2;
     QString value;
-    float days = p_profile->countDays(type, start, end);
+    float days = cache.days(type, start, end);
 
-    float percentile=p_profile->general->prefCalcPercentile()/100.0;    // Pholynyk, 10Mar2016
-    EventDataType percent = percentile;                                 // was 0.90F
+    EventDataType percent = cache.percentile();                         // was 0.90F
+    EventDataType hours = cache.hours(type, start, end);
 
     // Handle special data sources first
     if (calc == SC_AHI) {
-        value = QString("%1").arg(calcAHI(start, end), 0, 'f', decimals);
+        value = QString("%1").arg(cache.ahi(start, end), 0, 'f', decimals);
     } else if (calc == SC_HOURS) {
-        value = QString("%1").arg(formatTime(p_profile->calcHours(type, start, end) / days));
+        value = QString("%1").arg(formatTime(hours / days));
     } else if (calc == SC_COMPLIANCE) {
         float c = p_profile->countCompliantDays(type, start, end);
         float p = (100.0 / days) * c;
         value = QString("%1%").arg(p, 0, 'f', 0);
     } else if (calc == SC_DAYS) {
-        value = QString("%1").arg(p_profile->countDays(type, start, end));
+        value = QString("%1").arg(int(days));
     } else if ((calc == SC_COLUMNHEADERS) || (calc == SC_SUBHEADING) || (calc == SC_UNDEFINED))  {
     } else {
         //
@@ -1526,19 +1714,19 @@ QString StatisticsRow::value(QDate start, QDate end)
                 val = p_profile->calcMax(code, type, start, end);
                 break;
             case SC_CPH:
-                val = p_profile->calcCount(code, type, start, end) / p_profile->calcHours(type, start, end);
+                val = cache.count(code, type, start, end) / hours;
                 break;
             case SC_SPH:
                 fmt += "%";
-                val = 100.0 / p_profile->calcHours(type, start, end) * p_profile->calcSum(code, type, start, end) / 3600.0;
+                val = 100.0 / hours * p_profile->calcSum(code, type, start, end) / 3600.0;
                 break;
             case SC_ABOVE:
                 fmt += "%";
-                val = 100.0 / p_profile->calcHours(type, start, end) * (p_profile->calcAboveThreshold(code, schema::channel[code].upperThreshold(), type, start, end) / 60.0);
+                val = 100.0 / hours * (p_profile->calcAboveThreshold(code, schema::channel[code].upperThreshold(), type, start, end) / 60.0);
                 break;
             case SC_BELOW:
                 fmt += "%";
-                val = 100.0 / p_profile->calcHours(type, start, end) * (p_profile->calcBelowThreshold(code, schema::channel[code].lowerThreshold(), type, start, end) / 60.0);
+                val = 100.0 / hours * (p_profile->calcBelowThreshold(code, schema::channel[code].lowerThreshold(), type, start, end) / 60.0);
                 break;
             default:
                 break;
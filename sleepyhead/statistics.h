@@ -10,11 +10,21 @@
 #define SUMMARY_H
 
 #include <QObject>
+#include <QAtomicInt>
 #include <QHash>
 #include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QPair>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+#include <functional>
 #include "SleepLib/schema.h"
 #include "SleepLib/machine.h"
 
+class StatisticsCache;
+
 enum StatCalcType {
     SC_UNDEFINED=0, SC_COLUMNHEADERS, SC_HEADING, SC_SUBHEADING, SC_MEDIAN, SC_AVG, SC_WAVG, SC_90P, SC_MIN, SC_MAX, SC_CPH, SC_SPH, SC_AHI, SC_HOURS, SC_COMPLIANCE, SC_DAYS, SC_ABOVE, SC_BELOW
 };
@@ -91,7 +101,45 @@ struct StatisticsRow {
         return schema::channel[src].id();
     }
 
-    QString value(QDate start, QDate end);
+    QString value(QDate start, QDate end, StatisticsCache & cache);
+
+    //! \brief Builds the aggregate cube columns value() reads for [start, end], must be called on the GUI thread
+    void prepare(QDate start, QDate end);
+
+    //! \brief Returns true if working out this rows values goes past the aggregate cube to the days themselves, so it stays on the GUI thread
+    bool exclusive() const {
+        return (calc == SC_ABOVE) || (calc == SC_BELOW);
+    }
+};
+
+/*! \class StatisticsCache
+    \brief Values shared between the cells of one Statistics page, so each is only worked out once
+
+    Days and hours for each period are used by most rows. Only queries the aggregate cube, so it's safe to use from
+    the statistics worker threads once the cells have been prepared.
+    */
+class StatisticsCache
+{
+  public:
+    StatisticsCache();
+
+    int days(MachineType type, QDate start, QDate end);
+    EventDataType hours(MachineType type, QDate start, QDate end);
+    EventDataType count(ChannelID code, MachineType type, QDate start, QDate end);
+    EventDataType ahi(QDate start, QDate end);
+
+    //! \brief The upper percentile from preferences, as a fraction
+    EventDataType percentile() const { return m_percentile; }
+
+  protected:
+    typedef QPair<quint64, quint64> Key;
+
+    //! \brief Returns the value stored for key, working it out with calc the first time
+    double lookup(const Key & key, const std::function<double()> & calc);
+
+    QHash<Key, double> m_values;
+    QMutex m_mutex;
+    EventDataType m_percentile;
 };
 
 class RXItem {
@@ -145,18 +193,79 @@ public:
 };
 
 
+/*! \class RecordsIndex
+    \brief Each CPAP day's record box values, kept sorted per metric so the best and worst days come straight off the ends
+
+    Kept for as long as the profile's days are loaded, and told which days changed through Profile::takeChangedDays(),
+    the same Day::invalidate(), addDay() and unlinkDay() calls that keep the aggregate cube current. Saved to
+    Records.cache along with the Day::fingerprint() of each day, which is only checked when the days are (re)loaded.
+    */
+class RecordsIndex
+{
+  public:
+    enum Metric {
+        AHI = 0, FlowLimit, LargeLeak, CSR, PB, Usage, MetricCount
+    };
+
+    //! \brief Bring the index up to date with p_profile's changed days, reading the cache first after the days were loaded
+    void update();
+
+    //! \brief Number of days indexed
+    int size() const { return m_days.size(); }
+
+    //! \brief Up to count (value, date) pairs with the lowest values of metric, lowest first
+    QList<QPair<float, QDate> > lowest(Metric metric, int count) const;
+
+    //! \brief Up to count (value, date) pairs with the highest values of metric, highest first
+    QList<QPair<float, QDate> > highest(Metric metric, int count) const;
+
+    //! \brief Number of days with metric at or above value
+    int countAtLeast(Metric metric, float value) const;
+
+  protected:
+    struct Entry {
+        quint32 signature;
+        float values[MetricCount];
+    };
+
+    void load();
+    void save();
+
+    void insert(QDate date, const Entry & entry);
+    void remove(QDate date);
+    void clear();
+
+    //! \brief Works out date's entry and inserts it, returns false if it isn't a CPAP day
+    bool add(QDate date);
+
+    QMap<QDate, Entry> m_days;
+    QMultiMap<float, QDate> m_index[MetricCount];
+};
+
+/*! \struct StatisticsCell
+    \brief One value in the statistics table, filled in by a StatisticsJob
+    */
+struct StatisticsCell {
+    StatisticsRow * row;
+    QDate start;
+    QDate end;
+    QString value;
+};
 
 class Statistics : public QObject
 {
     Q_OBJECT
   public:
     explicit Statistics(QObject *parent = 0);
+    virtual ~Statistics();
 
     void loadRXChanges();
     void saveRXChanges();
     void updateRXChanges();
 
-    QString GenerateHTML();
+    /*! \brief Lays out the Statistics page and starts working out its cells, htmlReady() is emitted once they're done
+        Each Statistics object builds one page, make a new one to refresh it */
+    void GenerateHTML();
     QString GenerateMachineList();
     QString GenerateRXChanges();
 
@@ -164,19 +273,50 @@ class Statistics : public QObject
 
 
   protected:
+    //! \brief Returns the RX period covering date, or rxitems.end()
+    QMap<QDate, RXItem>::iterator findRX(QDate date);
+
+    //! \brief Add one days settings and totals to the RX periods, splitting or joining them as needed
+    void addRXDay(QDate date, Day * day, Machine * mach);
+
+    //! \brief Take date back out of its RX period
+    void removeRXDay(QDate date);
+
+    //! \brief Run work on the worker pool, finishing the page after the last job is done
+    void startJob(std::function<void()> work);
+
+    /*! \brief Work out every cell's value, the shared per period totals first, then the cells themselves
+        Everything reading days happens here first, the worker jobs only query the prepared cube columns */
+    void evaluateCells();
+
     // Using a map to maintain order
     QList<StatisticsRow> rows;
     QMap<StatCalcType, QString> calcnames;
     QMap<MachineType, QString> machinenames;
 
-    QMap<QDate, RXItem> rxitems;
+    QMap<QDate, RXItem> rxitems;            // non overlapping periods, keyed by start date
+    QMap<QDate, quint32> rxdays;            // signature of each day rxitems was built from
+
+    //! \brief Outlives each page, so it only has to catch up on the days changed since the last one
+    static RecordsIndex records;
+
+    // The page while its cells are worked out, the html between each pair of cells is kept in m_segments
+    QStringList m_segments;
+    QVector<StatisticsCell> m_cells;
+    QString m_html;
+    bool m_havedata;
+    StatisticsCache * m_cache;
 
-    QList<QDate> record_best_ahi;
-    QList<QDate> record_worst_ahi;
+    QAtomicInt m_pending;
+    QThreadPool m_pool;     // last, so it's waited on before the cells and cache go
 
   signals:
+    //! \brief The finished page from GenerateHTML()
+    void htmlReady(QString html);
 
-  public slots:
+  protected slots:
+    //! \brief Splices the cells into the page and emits htmlReady(), on the GUI thread
+    void finishHTML();
 
 };
 
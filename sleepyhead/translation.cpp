@@ -98,7 +98,10 @@ void initTranslations() {
     }
     qDebug() << "Available Translations:" << QString(availtrans.join(", ")).toLocal8Bit().data();
 
-    if (language.isEmpty() || !langNames.contains(language)) {
+    if ((language.isEmpty() || !langNames.contains(language)) && headless()) {
+        // Nobody to ask, and nothing gets saved, so the next GUI run still asks
+        language = en;
+    } else if (language.isEmpty() || !langNames.contains(language)) {
         QDialog langsel(nullptr, Qt::CustomizeWindowHint | Qt::WindowTitleHint);
         QFont font;
         font.setPointSize(20);
@@ -0,0 +1,17 @@
+QT += core gui testlib
+CONFIG += console
+CONFIG -= app_bundle
+
+SLEEPLIB = $$PWD/../sleepyhead/SleepLib
+
+INCLUDEPATH += $$SLEEPLIB
+DEPENDPATH += $$SLEEPLIB $$PWD
+
+HEADERS += $$SLEEPLIB/event.h \
+    $$SLEEPLIB/machine_common.h
+
+SOURCES += $$PWD/tst_interleave.cpp \
+    $$SLEEPLIB/event.cpp
+
+OBJECTS_DIR = .obj
+MOC_DIR = .moc
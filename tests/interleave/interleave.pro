@@ -0,0 +1,4 @@
+TEMPLATE = app
+TARGET = tst_interleave
+
+include(../interleave.pri)
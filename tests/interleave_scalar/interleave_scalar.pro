@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = tst_interleave_scalar
+
+DEFINES += EVENT_NO_SSE2
+
+include(../interleave.pri)
@@ -0,0 +1,4 @@
+TEMPLATE = subdirs
+
+# Same checks built twice: once with the SSE2 paths and once forced scalar
+SUBDIRS += interleave interleave_scalar
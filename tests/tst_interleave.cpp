@@ -0,0 +1,146 @@
+/* EventList interleaved waveform tests
+ *
+ * Copyright (c) 2011-2018 Mark Watkins <mark@jedimark.net>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of the source code
+ * for more details. */
+
+#include <QtTest/QtTest>
+#include <QByteArray>
+#include <QVector>
+
+#include "event.h"
+
+/*! \class TestInterleave
+    \brief Checks EventList::AddInterleavedWaveform() against the old mid()/append() split followed by AddWaveform()
+    Built twice by tests.pro, so both the SSE2 and the scalar de-interleave get compared to the same reference */
+class TestInterleave : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void matchesReference_data();
+    void matchesReference();
+};
+
+// Repeatable bytes covering the whole 0..255 range, so signed samples go negative
+static QByteArray fixture(int size, quint32 seed)
+{
+    QByteArray data(size, 0);
+    for (int i = 0; i < size; ++i) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = char(seed >> 16);
+    }
+    return data;
+}
+
+// How the PRS1 loader split waveform blocks before AddInterleavedWaveform()
+static QVector<QByteArray> referenceSplit(const QList<QByteArray> & blocks, const QVector<int> & interleaves)
+{
+    int num = interleaves.size();
+    QVector<QByteArray> data;
+    data.resize(num);
+
+    for (auto & block : blocks) {
+        int bsize = block.size();
+        int pos = 0;
+        do {
+            for (int n=0; n < num; n++) {
+                int interleave = interleaves.at(n);
+                data[n].append(block.mid(pos, interleave));
+                pos += interleave;
+            }
+        } while (pos < bsize);
+    }
+    return data;
+}
+
+void TestInterleave::matchesReference_data()
+{
+    QTest::addColumn<QVector<int> >("interleaves");
+    QTest::addColumn<QVector<int> >("chunks");
+
+    // One byte each of two signals is the layout the SSE2 path handles
+    QTest::newRow("pair, 8 pairs") << QVector<int>{1, 1} << QVector<int>{16};
+    QTest::newRow("pair, many") << QVector<int>{1, 1} << QVector<int>{4096};
+    QTest::newRow("pair, odd size") << QVector<int>{1, 1} << QVector<int>{63};
+    QTest::newRow("pair, 7 pair tail") << QVector<int>{1, 1} << QVector<int>{30};
+    QTest::newRow("pair, 1 pair tail") << QVector<int>{1, 1} << QVector<int>{18};
+    QTest::newRow("pair, shorter than 8") << QVector<int>{1, 1} << QVector<int>{6};
+    QTest::newRow("pair, shorter than 8, odd") << QVector<int>{1, 1} << QVector<int>{7};
+    QTest::newRow("pair, one byte") << QVector<int>{1, 1} << QVector<int>{1};
+    QTest::newRow("pair, chunks") << QVector<int>{1, 1} << QVector<int>{17, 33, 8, 1, 250};
+
+    // Everything else goes through the scalar path either way
+    QTest::newRow("2:1") << QVector<int>{2, 1} << QVector<int>{301};
+    QTest::newRow("1:3, tail") << QVector<int>{1, 3} << QVector<int>{102};
+    QTest::newRow("4:4, chunks") << QVector<int>{4, 4} << QVector<int>{64, 13, 5};
+    QTest::newRow("5:3, short tail") << QVector<int>{5, 3} << QVector<int>{83};
+    QTest::newRow("3:2:1") << QVector<int>{3, 2, 1} << QVector<int>{97, 6};
+}
+
+void TestInterleave::matchesReference()
+{
+    QFETCH(QVector<int>, interleaves);
+    QFETCH(QVector<int>, chunks);
+
+    QList<QByteArray> blocks;
+    quint32 seed = 1;
+    for (int size : chunks) {
+        blocks.append(fixture(size, seed++));
+    }
+
+    QVector<QByteArray> ref = referenceSplit(blocks, interleaves);
+
+    int cycle = 0;
+    for (int interleave : interleaves) cycle += interleave;
+
+    const qint64 duration = 1000;
+
+    for (int is_signed = 0; is_signed < 2; ++is_signed) {
+        int offset = 0;
+        for (int n = 0; n < interleaves.size(); ++n) {
+            // Negative gain makes sure min and max stay the right way round
+            EventDataType gain = is_signed ? 1.0f : -0.1f;
+
+            EventList expected(EVL_Waveform, gain, 0.0f, 0.0f, 0.0f, 1.0);
+            EventList actual(EVL_Waveform, gain, 0.0f, 0.0f, 0.0f, 1.0);
+
+            QByteArray & sig = ref[n];
+            if (is_signed) {
+                expected.AddWaveform(0, sig.data(), sig.size(), duration);
+            } else {
+                expected.AddWaveform(0, (unsigned char *)sig.data(), sig.size(), duration);
+            }
+
+            qint64 ti = 0;
+            int expectedCount = 0;
+            for (auto & block : blocks) {
+                expectedCount += EventList::interleavedCount(block.size(), offset, interleaves.at(n), cycle);
+                actual.AddInterleavedWaveform(ti, (const unsigned char *)block.constData(), block.size(), offset,
+                                              interleaves.at(n), cycle, duration / blocks.size(), is_signed);
+                ti += duration / blocks.size();
+            }
+
+            QCOMPARE(int(actual.count()), sig.size());
+            QCOMPARE(expectedCount, sig.size());
+            for (int i = 0; i < sig.size(); ++i) {
+                if (actual.raw(i) != expected.raw(i)) {
+                    QFAIL(qPrintable(QString("signal %1 (%2) sample %3: got %4, expected %5")
+                                     .arg(n).arg(is_signed ? "signed" : "unsigned").arg(i)
+                                     .arg(actual.raw(i)).arg(expected.raw(i))));
+                }
+            }
+            if (sig.size() > 0) {
+                QCOMPARE(actual.Min(), expected.Min());
+                QCOMPARE(actual.Max(), expected.Max());
+            }
+            offset += interleaves.at(n);
+        }
+    }
+}
+
+QTEST_APPLESS_MAIN(TestInterleave)
+
+#include "tst_interleave.moc"